@@ -0,0 +1,42 @@
+#include "../http/AccessLog.h"
+#include <cstring>
+#include <benchmark/benchmark.h>
+#include <netinet/in.h>
+
+// author: Haoyang Yang
+// filename: AccessLogBench.cc
+// brief: IO 线程写一条访问记录的开销（一次 128 字节拷贝 + release store），后台线程写 /dev/null。
+//        紧循环里写入远快于后台线程取空，大部分记录走的是队列满丢弃的路径，dropped 是丢弃的比例
+
+using namespace webserver::http;
+
+namespace {
+
+AccessRecord MakeRecord() {
+    AccessRecord record;
+    record.status = 200;
+    record.bytes = 11;
+    record.family = AF_INET;
+    record.addr[0] = 127;
+    record.addr[3] = 1;
+    const char path[] = "/api/v1/users/42";
+    record.path_len = sizeof(path) - 1;
+    memcpy(record.path, path, record.path_len);
+    return record;
+}
+
+void BM_AccessLogAppend(benchmark::State &state) {
+    AccessLog log("/dev/null");
+    AccessRecord record = MakeRecord();
+    uint64_t n = 0;
+    for(auto _ : state) {
+        record.time_ns = ++n;
+        log.Append(record);
+    }
+    state.counters["dropped"] = static_cast<double>(log.Dropped()) / n;
+}
+BENCHMARK(BM_AccessLogAppend);
+
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,75 @@
+#include "../src/Buffer.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+// author: Haoyang Yang
+// filename: BufferBench.cc
+// brief: 分块缓冲区：不同长度的 Append、从管道 ReadFd、以及读完后 ReleaseConsumed 把块还给池（原来的 Shrink），
+//        统计每秒处理的字节数（bytes_per_second）
+
+using namespace webserver::src;
+
+namespace {
+
+/* brief: 追加 len 字节后整体消费掉，块一直在池和缓冲区之间循环 */
+void BM_Append(benchmark::State &state) {
+    const size_t len = static_cast<size_t>(state.range(0));
+    const std::string data(len, 'x');
+    Buffer buf;
+    for(auto _ : state) {
+        for(int i = 0; i < 16; ++i) buf.Append(data.data(), len);
+        benchmark::DoNotOptimize(buf.ReadableBytes());
+        buf.MoveReadOffset(buf.ReadableBytes());
+    }
+    state.SetBytesProcessed(state.iterations() * 16 * len);
+}
+BENCHMARK(BM_Append)->Arg(64)->Arg(1024)->Arg(16 * 1024)->Arg(64 * 1024);
+
+/* brief: 每次往管道写 len 字节，再用 ReadFd 一次读出来（len 不超过管道容量 64K） */
+void BM_ReadFd(benchmark::State &state) {
+    const size_t len = static_cast<size_t>(state.range(0));
+    const std::string data(len, 'x');
+    int fds[2];
+    if(pipe2(fds, O_NONBLOCK) < 0) {
+        state.SkipWithError("pipe2 failed");
+        return;
+    }
+    Buffer buf;
+    for(auto _ : state) {
+        state.PauseTiming();
+        if(write(fds[1], data.data(), len) != static_cast<ssize_t>(len)) {
+            state.SkipWithError("write failed");
+            break;
+        }
+        state.ResumeTiming();
+        int err = 0;
+        ssize_t n = buf.ReadFd(fds[0], &err);
+        benchmark::DoNotOptimize(n);
+        buf.MoveReadOffset(buf.ReadableBytes());
+    }
+    close(fds[0]);
+    close(fds[1]);
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_ReadFd)->Arg(512)->Arg(16 * 1024)->Arg(64 * 1024);
+
+/* brief: 一个请求的生命周期：写进跨块的数据、按行消费、归还已经消费完的块 */
+void BM_ReleaseConsumed(benchmark::State &state) {
+    const size_t len = static_cast<size_t>(state.range(0));
+    const std::string data(len, 'x');
+    Buffer buf;
+    for(auto _ : state) {
+        buf.Append(data.data(), len);
+        buf.MoveReadOffset(len);
+        buf.ReleaseConsumed();
+        benchmark::DoNotOptimize(buf.ReadableBytes());
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_ReleaseConsumed)->Arg(600)->Arg(40 * 1024);
+
+}
+
+BENCHMARK_MAIN();
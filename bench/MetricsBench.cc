@@ -0,0 +1,63 @@
+#include "../src/Metrics.h"
+#include <benchmark/benchmark.h>
+
+// author: Haoyang Yang
+// filename: MetricsBench.cc
+// brief: 指标记录的开销：计数器累加、直方图记录（IO 路径上每个事件都会调用），以及一次抓取汇总的耗时
+
+using namespace webserver::src;
+
+namespace {
+
+void BM_CounterAdd(benchmark::State &state) {
+    Metrics metrics;
+    uint64_t n = 0;
+    for(auto _ : state) {
+        metrics.bytes_read.Add(++n & 1023);
+    }
+    benchmark::DoNotOptimize(metrics.bytes_read.Get());
+}
+BENCHMARK(BM_CounterAdd);
+
+void BM_HistogramRecord(benchmark::State &state) {
+    Metrics metrics;
+    uint64_t n = 0;
+    for(auto _ : state) {
+        metrics.task_wait_us.Record((n++ * 2654435761u) & 0xfffff);
+    }
+    benchmark::DoNotOptimize(metrics.task_wait_us.Sum());
+}
+BENCHMARK(BM_HistogramRecord);
+
+/* brief: 一次路由耗时记录，包括两次读时钟 */
+void BM_RouteLatency(benchmark::State &state) {
+    Metrics::SetRouteCount(64);
+    Metrics metrics;
+    int32_t route = 0;
+    for(auto _ : state) {
+        uint64_t start = Metrics::NowNs();
+        metrics.RouteLatency(route++ & 63, (Metrics::NowNs() - start) / 1000);
+    }
+}
+BENCHMARK(BM_RouteLatency);
+
+/* brief: 抓取：汇总 loops 个 loop 的指标并输出文本 */
+void BM_Scrape(benchmark::State &state) {
+    Metrics::SetRouteCount(64);
+    std::vector<std::unique_ptr<Metrics>> loops;
+    for(int64_t i = 0; i < state.range(0); ++i) {
+        loops.push_back(std::make_unique<Metrics>());
+        for(int32_t r = 0; r < 64; ++r) loops.back()->RouteLatency(r, r * 100);
+    }
+    std::string out;
+    for(auto _ : state) {
+        out.clear();
+        Metrics::AppendPrometheus(Metrics::Collect(), &out);
+        benchmark::DoNotOptimize(out.data());
+    }
+}
+BENCHMARK(BM_Scrape)->Arg(1)->Arg(8);
+
+}
+
+BENCHMARK_MAIN();
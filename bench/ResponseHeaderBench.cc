@@ -0,0 +1,71 @@
+#include "../http/HttpResponse.h"
+#include "../http/FileCache.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// author: Haoyang Yang
+// filename: ResponseHeaderBench.cc
+// brief: 响应头序列化：静态文件响应（带缓存的头部片段和文件正文）和普通业务响应（两个自定义头部），
+//        序列化进一个复用的字符串（对应输出队列回收的字符串），统计每次序列化的堆内存申请次数（allocs_per_iter）
+
+using namespace webserver;
+
+namespace {
+std::atomic<size_t> g_allocs{0};
+}
+
+void *operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if(void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+constexpr std::string_view kDate = "Sat, 17 Oct 2026 08:00:00 GMT";
+
+void Serialize(benchmark::State &state, const http::HttpResponse &response) {
+    std::string out;
+    out.reserve(1024);
+    size_t allocs = g_allocs.load(std::memory_order_relaxed);
+    for(auto _ : state) {
+        out.clear();
+        response.SerializeHeader("HTTP/1.1", false, kDate, out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    allocs = g_allocs.load(std::memory_order_relaxed) - allocs;
+    state.counters["allocs_per_iter"] = static_cast<double>(allocs) / state.iterations();
+    state.SetBytesProcessed(state.iterations() * out.size());
+}
+
+void BM_SerializeFileHeader(benchmark::State &state) {
+    auto file = std::make_shared<http::CachedFile>();
+    file->size = 123456;
+    file->mime = "text/javascript";
+    file->headers = "Content-Type: text/javascript\r\nAccept-Ranges: bytes\r\n"
+                    "Access-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: GET, HEAD, OPTIONS\r\n"
+                    "Cache-Control: public, max-age=3600\r\nLast-Modified: Sat, 17 Oct 2026 07:00:00 GMT\r\n"
+                    "Vary: Accept-Encoding\r\n";
+    http::HttpResponse response;
+    response._file = file;
+    response.SetFileBody(-1, 0, file->size);
+    Serialize(state, response);
+}
+BENCHMARK(BM_SerializeFileHeader);
+
+void BM_SerializeHandlerHeader(benchmark::State &state) {
+    http::HttpResponse response;
+    response.SetContent("{\"id\":42,\"name\":\"webserver\"}", "application/json");
+    response.SetHeader("Cache-Control", "no-store");
+    Serialize(state, response);
+}
+BENCHMARK(BM_SerializeHandlerHeader);
+
+}
+
+BENCHMARK_MAIN();
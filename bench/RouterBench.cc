@@ -0,0 +1,87 @@
+#include "../http/Router.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// author: Haoyang Yang
+// filename: RouterBench.cc
+// brief: 路由匹配（HttpServer 按请求匹配路由的核心）：注册 10 ~ 10000 条路由（静态路径、带 :param 的 REST 风格路径、*catchall），
+//        分别匹配静态路径、两个参数的路径、catchall 路径和方法不允许的路径，统计每次匹配的耗时和堆内存申请次数（allocs_per_iter）
+
+using namespace webserver;
+
+namespace {
+std::atomic<size_t> g_allocs{0};
+}
+
+void *operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if(void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+/* brief: 约 count 条路由：count / 4 个资源，每个资源 4 条路由，再加一条 catchall。按路由数缓存 */
+const http::Router &Routes(int count) {
+    static std::map<int, std::unique_ptr<http::Router>> routers;
+    auto &router = routers[count];
+    if(!router) {
+        router = std::make_unique<http::Router>();
+        int32_t id = 0;
+        for(int i = 0; i < std::max(1, count / 4); ++i) {
+            std::string base = "/api/v1/resource" + std::to_string(i);
+            router->Insert(http::METHOD_GET, base, id++);
+            router->Insert(http::METHOD_POST, base, id++);
+            router->Insert(http::METHOD_GET, base + "/:id", id++);
+            router->Insert(http::METHOD_GET, base + "/:id/items/:item", id++);
+        }
+        router->Insert(http::METHOD_GET, "/static/*path", id++);
+        router->Compile();
+    }
+    return *router;
+}
+
+/* brief: 路由表中间的那个资源 */
+std::string Resource(benchmark::State &state) {
+    return "/api/v1/resource" + std::to_string(std::max<int64_t>(1, state.range(0) / 4) / 2);
+}
+
+void Match(benchmark::State &state, http::HttpMethod method, const std::string &path) {
+    const http::Router &router = Routes(static_cast<int>(state.range(0)));
+    http::RouteParams params;
+    int32_t id = -1;
+    uint32_t allow = 0;
+    size_t allocs = g_allocs.load(std::memory_order_relaxed);
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(router.Match(method, path, &id, &params, &allow));
+        benchmark::DoNotOptimize(id);
+    }
+    allocs = g_allocs.load(std::memory_order_relaxed) - allocs;
+    state.counters["allocs_per_iter"] = static_cast<double>(allocs) / state.iterations();
+    state.counters["routes"] = static_cast<double>(router.Size());
+}
+
+void BM_MatchStatic(benchmark::State &state) { Match(state, http::METHOD_GET, Resource(state)); }
+BENCHMARK(BM_MatchStatic)->RangeMultiplier(10)->Range(10, 10000);
+
+void BM_MatchParams(benchmark::State &state) { Match(state, http::METHOD_GET, Resource(state) + "/12345/items/678"); }
+BENCHMARK(BM_MatchParams)->RangeMultiplier(10)->Range(10, 10000);
+
+void BM_MatchCatchall(benchmark::State &state) { Match(state, http::METHOD_GET, "/static/js/vendor/app.bundle.js"); }
+BENCHMARK(BM_MatchCatchall)->RangeMultiplier(10)->Range(10, 10000);
+
+void BM_MatchNotAllowed(benchmark::State &state) { Match(state, http::METHOD_DELETE, Resource(state)); }
+BENCHMARK(BM_MatchNotAllowed)->RangeMultiplier(10)->Range(10, 10000);
+
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,50 @@
+#include "../src/LoopThread.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <vector>
+#include <thread>
+
+// author: Haoyang Yang
+// filename: TaskQueueBench.cc
+// brief: 跨线程投递任务的吞吐：P 个生产者线程同时向同一个 EventLoop PushInLoop，
+//        统计每秒执行完的任务数（items_per_second），观察随生产者数量增加的变化
+
+using namespace webserver::src;
+
+namespace {
+
+constexpr int kTasksPerProducer = 100000;
+
+EventLoop *BenchLoop() {
+    // 进程退出前一直运行，故意不析构
+    static LoopThread *thread = new LoopThread();
+    return thread->GetLoop();
+}
+
+void BM_PushInLoop(benchmark::State &state) {
+    EventLoop *loop = BenchLoop();
+    const int producers = static_cast<int>(state.range(0));
+    const int64_t total = static_cast<int64_t>(producers) * kTasksPerProducer;
+    std::atomic<int64_t> done(0);
+    for(auto _ : state) {
+        done.store(0, std::memory_order_relaxed);
+        std::vector<std::thread> threads;
+        for(int i = 0; i < producers; ++i) {
+            threads.emplace_back([&]() {
+                for(int j = 0; j < kTasksPerProducer; ++j) {
+                    loop->PushInLoop([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+                }
+            });
+        }
+        for(auto &t : threads) t.join();
+        // 等 EventLoop 把任务全部执行完
+        while(done.load(std::memory_order_acquire) < total) std::this_thread::yield();
+    }
+    state.SetItemsProcessed(state.iterations() * total);
+    state.counters["producers"] = producers;
+}
+BENCHMARK(BM_PushInLoop)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,144 @@
+#include "../replace/ThreadPool.h"
+#include "../src/LoopThread.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// author: Haoyang Yang
+// filename: ThreadPoolBench.cc
+// brief: 业务线程池吞吐：4 个提交线程（对应 IO 线程）向线程池提交忙等 1us ~ 1ms 的任务，
+//        对比原来的单队列单锁线程池（LegacyPool）和工作窃取线程池，统计每秒执行完的任务数（items_per_second）；
+//        以及任务完成后 PostBack 的回调要等多久才在 IO 线程执行（back_delay_us），工作线程有积压时也不应超过 kMaxBackDelayUs
+
+using namespace webserver;
+
+namespace {
+
+constexpr int kProducers = 4;
+
+/* brief: 原来的业务线程池：一个队列、一把锁、一个条件变量，每个任务都包一层 std::bind */
+class LegacyPool
+{
+public:
+    explicit LegacyPool(size_t threads_num) : _stop(false) {
+        for(size_t i = 0; i < threads_num; ++i) {
+            _workers.emplace_back([this] { while(true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(_queue_mutex);
+                    _cond.wait(lock, [this]{ return _stop || !_tasks.empty(); });
+                    if(_stop && _tasks.empty()) return;
+                    task = std::move(_tasks.front());
+                    _tasks.pop();
+                }
+                task();
+            }});
+        }
+    }
+    ~LegacyPool() {
+        {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        for(auto &worker : _workers) worker.join();
+    }
+    template<class F, class... Args>
+    void Enqueue(F&& f, Args&&... args) {
+        auto task = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            _tasks.emplace(task);
+        }
+        _cond.notify_one();
+    }
+private:
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _queue_mutex;
+    std::condition_variable _cond;
+    bool _stop;
+};
+
+size_t WorkerCount() { return std::max(4u, std::thread::hardware_concurrency()); }
+
+/* brief: 忙等 us 微秒，模拟不阻塞的业务计算 */
+void Spin(int64_t us) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while(std::chrono::steady_clock::now() < end) {}
+}
+
+template<class Pool>
+void Run(benchmark::State &state) {
+    const int64_t us = state.range(0);
+    // 每轮的总工作量大致相同：短任务多提交一些
+    const int64_t per_producer = std::max<int64_t>(16, 20000 / us);
+    const int64_t total = per_producer * kProducers;
+    Pool pool(WorkerCount());
+    std::atomic<int64_t> done(0);
+    for(auto _ : state) {
+        done.store(0, std::memory_order_relaxed);
+        std::vector<std::thread> producers;
+        for(int i = 0; i < kProducers; ++i) {
+            producers.emplace_back([&]() {
+                for(int64_t j = 0; j < per_producer; ++j) {
+                    pool.Enqueue([&done, us]() {
+                        Spin(us);
+                        done.fetch_add(1, std::memory_order_release);
+                    });
+                }
+            });
+        }
+        for(auto &t : producers) t.join();
+        while(done.load(std::memory_order_acquire) < total) std::this_thread::yield();
+    }
+    state.SetItemsProcessed(state.iterations() * total);
+    state.counters["workers"] = static_cast<double>(WorkerCount());
+}
+
+void BM_LegacyPool(benchmark::State &state) { Run<LegacyPool>(state); }
+BENCHMARK(BM_LegacyPool)->Arg(1)->Arg(10)->Arg(100)->Arg(1000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+void BM_StealingPool(benchmark::State &state) { Run<http::ThreadPool>(state); }
+BENCHMARK(BM_StealingPool)->Arg(1)->Arg(10)->Arg(100)->Arg(1000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+/* brief: 完成延迟：一个工作线程积压着忙等 us 微秒的任务，每个任务结束时 PostBack 一个回调到 IO 线程，
+          统计从任务结束到回调执行的平均值和 p99 */
+void BM_BackDelay(benchmark::State &state) {
+    const int64_t us = state.range(0);
+    const int64_t count = std::max<int64_t>(16, 20000 / us);
+    static src::LoopThread *io = new src::LoopThread(); // 故意不析构，EventLoop 线程一直运行
+    src::EventLoop *loop = io->GetLoop();
+    http::ThreadPool pool(1);
+    std::atomic<int64_t> done(0);
+    std::vector<int64_t> delays;    // 只在 IO 线程里修改，等 done 之后读取
+    for(auto _ : state) {
+        done.store(0, std::memory_order_relaxed);
+        for(int64_t i = 0; i < count; ++i) {
+            pool.Enqueue([&, us]() {
+                Spin(us);
+                auto finished = std::chrono::steady_clock::now();
+                pool.PostBack(loop, [&, finished]() {
+                    delays.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - finished).count());
+                    done.fetch_add(1, std::memory_order_release);
+                });
+            });
+        }
+        // 睡眠等待，不和工作线程、IO 线程抢 CPU
+        while(done.load(std::memory_order_acquire) < count) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    std::sort(delays.begin(), delays.end());
+    int64_t total = 0;
+    for(int64_t ns : delays) total += ns;
+    state.counters["back_delay_us"] = total / 1000.0 / delays.size();
+    state.counters["p99_back_delay_us"] = delays[delays.size() * 99 / 100] / 1000.0;
+}
+BENCHMARK(BM_BackDelay)->Arg(1)->Arg(10)->Arg(100)->Arg(1000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+}
+
+BENCHMARK_MAIN();
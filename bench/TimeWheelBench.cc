@@ -0,0 +1,101 @@
+#include "../src/EventLoop.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+// author: Haoyang Yang
+// filename: TimeWheelBench.cc
+// brief: 时间轮在大量定时器下的添加 / 刷新 / 取消：先挂上 1M 个 1s ~ 60s 的定时器（对应 1M 个空闲连接），
+//        再测单次操作的耗时。在 EventLoop 所在线程调用，走的是连接实际使用的 EventLoop 接口
+
+using namespace webserver::src;
+
+namespace {
+std::atomic<uint64_t> g_allocs{0};  // operator new 的调用次数，刷新定时器不应该申请内存
+}
+
+void *operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if(void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+constexpr uint64_t kTimers = 1000000;
+
+/* brief: 基准测试所在线程的 EventLoop，挂着 kTimers 个定时器。进程退出前一直存在，故意不析构 */
+EventLoop *Loop() {
+    static EventLoop *loop = []() {
+        auto *loop = new EventLoop();
+        std::mt19937_64 rng(42);
+        for(uint64_t id = 1; id <= kTimers; ++id) loop->AddTimerMs(id, 1000 + rng() % 59000, []() {});
+        return loop;
+    }();
+    return loop;
+}
+
+/* brief: 添加一个新定时器再取消，定时器总数保持不变 */
+void BM_TimerAddCancel(benchmark::State &state) {
+    EventLoop *loop = Loop();
+    uint64_t id = kTimers + 1;
+    for(auto _ : state) {
+        loop->AddTimerMs(id, 30000, []() {});
+        loop->CancelTimer(id);
+        ++id;
+    }
+}
+BENCHMARK(BM_TimerAddCancel);
+
+/* brief: 刷新随机一个已有的定时器（连接收到数据时的操作） */
+void BM_TimerRefresh(benchmark::State &state) {
+    EventLoop *loop = Loop();
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> ids(4096);
+    for(auto &id : ids) id = 1 + rng() % kTimers;
+    size_t i = 0;
+    uint64_t allocs = g_allocs.load(std::memory_order_relaxed);
+    for(auto _ : state) {
+        loop->RefreshTimer(ids[i++ & 4095]);
+    }
+    state.counters["allocs"] = benchmark::Counter(static_cast<double>(g_allocs.load(std::memory_order_relaxed) - allocs),
+                                                  benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_TimerRefresh);
+
+/* brief: 取消随机一个已有的定时器再重新添加（连接关闭后有新连接进来） */
+void BM_TimerCancelAdd(benchmark::State &state) {
+    EventLoop *loop = Loop();
+    std::mt19937_64 rng(11);
+    std::vector<uint64_t> ids(4096);
+    for(auto &id : ids) id = 1 + rng() % kTimers;
+    size_t i = 0;
+    for(auto _ : state) {
+        uint64_t id = ids[i++ & 4095];
+        loop->CancelTimer(id);
+        loop->AddTimerMs(id, 30000, []() {});
+    }
+}
+BENCHMARK(BM_TimerCancelAdd);
+
+/* brief: 没有定时器到期时推进时间轮和计算下一次超时，每轮事件循环都会调用 */
+void BM_TimerNextTimeout(benchmark::State &state) {
+    EventLoop *loop = Loop();
+    TimeWheel wheel(loop);
+    for(uint64_t id = 1; id <= 1024; ++id) wheel.AddTimerMs(id, 60000 + id, []() {});
+    for(auto _ : state) {
+        wheel.RunExpired();
+        benchmark::DoNotOptimize(wheel.NextTimeout());
+    }
+}
+BENCHMARK(BM_TimerNextTimeout);
+
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,68 @@
+#include "../util/Util.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <string_view>
+
+// author: Haoyang Yang
+// filename: UtilBench.cc
+// brief: 请求处理路径上的工具函数：查询串的 UrlDecode（返回新字符串 / 追加到复用的字符串）
+//        和 Range 头部的 ParseRange（几种常见写法），统计每次调用的耗时
+
+using namespace webserver;
+
+namespace {
+
+constexpr std::string_view kQuery = "q=%E4%BD%A0%E5%A5%BD+world&lang=zh-CN&redirect=https%3A%2F%2Fwww.example.com%2Fa%2Fb%3Fc%3D1&page=3";
+constexpr std::string_view kPlain = "/static/js/vendor/app.bundle.js";
+
+void BM_UrlDecode(benchmark::State &state) {
+    for(auto _ : state) {
+        std::string out = util::Util::UrlDecode(kQuery, true);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * kQuery.size());
+}
+BENCHMARK(BM_UrlDecode);
+
+void BM_UrlDecodeReuse(benchmark::State &state) {
+    std::string out;
+    out.reserve(256);
+    for(auto _ : state) {
+        out.clear();
+        util::Util::UrlDecode(kQuery, true, &out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * kQuery.size());
+}
+BENCHMARK(BM_UrlDecodeReuse);
+
+/* brief: 没有需要解码的字符，最常见的路径 */
+void BM_UrlDecodePlain(benchmark::State &state) {
+    std::string out;
+    out.reserve(256);
+    for(auto _ : state) {
+        out.clear();
+        util::Util::UrlDecode(kPlain, false, &out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * kPlain.size());
+}
+BENCHMARK(BM_UrlDecodePlain);
+
+const std::string_view kRanges[] = {"bytes=0-499", "bytes=1048576-", "bytes=-500", "bytes=100-199, 300-399"};
+
+void BM_ParseRange(benchmark::State &state) {
+    const std::string_view range = kRanges[state.range(0)];
+    off_t start = 0, end = 0;
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(util::Util::ParseRange(range, 8 * 1024 * 1024, start, end));
+        benchmark::DoNotOptimize(start);
+        benchmark::DoNotOptimize(end);
+    }
+    state.SetLabel(std::string(range));
+}
+BENCHMARK(BM_ParseRange)->DenseRange(0, 3);
+
+}
+
+BENCHMARK_MAIN();
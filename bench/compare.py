@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# author: Haoyang Yang
+# filename: compare.py
+# brief: 比较两次基准测试的 JSON 结果（run_benchmarks 输出的目录，或者单个 --benchmark_out 文件）。
+#        按基准测试名字对齐，打印每项的耗时变化，变慢超过阈值的标成 REGRESSION，有退化时返回 1。
+#        用法: bench/compare.py <基线> <本次> [--threshold 5]
+
+import argparse
+import json
+import os
+import sys
+
+UNIT_NS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    """读取一个 JSON 文件或目录下全部 JSON 文件，返回 {名字: 每次迭代耗时(ns)}"""
+    files = [path]
+    is_dir = os.path.isdir(path)
+    if is_dir:
+        files = sorted(os.path.join(path, f) for f in os.listdir(path) if f.endswith(".json"))
+    results = {}
+    for file in files:
+        with open(file) as f:
+            data = json.load(f)
+        # 目录里的结果按文件名（基准测试程序名）区分，单个文件直接用基准测试名字
+        prefix = os.path.splitext(os.path.basename(file))[0] + "/" if is_dir else ""
+        for bench in data.get("benchmarks", []):
+            # 重复运行时只取均值，单次运行的结果没有 aggregate_name
+            if bench.get("run_type") == "aggregate" and bench.get("aggregate_name") != "mean":
+                continue
+            if bench.get("error_occurred"):
+                continue
+            name = prefix + bench.get("run_name", bench["name"])
+            results[name] = bench["real_time"] * UNIT_NS.get(bench.get("time_unit", "ns"), 1.0)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="比较两次基准测试结果")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=5.0, help="变慢超过这个百分比视为退化（默认 5）")
+    args = parser.parse_args()
+
+    base = load(args.baseline)
+    cur = load(args.current)
+    regressions = 0
+    width = max((len(n) for n in set(base) | set(cur)), default=20)
+    print("%-*s %14s %14s %9s" % (width, "benchmark", "baseline(ns)", "current(ns)", "change"))
+    for name in sorted(cur):
+        if name not in base:
+            print("%-*s %14s %14.1f %9s" % (width, name, "-", cur[name], "new"))
+            continue
+        change = (cur[name] - base[name]) / base[name] * 100.0 if base[name] > 0 else 0.0
+        mark = ""
+        if change > args.threshold:
+            mark = "  REGRESSION"
+            regressions += 1
+        print("%-*s %14.1f %14.1f %+8.1f%%%s" % (width, name, base[name], cur[name], change, mark))
+    for name in sorted(set(base) - set(cur)):
+        print("%-*s %14.1f %14s %9s" % (width, name, base[name], "-", "removed"))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,205 @@
+#include "AccessLog.h"
+#include "HttpRequest.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <spdlog/spdlog.h>
+
+namespace webserver::http
+{
+
+namespace {
+std::atomic<uint64_t> g_next_log_id{1};    // 日志实例编号，从 1 开始，0 表示线程还没有缓存队列
+
+/* brief: 线程本地缓存的队列：上一次使用的日志实例编号和它的队列 */
+struct LocalRingCache {
+    uint64_t id = 0;
+    void *ring = nullptr;
+};
+thread_local LocalRingCache t_ring_cache;
+
+constexpr size_t kWriteBatch = 64 * 1024;   // 格式化的内容攒到这么多就写一次
+
+/* brief: 追加路径，双引号、反斜杠和不可打印字符转义成 \" \\ \xHH，日志行里不会出现引号和换行 */
+void AppendEscaped(std::string *out, const char *data, size_t len) {
+    static const char kHex[] = "0123456789abcdef";
+    for(size_t i = 0; i < len; ++i) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if(c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back(static_cast<char>(c));
+        } else if(c < 0x20 || c >= 0x7f) {
+            out->append("\\x");
+            out->push_back(kHex[c >> 4]);
+            out->push_back(kHex[c & 0xf]);
+        } else {
+            out->push_back(static_cast<char>(c));
+        }
+    }
+}
+}
+
+AccessLog::AccessLog(const std::string &path, AccessLogFormat format)
+    : _id(g_next_log_id.fetch_add(1, std::memory_order_relaxed)), _fd(-1), _own_fd(false), _format(format),
+    _stop(false), _time_sec(-1), _time_len(0)
+    {
+        if(path == "-") {
+            _fd = STDOUT_FILENO;
+        } else {
+            _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if(_fd < 0) SPDLOG_ERROR("打开访问日志 {} 失败, errno = {}", path, errno);
+            _own_fd = _fd >= 0;
+        }
+        _thread = std::thread(&AccessLog::ThreadEntry, this);
+    }
+
+AccessLog::~AccessLog() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_one();
+    _thread.join();
+    if(_own_fd) close(_fd);
+}
+
+void AccessLog::Append(const AccessRecord &record) {
+    Ring *ring = LocalRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if(head - ring->cached_tail >= kAccessRingSize) {
+        // 看起来满了，重新读一次消费位置，还是满就丢弃
+        ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+        if(head - ring->cached_tail >= kAccessRingSize) {
+            ring->dropped.Add();
+            return;
+        }
+    }
+    ring->records[head & (kAccessRingSize - 1)] = record;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t AccessLog::Dropped() const {
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    uint64_t dropped = 0;
+    for(auto &ring : _rings) dropped += ring->dropped.Get();
+    return dropped;
+}
+// ============= Private ============
+AccessLog::Ring *AccessLog::LocalRing() {
+    if(t_ring_cache.id == _id) return static_cast<Ring*>(t_ring_cache.ring);
+    // 本线程第一次写这个日志：创建队列并登记，之后后台线程就会取它
+    auto ring = std::make_unique<Ring>();
+    Ring *ptr = ring.get();
+    {
+        std::lock_guard<std::mutex> lock(_rings_mutex);
+        _rings.push_back(std::move(ring));
+    }
+    t_ring_cache.id = _id;
+    t_ring_cache.ring = ptr;
+    return ptr;
+}
+
+void AccessLog::ThreadEntry() {
+    while(true) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait_for(lock, std::chrono::milliseconds(kAccessFlushMs), [this]() { return _stop; });
+            stop = _stop;
+        }
+        Flush();
+        if(stop) break;
+    }
+}
+
+void AccessLog::Flush() {
+    std::vector<Ring*> rings;
+    {
+        std::lock_guard<std::mutex> lock(_rings_mutex);
+        for(auto &ring : _rings) rings.push_back(ring.get());
+    }
+    // 记录里是单调时钟，换算成实时时钟的偏移每次取空时算一次
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t offset_ns = (static_cast<int64_t>(real.tv_sec) - mono.tv_sec) * 1000000000 + (real.tv_nsec - mono.tv_nsec);
+
+    std::string out;
+    out.reserve(kWriteBatch + 1024);
+    for(Ring *ring : rings) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for(; tail != head; ++tail) {
+            Format(ring->records[tail & (kAccessRingSize - 1)], offset_ns, &out);
+            if(out.size() >= kWriteBatch) WriteOut(&out);
+        }
+        // 格式化完才归还槽位，生产者不会覆盖正在读的记录
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    WriteOut(&out);
+}
+
+void AccessLog::Format(const AccessRecord &record, int64_t offset_ns, std::string *out) {
+    int64_t real_ns = static_cast<int64_t>(record.time_ns) + offset_ns;
+    time_t sec = static_cast<time_t>(real_ns / 1000000000);
+    if(sec != _time_sec) {
+        struct tm tm;
+        gmtime_r(&sec, &tm);
+        const char *fmt = _format == ACCESS_LOG_CLF ? "[%d/%b/%Y:%H:%M:%S +0000]" : "%Y-%m-%dT%H:%M:%S";
+        _time_len = strftime(_time_buf, sizeof(_time_buf), fmt, &tm);
+        _time_sec = sec;
+    }
+    char host[INET6_ADDRSTRLEN] = "-";
+    if(record.family == AF_INET || record.family == AF_INET6) inet_ntop(record.family, record.addr, host, sizeof(host));
+    std::string_view method = MethodName(static_cast<HttpMethod>(record.method));
+    const char *version = record.version == 10 ? "HTTP/1.0" : "HTTP/1.1";
+    char num[64];
+    if(_format == ACCESS_LOG_CLF) {
+        // host ident authuser [date] "request" status bytes
+        out->append(host);
+        out->append(" - - ");
+        out->append(_time_buf, _time_len);
+    } else {
+        out->append(_time_buf, _time_len);
+        int n = snprintf(num, sizeof(num), ".%03dZ ", static_cast<int>(real_ns / 1000000 % 1000));
+        out->append(num, n);
+        out->append(host);
+    }
+    out->append(" \"");
+    out->append(method);
+    out->push_back(' ');
+    AppendEscaped(out, record.path, record.path_len);
+    if(record.truncated) out->append("...");
+    out->push_back(' ');
+    out->append(version);
+    out->append("\" ");
+    int n = snprintf(num, sizeof(num), "%u %llu", record.status, static_cast<unsigned long long>(record.bytes));
+    out->append(num, n);
+    if(_format == ACCESS_LOG_DEFAULT) {
+        n = snprintf(num, sizeof(num), " %uus ", record.latency_us);
+        out->append(num, n);
+        if(record.route >= 0 && static_cast<size_t>(record.route) < _route_names.size()) out->append(_route_names[record.route]);
+        else out->push_back('-');
+    }
+    out->push_back('\n');
+}
+
+void AccessLog::WriteOut(std::string *out) {
+    size_t written = 0;
+    while(_fd >= 0 && written < out->size()) {
+        ssize_t ret = write(_fd, out->data() + written, out->size() - written);
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            SPDLOG_ERROR("写访问日志失败, errno = {}", errno);
+            break;
+        }
+        written += ret;
+    }
+    out->clear();
+}
+
+}
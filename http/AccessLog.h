@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../src/Metrics.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// author: Haoyang Yang
+// filename: AccessLog.h
+// brief: 异步访问日志。IO 线程只把一条定长的二进制记录（时间、对端地址、方法、路径前缀、状态码、字节数、路由、耗时）
+//        拷进本线程自己的无锁单生产者环形队列，不格式化、不加锁、不做系统调用，队列满了就丢弃并计数，从不阻塞；
+//        后台线程定期把所有队列取空，格式化后成批 write 到日志文件，可选 Common Log Format
+
+namespace webserver::http
+{
+
+static constexpr size_t kAccessRingSize = 4096;     // 每个线程的环形队列能放的记录数，必须是 2 的幂
+static constexpr size_t kAccessPathMax = 80;        // 记录里保存的路径长度上限，超出部分截断
+static constexpr int kAccessFlushMs = 100;          // 后台线程每隔多久把队列取空一次
+
+/* brief: 访问日志的输出格式 */
+enum AccessLogFormat {
+    ACCESS_LOG_DEFAULT, // 2026-10-17T09:25:34.710Z 127.0.0.1 "GET /hello HTTP/1.1" 200 11 35us GET /hello
+    ACCESS_LOG_CLF      // 127.0.0.1 - - [17/Oct/2026:09:25:34 +0000] "GET /hello HTTP/1.1" 200 11
+};
+
+/* brief: 一条访问记录，定长 128 字节，两个缓存行 */
+struct alignas(64) AccessRecord {
+    uint64_t time_ns = 0;       // 请求处理结束的时刻（单调时钟，src::Metrics::NowNs）
+    uint64_t bytes = 0;         // 响应正文的字节数
+    uint32_t latency_us = 0;    // 从开始处理到响应进入输出队列的耗时
+    int32_t route = -1;         // 路由下标，静态资源和没有匹配的请求是 -1
+    uint16_t status = 0;        // 状态码
+    uint8_t method = 0;         // HttpMethod
+    uint8_t version = 11;       // 协议版本：10 表示 HTTP/1.0，11 表示 HTTP/1.1
+    uint8_t family = 0;         // 对端地址族，0 表示未知
+    uint8_t path_len = 0;       // path 的有效长度
+    uint8_t truncated = 0;      // 路径被截断过
+    uint8_t addr[16] = {};      // 对端地址（IPv4 只用前 4 字节）
+    char path[kAccessPathMax];  // 请求路径（不含查询串）的前 kAccessPathMax 字节
+};
+static_assert(sizeof(AccessRecord) == 128, "AccessRecord 应该是两个缓存行");
+
+class AccessLog
+{
+public:
+    /* brief: 打开（追加写）日志文件并启动后台线程，path 为 "-" 时写到标准输出 */
+    AccessLog(const std::string &path, AccessLogFormat format = ACCESS_LOG_DEFAULT);
+    /* brief: 停止后台线程，把还在队列里的记录写完 */
+    ~AccessLog();
+    AccessLog(const AccessLog&) = delete;
+    AccessLog &operator=(const AccessLog&) = delete;
+
+    /* brief: 设置路由名字（下标和 HttpServer 的路由一致），需要在服务器启动前调用 */
+    void SetRouteNames(std::vector<std::string> names) { _route_names = std::move(names); }
+    /* brief: 追加一条记录，任意线程可调用。每个线程第一次调用时注册自己的队列，之后只是一次拷贝和一次 release store */
+    void Append(const AccessRecord &record);
+    /* brief: 因为队列满丢弃的记录数 */
+    uint64_t Dropped() const;
+private:
+    /* brief: 单生产者单消费者的环形队列，生产者和消费者的下标各占一个缓存行 */
+    struct Ring {
+        alignas(64) std::atomic<uint64_t> head{0};  // 生产者写入的位置
+        uint64_t cached_tail = 0;                   // 生产者缓存的消费位置，队列看起来满了才重新读 tail
+        src::Counter dropped;                       // 队列满时丢弃的记录数
+        alignas(64) std::atomic<uint64_t> tail{0};  // 消费者读到的位置
+        std::unique_ptr<AccessRecord[]> records = std::make_unique<AccessRecord[]>(kAccessRingSize);
+    };
+    /* brief: 当前线程在本日志上的队列，第一次调用时创建 */
+    Ring *LocalRing();
+    /* brief: 后台线程入口 */
+    void ThreadEntry();
+    /* brief: 把所有队列取空，格式化后写进文件 */
+    void Flush();
+    /* brief: 格式化一条记录追加到 out。offset_ns 是实时时钟减单调时钟 */
+    void Format(const AccessRecord &record, int64_t offset_ns, std::string *out);
+    /* brief: 把 out 整体写进文件 */
+    void WriteOut(std::string *out);
+private:
+    const uint64_t _id;             // 日志实例的编号，线程本地的队列缓存用它区分实例
+    int _fd;                        // 日志文件，打开失败时为 -1，记录被丢弃
+    bool _own_fd;                   // 析构时是否关闭 _fd
+    AccessLogFormat _format;
+    std::vector<std::string> _route_names;  // 路由下标 -> 名字
+    mutable std::mutex _rings_mutex;    // 保护 _rings，只在线程注册队列和后台线程取队列时加锁
+    std::vector<std::unique_ptr<Ring>> _rings;
+    std::mutex _mutex;              // 配合 _cond 让后台线程定时醒来，停止时立即唤醒
+    std::condition_variable _cond;
+    bool _stop;
+    time_t _time_sec;               // _time_buf 对应的秒数
+    char _time_buf[40];             // 缓存的时间前缀（秒级）
+    size_t _time_len;
+    std::thread _thread;            // 后台线程，最后初始化
+};
+
+}
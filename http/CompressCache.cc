@@ -0,0 +1,156 @@
+#include "CompressCache.h"
+#include "FileCache.h"
+#include <unistd.h>
+#include <cstring>
+#include <zlib.h>
+#include <spdlog/spdlog.h>
+#ifdef WEBSERVER_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace webserver::http
+{
+
+const char *EncodingName(Encoding encoding) {
+    switch(encoding) {
+        case ENCODING_GZIP: return "gzip";
+        case ENCODING_BR: return "br";
+        default: return "identity";
+    }
+}
+
+bool CanCompress(Encoding encoding) {
+    if(encoding == ENCODING_GZIP) return true;
+#ifdef WEBSERVER_WITH_BROTLI
+    if(encoding == ENCODING_BR) return true;
+#endif
+    return false;
+}
+
+size_t CompressCache::KeyHash::operator()(const Key &key) const {
+    size_t h = std::hash<uint64_t>()(key.ino);
+    h = h * 31 + std::hash<uint64_t>()(key.dev);
+    h = h * 31 + std::hash<int64_t>()(key.mtime_ns);
+    h = h * 31 + std::hash<size_t>()(key.size);
+    return h * 31 + key.encoding;
+}
+
+CompressCache::CompressCache(size_t capacity)
+    : _capacity(capacity), _bytes(0), _stop(false), _worker([this]() { WorkerLoop(); })
+    {}
+
+CompressCache::~CompressCache() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+    _worker.join();
+}
+/* brief: 查找压缩版本，没有则提交后台任务 */
+std::shared_ptr<const std::string> CompressCache::Get(const std::shared_ptr<const CachedFile> &file, Encoding encoding) {
+    if(!CanCompress(encoding) || file->size < kMinCompressSize || file->size > kMaxCompressSize) return nullptr;
+    Key key{file->dev, file->ino, file->size, file->mtime_ns, encoding};
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(key);
+        if(it != _entries.end()) {
+            _lru.splice(_lru.begin(), _lru, it->second);
+            return it->second->second;
+        }
+        if(_pending.count(key) || _jobs.size() >= kMaxCompressJobs) return nullptr;
+        _pending.insert(key);
+        _jobs.push_back(Job{key, file});
+    }
+    _cond.notify_one();
+    return nullptr;
+}
+
+size_t CompressCache::Bytes() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+}
+// ============= Private ============
+void CompressCache::WorkerLoop() {
+    while(true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+            if(_stop) return;
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+        auto data = std::make_shared<std::string>();
+        bool ok = Compress(job.file->fd, job.file->size, job.key.encoding, data.get());
+        // 压缩后至少小 1/8 才值得，否则记一个空条目，之后直接发原文件
+        if(!ok || data->size() > job.file->size - job.file->size / 8) data.reset();
+        else data->shrink_to_fit();
+        SPDLOG_DEBUG("后台压缩完成: inode {} {} {} -> {}", job.key.ino, EncodingName(job.key.encoding),
+                     job.file->size, data ? data->size() : job.file->size);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.erase(job.key);
+        if(ok) InsertLocked(job.key, std::move(data));
+    }
+}
+/* brief: 读取整个文件并压缩 */
+bool CompressCache::Compress(int fd, size_t size, Encoding encoding, std::string *out) {
+    // 只用 pread 按偏移读，不影响其它线程共享这个 fd 做 sendfile
+    std::string input(size, '\0');
+    for(size_t off = 0; off < size; ) {
+        ssize_t n = pread(fd, &input[off], size - off, off);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) {
+            SPDLOG_WARN("读取待压缩文件失败: {}", n < 0 ? strerror(errno) : "文件变短");
+            return false;
+        }
+        off += n;
+    }
+    if(encoding == ENCODING_GZIP) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // windowBits 加 16 输出 gzip 格式；在后台压缩且结果会反复使用，用最高压缩级别
+        if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+        out->resize(deflateBound(&zs, size));
+        zs.next_in = reinterpret_cast<Bytef*>(input.data());
+        zs.avail_in = size;
+        zs.next_out = reinterpret_cast<Bytef*>(out->data());
+        zs.avail_out = out->size();
+        int ret = deflate(&zs, Z_FINISH);
+        out->resize(zs.total_out);
+        deflateEnd(&zs);
+        return ret == Z_STREAM_END;
+    }
+#ifdef WEBSERVER_WITH_BROTLI
+    if(encoding == ENCODING_BR) {
+        size_t len = BrotliEncoderMaxCompressedSize(size);
+        out->resize(len);
+        if(!BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                                  reinterpret_cast<const uint8_t*>(input.data()), &len,
+                                  reinterpret_cast<uint8_t*>(out->data()))) return false;
+        out->resize(len);
+        return true;
+    }
+#endif
+    return false;
+}
+
+size_t CompressCache::Charge(const Entry &entry) {
+    // 空条目也计入键和链表节点的开销，防止大量不可压缩的文件让缓存无限增长
+    return sizeof(Entry) + 64 + (entry.second ? entry.second->size() : 0);
+}
+
+void CompressCache::InsertLocked(const Key &key, std::shared_ptr<const std::string> data) {
+    if(_entries.count(key)) return;
+    _lru.emplace_front(key, std::move(data));
+    _entries[key] = _lru.begin();
+    _bytes += Charge(_lru.front());
+    while(_bytes > _capacity && !_lru.empty()) {
+        _bytes -= Charge(_lru.back());
+        _entries.erase(_lru.back().first);
+        _lru.pop_back();
+    }
+}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/types.h>
+
+// author: Haoyang Yang
+// filename: CompressCache.h
+// brief: 静态资源压缩版本的缓存。没有预压缩文件（.gz / .br）的可压缩资源第一次被请求时，
+//        把压缩任务交给后台线程，请求本身先返回原文件；压缩完成后缓存在内存里，之后的请求直接借给输出队列发送。
+//        以文件身份（设备号、inode、大小、修改时间）和编码为键，文件被修改后键自然不同，旧版本随 LRU 淘汰。
+//        按压缩后的总字节数限制大小。编译时定义 WEBSERVER_WITH_BROTLI（并链接 libbrotlienc）才会在后台生成 br 版本
+
+namespace webserver::http
+{
+
+struct CachedFile;
+
+static constexpr size_t kDefaultCompressCacheBytes = 64 * 1024 * 1024;  // 缓存的压缩数据总量上限
+static constexpr size_t kMinCompressSize = 256;                 // 小于它的文件压缩收益抵不过 Content-Encoding 头部
+static constexpr size_t kMaxCompressSize = 8 * 1024 * 1024;     // 大于它的文件不在内存里压缩，只使用预压缩文件
+static constexpr size_t kMaxCompressJobs = 64;                  // 排队的压缩任务上限，超过后丢弃，之后的请求会再次提交
+
+/* brief: 内容编码 */
+enum Encoding {
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP,
+    ENCODING_BR,
+};
+
+/* brief: Content-Encoding 头部使用的编码名称 */
+const char *EncodingName(Encoding encoding);
+/* brief: 当前编译的版本能否在后台生成该编码 */
+bool CanCompress(Encoding encoding);
+
+class CompressCache
+{
+public:
+    /* brief: capacity 是缓存的压缩数据总字节数上限。构造时启动后台压缩线程 */
+    explicit CompressCache(size_t capacity = kDefaultCompressCacheBytes);
+    /* brief: 停止后台线程，丢弃还没开始的任务 */
+    ~CompressCache();
+    CompressCache(const CompressCache&) = delete;
+    CompressCache &operator=(const CompressCache&) = delete;
+
+    /* brief: 查找 file 的 encoding 压缩版本。没有时提交后台压缩任务并返回空，调用方先发送原文件；
+              压缩后没有明显变小的文件也返回空，且不再重复压缩。任意线程都可以调用 */
+    std::shared_ptr<const std::string> Get(const std::shared_ptr<const CachedFile> &file, Encoding encoding);
+    /* brief: 当前缓存的压缩数据字节数 */
+    size_t Bytes();
+private:
+    /* brief: 缓存键：文件身份 + 编码 */
+    struct Key {
+        dev_t dev;
+        ino_t ino;
+        size_t size;
+        int64_t mtime_ns;
+        Encoding encoding;
+        bool operator==(const Key &other) const {
+            return dev == other.dev && ino == other.ino && size == other.size &&
+                   mtime_ns == other.mtime_ns && encoding == other.encoding;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+    /* brief: 后台压缩任务，持有 CachedFile 保证 fd 在压缩期间有效 */
+    struct Job {
+        Key key;
+        std::shared_ptr<const CachedFile> file;
+    };
+    /* brief: 缓存条目，data 为空表示压缩不划算 */
+    using Entry = std::pair<Key, std::shared_ptr<const std::string>>;
+    /* brief: 后台线程的入口函数，逐个执行压缩任务 */
+    void WorkerLoop();
+    /* brief: 读取文件并压缩到 out，失败返回 false */
+    static bool Compress(int fd, size_t size, Encoding encoding, std::string *out);
+    /* brief: 条目占用的字节数 */
+    static size_t Charge(const Entry &entry);
+    /* brief: 加入一个条目并按容量淘汰，需要持有锁 */
+    void InsertLocked(const Key &key, std::shared_ptr<const std::string> data);
+private:
+    size_t _capacity;       // 缓存的压缩数据总字节数上限
+    size_t _bytes;          // 当前缓存的字节数
+    std::mutex _mutex;      // 保护以下成员，各个 EventLoop 线程和后台线程共享
+    std::condition_variable _cond;  // 有新任务或需要退出时唤醒后台线程
+    bool _stop;             // 后台线程是否需要退出
+    std::list<Entry> _lru;  // 最近使用的在前
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> _entries;
+    std::unordered_set<Key, KeyHash> _pending;  // 已经提交、还没完成的任务，避免同一个文件重复压缩
+    std::deque<Job> _jobs;  // 排队的压缩任务
+    std::thread _worker;    // 后台压缩线程，最后初始化
+};
+
+}
@@ -0,0 +1,218 @@
+#include "FileCache.h"
+#include "../src/EventLoop.h"
+#include "../util/Util.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <spdlog/spdlog.h>
+
+namespace webserver::http
+{
+
+namespace {
+constexpr uint32_t kWatchMask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+/* brief: 文本类资源压缩收益明显，图片、视频、ts 切片本身已经压缩过 */
+bool Compressible(const std::string &mime) {
+    return mime.rfind("text/", 0) == 0 || mime == "application/json" || mime == "application/xml" ||
+           mime == "application/xhtml+xml" || mime == "image/svg+xml" || mime == "application/vnd.apple.mpegurl";
+}
+}
+
+CachedFile::~CachedFile() {
+    if(fd >= 0) close(fd);
+}
+
+FileCache::FileCache(const std::string &basedir, size_t capacity)
+    : _basedir(basedir), _capacity(capacity), _generation(0)
+    {
+        _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(_inotify_fd < 0) SPDLOG_WARN("inotify_init1 失败，静态文件缓存不会自动失效: {}", strerror(errno));
+    }
+
+FileCache::~FileCache() {
+    if(_channel) _channel->Remove();
+    if(_inotify_fd >= 0) close(_inotify_fd);
+}
+
+void FileCache::Watch(src::EventLoop *loop) {
+    if(_inotify_fd < 0 || _channel) return;
+    _channel = std::make_unique<src::Channel>(loop, _inotify_fd);
+    _channel->SetReadCallback([this]() { HandleEvents(); });
+    _channel->EnableRead();
+}
+/* brief: 获取请求路径对应的文件，先查缓存 */
+std::shared_ptr<const CachedFile> FileCache::Open(const std::string &path) {
+    uint64_t generation;
+    bool watched;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(path);
+        if(it != _entries.end()) {
+            // 命中：移到 LRU 头部
+            _lru.splice(_lru.begin(), _lru, it->second);
+            return it->second->second;
+        }
+        // 先监控目录再打开文件，保证打开之后的修改一定能收到通知
+        watched = WatchDirectory(path.substr(0, path.rfind('/') + 1));
+        generation = _generation;
+    }
+    std::shared_ptr<CachedFile> file = Load(path);
+    if(file == nullptr) return nullptr;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(!watched || generation != _generation || _entries.count(path)) {
+        // 目录没有监控上，或者打开期间有文件变化（不一定是这个文件），或者其他线程已经缓存了，本次结果只用这一次
+        return file;
+    }
+    _lru.emplace_front(path, file);
+    _entries[path] = _lru.begin();
+    while(_entries.size() > _capacity) EraseLocked(_lru.back().first);
+    return file;
+}
+
+size_t FileCache::Size() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+// ============= Private ============
+/* brief: 打开文件并拼好响应头 */
+std::shared_ptr<CachedFile> FileCache::Load(const std::string &path) {
+    std::string filename = _basedir + path;
+    if(filename.back() == '/') filename += "index.html";
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return nullptr;
+    auto file = std::make_shared<CachedFile>();
+    file->fd = fd;  // 之后出错由 CachedFile 析构关闭
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        SPDLOG_DEBUG("资源不是普通文件: {}", filename);
+        return nullptr;
+    }
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    file->mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mime = util::Util::ExtMime(filename);
+    file->compressible = Compressible(file->mime);
+    if(file->compressible) {
+        file->gzip = LoadSidecar(filename + ".gz", *file);
+        file->br = LoadSidecar(filename + ".br", *file);
+    }
+
+    char last_modified[64];
+    struct tm tm;
+    gmtime_r(&file->mtime, &tm);
+    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    std::string &headers = file->headers;
+    headers.reserve(256);
+    headers += "Content-Type: ";
+    headers += file->mime;
+    headers += "\r\nAccept-Ranges: bytes\r\n";  // 告诉浏览器支持断点续传/视频拖动
+    headers += "Access-Control-Allow-Origin: *\r\n";
+    headers += "Access-Control-Allow-Methods: GET, HEAD, OPTIONS\r\n";
+    //ts 切片：强制缓存1年
+    if(file->mime == "video/mp2t") headers += "Cache-Control: public, max-age=31536000, immutable\r\n";
+    else if(file->mime == "application/vnd.apple.mpegurl") headers += "Cache-Control: no-cache\r\n"; // m3u8索引，不缓存(防止更新了切片还在用旧索引)
+    else headers += "Cache-Control: public, max-age=3600\r\n"; //其它静态资源默认缓存策略
+    headers += "Last-Modified: ";
+    headers += last_modified;
+    headers += "\r\n";
+    // 同一个 URL 按 Accept-Encoding 返回不同的表示，原文件的响应也要带上，否则中间缓存可能把它发给支持压缩的客户端，反之亦然
+    if(file->compressible) headers += "Vary: Accept-Encoding\r\n";
+    return file;
+}
+
+std::shared_ptr<const CachedFile> FileCache::LoadSidecar(const std::string &filename, const CachedFile &file) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return nullptr;
+    auto sidecar = std::make_shared<CachedFile>();
+    sidecar->fd = fd;
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) return nullptr;
+    int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    if(mtime_ns < file.mtime_ns) {
+        // 原文件更新过而预压缩文件没有重新生成，内容对不上
+        SPDLOG_DEBUG("预压缩文件比原文件旧，忽略: {}", filename);
+        return nullptr;
+    }
+    sidecar->size = st.st_size;
+    sidecar->mtime = st.st_mtime;
+    sidecar->mtime_ns = mtime_ns;
+    sidecar->dev = st.st_dev;
+    sidecar->ino = st.st_ino;
+    return sidecar;
+}
+
+bool FileCache::WatchDirectory(const std::string &dir) {
+    if(_inotify_fd < 0 || _dir_watches.count(dir)) return true;
+    int wd = inotify_add_watch(_inotify_fd, (_basedir + dir).c_str(), kWatchMask);
+    if(wd < 0) {
+        // 目录不存在时之后打开文件也会失败；ENOSPC/EACCES 等监控不上的目录，文件变了也收不到通知，不能缓存
+        SPDLOG_DEBUG("监控目录失败: {}, {}", dir, strerror(errno));
+        return false;
+    }
+    _dir_watches[dir] = wd;
+    _watch_dirs[wd] = dir;
+    return true;
+}
+/* brief: 处理 inotify 事件 */
+void FileCache::HandleEvents() {
+    alignas(struct inotify_event) char buf[4096];
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_generation;
+    while(true) {
+        ssize_t n = read(_inotify_fd, buf, sizeof(buf));
+        if(n <= 0) break;
+        for(char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            if(ev->mask & IN_Q_OVERFLOW) {
+                // 事件丢失，无法知道哪些文件变了
+                SPDLOG_WARN("inotify 事件队列溢出，清空静态文件缓存");
+                ClearLocked();
+                continue;
+            }
+            auto wit = _watch_dirs.find(ev->wd);
+            if(wit == _watch_dirs.end()) continue;
+            if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // 目录本身被删除或移动，它下面（包括子目录）的条目都可能失效，直接清空
+                _dir_watches.erase(wit->second);
+                _watch_dirs.erase(wit);
+                ClearLocked();
+                continue;
+            }
+            if(ev->len == 0) continue;
+            std::string name(ev->name);
+            EraseLocked(wit->second + name);
+            // 预压缩文件属于原文件的条目
+            if(name.size() > 3 && (name.ends_with(".gz") || name.ends_with(".br"))) {
+                name.resize(name.size() - 3);
+                EraseLocked(wit->second + name);
+            }
+            if(name == "index.html") EraseLocked(wit->second);
+            if((ev->mask & IN_ISDIR) && (ev->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+                ClearLocked(); // 子目录被删除或替换，它下面的条目都可能失效
+            }
+        }
+    }
+}
+
+void FileCache::EraseLocked(const std::string &path) {
+    auto it = _entries.find(path);
+    if(it == _entries.end()) return;
+    _lru.erase(it->second);
+    _entries.erase(it);
+}
+
+void FileCache::ClearLocked() {
+    _entries.clear();
+    _lru.clear();
+}
+
+}
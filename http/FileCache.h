@@ -0,0 +1,90 @@
+#pragma once
+
+#include "../src/Channel.h"
+#include <string>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <ctime>
+#include <sys/types.h>
+
+// author: Haoyang Yang
+// filename: FileCache.h
+// brief: 静态资源的打开文件缓存。以请求路径为键，缓存打开的 fd、大小、修改时间、MIME 和拼好的响应头片段，
+//        命中时不再 stat/open/fstat，只剩 sendfile。条目用 shared_ptr 引用计数，正在发送的响应持有引用，
+//        条目被淘汰或失效后 fd 在最后一个引用释放时才关闭。
+//        按 LRU 限制条目数量；文件所在目录用 inotify 监控，文件被修改/删除/替换时由 baseloop 线程把条目移除。
+//        可压缩的文件打开时顺便查找同目录下不比它旧的预压缩文件（foo.js.gz / foo.js.br），作为条目的一部分一起缓存
+
+namespace webserver::src { class EventLoop; }
+
+namespace webserver::http
+{
+
+static constexpr size_t kDefaultFileCacheEntries = 1024;   // 缓存的文件数量上限，同时也是缓存占用 fd 数量的上限
+
+/* brief: 缓存的文件 */
+struct CachedFile {
+    CachedFile() = default;
+    ~CachedFile();
+    CachedFile(const CachedFile&) = delete;
+    CachedFile &operator=(const CachedFile&) = delete;
+
+    int fd = -1;            // 只读打开的文件，只用 sendfile 按偏移读取，多个连接可以共享
+    size_t size = 0;        // 文件大小
+    time_t mtime = 0;       // 修改时间
+    int64_t mtime_ns = 0;   // 纳秒精度的修改时间，和 dev / ino 一起作为压缩缓存的键
+    dev_t dev = 0;          // 所在设备
+    ino_t ino = 0;          // inode
+    bool compressible = false;  // MIME 类型是否值得压缩（文本类）
+    std::string mime;       // MIME 类型
+    std::string headers;    // 拼好的响应头片段（Content-Type / Cache-Control / Last-Modified 等），每行以 \r\n 结尾
+    std::shared_ptr<const CachedFile> gzip;     // 预压缩的 .gz 文件，没有则为空，只用到 fd 和 size
+    std::shared_ptr<const CachedFile> br;       // 预压缩的 .br 文件，没有则为空
+};
+
+class FileCache
+{
+public:
+    /* brief: basedir 是静态资源根目录，capacity 是缓存的文件数量上限 */
+    explicit FileCache(const std::string &basedir, size_t capacity = kDefaultFileCacheEntries);
+    ~FileCache();
+    FileCache(const FileCache&) = delete;
+    FileCache &operator=(const FileCache&) = delete;
+
+    /* brief: 在 loop 上监控 inotify 事件，需要在 loop 线程内调用 */
+    void Watch(src::EventLoop *loop);
+    /* brief: 获取请求路径 path 对应的普通文件，以 / 结尾的路径对应目录下的 index.html。
+              未命中时打开文件并加入缓存，不存在或不是普通文件返回空。任意线程都可以调用 */
+    std::shared_ptr<const CachedFile> Open(const std::string &path);
+    /* brief: 当前缓存的文件数量 */
+    size_t Size();
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const CachedFile>>;
+    /* brief: 打开文件并拼好响应头，不加锁 */
+    std::shared_ptr<CachedFile> Load(const std::string &path);
+    /* brief: 打开 filename 对应的预压缩文件，它必须是普通文件且不比原文件旧，否则返回空 */
+    static std::shared_ptr<const CachedFile> LoadSidecar(const std::string &filename, const CachedFile &file);
+    /* brief: 确保请求路径所在目录被 inotify 监控，需要持有锁。监控失败返回 false，此时目录下的文件不能缓存 */
+    bool WatchDirectory(const std::string &dir);
+    /* brief: 读取 inotify 事件，移除失效的条目。在 baseloop 线程内执行 */
+    void HandleEvents();
+    /* brief: 移除一个条目，需要持有锁 */
+    void EraseLocked(const std::string &path);
+    /* brief: 移除所有条目，需要持有锁 */
+    void ClearLocked();
+private:
+    std::string _basedir;   // 静态资源根目录
+    size_t _capacity;       // 缓存的文件数量上限
+    int _inotify_fd;        // inotify 实例，创建失败时为 -1，此时缓存不会自动失效
+    std::unique_ptr<src::Channel> _channel;     // inotify 的事件管理
+    std::mutex _mutex;      // 保护以下成员，各个 EventLoop 线程共享同一个缓存
+    uint64_t _generation;   // 每处理一批 inotify 事件加 1，打开文件期间发生变化则不缓存
+    std::list<Entry> _lru;  // 最近使用的在前
+    std::unordered_map<std::string, std::list<Entry>::iterator> _entries;  // 请求路径 -> 条目
+    std::unordered_map<std::string, int> _dir_watches;  // 请求路径的目录部分（以 / 结尾） -> watch descriptor
+    std::unordered_map<int, std::string> _watch_dirs;   // watch descriptor -> 请求路径的目录部分
+};
+
+}
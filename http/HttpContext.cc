@@ -1,5 +1,7 @@
 #include "HttpContext.h"
-#include <algorithm>
+#include "../src/ByteScan.h"
+#include <charconv>
+#include <strings.h>
 
 namespace webserver::http
 {
@@ -7,6 +9,14 @@ namespace webserver::http
 void HttpContext::Reset() {
     _resp_status = 200;
     _recv_status = RECV_HTTP_LINE;
+    _scan_pos = 0;
+    _line_start = 0;
+    _fields_begin = 0;
+    _body_remain = 0;
+    _chunked = false;
+    _chunk_state = CHUNK_SIZE;
+    _chunk_remain = 0;
+    _body_callback = nullptr;
     _request.Reset();
 }
 /* brief: 接收并解析Http请求的总流程，暴露给使用者 */
@@ -21,183 +31,309 @@ void HttpContext::RecvHttpRequest(src::Buffer *buf) {
 }
 //==========  Private  ===========
 //========== Http 请求行 ==========
-/* brief: 接收Http请求行 */
+/* brief: 接收Http请求行：先找到请求头结束的空行，把请求行和请求头整体拷贝进请求，再解析请求行 */
 bool HttpContext::RecvHttpLine(src::Buffer *buf) {
     if(_recv_status != RECV_HTTP_LINE) return false; //如果不处于接收请求行状态则返回
     SPDLOG_DEBUG("开始接收 Http 请求行");
-    //step 1: 获取一行数据
-    std::string line = buf->GetlineAndPop();
-    SPDLOG_TRACE("HttpLine: {}", line);
-    //step 2: 缓冲区数据不足一行/一行超大（即没读到\r\n）
-    if(line.size() == 0) {
-        // 缓冲区中的数据不足一行，则需要判断缓冲区的可读数据长度，如果很长，则说明有问题
-        SPDLOG_DEBUG("缓冲区数据没有行结尾标识符");
-        if(buf->ReadableBytes() > MAX_LINE) {
-            SPDLOG_WARN("缓冲区数据太长，缓冲区数据错误");
-            _recv_status = RECV_HTTP_ERROR;
-            _resp_status = 414; // url too long
-            return false;
+    //step 1: 逐行查找空行。从上次扫描停下的位置继续，数据分多次到达时不重复扫描
+    while(true) {
+        size_t lf = buf->Find('\n', _scan_pos);
+        if(lf == src::Buffer::npos) {
+            // 缓冲区中的数据不足一行，则需要判断当前行的长度，如果很长，则说明有问题
+            _scan_pos = buf->ReadableBytes();
+            if(_scan_pos - _line_start > MAX_LINE) {
+                SPDLOG_WARN("一行数据太长，错误数据");
+                return SetError(414); // url too long
+            }
+            if(_scan_pos > MAX_HEAD) {
+                SPDLOG_WARN("请求头太长，错误数据");
+                return SetError(431);
+            }
+            // 不足一行，但也不多，就等待新数据到来
+            SPDLOG_DEBUG("缓冲区数据不足一行，等待新数据到来");
+            return true;
         }
-        // 不足一行，但也不多，就等待新数据到来
-        SPDLOG_DEBUG("缓冲区数据不足一行，等待新数据到来");
-        return true;
-    }
-    // 读到了一行，但一行超大
-    if(line.size() > MAX_LINE) {
-        SPDLOG_WARN("一行数据太长，错误数据");
-        _recv_status = RECV_HTTP_ERROR;
-        _resp_status = 414; // url too long
-        return false;
+        size_t line_len = lf - _line_start;
+        if(line_len > MAX_LINE) {
+            SPDLOG_WARN("一行数据太长，错误数据");
+            return SetError(414); // url too long
+        }
+        bool empty = (line_len == 0) || (line_len == 1 && buf->PeekByte(lf - 1) == '\r');
+        bool first_line = (_line_start == 0);
+        _scan_pos = _line_start = lf + 1;
+        if(!empty) {
+            if(_scan_pos > MAX_HEAD) {
+                SPDLOG_WARN("请求头太长，错误数据");
+                return SetError(431);
+            }
+            continue;
+        }
+        if(first_line) {
+            // 请求行之前的空行直接丢掉（例如上一个请求正文后面多余的 \r\n）
+            buf->MoveReadOffset(lf + 1);
+            _scan_pos = _line_start = 0;
+            continue;
+        }
+        break;
     }
-    // 读取完完整的正常的一行
-    bool ret = ParseHttpLine(line);
+    //step 2: 请求头完整了，整体拷贝进请求，之后的解析都只记录偏移
+    size_t head_len = _scan_pos;
+    _request._head.resize(head_len);
+    buf->ReadAndPop(&_request._head[0], head_len);
+    _scan_pos = _line_start = 0;
+    //step 3: 解析请求行
+    const char *head = _request._head.data();
+    const char *eol = src::FindByte(head, head + head_len, '\n');
+    _fields_begin = eol - head + 1;
+    bool ret = ParseHttpLine(std::string_view(head, eol - head));
     if(ret == false) return false;
     SPDLOG_DEBUG("结束接收请求行");
     _recv_status = RECV_HTTP_HEAD; // 成功接收完请求行，状态切换置接收请求头
     return true;
 }
 /* brief: 解析Http请求行 */
-bool HttpContext::ParseHttpLine(std::string &line) {
-    // step 1: 先去掉接收到的请求行的\r\n
-    if(line.back() == '\n') line.pop_back();
-    if(line.back() == '\r') line.pop_back();
-    // 获取解析完成的请求行
+bool HttpContext::ParseHttpLine(std::string_view line) {
+    // step 1: 先去掉接收到的请求行的\r
+    if(!line.empty() && line.back() == '\r') line.remove_suffix(1);
     SPDLOG_TRACE("开始分割请求行: {}", line);
-    auto matches = util::Util::SplitLine(line);
-    assert(matches.size() == 4);
-    SPDLOG_TRACE("parseline matches[0]: {}", matches[0]);
-    SPDLOG_TRACE("parseline matches[1]: {}", matches[1]);
-    SPDLOG_TRACE("parseline matches[2]: {}", matches[2]);
-    SPDLOG_TRACE("parseline matches[3]: {}", matches[3]);
-    // step 2: 设置HttpRequest上下文
-    // 2.1设置method
-    _request._method = matches[0];
-    std::transform(_request._method.begin(), _request._method.end(), _request._method.begin(), ::toupper);  // 将请求方法转化为大写
-    // 2.2设置path
-    _request._path = util::Util::UrlDecode(matches[1], false);   // 设置资源路径，需要进行解码操作，但不需要 + 转空格
-    // 2.3设置协议版本
-    _request._version = matches[3];
-    // 2.4设置查询字符串
+    // step 2: 按空格分出 请求方法 / 请求资源 / 协议版本，请求资源再按 ? 分出路径和查询字符串
+    const char *begin = line.data();
+    const char *end = begin + line.size();
+    const char *sp1 = src::FindByte(begin, end, ' ');
+    const char *target = sp1 + 1;
+    const char *sp2 = sp1 == end ? end : src::FindByte(target, end, ' ');
+    if(sp1 == begin || sp2 == end) {
+        SPDLOG_WARN("请求行格式错误");
+        return SetError(400); // BAD REQUEST
+    }
+    const char *question = src::FindByte(target, sp2, '?');
+    // step 3: 设置HttpRequest上下文，字符串都复用上一个请求留下的容量
+    // 3.1设置method
+    _request._method.assign(begin, sp1);
+    for(char &c : _request._method) {
+        if(c >= 'a' && c <= 'z') c = c - 'a' + 'A';  // 将请求方法转化为大写
+    }
+    _request._method_id = ParseMethod(_request._method);
+    // 3.2设置path
+    _request._path.clear();
+    util::Util::UrlDecode(std::string_view(target, question - target), false, &_request._path); // 设置资源路径，需要进行解码操作，但不需要 + 转空格
+    // 3.3设置协议版本
+    _request._version.assign(sp2 + 1, end);
+    // 3.4设置查询字符串
+    if(question == sp2) return true;
     std::vector<std::string_view> query_string_arry;
-    std::string_view query_string = matches[2];
-    // 2.4.1 查询字符串格式位 key1=value1&key2=value2...，先以&分割，得到各个字串
+    std::string_view query_string(question + 1, sp2 - question - 1);
+    // 3.4.1 查询字符串格式位 key1=value1&key2=value2...，先以&分割，得到各个字串
     util::Util::Split(query_string, "&", &query_string_arry);
-    // 2.4.2 针对各个字串，以 = 分割，得到key val
-    for(auto &line : query_string_arry) {
-        size_t pos = line.find("=");
+    // 3.4.2 针对各个字串，以 = 分割，得到key val
+    for(auto &kv : query_string_arry) {
+        size_t pos = kv.find("=");
         if(pos == std::string::npos) {
             // 字串里没有 = ，请求行格式出错
             SPDLOG_WARN("请求行的请求参数格式错误");
-            _recv_status = RECV_HTTP_ERROR;
-            _resp_status = 400; // BAD REQUEST
-            return false;
+            return SetError(400); // BAD REQUEST
         }
         // 找到了 = ，对其解码，之后设置进request里
-        std::string key = util::Util::UrlDecode(line.substr(0, pos), true);
-        std::string val = util::Util::UrlDecode(line.substr(pos + 1), true);
+        std::string key = util::Util::UrlDecode(kv.substr(0, pos), true);
+        std::string val = util::Util::UrlDecode(kv.substr(pos + 1), true);
         _request.SetParam(key, val);
     }
     return true;
 }
 //========== Http 请求头 ==========
-/* brief: 接收Http请求头 */
+/* brief: 解析Http请求头。请求头已经在 RecvHttpLine 里完整拷贝进请求，这里逐行记录偏移 */
 bool HttpContext::RecvHttpHead(src::Buffer *buf) {
     if(_recv_status != RECV_HTTP_HEAD) return false; // 如果不处于接收请求头状态则返回
-    // 一行一行的取出数据，直到遇到空行，头部格式 key1: val1\r\nkey2: val2\r\n...
-    SPDLOG_DEBUG("开始接收 Http 请求头");
-    while(1) {
-        //step 1:获取一行数据
-        std::string line = buf->GetlineAndPop();
-        SPDLOG_TRACE("一行数据 line = {}", line);
-        //step 2:缓冲区不足一行/一行数据超大
-        if(line.size() == 0) {
-            //缓冲区中的数据不足一行，则需要判断缓冲区的可读数据长度，如果很长，则有问题
-            SPDLOG_DEBUG("缓冲区数据没有行结尾标识符");
-            if(buf->ReadableBytes() > MAX_LINE) {
-                SPDLOG_WARN("缓冲区数据太长，缓冲区数据错误");
-                _recv_status = RECV_HTTP_ERROR;
-                _resp_status = 414; //URL TOO LONG
-                return false;
-            }
-            //不足一行，但不过多，就等新数据到来
-            SPDLOG_DEBUG("缓冲区数据不足一行，等待新数据到来");
-            return true;
-        }
-        if(line.size() > MAX_LINE) {
-            //一行数据超大
-            SPDLOG_WARN("一行数据太长，错误数据");
-            _recv_status = RECV_HTTP_ERROR;
-            _resp_status = 414; //URL TOO LONG
-            return false;
-        }
-        if(line == "\n" || line == "\r\n") {
+    // 一行一行的解析，直到遇到空行，头部格式 key1: val1\r\nkey2: val2\r\n...
+    SPDLOG_DEBUG("开始解析 Http 请求头");
+    const char *head = _request._head.data();
+    size_t size = _request._head.size();
+    size_t pos = _fields_begin;
+    while(pos < size) {
+        const char *line = head + pos;
+        const char *eol = src::FindByte(line, head + size, '\n');
+        const char *line_end = eol;
+        if(line_end > line && line_end[-1] == '\r') --line_end;
+        if(line_end == line) {
             //读到空行，请求头接收完毕
             SPDLOG_DEBUG("读到空行，请求头接收完毕");
             break;
         }
-        // 正常接收到一行数据，对其进行解析
-        bool ret = ParseHttpHead(line);
+        bool ret = ParseHttpHead(pos, line_end - head);
         if(ret == false) {
             SPDLOG_WARN("该行请求头解析失败，结束接收请求头");
             return false;
         }
+        pos = eol - head + 1;
+    }
+    // Content-Length 必须是合法的十进制数字，否则无法确定正文边界
+    std::string_view contlen = _request.GetHeaderView("Content-Length");
+    _body_remain = 0;
+    if(!contlen.empty()) {
+        auto res = std::from_chars(contlen.data(), contlen.data() + contlen.size(), _body_remain);
+        if(res.ec != std::errc() || res.ptr != contlen.data() + contlen.size()) {
+            SPDLOG_WARN("Content-Length 格式错误");
+            return SetError(400); // BAD REQUEST
+        }
+    }
+    // Transfer-Encoding 只支持 chunked；和 Content-Length 同时出现时拒绝，避免前后端对正文边界理解不一致
+    if(_request.HasHeader("Transfer-Encoding")) {
+        if(strcasecmp(std::string(_request.GetHeaderView("Transfer-Encoding")).c_str(), "chunked") != 0) {
+            SPDLOG_WARN("不支持的 Transfer-Encoding: {}", _request.GetHeaderView("Transfer-Encoding"));
+            return SetError(501); // NOT IMPLEMENTED
+        }
+        if(!contlen.empty()) {
+            SPDLOG_WARN("Transfer-Encoding 和 Content-Length 同时出现");
+            return SetError(400); // BAD REQUEST
+        }
+        _chunked = true;
+        _chunk_state = CHUNK_SIZE;
     }
     SPDLOG_DEBUG("结束接收请求头");
+    // 由使用者决定正文是否按片交出去，不交出去则整体放进 _request._body
+    if(_head_callback) _body_callback = _head_callback(_request);
+    if(!_body_callback && _body_remain > _max_body) {
+        SPDLOG_WARN("请求体过大: {}", _body_remain);
+        return SetError(413); // PAYLOAD TOO LARGE
+    }
+    // Content-Length 来自对端，预留的空间不超过一个块，之后按实际收到的数据增长
+    if(!_body_callback && !_chunked) _request._body.reserve(std::min(_body_remain, src::kBlockSize));
     _recv_status = RECV_HTTP_BODY;
     return true;
 }
-/* brief: 解析Http请求头 */
-bool HttpContext::ParseHttpHead(std::string &line) {
-    //step 1: 先去掉\r\n
-    if(line.back() == '\n') line.pop_back();
-    if(line.back() == '\r') line.pop_back();
-    //step 2: 根据": "分割请求头
-    size_t pos = line.find(": ");
-    if(pos == std::string::npos) {
+/* brief: 解析Http请求头，[begin, end) 是 _head 里去掉行尾的一行 */
+bool HttpContext::ParseHttpHead(size_t begin, size_t end) {
+    const char *head = _request._head.data();
+    //step 1: 根据 ':' 分割请求头
+    const char *colon = src::FindByte(head + begin, head + end, ':');
+    if(colon == head + end || colon == head + begin) {
         // 没有找到分割符
-        SPDLOG_WARN("没有找到 ': ' 分割，无效请求头");
-        _recv_status = RECV_HTTP_ERROR;
-        _resp_status = 400; // BAD REQUEST
-        return false;
+        SPDLOG_WARN("没有找到 ':' 分割，无效请求头");
+        return SetError(400); // BAD REQUEST
     }
-    std::string key = line.substr(0, pos);
-    std::string val = line.substr(pos + 2);
-    _request.SetHeader(key, val);
+    //step 2: 去掉值两边的空白
+    size_t value_begin = colon - head + 1;
+    size_t value_end = end;
+    while(value_begin < value_end && (head[value_begin] == ' ' || head[value_begin] == '\t')) ++value_begin;
+    while(value_end > value_begin && (head[value_end - 1] == ' ' || head[value_end - 1] == '\t')) --value_end;
+    http::HeaderField field;
+    field.name_off = static_cast<uint32_t>(begin);
+    field.name_len = static_cast<uint32_t>(colon - head - begin);
+    field.value_off = static_cast<uint32_t>(value_begin);
+    field.value_len = static_cast<uint32_t>(value_end - value_begin);
+    _request.AddHeaderField(field);
     return true;
 }
+/* brief: 进入错误状态 */
+bool HttpContext::SetError(int status) {
+    _recv_status = RECV_HTTP_ERROR;
+    _resp_status = status;
+    return false;
+}
 //========== Http 请求体 ==========
 /* brief: 接收Http请求体 */
 bool HttpContext::RecvHttpBody(src::Buffer *buf) {
     if(_recv_status != RECV_HTTP_BODY) return false;
     SPDLOG_DEBUG("开始接收 Http 请求体");
-    //step 1: 获取正文长度
-    size_t content_length = _request.GetContentLength();
-    SPDLOG_TRACE("content-length: {}", content_length);
-    if(content_length == 0) {\
-        // 根据请求头的说明，没有请求体
-        SPDLOG_DEBUG("正文长度为 0 , 接收 Http 请求完毕");
+    if(_chunked) return RecvChunkedBody(buf);
+    //按 Content-Length 接收，缓冲区里的数据不一定全是正文，也可能还不够
+    SPDLOG_TRACE("body_remain = {}, ReadAbleBytes = {}", _body_remain, buf->ReadableBytes());
+    if(!RecvBodyData(buf, &_body_remain)) return true;
+    if(_body_remain == 0) {
+        SPDLOG_DEBUG("正文接收完毕");
         _recv_status = RECV_HTTP_OVER;
         return true;
     }
-    //step 2:走到这，说明有正文。先明白当前已经接收了多少正文，再计算出要接收的剩余正文
-    size_t real_len = content_length - _request._body.size();
-    SPDLOG_TRACE("real_len = {}, ReadAbleBytes = {}", real_len, buf->ReadableBytes());
-    //step 3:接收正文，放到 body 中，要考虑缓冲区的数据是否全是正文
-    // 3.1 缓冲区中数据包含所有正文，取出所需数据
-    if(buf->ReadableBytes() >= real_len) {
-        _request._body.append(buf->ReadPos(), real_len);
-        SPDLOG_TRACE("real_len = {}", real_len);
-        buf->MoveReadOffset(real_len);
-        _recv_status = RECV_HTTP_OVER;
-        SPDLOG_DEBUG("缓冲区数据满足正文需要，取出需要的数据");
-        return true;
-    }
-    // 3.2 走到这说明缓冲区中数据还不包含所有正文，取出后等待下一次正文到来
-    _request._body.append(buf->ReadPos(), buf->ReadableBytes());
-    buf->MoveReadOffset(buf->ReadableBytes());
-    SPDLOG_TRACE("ReadAbleBytes = {}", buf->ReadableBytes());
     SPDLOG_DEBUG("缓冲区数据不满足正文需要，等待新数据到来");
     return true;
 }
+/* brief: 接收 chunked 编码的请求体: 十六进制长度行 + 数据 + \r\n，长度为 0 的块之后是可选的 trailer 和空行 */
+bool HttpContext::RecvChunkedBody(src::Buffer *buf) {
+    while(true) {
+        switch(_chunk_state) {
+            case CHUNK_SIZE: {
+                size_t lf = buf->Find('\n');
+                if(lf == src::Buffer::npos) {
+                    if(buf->ReadableBytes() > MAX_LINE) return SetError(400);
+                    return true; // 长度行还没收全
+                }
+                // 长度行很短，拷出来解析。忽略 ';' 之后的 chunk 扩展
+                _chunk_line.resize(lf + 1);
+                buf->ReadAndPop(&_chunk_line[0], lf + 1);
+                const char *begin = _chunk_line.data();
+                const char *end = src::FindByte2(begin, begin + _chunk_line.size(), ';', '\r');
+                if(end == begin + _chunk_line.size()) --end; // 只有 \n 结尾
+                auto res = std::from_chars(begin, end, _chunk_remain, 16);
+                if(res.ec != std::errc() || res.ptr != end || begin == end) {
+                    SPDLOG_WARN("chunk 长度格式错误");
+                    return SetError(400); // BAD REQUEST
+                }
+                if(!_body_callback && _chunk_remain > _max_body - _request._body.size()) {
+                    SPDLOG_WARN("chunked 请求体过大");
+                    return SetError(413); // PAYLOAD TOO LARGE
+                }
+                _chunk_state = _chunk_remain > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+                break;
+            }
+            case CHUNK_DATA: {
+                if(!RecvBodyData(buf, &_chunk_remain)) return true;
+                if(_chunk_remain > 0) return true; // 数据还没收全
+                _chunk_state = CHUNK_DATA_END;
+                break;
+            }
+            case CHUNK_DATA_END: {
+                // 数据之后必须紧跟 \r\n（兼容只有 \n）
+                if(buf->ReadableBytes() < 1) return true;
+                char c = buf->PeekByte(0);
+                if(c == '\r') {
+                    if(buf->ReadableBytes() < 2) return true;
+                    if(buf->PeekByte(1) != '\n') return SetError(400);
+                    buf->MoveReadOffset(2);
+                } else if(c == '\n') {
+                    buf->MoveReadOffset(1);
+                } else {
+                    SPDLOG_WARN("chunk 数据之后不是行尾");
+                    return SetError(400); // BAD REQUEST
+                }
+                _chunk_state = CHUNK_SIZE;
+                break;
+            }
+            case CHUNK_TRAILER: {
+                // trailer 字段直接丢弃，读到空行请求结束
+                size_t lf = buf->Find('\n');
+                if(lf == src::Buffer::npos) {
+                    if(buf->ReadableBytes() > MAX_LINE) return SetError(400);
+                    return true;
+                }
+                bool empty = (lf == 0) || (lf == 1 && buf->PeekByte(0) == '\r');
+                buf->MoveReadOffset(lf + 1);
+                if(empty) {
+                    SPDLOG_DEBUG("chunked 正文接收完毕");
+                    _recv_status = RECV_HTTP_OVER;
+                    return true;
+                }
+                break;
+            }
+        }
+    }
+}
+/* brief: 从缓冲区取出至多 *remain 字节正文，按块交给使用者或者追加到 _request._body。使用者要求暂停时返回 false */
+bool HttpContext::RecvBodyData(src::Buffer *buf, size_t *remain) {
+    while(*remain > 0 && buf->ReadableBytes() > 0) {
+        // 一次只取第一个块里连续的数据，不需要拼接
+        size_t n = std::min(*remain, buf->ContiguousReadableBytes());
+        const char *data = buf->ReadPos();
+        *remain -= n;
+        if(_body_callback) {
+            bool more = _body_callback(std::string_view(data, n));
+            buf->MoveReadOffset(n);
+            if(!more) return false;
+        } else {
+            _request._body.append(data, n);
+            buf->MoveReadOffset(n);
+        }
+    }
+    return true;
+}
 
-}
\ No newline at end of file
+}
@@ -7,6 +7,8 @@ namespace webserver::http
 {
 
 #define MAX_LINE 8192
+#define MAX_HEAD (64 * 1024)
+#define MAX_BODY (16 * 1024 * 1024)   // 默认的请求体上限，只限制放进 HttpRequest::_body 的正文，按片交出去的不限制
 
 typedef enum {
     RECV_HTTP_ERROR,
@@ -16,11 +18,31 @@ typedef enum {
     RECV_HTTP_OVER
 } HttpRecvStatus;
 
-/* brief: 记录Http请求的接收和处理进度，解决粘包问题 */
+/* brief: chunked 请求体的解析阶段 */
+typedef enum {
+    CHUNK_SIZE,         // 等待长度行
+    CHUNK_DATA,         // 接收块数据
+    CHUNK_DATA_END,     // 等待块数据后的 \r\n
+    CHUNK_TRAILER       // 最后一个块之后，等待 trailer 和空行
+} ChunkState;
+
+/* brief: 记录Http请求的接收和处理进度，解决粘包问题。
+          请求头没收全时记住已经扫描到的位置，新数据到来后只扫描新的部分；收全后整体拷贝进 HttpRequest，
+          请求行和请求头字段都只记录偏移，不再为每一行、每个字段分配字符串 */
 class HttpContext
 {
 public:
-    HttpContext() : _resp_status(200), _recv_status(RECV_HTTP_LINE) {}
+    /* brief: 正文的一段数据，返回 false 表示使用者处理不过来，解析暂停，剩下的数据留在缓冲区里 */
+    using BodyCallback = std::function<bool(std::string_view data)>;
+    /* brief: 请求头接收完毕后调用，返回非空的 BodyCallback 则正文按片交给它，不再放进 HttpRequest::_body */
+    using HeadCallback = std::function<BodyCallback(HttpRequest &request)>;
+
+    HttpContext() : _resp_status(200), _recv_status(RECV_HTTP_LINE), _scan_pos(0), _line_start(0), _fields_begin(0),
+                    _body_remain(0), _chunked(false), _chunk_state(CHUNK_SIZE), _chunk_remain(0), _max_body(MAX_BODY) {}
+    /* brief: 设置请求头接收完毕的回调，对连接上之后的所有请求生效 */
+    void SetHeadCallback(const HeadCallback &cb) { _head_callback = cb; }
+    /* brief: 设置放进 HttpRequest::_body 的正文上限，超出时响应 413，对连接上之后的所有请求生效 */
+    void SetMaxBodySize(size_t size) { _max_body = size; }
     /* brief: 重置Http解析上下文 */
     void Reset();
     /* brief: 获取响应状态 */
@@ -36,19 +58,36 @@ private:
     /* brief: 接收Http请求行 */
     bool RecvHttpLine(src::Buffer *buf);
     /* brief: 解析Http请求行 */
-    bool ParseHttpLine(std::string &line);
+    bool ParseHttpLine(std::string_view line);
     //========== Http 请求头 ============
     /* brief: 接收Http请求头 */
     bool RecvHttpHead(src::Buffer *buf);
-    /* brief: 解析Http请求头 */
-    bool ParseHttpHead(std::string &line);
+    /* brief: 解析Http请求头，[begin, end) 是请求头原文里的一行 */
+    bool ParseHttpHead(size_t begin, size_t end);
     //========== Http 请求体 ============
     /* brief: 接收Http请求体 */
     bool RecvHttpBody(src::Buffer *buf);
+    /* brief: 接收 chunked 编码的Http请求体 */
+    bool RecvChunkedBody(src::Buffer *buf);
+    /* brief: 取出至多 *remain 字节的正文数据，使用者要求暂停时返回 false */
+    bool RecvBodyData(src::Buffer *buf, size_t *remain);
+    /* brief: 进入错误状态，返回 false */
+    bool SetError(int status);
 private:
     int _resp_status;   // 响应状态码
     HttpRecvStatus _recv_status;    //当前接收及解析的阶段状态
     HttpRequest _request;           //已经解析得到的请求信息
+    size_t _scan_pos;               //输入缓冲区里已经扫描过的字节数（相对读位置）
+    size_t _line_start;             //输入缓冲区里当前行的起始位置（相对读位置）
+    size_t _fields_begin;           //请求头原文里第一个请求头字段的位置
+    size_t _body_remain;            //按 Content-Length 接收时还没收到的正文字节数
+    bool _chunked;                  //正文是否是 chunked 编码
+    ChunkState _chunk_state;        //chunked 正文的解析阶段
+    size_t _chunk_remain;           //当前块还没收到的字节数
+    size_t _max_body;               //放进 _request._body 的正文上限
+    std::string _chunk_line;        //长度行的临时存储，复用容量
+    HeadCallback _head_callback;    //请求头接收完毕的回调
+    BodyCallback _body_callback;    //当前请求的正文回调，为空则正文放进 _request._body
 };
 
 }
\ No newline at end of file
@@ -1,64 +1,116 @@
 #include "HttpRequest.h"
+#include <charconv>
+#include <strings.h>
+#include <unistd.h>
 
 namespace webserver::http
 {
 
+namespace {
+constexpr std::string_view kMethodNames[METHOD_COUNT] = {
+    "GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS", "CONNECT", "TRACE"
+};
+}
+
+HttpMethod ParseMethod(std::string_view method) {
+    for(uint8_t i = 0; i < METHOD_COUNT; ++i) {
+        if(kMethodNames[i] == method) return static_cast<HttpMethod>(i);
+    }
+    return METHOD_UNKNOWN;
+}
+
+std::string_view MethodName(HttpMethod method) {
+    return method < METHOD_COUNT ? kMethodNames[method] : std::string_view("UNKNOWN");
+}
+
+SpilledBody::~SpilledBody() {
+    if(fd >= 0) close(fd);
+}
+
 void HttpRequest::Reset() {
     _method.clear();
+    _method_id = METHOD_UNKNOWN;
     _path.clear();
     _version = "HTTP/1.1";
     _body.clear();
-    _headers.clear();
+    _head.clear();
+    _header_fields.clear();
     _params.clear();
+    _route_params.size = 0;
+    _route = -1;
+    _spilled_body.reset();
+}
+/* brief: 设置Http请求请求头，追加到 _head 末尾 */
+void HttpRequest::SetHeader(std::string_view key, std::string_view val) {
+    HeaderField field;
+    field.name_off = static_cast<uint32_t>(_head.size());
+    field.name_len = static_cast<uint32_t>(key.size());
+    _head.append(key);
+    field.value_off = static_cast<uint32_t>(_head.size());
+    field.value_len = static_cast<uint32_t>(val.size());
+    _head.append(val);
+    _header_fields.push_back(field);
 }
 /* brief: 判断是否存在指定头部字段 */
-bool HttpRequest::HasHeader(const std::string &key) const {
-    auto it = _headers.find(key);
-    if(it == _headers.end()) return false;
-    return true;
+bool HttpRequest::HasHeader(std::string_view key) const {
+    for(size_t i = 0; i < _header_fields.size(); ++i) {
+        std::string_view name = HeaderName(i);
+        if(name.size() == key.size() && strncasecmp(name.data(), key.data(), key.size()) == 0) return true;
+    }
+    return false;
 }
 /* brief: 获取指定头部字段 */
-std::string HttpRequest::GetHeader(const std::string &key) const {
-    auto it = _headers.find(key);
-    if(it == _headers.end()) return "";
-    return it->second;
+std::string HttpRequest::GetHeader(std::string_view key) const {
+    return std::string(GetHeaderView(key));
 }
-/* brief: 获取指定头部字段的视图（零拷贝） */
-std::string_view HttpRequest::GetHeaderView(const std::string &key) const {
-    auto it = _headers.find(key);
-    if(it == _headers.end()) return {}; //返回空的 view
-    return it->second; // 隐式转换为 string_view
+/* brief: 获取指定头部字段的视图（零拷贝），请求头数量很少，线性查找比哈希表更快，也不需要为每个字段申请节点 */
+std::string_view HttpRequest::GetHeaderView(std::string_view key) const {
+    for(size_t i = 0; i < _header_fields.size(); ++i) {
+        std::string_view name = HeaderName(i);
+        if(name.size() == key.size() && strncasecmp(name.data(), key.data(), key.size()) == 0) return HeaderValue(i);
+    }
+    return {}; //返回空的 view
 }
-/* brief: 判断是否存在指定查询字符串 */
+/* brief: 判断是否存在指定查询字符串或路径参数 */
 bool HttpRequest::HasParam(const std::string &key) const {
     auto it = _params.find(key);
-    if(it == _params.end()) return false;
-    return true;
+    if(it != _params.end()) return true;
+    for(uint8_t i = 0; i < _route_params.size; ++i) {
+        if(_route_params.items[i].name == key) return true;
+    }
+    return false;
 }
-/* brief: 获取指定查询字符串 */
+/* brief: 获取指定查询字符串，查询字符串优先 */
 std::string HttpRequest::GetParam(const std::string &key) const {
     auto it = _params.find(key);
-    if(it == _params.end()) return "";
-    return it->second;
+    if(it != _params.end()) return it->second;
+    return std::string(GetPathParam(key));
+}
+/* brief: 获取路径参数 */
+std::string_view HttpRequest::GetPathParam(std::string_view key) const {
+    for(uint8_t i = 0; i < _route_params.size; ++i) {
+        const RouteParams::Param &param = _route_params.items[i];
+        if(param.name == key) return std::string_view(_path.data() + param.value_off, param.value_len);
+    }
+    return {};
 }
 /* brief: 获取请求体大小 */
 size_t HttpRequest::GetContentLength() const {
-    bool ret = HasHeader("Content-Length");
-    if(ret == false) {
-        return 0;
-    }
-    std::string contlen = GetHeader("Content-Length");
-    return std::stol(contlen);
+    std::string_view contlen = GetHeaderView("Content-Length");
+    size_t len = 0;
+    // 格式错误的长度由解析器拒绝（400），这里只按 0 处理
+    std::from_chars(contlen.data(), contlen.data() + contlen.size(), len);
+    return len;
 }
 /* brief: 判断是否是短连接 */
 bool HttpRequest::IsClose() const {
     if(_version == "HTTP/1.0") {
-        if(HasHeader("Connection") == true && GetHeader("Connection") == "keep-alive") {
+        if(HasHeader("Connection") == true && GetHeaderView("Connection") == "keep-alive") {
             return false;
         }
         return true;
     } else {
-        if(HasHeader("Connection") == false || GetHeader("Connection") == "keep-alive") {
+        if(HasHeader("Connection") == false || GetHeaderView("Connection") == "keep-alive") {
             return false;
         }
         return true;
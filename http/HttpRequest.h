@@ -1,45 +1,114 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <string_view>
 #include <regex>
+#include <memory>
 #include <spdlog/spdlog.h>
 
 namespace webserver::http
 {
 
+/* brief: 一个请求头字段在 HttpRequest::_head 里的位置，存偏移而不是指针，请求被拷贝/移动后依然有效 */
+struct HeaderField {
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t value_off;
+    uint32_t value_len;
+};
+
+/* brief: 请求方法，路由按它下标查找处理函数 */
+enum HttpMethod : uint8_t {
+    METHOD_GET = 0,
+    METHOD_HEAD,
+    METHOD_POST,
+    METHOD_PUT,
+    METHOD_DELETE,
+    METHOD_PATCH,
+    METHOD_OPTIONS,
+    METHOD_CONNECT,
+    METHOD_TRACE,
+    METHOD_COUNT,
+    METHOD_UNKNOWN = METHOD_COUNT,
+};
+/* brief: 方法名（大写）转换为枚举，不认识的返回 METHOD_UNKNOWN */
+HttpMethod ParseMethod(std::string_view method);
+/* brief: 枚举转换为方法名 */
+std::string_view MethodName(HttpMethod method);
+
+static constexpr size_t kMaxRouteParams = 8;   // 一条路由最多捕获的 :param / *catchall 个数
+
+/* brief: 路由捕获的路径参数。参数名指向路由表（和服务器同生命周期），参数值存 _path 里的偏移，请求被拷贝/移动后依然有效 */
+struct RouteParams {
+    struct Param {
+        std::string_view name;
+        uint32_t value_off;
+        uint32_t value_len;
+    };
+    Param items[kMaxRouteParams];
+    uint8_t size = 0;
+};
+
+/* brief: 写进临时文件的请求体。文件创建后立即 unlink，最后一个引用释放时关闭，进程退出也不会留下文件 */
+struct SpilledBody {
+    SpilledBody() = default;
+    ~SpilledBody();
+    SpilledBody(const SpilledBody&) = delete;
+    SpilledBody &operator=(const SpilledBody&) = delete;
+
+    int fd = -1;        // 临时文件，可以用 pread 从偏移 0 读取正文
+    size_t size = 0;    // 已经写入的正文长度
+    bool failed = false;    // 写入临时文件失败
+};
+
 class HttpRequest
 {
 public:
     HttpRequest() : _version("HTTP/1.1") {}
-    /* brief: 重置Http请求，防止上下文残留 */
+    /* brief: 重置Http请求，防止上下文残留。字符串和数组只清空不释放，同一个连接上的下一个请求复用它们的容量 */
     void Reset();
     /* brief: 设置Http请求请求头 */
-    void SetHeader(const std::string &key, const std::string &val) { _headers.insert(std::make_pair(key, val)); }
-    /* brief: 判断是否存在指定头部字段 */
-    bool HasHeader(const std::string &key) const;
+    void SetHeader(std::string_view key, std::string_view val);
+    /* brief: 记录一个位于 _head 里的请求头字段，由解析器调用 */
+    void AddHeaderField(const HeaderField &field) { _header_fields.push_back(field); }
+    /* brief: 判断是否存在指定头部字段（字段名不区分大小写） */
+    bool HasHeader(std::string_view key) const;
     /* brief: 获取指定头部字段 */
-    std::string GetHeader(const std::string &key) const;
+    std::string GetHeader(std::string_view key) const;
     /* brief: 获取指定头部字段的视图(零拷贝) */
-    std::string_view GetHeaderView(const std::string &key) const;
+    std::string_view GetHeaderView(std::string_view key) const;
+    /* brief: 按顺序遍历所有请求头 */
+    size_t HeaderCount() const { return _header_fields.size(); }
+    std::string_view HeaderName(size_t i) const { return View(_header_fields[i].name_off, _header_fields[i].name_len); }
+    std::string_view HeaderValue(size_t i) const { return View(_header_fields[i].value_off, _header_fields[i].value_len); }
     /* brief: 插入查询字符串 */
     void SetParam(const std::string &key, const std::string &val) { _params.insert(std::make_pair(key, val)); }
-    /* brief: 判断是否存在指定查询字符串 */
+    /* brief: 判断是否存在指定查询字符串或路径参数 */
     bool HasParam(const std::string &key) const;
-    /* brief: 获取指定查询字符串 */
+    /* brief: 获取指定查询字符串，没有则取同名的路径参数 */
     std::string GetParam(const std::string &key) const;
+    /* brief: 获取路由捕获的路径参数（零拷贝），没有返回空 */
+    std::string_view GetPathParam(std::string_view key) const;
     /* brief: 获取请求体大小 */
     size_t GetContentLength() const;
     /* brief: 判断是否是短连接 */
     bool IsClose() const;
+private:
+    std::string_view View(uint32_t off, uint32_t len) const { return std::string_view(_head.data() + off, len); }
 public:
     std::string _method;    // Http请求方法
+    HttpMethod _method_id = METHOD_UNKNOWN;  // 请求方法的枚举，解析请求行时设置
     std::string _path;      // Http请求路径
     std::string _version;   // Http协议版本
     std::string _body;      // Http请求正文
-    std::unordered_map<std::string, std::string> _headers; // Http请求头
+    std::string _head;      // 请求行和请求头的原文，从输入缓冲区整体拷贝一次，请求头字段都指向这里
+    std::vector<HeaderField> _header_fields; // Http请求头
     std::unordered_map<std::string, std::string> _params;  // Http查询字符串
+    RouteParams _route_params;  // 路由捕获的路径参数
+    int32_t _route = -1;        // 匹配到的路由下标，没有匹配为 -1
+    std::shared_ptr<SpilledBody> _spilled_body;     // 路由要求正文写进临时文件时的正文，此时 _body 为空
 };
 
 }
\ No newline at end of file
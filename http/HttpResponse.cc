@@ -1,4 +1,8 @@
 #include "HttpResponse.h"
+#include "FileCache.h"
+#include "../util/Util.h"
+#include <charconv>
+#include <strings.h>
 
 namespace webserver::http
 {
@@ -9,6 +13,10 @@ void HttpResponse::Reset() {
     _body.clear();
     _redirect_url.clear();
     _headers.clear();
+    _file.reset();
+    _shared_body.reset();
+    _body_desc = BodyDesc();
+    _writer.reset();
 }
 /* brief: 判断是否存在对应响应头 */
 bool HttpResponse::HasHeader(const std::string &key) const {
@@ -27,6 +35,74 @@ void HttpResponse::SetContent(const std::string &body, const std::string &type)
     _body = body;
     SetHeader("Content-Type", type);
 }
+/* brief: 正文是文件区间 */
+void HttpResponse::SetFileBody(int fd, off_t offset, size_t size) {
+    _body_desc.type = BODY_FILE;
+    _body_desc.fd = fd;
+    _body_desc.offset = offset;
+    _body_desc.size = size;
+}
+/* brief: 正文是共享字符串 */
+void HttpResponse::SetSharedBody(std::shared_ptr<const std::string> body) {
+    _body_desc.type = BODY_SHARED;
+    _shared_body = std::move(body);
+}
+/* brief: 正文长度 */
+size_t HttpResponse::BodySize() const {
+    switch(_body_desc.type) {
+        case BODY_SHARED: return _shared_body ? _shared_body->size() : 0;
+        case BODY_FILE: return _body_desc.size;
+        default: return _body.size();
+    }
+}
+/* brief: 序列化状态行和响应头 */
+void HttpResponse::SerializeHeader(std::string_view version, bool close, std::string_view date, std::string &out) const {
+    char num[24];
+    auto append_num = [&](uint64_t n) {
+        auto res = std::to_chars(num, num + sizeof(num), n);
+        out.append(num, res.ptr - num);
+    };
+    // 状态行: HTTP/1.1 200 OK
+    out += version;
+    out += ' ';
+    append_num(static_cast<uint64_t>(_status));
+    out += ' ';
+    out += util::Util::StatusDesc(_status);
+    out += "\r\n";
+
+    bool has_length = false, has_type = false;
+    for(auto &kv : _headers) {
+        if(strcasecmp(kv.first.c_str(), "Content-Length") == 0) has_length = true;
+        else if(strcasecmp(kv.first.c_str(), "Content-Type") == 0) has_type = true;
+        else if(strcasecmp(kv.first.c_str(), "Connection") == 0) continue; // 由 close 决定
+        out += kv.first;
+        out += ": ";
+        out += kv.second;
+        out += "\r\n";
+    }
+    if(_file) out += _file->headers; // 静态资源缓存里拼好的头部片段
+
+    size_t body_size = BodySize();
+    // 1xx / 204 / 304 不能带正文；其它响应即使正文为空也要给出长度，否则长连接上客户端无法判断响应结束
+    if(!has_length && _status >= 200 && _status != 204 && _status != 304) {
+        out += "Content-Length: ";
+        append_num(body_size);
+        out += "\r\n";
+    }
+    if(!has_type && !_file && body_size > 0) out += "Content-Type: application/octet-stream\r\n";
+    if(_redirect_flag) {
+        out += "Location: ";
+        out += _redirect_url;
+        out += "\r\n";
+    }
+    out += close ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+    if(!date.empty()) {
+        out += "Date: ";
+        out += date;
+        out += "\r\n";
+    }
+    out += "\r\n";
+}
 /* brief: 设置重定向 */
 void HttpResponse::SetRedirect(const std::string &url, int status) {
     _status = status;
@@ -1,12 +1,33 @@
 #pragma once
 
 #include <string>
+#include <memory>
+#include <string_view>
+#include <sys/types.h>
 #include <unordered_map>
 #include <spdlog/spdlog.h>
 
 namespace webserver::http
 {
 
+struct CachedFile;
+class ResponseWriter;
+
+/* brief: 响应正文的来源 */
+enum BodyType {
+    BODY_STRING = 0,    // _body
+    BODY_SHARED,        // _shared_body，借给输出队列发送，不拷贝
+    BODY_FILE,          // 文件区间，用 sendfile 发送。_file 非空时 fd 由它持有，否则 fd 的所有权随发送交给连接
+};
+
+/* brief: 正文描述，代替原来用 X-SENDFILE-* 响应头在函数之间传递 fd / 偏移 / 长度 */
+struct BodyDesc {
+    BodyType type = BODY_STRING;
+    int fd = -1;        // BODY_FILE 的文件
+    off_t offset = 0;   // BODY_FILE 的起始偏移
+    size_t size = 0;    // BODY_FILE 的长度
+};
+
 class HttpResponse
 {
 public:
@@ -23,6 +44,15 @@ public:
     std::string GetHeader(const std::string &key) const;
     /* brief: 设置响应体 */
     void SetContent(const std::string &body, const std::string &type = "text/html");
+    /* brief: 正文是文件 fd 的 [offset, offset + size) 区间 */
+    void SetFileBody(int fd, off_t offset, size_t size);
+    /* brief: 正文是共享的只读字符串 */
+    void SetSharedBody(std::shared_ptr<const std::string> body);
+    /* brief: 正文长度 */
+    size_t BodySize() const;
+    /* brief: 把状态行和响应头追加到 out，以空行结束。Content-Length / Connection / Date 等由这里补上，
+              不修改 _headers，数字用 to_chars 格式化，out 容量足够时不申请内存 */
+    void SerializeHeader(std::string_view version, bool close, std::string_view date, std::string &out) const;
     /* brief: 设置重定向 */
     void SetRedirect(const std::string &url, int status = 302);
     /* brief: 判断是否是短连接 */
@@ -33,6 +63,11 @@ public:
     std::string _body;
     std::string _redirect_url; //重定向url
     std::unordered_map<std::string, std::string> _headers; //响应头
+    std::shared_ptr<const CachedFile> _file; //静态资源响应的缓存文件，它的响应头片段直接拼进头部，fd 借给 SendFile
+    std::shared_ptr<const std::string> _shared_body; //共享的只读正文（例如压缩缓存里的数据），借给输出队列发送，不拷贝
+    BodyDesc _body_desc; //正文从哪里来，默认是 _body
+    std::shared_ptr<ResponseWriter> _writer; //流式响应的写入器，非空时响应由它发送，不再走 WriteResponse
+    bool _deferred = false; //协程处理函数挂起了，请求已经交给协程，响应在协程结束后发送
 };
 
 }
\ No newline at end of file
@@ -1,25 +1,30 @@
 #include "HttpServer.h"
+#include <optional>
+#include <cstring>
+#include <netinet/in.h>
 #include <spdlog/spdlog.h>
 
 namespace webserver::server
 {
 /* brief: 创建服务器，并将消息处理函数绑定到server里 */
-HttpServer::HttpServer(uint16_t port, int timeout) : _server(port) {
+HttpServer::HttpServer(uint16_t port, int timeout, src::PollerBackend backend) : _server(port, backend) {
     _server.EnableInactiveRelease(timeout);
-    _server.SetConnectedCallback(std::bind(&HttpServer::OnConnected, this, std::placeholders::_1)); // 将OnConnection的this绑定后，剩下的Connection参数交给服务器去绑定
-    _server.SetMessageCallback(std::bind(&HttpServer::OnMessage, this, std::placeholders::_1, std::placeholders::_2));
-
-    //初始化常用方法的根节点
-    _roots["GET"] = std::make_shared<TrieNode>();
-    _roots["POST"] = std::make_shared<TrieNode>();
-    _roots["PUT"] = std::make_shared<TrieNode>();
-    _roots["DELETE"] = std::make_shared<TrieNode>();
+    // 回调只捕获 this，每个连接拷贝一份时不需要额外申请内存
+    _server.SetConnectedCallback([this](const std::shared_ptr<src::Connection> &conn) { OnConnected(conn); });
+    _server.SetMessageCallback([this](const std::shared_ptr<src::Connection> &conn, src::Buffer *buf) { OnMessage(conn, buf); });
+    // 输出积压到高水位时停止读取，OnMessage 也不再解析缓冲区里剩下的请求；降到低水位后恢复，留在缓冲区里的请求重新交给 OnMessage
+    _server.SetWaterMarks(kOutputHighWaterMark, kOutputLowWaterMark);
+    _server.SetHighWaterMarkCallback([](const std::shared_ptr<src::Connection> &conn) { conn->PauseRead(src::PAUSE_BY_OUTPUT); });
+    _server.SetLowWaterMarkCallback([](const std::shared_ptr<src::Connection> &conn) { conn->ResumeRead(src::PAUSE_BY_OUTPUT); });
 }
 /* brief: 提供给使用者注册基准路径 */
 void HttpServer::SetBaseDir(const std::string &path) {
     bool ret = util::Util::IsDirectory(path);
     assert(ret == true);
     _basedir = path;
+    _file_cache = std::make_unique<http::FileCache>(_basedir);
+    _file_cache->Watch(_server.GetBaseLoop());
+    _compress_cache = std::make_unique<http::CompressCache>();
 }
 // ============= Private ============
 /* brief: 错误处理函数 */
@@ -54,76 +59,76 @@ void HttpServer::ErrorHandler(const http::HttpRequest &request, http::HttpRespon
     response->SetContent(buf, "text/html");
 }
 /* brief: 对应连接写入响应的函数 */
-void HttpServer::WriteResponse(const std::shared_ptr<src::Connection> &connection, const http::HttpRequest &request, http::HttpResponse &response) {
-    // 1.先完善头部字段
-    if(request.IsClose() == true) response.SetHeader("Connection", "close");
-    else response.SetHeader("Connection", "keep-alive");
-
-    if(response._body.empty() == false && response.HasHeader("Content-Length") == false) {
-        response.SetHeader("Content-Length", std::to_string(response._body.size()));
+void HttpServer::WriteResponse(const std::shared_ptr<src::Connection> &connection, const http::HttpRequest &request, http::HttpResponse &response,
+                               uint64_t start_ns) {
+    // 1.状态行和头部直接写进输出队列队尾的字符串，Content-Length / Connection / Date 在序列化时补上
+    bool close = request.IsClose() || response.GetHeader("Connection") == "close";
+    connection->AppendInLoop([&](std::string &out) {
+        response.SerializeHeader(request._version, close, connection->GetLoop()->HttpDate(), out);
+    });
+    // 2.发送Body。输出队列按入队顺序发送，和头部一起由一次 writev 发出。
+    //   HEAD 只发送响应头（Content-Length 和 GET 一致），否则长连接上的客户端会把正文当成下一个响应的开头
+    uint64_t bytes = 0;
+    if(request._method_id == http::METHOD_HEAD) {
+        // 不属于文件缓存的 fd 本来要交给连接发送完后关闭，这里直接关闭
+        if(response._body_desc.type == http::BODY_FILE && !response._file) ::close(response._body_desc.fd);
+    } else switch(response._body_desc.type) {
+        case http::BODY_FILE:
+            //静态资源，sendfile 零拷贝。fd 属于文件缓存时由 _file 保证发送期间不被关闭
+            SPDLOG_TRACE("请求静态资源, 用SendFile实现零拷贝");
+            bytes = response._body_desc.size;
+            if(response._file) connection->SendFile(response._body_desc.fd, response._body_desc.offset, response._body_desc.size, response._file);
+            else connection->SendFile(response._body_desc.fd, response._body_desc.offset, response._body_desc.size);
+            break;
+        case http::BODY_SHARED:
+            SPDLOG_TRACE("共享正文, 借给输出队列发送");
+            if(response._shared_body) bytes = response._shared_body->size();
+            if(response._shared_body) connection->SendBorrowed(response._shared_body->data(), response._shared_body->size(), response._shared_body);
+            break;
+        default:
+            bytes = response._body.size();
+            if(!response._body.empty()) connection->Send(std::move(response._body));
+            break;
     }
-    if(response._body.empty() == false && response.HasHeader("Content-Type") == false) {
-        response.SetHeader("Content-Type", "application/octet-stream");
+    // 3.访问日志：IO 线程上只填一条定长记录放进队列
+    if(_access_log) {
+        http::AccessRecord record;
+        FillAccessRecord(connection.get(), request, &record);
+        record.status = static_cast<uint16_t>(response._status);
+        record.bytes = bytes;
+        record.time_ns = src::Metrics::NowNs();
+        if(start_ns != 0) record.latency_us = static_cast<uint32_t>((record.time_ns - start_ns) / 1000);
+        _access_log->Append(record);
     }
-    if(response._redirect_flag == true) {
-        response.SetHeader("Location", response._redirect_url);
+}
+/* brief: 填好访问记录里和响应无关的部分 */
+void HttpServer::FillAccessRecord(src::Connection *connection, const http::HttpRequest &request, http::AccessRecord *record) {
+    const struct sockaddr_storage &peer = connection->PeerAddress();
+    if(peer.ss_family == AF_INET) {
+        memcpy(record->addr, &reinterpret_cast<const struct sockaddr_in&>(peer).sin_addr, 4);
+        record->family = AF_INET;
+    } else if(peer.ss_family == AF_INET6) {
+        memcpy(record->addr, &reinterpret_cast<const struct sockaddr_in6&>(peer).sin6_addr, 16);
+        record->family = AF_INET6;
     }
-    // 2.将response里的要素，按照http格式进行组织, 先组织 Header
-    /* std::stringstream rsp_str;
-    rsp_str << request._version << " " << std::to_string(response._status) << " " << util::Util::StatusDesc(response._status) << "\r\n";
-    for(auto &head : response._headers) {
-        rsp_str << head.first << ": " << head.second << "\r\n";
-    }
-    rsp_str << "\r\n";
-    rsp_str << response._body;*/
-    std::string header;
-    header.reserve(256);
-
-    header += request._version;
-    header += " ";
-    header += std::to_string(response._status);
-    header += " ";
-    header += util::Util::StatusDesc(response._status);
-    header += "\r\n";
-
-    for(auto &kv : response._headers) {
-        if(kv.first.rfind("X-SENDFILE", 0) == 0) continue;
-        header += kv.first + ": " + kv.second + "\r\n";
-    }
-
-    header += "\r\n";
-    SPDLOG_TRACE("HttpResponse 的 Headers:");
-    SPDLOG_TRACE("{}", header);
-
-    // 2.发送Header
-    SPDLOG_TRACE("调用Send, 发送响应头");
-    connection->Send(header.c_str(), header.size());
-    // 3 发送Body
-    if(response.HasHeader("X-SENDFILE-FD")) {
-        //静态资源，调用 SendFile
-        //因为 Connection 保证先发Buffer后发File，所以顺序是安全的
-        SPDLOG_TRACE("请求静态资源, 用SendFile实现零拷贝");
-        int fd = std::stoi(response.GetHeader("X-SENDFILE-FD"));
-        size_t size = std::stoul(response.GetHeader("X-SENDFILE-SIZE"));
-
-        //获取 Offset, 默认为 0;
-        off_t offset = 0;
-        if(response.HasHeader("X-SENDFILE-OFFSET")) {
-            offset = std::stoll(response.GetHeader("X-SENDFILE-OFFSET"));
-        }
-        connection->SendFile(fd, offset, size);
-    } else if(!response._body.empty()) {
-        SPDLOG_TRACE("请求普通资源, 调用Send发送body");
-        connection->Send(response._body.c_str(), response._body.size());
+    record->method = request._method_id;
+    record->version = request._version == "HTTP/1.0" ? 10 : 11;
+    record->route = request._route;
+    size_t len = request._path.size();
+    if(len > http::kAccessPathMax) {
+        len = http::kAccessPathMax;
+        record->truncated = 1;
     }
+    memcpy(record->path, request._path.data(), len);
+    record->path_len = static_cast<uint8_t>(len);
 }
 /* brief: 判断是不是静态资源请求 */
-bool HttpServer::IsFileHandler(const http::HttpRequest &request) {
+bool HttpServer::IsFileHandler(const http::HttpRequest &request, std::shared_ptr<const http::CachedFile> *file) {
     SPDLOG_DEBUG("进入静态资源判断函数");
     // 1. 必须设置了静态资源根目录
     if(_basedir.empty()) return false;
     // 2. 请求方法必须是GET/HEAD
-    if(request._method != "GET" && request._method != "HEAD") {
+    if(request._method_id != http::METHOD_GET && request._method_id != http::METHOD_HEAD) {
         SPDLOG_DEBUG("请求方法不符合静态资源");
         return false;
     }
@@ -132,57 +137,23 @@ bool HttpServer::IsFileHandler(const http::HttpRequest &request) {
         SPDLOG_WARN("资源路径不合法");
         return false;
     }
-    // 4. 请求的资源必须存在，且是普通文件
-    std::string request_path = _basedir + request._path; // 为了避免直接修改请求的资源路径
-    if(request_path.back() == '/') request_path += "index.html";
-    if(util::Util::IsRegular(request_path) == false) {
-        SPDLOG_DEBUG("资源不是普通文件: {}", request_path);
+    // 4. 请求的资源必须存在，且是普通文件。命中缓存时不需要任何文件系统调用
+    *file = _file_cache->Open(request._path);
+    if(*file == nullptr) {
+        SPDLOG_DEBUG("资源不是普通文件: {}", request._path);
         return false;
     }
     SPDLOG_DEBUG("请求的资源是静态资源，退出静态资源判断函数");
     return true;
 }
 /* brief: 静态资源处理函数 */
-void HttpServer::FileHandler(const http::HttpRequest &request, http::HttpResponse *response) {
+void HttpServer::FileHandler(const http::HttpRequest &request, const std::shared_ptr<const http::CachedFile> &file, http::HttpResponse *response) {
     SPDLOG_DEBUG("进入FileHandler函数");
-    std::string request_path = _basedir + request._path; // 为了不破坏原始请求
-    if(request_path.back() == '/') request_path += "index.html";
-    SPDLOG_TRACE("request_path: {}", request_path);
-    /* bool ret = util::Util::ReadFile(request_path, &response->_body); */
-    //step1: 打开文件
-    int fd = open(request_path.c_str(), O_RDONLY);
-    if(fd < 0) {
-        SPDLOG_ERROR("打开文件失败");
-        response->_status = 404;
-        ErrorHandler(request, response);
-        return;
-    }
-    //step2: 获取文件状态
-    struct stat st;
-    if(fstat(fd, &st) < 0) {
-        SPDLOG_ERROR("获取文件状态失败");
-        close(fd);
-        response->_status = 404;
-        ErrorHandler(request, response);
-        return;
-    }
-    size_t file_size = st.st_size;
-    std::string mime = util::Util::ExtMime(request_path);
-
-    //step3: 设置通用头部
-    response->SetHeader("Content-Type", mime);
-    response->SetHeader("Accept-Ranges", "bytes"); // 告诉浏览器支持断点续传/视频拖动
-
-    //step3.1: 设置特殊头部
-    response->SetHeader("Access-Control-Allow-Origin", "*");
-    response->SetHeader("Access-Control-Allow-Methods", "GET, HEAD, OPTIONS");
-
-    //ts 切片：强制缓存1年
-    if(mime == "video/mp2t") { response->SetHeader("Cache-Control", "public, max-age=31536000, immutable"); }
-    else if(mime == "application/vnd.apple.mpegurl") { response->SetHeader("Cache-Control", "no-cache"); } // m3u8索引，不缓存或者短缓存(防止更新了切片还在用旧索引)
-    else { response->SetHeader("Cache-Control", "publicm max-age=3600"); } //其它静态资源默认缓存策略
+    size_t file_size = file->size;
+    //step1: Content-Type / Cache-Control 等通用头部已经在缓存里拼好，WriteResponse 直接拼进头部
+    response->_file = file;
 
-    //step4: 检查 Range 头部
+    //step2: 检查 Range 头部
     if(request.HasHeader("Range")) {
         SPDLOG_DEBUG("该请求是Range请求");
         std::string_view range_val = request.GetHeaderView("Range");
@@ -197,115 +168,184 @@ void HttpServer::FileHandler(const http::HttpRequest &request, http::HttpRespons
             SPDLOG_WARN("该Range请求不合法: Range: {}", range_val);
             response->_status = 416; //Range Not Satisfiable
             response->SetHeader("Content-Range", "bytes */" + std::to_string(file_size));
-            close(fd);
+            response->SetHeader("Content-Length", "0");
             return;
         }
         SPDLOG_DEBUG("合法Range请求");
         size_t content_len = end - start + 1;
 
         response->_status = 206; // Partial Content
-        response->SetHeader("Content-Length", std::to_string(content_len));
         std::string content_range = "bytes " + std::to_string(start) + "-" + std::to_string(end) + "/" + std::to_string(file_size);
         response->SetHeader("Content-Range", content_range);
         SPDLOG_TRACE("构造Range响应: Content-Range: {}", content_range);
-        //通过自定义头部传给WriteResponse
-        response->_headers["X-SENDFILE-FD"] = std::to_string(fd);
-        response->_headers["X-SENDFILE-SIZE"] = std::to_string(content_len);
-        response->_headers["X-SENDFILE-OFFSET"] = std::to_string(start); // 传递偏移量
+        //fd 由 response->_file 持有，Content-Length 由正文长度得出
+        response->SetFileBody(file->fd, start, content_len);
+    } else if(file->compressible && EncodedFileHandler(request, file, response)) {
+        SPDLOG_DEBUG("发送静态资源的压缩版本");
+        return;
     } else {
         SPDLOG_DEBUG("该请求是非Range请求");
         response->_status = 200;
-        response->SetHeader("Content-Length", std::to_string(file_size));
-
-        response->_headers["X-SENDFILE-FD"] = std::to_string(fd);
-        response->_headers["X-SENDFILE-SIZE"] = std::to_string(st.st_size);
-        response->_headers["X-SENDFILE-OFFSET"] = "0"; // 默认偏移量0
+        response->SetFileBody(file->fd, 0, file_size);
     }
-    
-    // 判断 MIME 是否以 image/ 开头，如果是，就开启缓存
-    /* if(mime.rfind("image/", 0) == 0) response->SetHeader("Cache-Control", "max-age=31536000, public"); */
     response->_body.clear();
     SPDLOG_DEBUG("退出FileHandler函数");
 }
-/* brief: 添加路由到 Trie */
-void HttpServer::AddRoute(const std::string &method, const std::string &pattern, const Handler &handler) {
-    if(_roots.find(method) == _roots.end()) {
-        _roots[method] = std::make_shared<TrieNode>();
-    }
-    auto node = _roots[method];
-
-    std::vector<std::string> parts = util::Util::SplitPath(pattern);
-    for(const auto &part : parts) {
-        if(!part.empty() && part[0] == ':') {
-            // 处理动态参数，例如 :id
-            if(!node->_param_child) {
-                node->_param_child = std::make_shared<TrieNode>();
-                node->_param_name = part.substr(1); // 存储"id";
-            }
-            // 简单实现: 如果有冲突的参数名，这里会覆盖，业务层应该避免
-            node->_param_name = part.substr(1);
-            node = node->_param_child;
-        } else {
-            // 处理静态路径
-            if(node->_children.find(part) == node->_children.end()) {
-                node->_children[part] = std::make_shared<TrieNode>();
-            }
-            node = node->_children[part];
+/* brief: 按 Accept-Encoding 发送静态资源的压缩版本 */
+bool HttpServer::EncodedFileHandler(const http::HttpRequest &request, const std::shared_ptr<const http::CachedFile> &file, http::HttpResponse *response) {
+    // Range 只对原文件生效（上面已经处理），这里只处理完整响应
+    if(request.HasHeader("Accept-Encoding") == false) return false;
+    std::string_view accept = request.GetHeaderView("Accept-Encoding");
+    int br_q = util::Util::CodingQuality(accept, "br");
+    int gzip_q = util::Util::CodingQuality(accept, "gzip");
+    // q 值高的优先，相同时 br 优先（压缩率更高）
+    http::Encoding order[2] = {http::ENCODING_BR, http::ENCODING_GZIP};
+    if(gzip_q > br_q) std::swap(order[0], order[1]);
+    for(http::Encoding encoding : order) {
+        if((encoding == http::ENCODING_BR ? br_q : gzip_q) <= 0) continue;
+        const auto &sidecar = (encoding == http::ENCODING_BR) ? file->br : file->gzip;
+        response->_status = 200;
+        response->SetHeader("Content-Encoding", http::EncodingName(encoding));
+        if(sidecar) {
+            // 预压缩文件和原文件一样用 sendfile 发送，它由 file 持有
+            response->SetFileBody(sidecar->fd, 0, sidecar->size);
+            return true;
+        }
+        // 没有预压缩文件：查压缩缓存，未命中时在后台压缩，这次先尝试下一个编码或者发送原文件
+        auto data = _compress_cache->Get(file, encoding);
+        if(data) {
+            response->SetSharedBody(std::move(data));
+            return true;
         }
+        response->_headers.erase("Content-Encoding");
     }
-    node->_is_end = true;
+    return false;
+}
+/* brief: 添加路由到路由表 */
+void HttpServer::AddRoute(const std::string &method, const std::string &pattern, const Handler &handler) {
+    auto node = InsertRoute(method, pattern);
+    if(node == nullptr) return;
     node->_handler = handler;
     SPDLOG_DEBUG("注册路由: [{}] {}", method, pattern);
 }
-/* brief: 在 Trie 中匹配路由 */
-bool HttpServer::MatchRoute(const std::string &method, const std::string &path, Handler &handler, std::unordered_map<std::string, std::string> &params) {
-    if(_roots.find(method) == _roots.end()) return false;
-    auto node = _roots[method];
-
-    std::vector<std::string> parts = util::Util::SplitPath(path);
-
-    for(const auto &part : parts) {
-        // 优先匹配静态路径
-        if(node->_children.count(part)) {
-            node = node->_children[part];
-        }
-        // 匹配动态参数
-        else if(node->_param_child) {
-            //捕获参数
-            params[node->_param_name] = part;
-            node = node->_param_child;
-        }
-        // 匹配失败
-        else {
-            return false;
-        }
+/* brief: 添加流式请求体路由 */
+void HttpServer::AddStreamRoute(const std::string &method, const std::string &pattern, const BodyHandler &body, const Handler &handler) {
+    auto node = InsertRoute(method, pattern);
+    if(node == nullptr) return;
+    node->_handler = handler;
+    node->_body_handler = body;
+    SPDLOG_DEBUG("注册流式请求体路由: [{}] {}", method, pattern);
+}
+/* brief: 添加请求体写临时文件的路由 */
+void HttpServer::AddSpillRoute(const std::string &method, const std::string &pattern, const Handler &handler) {
+    auto node = InsertRoute(method, pattern);
+    if(node == nullptr) return;
+    node->_handler = handler;
+    node->_spill_body = true;
+    SPDLOG_DEBUG("注册临时文件请求体路由: [{}] {}", method, pattern);
+}
+/* brief: 添加流式响应路由 */
+void HttpServer::AddWriterRoute(const std::string &method, const std::string &pattern, const WriterHandler &handler) {
+    auto node = InsertRoute(method, pattern);
+    if(node == nullptr) return;
+    node->_writer_handler = handler;
+    SPDLOG_DEBUG("注册流式响应路由: [{}] {}", method, pattern);
+}
+/* brief: 添加协程路由 */
+void HttpServer::AddCoRoute(const std::string &method, const std::string &pattern, const CoHandler &handler) {
+    auto node = InsertRoute(method, pattern);
+    if(node == nullptr) return;
+    node->_co_handler = handler;
+    SPDLOG_DEBUG("注册协程路由: [{}] {}", method, pattern);
+}
+/* brief: 开启访问日志 */
+void HttpServer::EnableAccessLog(const std::string &path, http::AccessLogFormat format) {
+    _access_log = std::make_unique<http::AccessLog>(path, format);
+}
+/* brief: 注册指标页面 */
+void HttpServer::EnableMetrics(const std::string &path) {
+    Get(path, [this](const http::HttpRequest &request, http::HttpResponse *response) { MetricsHandler(request, response); });
+}
+/* brief: 向路由表插入路由 */
+RouteEntry *HttpServer::InsertRoute(const std::string &method, const std::string &pattern) {
+    int32_t id = _router.Insert(http::ParseMethod(method), pattern, static_cast<int32_t>(_routes.size()));
+    if(id < 0) {
+        SPDLOG_ERROR("路由不合法: [{}] {}", method, pattern);
+        return nullptr;
     }
-
-    if(node->_is_end && node->_handler) {
-        handler = node->_handler;
-        return true;
+    if(id == static_cast<int32_t>(_routes.size())) {
+        _routes.emplace_back();
+        _routes.back()._method = method;
+        _routes.back()._pattern = pattern;
     }
-    return false;
+    return &_routes[id];
+}
+/* brief: 匹配路由 */
+bool HttpServer::MatchRoute(const std::string &method, const std::string &path, Handler &handler, std::unordered_map<std::string, std::string> &params) {
+    if(_router.Dirty()) _router.Compile();
+    int32_t id;
+    http::RouteParams captured;
+    if(_router.Match(http::ParseMethod(method), path, &id, &captured, nullptr) != http::ROUTE_FOUND) return false;
+    for(uint8_t i = 0; i < captured.size; ++i) {
+        params[std::string(captured.items[i].name)] = path.substr(captured.items[i].value_off, captured.items[i].value_len);
+    }
+    handler = _routes[id]._handler;
+    return true;
+}
+/* brief: 按请求匹配路由 */
+const RouteEntry *HttpServer::MatchEntry(http::HttpRequest &request, http::RouteStatus *status, uint32_t *allow) {
+    http::HttpMethod method = request._method_id;
+    if(method == http::METHOD_UNKNOWN) method = http::ParseMethod(request._method);
+    int32_t id;
+    *status = _router.Match(method, request._path, &id, &request._route_params, allow);
+    if(*status != http::ROUTE_FOUND) return nullptr;
+    request._route = id;
+    return &_routes[id];
 }
 /* brief: 对功能性请求进行路由分配的函数(已经确认了请求方法) */
-void HttpServer::Dispatcher(http::HttpRequest &request, http::HttpResponse *response) {
-    Handler handler;
-    //临时存储路径参数
-    std::unordered_map<std::string, std::string> path_params;
-
+void HttpServer::Dispatcher(const std::shared_ptr<src::Connection> &connection, http::HttpRequest &request, http::HttpResponse *response) {
     SPDLOG_DEBUG("正在匹配路由: [{}] {}", request._method, request._path);
 
-    //使用 Trie 树进行匹配
-    if(MatchRoute(request._method, request._path, handler, path_params)) {
+    //在路由表中匹配，路径参数直接写进 request._route_params，业务层通过 GetParam / GetPathParam 获取
+    http::RouteStatus status;
+    uint32_t allow = 0;
+    const RouteEntry *node = MatchEntry(request, &status, &allow);
+    if(node && (node->_handler || node->_writer_handler || node->_co_handler)) {
         SPDLOG_DEBUG("路由匹配成功");
-        //将提取到的路径参数合并到request的_params中
-        //这样业务层可以轻松获取
-        for(auto &kv : path_params) {
-            request.SetParam(kv.first, kv.second);
+        if(request._spilled_body && request._spilled_body->failed) {
+            SPDLOG_ERROR("请求体写入临时文件失败");
+            response->_status = 500;
+            return ErrorHandler(request, response);
         }
-
-        //调用业务函数
-        handler(request, response);
+        //调用业务函数。流式响应由 ResponseWriter 发送
+        int32_t route = static_cast<int32_t>(node - _routes.data());
+        if(node->_co_handler) return CoDispatch(connection, node->_co_handler, route, request, response);
+        uint64_t start = src::Metrics::NowNs();
+        if(node->_writer_handler) {
+            response->_writer = std::make_shared<http::ResponseWriter>(connection, request._version, request.IsClose(),
+                                                                       request._method_id == http::METHOD_HEAD);
+            if(_access_log) {
+                // 流式响应在 End() 时才知道状态码和字节数，可能在业务线程结束，记录的其余部分先在 IO 线程填好
+                http::AccessRecord record;
+                FillAccessRecord(connection.get(), request, &record);
+                response->_writer->SetEndCallback([log = _access_log.get(), record, start](int status, uint64_t bytes) mutable {
+                    record.status = static_cast<uint16_t>(status);
+                    record.bytes = bytes;
+                    record.time_ns = src::Metrics::NowNs();
+                    record.latency_us = static_cast<uint32_t>((record.time_ns - start) / 1000);
+                    log->Append(record);
+                });
+            }
+            node->_writer_handler(request, response->_writer);
+        } else {
+            node->_handler(request, response);
+        }
+        connection->GetLoop()->GetMetrics()->RouteLatency(route, (src::Metrics::NowNs() - start) / 1000);
+    } else if(status == http::ROUTE_METHOD_NOT_ALLOWED) {
+        SPDLOG_WARN("请求方法不允许: 405");
+        response->_status = 405;
+        response->SetHeader("Allow", http::Router::AllowHeader(allow));
+        ErrorHandler(request, response);
     } else {
         SPDLOG_WARN("路由匹配失败: 404");
         response->_status = 404;
@@ -327,16 +367,117 @@ void HttpServer::Dispatcher(http::HttpRequest &request, http::HttpResponse *resp
     }
     SPDLOG_WARN("没有找到请求的函数方法");
     response->_status = 404;*/
+}
+namespace {
+/* brief: 一次协程处理函数调用，协程挂起期间持有请求、响应和连接 */
+struct CoCall {
+    std::shared_ptr<src::Connection> connection;
+    http::HttpRequest request;
+    http::HttpResponse response;
+    std::exception_ptr error;   // 处理函数抛出的异常
+    bool done = false;          // 协程已经结束
+    bool deferred = false;      // 协程挂起过，响应由结束回调发送
+    int32_t route = -1;         // 路由下标，协程结束时记录处理耗时
+    uint64_t start_ns = 0;      // 开始处理的时刻
+};
+}
+/* brief: 启动协程处理函数 */
+void HttpServer::CoDispatch(const std::shared_ptr<src::Connection> &connection, const CoHandler &handler, int32_t route,
+                            http::HttpRequest &request, http::HttpResponse *response) {
+    // 请求移进调用记录，协程里的引用在连接上下文重置后依然有效
+    auto call = std::make_shared<CoCall>();
+    call->connection = connection;
+    call->route = route;
+    call->start_ns = src::Metrics::NowNs();
+    call->request = std::move(request);
+    std::optional<src::Task<void>> task;
+    try {
+        task.emplace(handler(call->request, &call->response));
+    } catch(...) {
+        call->error = std::current_exception();
+        call->done = true;
+    }
+    if(!task) connection->GetLoop()->GetMetrics()->RouteLatency(route, (src::Metrics::NowNs() - call->start_ns) / 1000);
+    if(task) {
+        src::Spawn(std::move(*task), [this, call](std::exception_ptr error) {
+            call->error = error;
+            call->done = true;
+            // 处理耗时包括挂起的时间，协程总是在连接所在的 IO 线程结束
+            call->connection->GetLoop()->GetMetrics()->RouteLatency(call->route, (src::Metrics::NowNs() - call->start_ns) / 1000);
+            if(!call->deferred) return; // 同步结束，由 CoDispatch 发送
+            // 协程在连接所在的 IO 线程恢复并结束。挂起期间连接暂停了读取，这时正轮到它的响应
+            const std::shared_ptr<src::Connection> &conn = call->connection;
+            if(conn->IsClosed()) return;
+            if(call->error) CoFailed(call->request, &call->response, call->error);
+            bool close = call->request.IsClose() || call->response.GetHeader("Connection") == "close";
+            WriteResponse(conn, call->request, call->response, call->start_ns);
+            if(close) conn->Shutdown();
+            else conn->ResumeRead(); // 继续处理流水线里的后续请求
+        });
+    }
+    if(!call->done) {
+        call->deferred = true;
+        response->_deferred = true;
+        return;
+    }
+    // 同步结束（没有挂起过），和普通处理函数一样由 OnMessage 发送
+    request = std::move(call->request);
+    *response = std::move(call->response);
+    if(call->error) CoFailed(request, response, call->error);
+}
+/* brief: 协程处理函数抛出了异常 */
+void HttpServer::CoFailed(const http::HttpRequest &request, http::HttpResponse *response, std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch(const std::exception &e) {
+        SPDLOG_ERROR("协程处理函数异常: {}", e.what());
+    } catch(...) {
+        SPDLOG_ERROR("协程处理函数异常");
+    }
+    *response = http::HttpResponse(500);
+    ErrorHandler(request, response);
+}
+namespace {
+/* brief: 转义 Prometheus 标签值里的反斜杠、双引号和换行 */
+void AppendLabelValue(std::string *out, const std::string &value) {
+    for(char c : value) {
+        if(c == '\\' || c == '"') out->push_back('\\');
+        if(c == '\n') {
+            out->append("\\n");
+            continue;
+        }
+        out->push_back(c);
+    }
+}
+}
+/* brief: 指标页面：汇总所有 EventLoop 的指标，再按路由输出处理耗时 */
+void HttpServer::MetricsHandler(const http::HttpRequest &request, http::HttpResponse *response) {
+    src::MetricsSnapshot snapshot = src::Metrics::Collect();
+    std::string body;
+    src::Metrics::AppendPrometheus(snapshot, &body);
+    src::Metrics::AppendHeader(&body, "webserver_route_latency_seconds", "histogram", "Handler latency by route.");
+    std::string labels;
+    for(size_t i = 0; i < snapshot.route_latency_us.size() && i < _routes.size(); ++i) {
+        if(snapshot.route_latency_us[i].Count() == 0) continue;
+        labels = "method=\"";
+        AppendLabelValue(&labels, _routes[i]._method);
+        labels += "\",route=\"";
+        AppendLabelValue(&labels, _routes[i]._pattern);
+        labels += "\"";
+        src::Metrics::AppendHistogram(&body, "webserver_route_latency_seconds", labels, snapshot.route_latency_us[i], 1e-6);
+    }
+    response->SetContent(body, "text/plain; version=0.0.4; charset=utf-8");
 }
  /* brief: 对功能性请求进行路由(还没有确认方法) */
-void HttpServer::Route(http::HttpRequest &request, http::HttpResponse *response) {
+void HttpServer::Route(const std::shared_ptr<src::Connection> &connection, http::HttpRequest &request, http::HttpResponse *response) {
     //1 静态资源优先匹配
-    if(IsFileHandler(request)) {
-        return FileHandler(request, response);
+    std::shared_ptr<const http::CachedFile> file;
+    if(IsFileHandler(request, &file)) {
+        return FileHandler(request, file, response);
     }
 
     //2 动态路由分发
-    Dispatcher(request, response);
+    Dispatcher(connection, request, response);
     //step 1:对请求进行分辨，是一个静态资源请求，还是一个功能性请求
     // 静态资源请求，则进行静态资源的处理
     // 功能性请求，则需要通过几个请求路由表来确定是否有处理函数
@@ -366,6 +507,50 @@ void HttpServer::Route(http::HttpRequest &request, http::HttpResponse *response)
     return;*/
 }
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/* brief: 向服务器注册连接成功后的处理函数 */
+void HttpServer::OnConnected(const std::shared_ptr<src::Connection> &connection) {
+    // 设置该连接的协议上下文信息。上下文由连接持有，回调里直接用裸指针不会悬空
+    http::HttpContext context;
+    src::Connection *conn = connection.get();
+    context.SetHeadCallback([this, conn](http::HttpRequest &request) { return OnHead(conn, request); });
+    context.SetMaxBodySize(_max_body);
+    connection->SetContext(std::move(context));
+}
+/* brief: 请求头接收完毕，流式路由的正文按片交给使用者 */
+http::HttpContext::BodyCallback HttpServer::OnHead(src::Connection *connection, http::HttpRequest &request) {
+    // 路径参数写进 request，正文处理函数里就可以拿到
+    http::RouteStatus status;
+    const RouteEntry *node = MatchEntry(request, &status, nullptr);
+    if(node == nullptr || (!node->_body_handler && !node->_spill_body)) return nullptr;
+
+    if(node->_body_handler) {
+        BodyHandler body = node->_body_handler;
+        std::weak_ptr<src::Connection> weak = connection->shared_from_this();
+        std::function<void()> resume = [weak]() {
+            if(auto conn = weak.lock()) conn->ResumeRead();
+        };
+        return [connection, body, resume, &request](std::string_view data) {
+            if(body(request, data, resume)) return true;
+            // 使用者处理不过来，停止从 socket 读取，输入缓冲区不再增长
+            connection->PauseRead();
+            return false;
+        };
+    }
+    // 正文写进临时文件
+    auto spilled = std::make_shared<http::SpilledBody>();
+    spilled->fd = util::Util::CreateTempFile(_spill_dir);
+    if(spilled->fd < 0) spilled->failed = true;
+    request._spilled_body = spilled;
+    return [spilled](std::string_view data) {
+        if(spilled->failed) return true; // 出错后继续消费正文，收完后响应 500
+        if(!util::Util::WriteAll(spilled->fd, data.data(), data.size())) {
+            spilled->failed = true;
+            return true;
+        }
+        spilled->size += data.size();
+        return true;
+    };
+}
 /* brief: 向服务器注册可读事件触发后的处理函数 */
 void HttpServer::OnMessage(const std::shared_ptr<src::Connection> &connection, src::Buffer *buffer) {
     while(buffer->ReadableBytes() > 0) {
@@ -382,6 +567,7 @@ void HttpServer::OnMessage(const std::shared_ptr<src::Connection> &connection, s
         if(context->GetRespStatus() >= 400) {
             // 进行错误响应，关闭连接
             SPDLOG_DEBUG("状态码大于 400, 进行错误响应");
+            connection->GetLoop()->GetMetrics()->ParseError(context->GetRespStatus());
             ErrorHandler(request, &response); // 填充错误显示页面数据到response
             WriteResponse(connection, request, response); // 组织响应发送给客户端
             context->Reset();
@@ -396,30 +582,50 @@ void HttpServer::OnMessage(const std::shared_ptr<src::Connection> &connection, s
         }
         //step 3. 请求路由 + 业务处理
         SPDLOG_DEBUG("开始请求路由 + 业务处理");
-        Route(request, &response);
-        //step 4. 对HttpResponse进行组织发送
-        WriteResponse(connection, request, response);
-        //缩容buffer
-        buffer->Shrink(src::Buffer::InitialSize);
+        // 短连接要在处理之前记下来，协程处理函数挂起时请求会被移走
+        bool request_close = request.IsClose();
+        uint64_t start = _access_log ? src::Metrics::NowNs() : 0;
+        Route(connection, request, &response);
+        if(response._deferred) {
+            //协程处理函数挂起了，响应在协程结束后发送。之前暂停读取，后续的流水线请求等它发送完（恢复读取）后再处理
+            buffer->ReleaseConsumed();
+            context->Reset();
+            if(request_close) buffer->MoveReadOffset(buffer->ReadableBytes());
+            connection->PauseRead();
+            break;
+        }
+        if(response._writer) {
+            //流式响应由 ResponseWriter 自己发送。没结束前暂停读取，后续的流水线请求等它结束（End 里恢复读取）后再处理
+            bool close = request_close;
+            buffer->ReleaseConsumed();
+            context->Reset();
+            if(close) {
+                buffer->MoveReadOffset(buffer->ReadableBytes());
+                break;
+            }
+            if(!response._writer->Ended()) {
+                connection->PauseRead();
+                break;
+            }
+            if(connection->IsReadPaused()) break; // 输出积压到了高水位
+            continue;
+        }
+        //step 4. 对HttpResponse进行组织发送。是否关闭连接要在重置上下文之前确定
+        bool close = request.IsClose() || response.GetHeader("Connection") == "close";
+        WriteResponse(connection, request, response, start);
+        //归还已经消费完的块
+        buffer->ReleaseConsumed();
         //重置上下文
         context->Reset();
-        //step 5. 根据长短连接判断是否关闭连接或者继续处理
-        if(response.IsClose()) { 
+        //step 5. 根据长短连接判断是否关闭连接，长连接则继续处理缓冲区里剩下的流水线请求。
+        //        响应按顺序挂在输出队列里，本轮处理完后由一次 writev 一起发出
+        if(close) { 
+            buffer->MoveReadOffset(buffer->ReadableBytes()); // 短连接之后的流水线请求不再处理
             connection->Shutdown(); 
             break;
         }
-
-        if (connection->IsWriting()) {
-             // 注意：这里退出循环意味着剩下的 buffer 数据留待下次处理。
-             // 由于 epoll 是水平触发(LT)或边缘触发(ET)不同，如果 buffer 里还有数据但没读完，
-             // 下次 ReadCallback 可能不会触发。
-             // 但由于我们 shrink 了 buffer，且 Connection 只有在 socket 可读时才回调，
-             // 所以这里最安全的做法是：不做 Pipelining 支持，或者简单的 break。
-             
-             // 鉴于目前的架构，最稳妥的修复是：处理完一个请求就 break，不循环处理 pipeline。
-             // 等待客户端发送新包或者下一次 epoll 触发。
-            break;
-        }
+        //输出积压到了高水位，剩下的流水线请求留在缓冲区里，等积压降到低水位恢复读取时再处理
+        if(connection->IsReadPaused()) break;
     }
 }
 
@@ -3,22 +3,41 @@
 #include "../src/TcpServer.h"
 #include "../util/Util.h"
 #include "HttpContext.h"
+#include "FileCache.h"
+#include "CompressCache.h"
+#include "ResponseWriter.h"
+#include "Router.h"
+#include "AccessLog.h"
 
 namespace webserver::server
 {
 
 #define DEFAULT_TIMEOUT 30
 
-/* brief: 路由树节点 */
-struct TrieNode {
-    // 静态路径子节点
-    std::unordered_map<std::string, std::shared_ptr<TrieNode>> _children;
-    // 通配符/参数子结点(eg. /:id) - 每一层只允许一个动态参数
-    std::shared_ptr<TrieNode> _param_child = nullptr;
-    std::string _param_name; //参数名称 例如：id
+static constexpr size_t kOutputHighWaterMark = 4 * 1024 * 1024;   // 连接输出队列积压到它时暂停读取和解析后续的流水线请求
+static constexpr size_t kOutputLowWaterMark = 1024 * 1024;        // 积压降到它时恢复
 
-    bool _is_end; //是否是路由终点
+/* brief: 流式请求体的处理函数。正文每到一段调用一次，data 只在调用期间有效；
+          返回 false 表示处理不过来，连接暂停读取，处理完后调用 resume 恢复（任意线程都可以调用） */
+using BodyHandler = std::function<bool(const http::HttpRequest &request, std::string_view data, const std::function<void()> &resume)>;
+
+/* brief: 流式响应的处理函数。request 只在调用期间有效；writer 可以保存下来在其他线程继续写，End() 或释放时响应结束 */
+using WriterHandler = std::function<void(const http::HttpRequest &request, const std::shared_ptr<http::ResponseWriter> &writer)>;
+
+/* brief: 协程处理函数。在连接所在的 IO 线程开始执行，可以 co_await EventLoop::Sleep / Readable / Writable、
+          ThreadPool::Offload、Connection::Drained 等，挂起期间不占用线程，恢复后仍在这个 IO 线程；
+          request / response 在协程结束前一直有效，协程结束后发送 response。挂起期间连接上流水线的后续请求暂不处理 */
+using CoHandler = std::function<src::Task<void>(const http::HttpRequest &request, http::HttpResponse *response)>;
+
+/* brief: 一条路由（方法 + 路径）的处理函数，路由表里存它在 HttpServer::_routes 中的下标 */
+struct RouteEntry {
     std::function<void(const http::HttpRequest&, http::HttpResponse*)> _handler = nullptr; // 处理函数
+    BodyHandler _body_handler = nullptr; // 流式请求体的处理函数，为空则正文整体放进 request._body
+    bool _spill_body = false; // 正文写进临时文件（request._spilled_body），不放进内存
+    WriterHandler _writer_handler = nullptr; // 流式响应的处理函数，和 _handler 二选一
+    CoHandler _co_handler = nullptr; // 协程处理函数，和 _handler 二选一
+    std::string _method;    // 注册时的方法和路径，用作 /metrics 里的标签
+    std::string _pattern;
 };
 
 class HttpServer
@@ -26,12 +45,12 @@ class HttpServer
     using Handler = std::function<void(const http::HttpRequest&, http::HttpResponse*)>;
     using Handlers = std::vector<std::pair<std::regex, Handler>>;
 public:
-    HttpServer(uint16_t port, int timeout = DEFAULT_TIMEOUT);
+    HttpServer(uint16_t port, int timeout = DEFAULT_TIMEOUT, src::PollerBackend backend = src::POLLER_EPOLL);
     /* brief: 提供给使用者注册基准路径 */
     void SetBaseDir(const std::string &path);
     /* brief: 提供给使用者注册业务函数 */
     void AddRoute(const std::string &method, const std::string &pattern, const Handler &handler);
-    /* brief: 在 Trie 中匹配路由 */
+    /* brief: 匹配路由，捕获的路径参数写进 params。服务器启动之前也可以调用 */
     bool MatchRoute(const std::string &method, const std::string &path,
                     Handler &handler, std::unordered_map<std::string, std::string> &params);
     /* brief: 提供给使用者注册GET方法业务函数 */
@@ -50,29 +69,90 @@ public:
     void Delete(const std::string &pattern, const Handler &handler) {
         AddRoute("DELETE", pattern, handler);
     }
+    /* brief: 注册流式接收请求体的路由：正文按片交给 body，不在内存里累积；正文收完后调用 handler 生成响应，此时 request._body 为空 */
+    void AddStreamRoute(const std::string &method, const std::string &pattern, const BodyHandler &body, const Handler &handler);
+    /* brief: 注册正文写进临时文件的路由：handler 通过 request._spilled_body 读取正文，上传占用的内存不随正文大小增长 */
+    void AddSpillRoute(const std::string &method, const std::string &pattern, const Handler &handler);
+    /* brief: 注册流式响应的路由：handler 通过 ResponseWriter 边生成边发送正文，没有设置 Content-Length 时使用 chunked 编码。
+              响应结束前连接上流水线的后续请求暂不处理 */
+    void AddWriterRoute(const std::string &method, const std::string &pattern, const WriterHandler &handler);
+    /* brief: 注册协程处理函数：处理函数可以 co_await 定时器、业务线程池、fd 就绪等，等待期间 IO 线程继续处理其他连接 */
+    void AddCoRoute(const std::string &method, const std::string &pattern, const CoHandler &handler);
+    /* brief: 在 path 上注册 Prometheus 文本格式的指标页面（各 EventLoop 的连接、收发字节、事件监控、任务池、
+              定时器、解析错误和各路由的处理耗时），抓取时才汇总 */
+    void EnableMetrics(const std::string &path = "/metrics");
+    /* brief: 开启访问日志：IO 线程只记录定长的二进制记录，后台线程格式化后成批写进 path（"-" 为标准输出），
+              format 可选 Common Log Format。需要在 Listen 之前调用 */
+    void EnableAccessLog(const std::string &path, http::AccessLogFormat format = http::ACCESS_LOG_DEFAULT);
+    /* brief: 设置连接输出队列的高低水位，默认 kOutputHighWaterMark / kOutputLowWaterMark，high 为 0 表示不限制。
+              积压到高水位后连接暂停读取，缓冲区里流水线的后续请求也暂不解析，对端收走数据、积压降到低水位后恢复，
+              慢客户端占用的内存不会无限增长。需要在 Listen 之前调用 */
+    void SetOutputWaterMarks(size_t high, size_t low) { _server.SetWaterMarks(high, low); }
+    /* brief: 设置放进 request._body 的请求体上限，默认 MAX_BODY，超出时响应 413（Content-Length 在接收正文之前就检查）。
+              流式接收和写进临时文件的路由不受限制。需要在 Listen 之前调用 */
+    void SetMaxBodySize(size_t size) { _max_body = size; }
+    /* brief: 设置临时文件所在目录，默认 /tmp */
+    void SetSpillDir(const std::string &dir) { _spill_dir = dir; }
     /* brief: 提供给使用者来设置从属线程数 */
     void SetThreadCount(int count) { _server.SetThreadCount(count); }
+    /* brief: 提供给使用者设置新连接的分配策略（轮询 / 最少连接 / 两选一），需要在 Listen 之前调用 */
+    void SetLoopPlacement(src::LoopPlacement placement) { _server.SetLoopPlacement(placement); }
+    /* brief: 提供给使用者设置从属线程绑定的 CPU（同时按 CPU 所在的 NUMA 节点分配内存），需要在 Listen 之前调用 */
+    void SetLoopCpus(const std::vector<int> &cpus) { _server.SetLoopCpus(cpus); }
+    /* brief: 提供给使用者开启按 CPU 分配新连接，配合 EnableReusePort 和 SetLoopCpus 使用，需要在 Listen 之前调用 */
+    void EnableCpuSteering() { _server.EnableCpuSteering(); }
+    /* brief: 提供给使用者开启边缘触发模式，需要在 Listen 之前调用 */
+    void EnableEdgeTrigger() { _server.EnableEdgeTrigger(); }
+    /* brief: 提供给使用者开启 SO_REUSEPORT 多监听模式，需要在 Listen 之前调用 */
+    void EnableReusePort() { _server.EnableReusePort(); }
     /* brief: 提供给使用者来启动服务器监听新连接的函数 */
     void Listen() { 
         //printf("进入Listen函数 启动服务器\n");
+        if(_router.Dirty()) _router.Compile(); // 路由表在启动前压平，之后各个线程只读
+        src::Metrics::SetRouteCount(_routes.size());
+        if(_access_log) {
+            std::vector<std::string> names;
+            for(auto &route : _routes) names.push_back(route._method + " " + route._pattern);
+            _access_log->SetRouteNames(std::move(names));
+        }
         _server.Start(); 
     }
 private:
     /* brief: 错误处理函数 */
     void ErrorHandler(const http::HttpRequest &request, http::HttpResponse *response);
-    /* brief: 对应连接写入响应的函数 */
-    void WriteResponse(const std::shared_ptr<src::Connection> &connection, const http::HttpRequest &request, http::HttpResponse &response);
-    /* brief: 判断是不是静态资源请求 */
-    bool IsFileHandler(const http::HttpRequest &request);
+    /* brief: 对应连接写入响应的函数。开启了访问日志时顺便记录一条，start_ns 是开始处理的时刻，为 0 时耗时记为 0 */
+    void WriteResponse(const std::shared_ptr<src::Connection> &connection, const http::HttpRequest &request, http::HttpResponse &response,
+                       uint64_t start_ns = 0);
+    /* brief: 用请求和连接填好访问记录里和响应无关的部分（对端地址、方法、路径、版本、路由） */
+    static void FillAccessRecord(src::Connection *connection, const http::HttpRequest &request, http::AccessRecord *record);
+    /* brief: 判断是不是静态资源请求，是则通过 file 返回缓存的文件 */
+    bool IsFileHandler(const http::HttpRequest &request, std::shared_ptr<const http::CachedFile> *file);
     /* brief: 静态资源处理函数 */
-    void FileHandler(const http::HttpRequest &request, http::HttpResponse *response);
+    void FileHandler(const http::HttpRequest &request, const std::shared_ptr<const http::CachedFile> &file, http::HttpResponse *response);
+    /* brief: 按 Accept-Encoding 选择静态资源的压缩版本并填好响应，没有可用的压缩版本时返回 false，由调用方发送原文件 */
+    bool EncodedFileHandler(const http::HttpRequest &request, const std::shared_ptr<const http::CachedFile> &file, http::HttpResponse *response);
     /* brief: 对功能性请求进行路由分配的函数(已经确认了请求方法) */
     //void Dispatcher(http::HttpRequest &request, http::HttpResponse *response, Handlers &handlers);
-    void Dispatcher(http::HttpRequest &request, http::HttpResponse *response);
+    void Dispatcher(const std::shared_ptr<src::Connection> &connection, http::HttpRequest &request, http::HttpResponse *response);
+    /* brief: 启动协程处理函数。同步结束时 request / response 放回原处，按普通处理函数发送；
+              挂起时请求移交给协程，设置 response->_deferred，协程结束后在结束回调里发送 */
+    void CoDispatch(const std::shared_ptr<src::Connection> &connection, const CoHandler &handler, int32_t route,
+                    http::HttpRequest &request, http::HttpResponse *response);
+    /* brief: 协程处理函数抛出了异常，response 换成 500 */
+    void CoFailed(const http::HttpRequest &request, http::HttpResponse *response, std::exception_ptr error);
+    /* brief: 指标页面的处理函数 */
+    void MetricsHandler(const http::HttpRequest &request, http::HttpResponse *response);
     /* brief: 对功能性请求进行路由(还没有确认方法) */
-    void Route(http::HttpRequest &request, http::HttpResponse *response);
+    void Route(const std::shared_ptr<src::Connection> &connection, http::HttpRequest &request, http::HttpResponse *response);
+    /* brief: 向路由表插入路由，返回它的处理函数记录，已经注册过时返回原来的记录；方法或路径不合法返回空 */
+    RouteEntry *InsertRoute(const std::string &method, const std::string &pattern);
+    /* brief: 按请求的方法和路径匹配路由，捕获的参数写进 request._route_params。
+              没有匹配时返回空，status 区分路径不存在和方法不允许，allow 返回允许的方法位图 */
+    const RouteEntry *MatchEntry(http::HttpRequest &request, http::RouteStatus *status, uint32_t *allow);
+    /* brief: 请求头接收完毕，按路由决定正文是否流式处理 */
+    http::HttpContext::BodyCallback OnHead(src::Connection *connection, http::HttpRequest &request);
     /* brief: 向服务器注册连接成功后的处理函数 */
-    void OnConnected(const std::shared_ptr<src::Connection> &connection) { connection->SetContext(http::HttpContext()); } // 设置该连接的协议上下文信息
+    void OnConnected(const std::shared_ptr<src::Connection> &connection);
     /* brief: 向服务器注册可读事件触发后的处理函数 */
     void OnMessage(const std::shared_ptr<src::Connection> &connection, src::Buffer *buffer);
 private:
@@ -80,9 +160,15 @@ private:
     //Handlers _post_route;   // 保存使用者注册的POST方法的业务函数
     //Handlers _put_route;    // 保存使用者注册的PUT方法的业务函数
     //Handlers _delete_route; // 保存使用者注册的DELETE方法的业务函数
-    std::unordered_map<std::string, std::shared_ptr<TrieNode>> _roots;
+    http::Router _router;   // 方法 + 路径 -> _routes 下标
+    std::vector<RouteEntry> _routes;    // 路由的处理函数，服务器启动后只读
     std::string _basedir;   // 保存使用者注册的基准路径
+    std::string _spill_dir = "/tmp";    // 请求体临时文件所在目录
+    size_t _max_body = MAX_BODY;        // 放进 request._body 的请求体上限
+    std::unique_ptr<http::AccessLog> _access_log; // 访问日志，开启后创建。放在 _server 之前，最后析构
     src::TcpServer _server; // Tcp服务器
+    std::unique_ptr<http::FileCache> _file_cache; // 静态资源的打开文件缓存，设置基准路径时创建。放在 _server 之后，先于 baseloop 析构
+    std::unique_ptr<http::CompressCache> _compress_cache; // 静态资源压缩版本的缓存和后台压缩线程，设置基准路径时创建
 };
 
 }
\ No newline at end of file
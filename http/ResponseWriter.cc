@@ -0,0 +1,136 @@
+#include "ResponseWriter.h"
+#include "../util/Util.h"
+#include <cstdio>
+#include <strings.h>
+
+namespace webserver::http
+{
+
+ResponseWriter::ResponseWriter(const std::shared_ptr<src::Connection> &connection, const std::string &version, bool close, bool head)
+    : _connection(connection), _version(version), _close(close), _head(head), _status(200),
+    _header_sent(false), _chunked(false), _ended(false), _inflight(std::make_shared<std::atomic<size_t>>(0))
+    {}
+
+ResponseWriter::~ResponseWriter() { End(); }
+
+void ResponseWriter::SetStatus(int status) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_header_sent) return;
+    _status = status;
+}
+
+void ResponseWriter::SetHeader(const std::string &key, const std::string &val) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_header_sent) return;
+    _headers.emplace_back(key, val);
+}
+
+void ResponseWriter::WriteHeader() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    WriteHeaderLocked();
+}
+/* brief: 写一段正文 */
+bool ResponseWriter::Write(std::string &&data) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_ended || _connection->IsClosed()) return false;
+    WriteHeaderLocked();
+    if(data.empty()) return true; // 空的 chunk 表示结束，不能发出去
+    if(_head) return true; // HEAD 和不带正文的状态码只有响应头
+    _bytes += data.size();
+    if(!_chunked) {
+        PostLocked([conn = _connection, str = std::move(data)]() mutable { conn->Send(std::move(str)); });
+        return true;
+    }
+    // chunk: 十六进制长度\r\n 数据 \r\n
+    char size_line[24];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", data.size());
+    if(data.size() < kWriterCopyLimit) {
+        std::string chunk;
+        chunk.reserve(n + data.size() + 2);
+        chunk.append(size_line, n);
+        chunk += data;
+        chunk += "\r\n";
+        PostLocked([conn = _connection, str = std::move(chunk)]() mutable { conn->Send(std::move(str)); });
+    } else {
+        // 大段正文不拷贝，和 chunk 头尾一起作为三个段进入输出队列，由一次 writev 发出
+        PostLocked([conn = _connection, head = std::string(size_line, n), str = std::move(data)]() mutable {
+            conn->Send(std::move(head));
+            conn->Send(std::move(str));
+            conn->Send(std::string("\r\n"));
+        });
+    }
+    return true;
+}
+/* brief: 结束响应 */
+void ResponseWriter::End() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_ended) return;
+    WriteHeaderLocked();
+    _ended = true;
+    if(_end_callback) _end_callback(_status, _bytes);
+    if(_chunked && !_head) PostLocked([conn = _connection]() { conn->Send(std::string("0\r\n\r\n")); });
+    if(_close) {
+        PostLocked([conn = _connection]() { conn->Shutdown(); });
+    } else {
+        // HttpServer 在流式响应结束前暂停了读取，恢复后处理连接上的下一个请求
+        PostLocked([conn = _connection]() { conn->ResumeRead(); });
+    }
+}
+
+bool ResponseWriter::Ended() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _ended;
+}
+// ============= Private ============
+/* brief: 发送响应头 */
+void ResponseWriter::WriteHeaderLocked() {
+    if(_header_sent) return;
+    _header_sent = true;
+    bool has_length = false;
+    for(auto &kv : _headers) {
+        if(strcasecmp(kv.first.c_str(), "Content-Length") == 0) has_length = true;
+    }
+    // 1xx / 204 / 304 不能带正文，和 HEAD 一样只发响应头，也不需要 chunked 或关闭连接来标记正文结束
+    bool no_body = _status < 200 || _status == 204 || _status == 304;
+    if(no_body) _head = true;
+    if(!has_length && !no_body) {
+        // HTTP/1.0 不支持 chunked，只能用关闭连接来表示正文结束
+        if(_version == "HTTP/1.0") _close = true;
+        else _chunked = true;
+    }
+    std::string header;
+    header.reserve(256);
+    header += _version;
+    header += " ";
+    header += std::to_string(_status);
+    header += " ";
+    header += util::Util::StatusDesc(_status);
+    header += "\r\n";
+    for(auto &kv : _headers) {
+        header += kv.first;
+        header += ": ";
+        header += kv.second;
+        header += "\r\n";
+    }
+    if(_chunked) header += "Transfer-Encoding: chunked\r\n";
+    header += _close ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+    // Date 用连接所在 loop 缓存的日期，在 IO 线程里补上
+    PostLocked([conn = _connection, str = std::move(header)]() mutable {
+        str += "Date: ";
+        str += conn->GetLoop()->HttpDate();
+        str += "\r\n\r\n";
+        conn->Send(std::move(str));
+    });
+}
+
+void ResponseWriter::PostLocked(src::Functor task) {
+    src::EventLoop *loop = _connection->GetLoop();
+    if(loop->IsInLoop() && _inflight->load(std::memory_order_acquire) == 0) return task();
+    _inflight->fetch_add(1, std::memory_order_relaxed);
+    loop->PushInLoop([task = std::move(task), inflight = _inflight]() {
+        task();
+        inflight->fetch_sub(1, std::memory_order_release);
+    });
+}
+
+}
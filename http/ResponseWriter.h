@@ -0,0 +1,80 @@
+#pragma once
+
+#include "../src/Connection.h"
+#include <mutex>
+#include <string>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// author: Haoyang Yang
+// filename: ResponseWriter.h
+// brief: 流式响应。处理函数拿到 ResponseWriter 后可以先发送响应头，再在 IO 线程或业务线程里一段一段地写正文，
+//        没有设置 Content-Length 时自动使用 chunked 编码，不需要先把整个正文拼进 HttpResponse::_body。
+//        生产者可以通过 Writable() / OnWritable() 按连接的发送速度控制节奏，避免输出队列无限积压
+
+namespace webserver::http
+{
+
+static constexpr size_t kWriterHighWaterMark = 1024 * 1024;    // 输出队列积压超过它时 Writable() 返回 false
+static constexpr size_t kWriterLowWaterMark = 256 * 1024;      // OnWritable() 等待积压降到它以下
+static constexpr size_t kWriterCopyLimit = 4096;               // 小于它的正文和 chunk 头尾拼成一段发送，大的正文单独成段不拷贝
+
+class ResponseWriter
+{
+public:
+    /* brief: version 是请求的协议版本，close 表示发送完后关闭连接，head 表示是 HEAD 请求（只发送响应头，Write 的正文被丢弃） */
+    ResponseWriter(const std::shared_ptr<src::Connection> &connection, const std::string &version, bool close, bool head = false);
+    /* brief: 没有调用 End() 就释放时自动结束响应 */
+    ~ResponseWriter();
+    ResponseWriter(const ResponseWriter&) = delete;
+    ResponseWriter &operator=(const ResponseWriter&) = delete;
+
+    /* brief: 设置状态码，需要在发送响应头之前调用 */
+    void SetStatus(int status);
+    /* brief: 设置响应头，需要在发送响应头之前调用。设置了 Content-Length 则不使用 chunked 编码 */
+    void SetHeader(const std::string &key, const std::string &val);
+    /* brief: 立即发送响应头，之后不能再修改状态码和响应头。不调用则第一次 Write() 时自动发送 */
+    void WriteHeader();
+    /* brief: 写一段正文，数据 move 进输出队列。连接已经关闭或响应已经结束时返回 false */
+    bool Write(std::string &&data);
+    bool Write(std::string_view data) { return Write(std::string(data)); }
+    /* brief: 结束响应。chunked 编码时发送最后一个空块，然后继续处理连接上的下一个请求（或关闭连接） */
+    void End();
+
+    /* brief: 输出队列积压是否低于高水位，生产者可以继续写 */
+    bool Writable() const { return _connection->PendingBytes() < kWriterHighWaterMark; }
+    /* brief: 输出队列积压的字节数 */
+    size_t PendingBytes() const { return _connection->PendingBytes(); }
+    /* brief: 连接是否已经关闭，关闭后继续写没有意义 */
+    bool Closed() const { return _connection->IsClosed(); }
+    /* brief: 积压降到低水位以下（或连接关闭）时调用一次 cb，在连接所在的 IO 线程执行 */
+    void OnWritable(const std::function<void()> &cb) { _connection->NotifyWhenDrained(kWriterLowWaterMark, cb); }
+    /* brief: 响应是否已经结束 */
+    bool Ended() const;
+    /* brief: 设置响应结束时的回调，参数是状态码和正文字节数（chunked 编码时不含块头尾），在调用 End() 的线程执行。
+              需要在处理函数拿到 ResponseWriter 之前设置（HttpServer 用它记录访问日志） */
+    void SetEndCallback(const std::function<void(int status, uint64_t bytes)> &cb) { _end_callback = cb; }
+private:
+    /* brief: 发送响应头，需要持有锁 */
+    void WriteHeaderLocked();
+    /* brief: 按调用顺序在连接所在线程执行 task，需要持有锁。
+              在 IO 线程且没有还没执行的投递时直接执行，否则投递到任务队列，保证不会越过之前从其他线程投递的写入 */
+    void PostLocked(src::Functor task);
+private:
+    std::shared_ptr<src::Connection> _connection;   // 响应所在的连接，响应结束前保持连接存活
+    std::string _version;   // 协议版本
+    bool _close;            // 发送完后是否关闭连接
+    bool _head;             // HEAD 请求或 1xx/204/304 响应，不发送正文
+    int _status;            // 状态码
+    std::vector<std::pair<std::string, std::string>> _headers;  // 响应头，按设置顺序发送
+    bool _header_sent;      // 响应头是否已经发送
+    bool _chunked;          // 是否使用 chunked 编码
+    bool _ended;            // 响应是否已经结束
+    uint64_t _bytes = 0;    // 已经写出的正文字节数
+    std::function<void(int, uint64_t)> _end_callback;   // 响应结束时的回调
+    std::shared_ptr<std::atomic<size_t>> _inflight;    // 已经投递、还没执行的任务数，任务可能在 ResponseWriter 析构后执行
+    mutable std::mutex _mutex;  // 写入可能来自多个线程，保证各段按调用顺序进入输出队列
+};
+
+}
@@ -0,0 +1,261 @@
+#include "Router.h"
+#include "../src/ByteScan.h"
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+#include <spdlog/spdlog.h>
+
+namespace webserver::http
+{
+
+namespace {
+/* brief: 比较前缀。路由前缀大多只有几个字节，逐字节比较比调用 memcmp 快 */
+inline bool SameBytes(const char *a, const char *b, size_t len) {
+    for(; len >= 8; len -= 8, a += 8, b += 8) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if(x != y) return false;
+    }
+    for(size_t i = 0; i < len; ++i) {
+        if(a[i] != b[i]) return false;
+    }
+    return true;
+}
+}
+
+/* brief: 注册用的指针树节点 */
+struct Router::BuildNode {
+    BuildNode() { std::fill(std::begin(routes), std::end(routes), -1); }
+    std::string prefix;     // 静态前缀
+    std::string name;       // 参数节点的参数名
+    std::vector<std::unique_ptr<BuildNode>> children;   // 静态子节点，首字节各不相同
+    std::unique_ptr<BuildNode> param;       // :param 子节点
+    std::unique_ptr<BuildNode> catchall;    // *catchall 子节点
+    int32_t routes[METHOD_COUNT];           // 每个方法的路由编号
+    bool has_route = false;
+};
+
+Router::Router() : _root(std::make_unique<BuildNode>()), _dirty(false), _route_count(0) {}
+
+Router::~Router() = default;
+/* brief: 注册路由 */
+int32_t Router::Insert(HttpMethod method, std::string_view pattern, int32_t id) {
+    if(method >= METHOD_COUNT || pattern.empty() || pattern[0] != '/') return -1;
+    // 末尾的 / 不区分，匹配时也会按去掉 / 再试一次
+    if(pattern.size() > 1 && pattern.back() == '/') pattern.remove_suffix(1);
+    size_t captures = 0;
+    for(size_t i = 1; i < pattern.size(); ++i) {
+        if(pattern[i - 1] == '/' && (pattern[i] == ':' || pattern[i] == '*')) ++captures;
+    }
+    if(captures > kMaxRouteParams) return -1;
+
+    BuildNode *node = InsertPath(_root.get(), pattern);
+    if(node == nullptr) return -1;
+    if(node->routes[method] >= 0) return node->routes[method];
+    node->routes[method] = id;
+    node->has_route = true;
+    _dirty = true;
+    ++_route_count;
+    return id;
+}
+/* brief: 压平指针树 */
+void Router::Compile() {
+    _nodes.clear();
+    _edges.clear();
+    _routes.clear();
+    _labels.clear();
+    Flatten(_root.get());
+    _dirty = false;
+}
+/* brief: 匹配路由 */
+RouteStatus Router::Match(HttpMethod method, std::string_view path, int32_t *id, RouteParams *params, uint32_t *allow) const {
+    assert(!_dirty);
+    params->size = 0;
+    if(_nodes.empty() || path.empty()) return ROUTE_NOT_FOUND;
+    int32_t n = MatchNode(0, path, 0, params);
+    if(n < 0 && path.size() > 1 && path.back() == '/') {
+        params->size = 0;
+        n = MatchNode(0, path.substr(0, path.size() - 1), 0, params);
+    }
+    if(n < 0) return ROUTE_NOT_FOUND;
+
+    const int32_t *routes = &_routes[_nodes[n].routes];
+    int32_t route = method < METHOD_COUNT ? routes[method] : -1;
+    if(route < 0 && method == METHOD_HEAD) route = routes[METHOD_GET];
+    if(route >= 0) {
+        *id = route;
+        return ROUTE_FOUND;
+    }
+    uint32_t mask = 0;
+    for(uint8_t i = 0; i < METHOD_COUNT; ++i) {
+        if(routes[i] >= 0) mask |= 1u << i;
+    }
+    if(routes[METHOD_GET] >= 0) mask |= 1u << METHOD_HEAD;
+    if(allow) *allow = mask;
+    params->size = 0;
+    return ROUTE_METHOD_NOT_ALLOWED;
+}
+
+std::string Router::AllowHeader(uint32_t allow) {
+    std::string header;
+    for(uint8_t i = 0; i < METHOD_COUNT; ++i) {
+        if(!(allow & (1u << i))) continue;
+        if(!header.empty()) header += ", ";
+        header += MethodName(static_cast<HttpMethod>(i));
+    }
+    return header;
+}
+// ============= Private ============
+Router::BuildNode *Router::InsertPath(BuildNode *node, std::string_view pattern) {
+    while(!pattern.empty()) {
+        char c = pattern[0];
+        if(c == ':' || c == '*') {
+            // 参数：:name 到下一个 / 为止，*name 到结尾
+            size_t end = (c == ':') ? pattern.find('/') : pattern.size();
+            if(end == std::string_view::npos) end = pattern.size();
+            std::string_view name = pattern.substr(1, end - 1);
+            if(name.empty()) return nullptr;
+            std::unique_ptr<BuildNode> &child = (c == ':') ? node->param : node->catchall;
+            if(!child) {
+                child = std::make_unique<BuildNode>();
+                child->name = name;
+            } else if(child->name != name) {
+                // 同一位置只有一个参数节点，参数名以先注册的为准
+                SPDLOG_WARN("路由参数名冲突: {} 和 {}，使用 {}", child->name, name, child->name);
+            }
+            node = child.get();
+            pattern.remove_prefix(end);
+            continue;
+        }
+        // 静态部分：到下一个以 : 或 * 开头的段为止
+        size_t end = 1;
+        while(end < pattern.size() && !(pattern[end - 1] == '/' && (pattern[end] == ':' || pattern[end] == '*'))) ++end;
+        std::string_view text = pattern.substr(0, end);
+        pattern.remove_prefix(end);
+
+        while(!text.empty()) {
+            auto it = std::find_if(node->children.begin(), node->children.end(),
+                                   [&](const std::unique_ptr<BuildNode> &child) { return child->prefix[0] == text[0]; });
+            if(it == node->children.end()) {
+                auto child = std::make_unique<BuildNode>();
+                child->prefix = text;
+                node->children.push_back(std::move(child));
+                node = node->children.back().get();
+                break;
+            }
+            BuildNode *child = it->get();
+            size_t common = 0;
+            while(common < child->prefix.size() && common < text.size() && child->prefix[common] == text[common]) ++common;
+            if(common < child->prefix.size()) {
+                // 只有一部分前缀相同，拆成公共前缀节点 + 原节点剩下的部分
+                auto mid = std::make_unique<BuildNode>();
+                mid->prefix = child->prefix.substr(0, common);
+                (*it)->prefix.erase(0, common);
+                mid->children.push_back(std::move(*it));
+                *it = std::move(mid);
+                child = it->get();
+            }
+            text.remove_prefix(common);
+            node = child;
+        }
+    }
+    return node;
+}
+
+int32_t Router::Flatten(const BuildNode *node) {
+    int32_t idx = static_cast<int32_t>(_nodes.size());
+    _nodes.emplace_back();
+    Node flat;
+    flat.prefix_off = static_cast<uint32_t>(_labels.size());
+    flat.prefix_len = static_cast<uint32_t>(node->prefix.size());
+    _labels += node->prefix;
+    flat.name_off = static_cast<uint32_t>(_labels.size());
+    flat.name_len = static_cast<uint32_t>(node->name.size());
+    _labels += node->name;
+    if(node->has_route) {
+        flat.routes = static_cast<int32_t>(_routes.size());
+        _routes.insert(_routes.end(), std::begin(node->routes), std::end(node->routes));
+    }
+    // 子节点按首字节排序后占一段连续的位置，下标等递归压平后再填
+    std::vector<const BuildNode*> children;
+    for(auto &child : node->children) children.push_back(child.get());
+    std::sort(children.begin(), children.end(), [](const BuildNode *a, const BuildNode *b) { return a->prefix < b->prefix; });
+    flat.child_begin = static_cast<uint32_t>(_edges.size());
+    flat.child_count = static_cast<uint32_t>(children.size());
+    for(const BuildNode *child : children) _edges.push_back(Edge{child->prefix[0], -1});
+    _nodes[idx] = flat;
+    for(size_t i = 0; i < children.size(); ++i) {
+        int32_t child = Flatten(children[i]);
+        _edges[flat.child_begin + i].node = child;
+    }
+    if(node->param) {
+        int32_t child = Flatten(node->param.get());
+        _nodes[idx].param = child;
+    }
+    if(node->catchall) {
+        int32_t child = Flatten(node->catchall.get());
+        _nodes[idx].catchall = child;
+    }
+    return idx;
+}
+
+int32_t Router::MatchNode(int32_t n, std::string_view path, size_t offset, RouteParams *params) const {
+    // 只有静态子节点可走时原地循环往下走，遇到还有 :param / *catchall 可以回退的节点才递归
+    while(true) {
+        const Node &node = _nodes[n];
+        if(offset == path.size()) {
+            if(node.routes >= 0) return n;
+            // *catchall 也可以匹配空的剩余路径，例如 /static/ 匹配 /static/*path
+            if(node.catchall >= 0 && _nodes[node.catchall].routes >= 0) {
+                params->items[params->size++] = {Name(_nodes[node.catchall]), static_cast<uint32_t>(offset), 0};
+                return node.catchall;
+            }
+            return -1;
+        }
+        // 1. 静态子节点：首字节各不相同，最多一个候选
+        int32_t next = -1;
+        const char c = path[offset];
+        const Edge *edges = _edges.data() + node.child_begin;
+        for(uint32_t i = 0; i < node.child_count; ++i) {
+            if(edges[i].byte != c) continue;
+            // 首字节已经相同，从第二个字节开始比
+            const Node &child = _nodes[edges[i].node];
+            if(path.size() - offset >= child.prefix_len &&
+               SameBytes(path.data() + offset + 1, _labels.data() + child.prefix_off + 1, child.prefix_len - 1)) {
+                next = edges[i].node;
+            }
+            break;
+        }
+        if(next >= 0) {
+            size_t next_offset = offset + _nodes[next].prefix_len;
+            if(node.param < 0 && node.catchall < 0) {
+                n = next;
+                offset = next_offset;
+                continue;
+            }
+            int32_t ret = MatchNode(next, path, next_offset, params);
+            if(ret >= 0) return ret;
+        }
+        // 2. :param 匹配到下一个 / 为止，不能为空
+        if(node.param >= 0) {
+            const char *begin = path.data() + offset;
+            const char *end = src::FindByte(begin, path.data() + path.size(), '/');
+            if(end != begin) {
+                uint8_t saved = params->size;
+                params->items[params->size++] = {Name(_nodes[node.param]), static_cast<uint32_t>(offset), static_cast<uint32_t>(end - begin)};
+                int32_t ret = MatchNode(node.param, path, end - path.data(), params);
+                if(ret >= 0) return ret;
+                params->size = saved;
+            }
+        }
+        // 3. *catchall 匹配剩下的全部
+        if(node.catchall >= 0 && _nodes[node.catchall].routes >= 0) {
+            params->items[params->size++] = {Name(_nodes[node.catchall]), static_cast<uint32_t>(offset), static_cast<uint32_t>(path.size() - offset)};
+            return node.catchall;
+        }
+        return -1;
+    }
+}
+
+}
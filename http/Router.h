@@ -0,0 +1,89 @@
+#pragma once
+
+#include "HttpRequest.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+// author: Haoyang Yang
+// filename: Router.h
+// brief: 压缩前缀树（radix tree）路由表。注册时在一棵指针树上插入，Compile() 把它压平成几个连续数组：
+//        节点数组、边数组（同一个父节点的子节点连续存放，每条边带子节点前缀的首字节）、所有静态前缀和参数名拼成的一个字符串。
+//        匹配时只在这些数组上按字节比较，路径不切分、不拷贝，捕获的参数写进请求里的定长数组，整个过程不申请内存。
+//        支持 /user/:id 这样匹配一段的参数和 /static/*path 这样匹配剩余全部路径的参数；
+//        同一节点上静态前缀优先于 :param，:param 优先于 *catchall。
+//        每个终点节点按方法下标存路由编号，路径匹配而方法不匹配时返回允许的方法集合，用于 405 和 Allow 头部
+
+namespace webserver::http
+{
+
+/* brief: 匹配结果 */
+enum RouteStatus {
+    ROUTE_FOUND = 0,            // 找到路由
+    ROUTE_NOT_FOUND,            // 路径不存在
+    ROUTE_METHOD_NOT_ALLOWED,   // 路径存在但没有注册这个方法
+};
+
+class Router
+{
+public:
+    Router();
+    ~Router();
+    Router(const Router&) = delete;
+    Router &operator=(const Router&) = delete;
+
+    /* brief: 注册 method + pattern，pattern 以 / 开头，可以包含 :name（一段）和 *name（剩余全部，只能在最后）。
+              已经注册过时返回原来的编号，否则记录 id 并返回它；pattern 不合法返回 -1。
+              注册后需要 Compile() 才能匹配，只能在服务器启动之前调用 */
+    int32_t Insert(HttpMethod method, std::string_view pattern, int32_t id);
+    /* brief: 把注册的路由压平成数组，Insert 之后、第一次 Match 之前调用 */
+    void Compile();
+    /* brief: 是否有注册之后还没有 Compile 的路由 */
+    bool Dirty() const { return _dirty; }
+    /* brief: 匹配 path。找到时通过 id 返回路由编号、通过 params 返回捕获的参数（值是 path 里的偏移）；
+              方法不匹配时通过 allow 返回允许的方法位图（1 << HttpMethod）。HEAD 没有单独注册时使用 GET 的路由。
+              末尾多一个 / 的路径没有匹配时按去掉 / 再匹配一次。不申请内存，多个线程可以同时调用 */
+    RouteStatus Match(HttpMethod method, std::string_view path, int32_t *id, RouteParams *params, uint32_t *allow) const;
+    /* brief: 把允许的方法位图写成 Allow 头部的值，例如 "GET, HEAD, POST" */
+    static std::string AllowHeader(uint32_t allow);
+    /* brief: 注册的路由条数 */
+    size_t Size() const { return _route_count; }
+private:
+    struct BuildNode;
+    /* brief: 压平后的节点 */
+    struct Node {
+        uint32_t prefix_off = 0;    // 静态前缀在 _labels 里的位置，根节点和参数节点的前缀为空
+        uint32_t prefix_len = 0;
+        uint32_t name_off = 0;      // 参数节点的参数名在 _labels 里的位置
+        uint32_t name_len = 0;
+        uint32_t child_begin = 0;   // 静态子节点在 _edges 里的区间
+        uint32_t child_count = 0;
+        int32_t param = -1;         // :param 子节点
+        int32_t catchall = -1;      // *catchall 子节点
+        int32_t routes = -1;        // 路由编号在 _routes 里的起点（METHOD_COUNT 个），没有路由为 -1
+    };
+    /* brief: 指向静态子节点的边 */
+    struct Edge {
+        char byte;          // 子节点前缀的首字节
+        int32_t node;       // 子节点下标
+    };
+    /* brief: 在指针树上插入 pattern 剩余的部分，返回终点节点 */
+    BuildNode *InsertPath(BuildNode *node, std::string_view pattern);
+    /* brief: 把 node 压平，返回它在 _nodes 里的下标 */
+    int32_t Flatten(const BuildNode *node);
+    /* brief: 从 node（前缀已经匹配）开始匹配 path 剩余部分，返回终点节点下标，失败返回 -1 */
+    int32_t MatchNode(int32_t node, std::string_view path, size_t offset, RouteParams *params) const;
+    /* brief: 参数名 */
+    std::string_view Name(const Node &node) const { return std::string_view(_labels.data() + node.name_off, node.name_len); }
+private:
+    std::unique_ptr<BuildNode> _root;   // 注册用的指针树
+    bool _dirty;                        // 注册后还没有 Compile
+    size_t _route_count;                // 注册的路由条数
+    std::vector<Node> _nodes;           // 压平后的节点，0 是根节点
+    std::vector<Edge> _edges;           // 静态子节点的边，同一个父节点的连续存放
+    std::vector<int32_t> _routes;       // 每个终点节点 METHOD_COUNT 个路由编号，-1 表示该方法没有注册
+    std::string _labels;                // 所有静态前缀和参数名
+};
+
+}
@@ -6,14 +6,9 @@ namespace webserver::server
 /* brief: 创建服务器，并将消息处理函数绑定到server里 */
 HttpServer::HttpServer(uint16_t port, int timeout, int worker_threads) : _server(port), _worker_pool(std::make_unique<http::ThreadPool>(worker_threads)) {
     _server.EnableInactiveRelease(timeout);
-    _server.SetConnectedCallback(std::bind(&HttpServer::OnConnected, this, std::placeholders::_1)); // 将OnConnection的this绑定后，剩下的Connection参数交给服务器去绑定
-    _server.SetMessageCallback(std::bind(&HttpServer::OnMessage, this, std::placeholders::_1, std::placeholders::_2));
-
-    //初始化常用方法的根节点
-    _roots["GET"] = std::make_shared<TrieNode>();
-    _roots["POST"] = std::make_shared<TrieNode>();
-    _roots["PUT"] = std::make_shared<TrieNode>();
-    _roots["DELETE"] = std::make_shared<TrieNode>();
+    // 回调只捕获 this，每个连接拷贝一份时不需要额外申请内存
+    _server.SetConnectedCallback([this](const std::shared_ptr<src::Connection> &conn) { OnConnected(conn); });
+    _server.SetMessageCallback([this](const std::shared_ptr<src::Connection> &conn, src::Buffer *buf) { OnMessage(conn, buf); });
 }
 /* brief: 提供给使用者注册基准路径 */
 void HttpServer::SetBaseDir(const std::string &path) {
@@ -55,66 +50,19 @@ void HttpServer::ErrorHandler(const http::HttpRequest &request, http::HttpRespon
 }
 /* brief: 对应连接写入响应的函数 */
 void HttpServer::WriteResponse(const std::shared_ptr<src::Connection> &connection, const http::HttpRequest &request, http::HttpResponse &response) {
-    // 1.先完善头部字段
-    if(request.IsClose() == true) response.SetHeader("Connection", "close");
-    else response.SetHeader("Connection", "keep-alive");
-
-    if(response._body.empty() == false && response.HasHeader("Content-Length") == false) {
-        response.SetHeader("Content-Length", std::to_string(response._body.size()));
-    }
-    if(response._body.empty() == false && response.HasHeader("Content-Type") == false) {
-        response.SetHeader("Content-Type", "application/octet-stream");
-    }
-    if(response._redirect_flag == true) {
-        response.SetHeader("Location", response._redirect_url);
-    }
-    // 2.将response里的要素，按照http格式进行组织, 先组织 Header
-    /* std::stringstream rsp_str;
-    rsp_str << request._version << " " << std::to_string(response._status) << " " << util::Util::StatusDesc(response._status) << "\r\n";
-    for(auto &head : response._headers) {
-        rsp_str << head.first << ": " << head.second << "\r\n";
-    }
-    rsp_str << "\r\n";
-    rsp_str << response._body;*/
-    std::string header;
-    header.reserve(256);
-
-    header += request._version;
-    header += " ";
-    header += std::to_string(response._status);
-    header += " ";
-    header += util::Util::StatusDesc(response._status);
-    header += "\r\n";
-
-    for(auto &kv : response._headers) {
-        if(kv.first.rfind("X-SENDFILE", 0) == 0) continue;
-        header += kv.first + ": " + kv.second + "\r\n";
-    }
-
-    header += "\r\n";
-    SPDLOG_TRACE("HttpResponse 的 Headers:");
-    SPDLOG_TRACE("{}", header);
-
-    // 2.发送Header
-    SPDLOG_TRACE("调用Send, 发送响应头");
-    connection->Send(header.c_str(), header.size());
-    // 3 发送Body
-    if(response.HasHeader("X-SENDFILE-FD")) {
-        //静态资源，调用 SendFile
-        //因为 Connection 保证先发Buffer后发File，所以顺序是安全的
+    // 1.状态行和头部直接写进输出队列队尾的字符串，Content-Length / Connection / Date 在序列化时补上
+    bool close = request.IsClose() || response.GetHeader("Connection") == "close";
+    connection->AppendInLoop([&](std::string &out) {
+        response.SerializeHeader(request._version, close, connection->GetLoop()->HttpDate(), out);
+    });
+    // 2.发送Body，输出队列按入队顺序发送
+    if(response._body_desc.type == http::BODY_FILE) {
+        //静态资源，fd 的所有权交给连接
         SPDLOG_TRACE("请求静态资源, 用SendFile实现零拷贝");
-        int fd = std::stoi(response.GetHeader("X-SENDFILE-FD"));
-        size_t size = std::stoul(response.GetHeader("X-SENDFILE-SIZE"));
-
-        //获取 Offset, 默认为 0;
-        off_t offset = 0;
-        if(response.HasHeader("X-SENDFILE-OFFSET")) {
-            offset = std::stoll(response.GetHeader("X-SENDFILE-OFFSET"));
-        }
-        connection->SendFile(fd, offset, size);
+        connection->SendFile(response._body_desc.fd, response._body_desc.offset, response._body_desc.size);
     } else if(!response._body.empty()) {
         SPDLOG_TRACE("请求普通资源, 调用Send发送body");
-        connection->Send(response._body.c_str(), response._body.size());
+        connection->Send(std::move(response._body));
     }
 }
 /* brief: 判断是不是静态资源请求 */
@@ -123,7 +71,7 @@ bool HttpServer::IsFileHandler(const http::HttpRequest &request) {
     // 1. 必须设置了静态资源根目录
     if(_basedir.empty()) return false;
     // 2. 请求方法必须是GET/HEAD
-    if(request._method != "GET" && request._method != "HEAD") {
+    if(request._method_id != http::METHOD_GET && request._method_id != http::METHOD_HEAD) {
         SPDLOG_DEBUG("请求方法不符合静态资源");
         return false;
     }
@@ -167,7 +115,7 @@ void HttpServer::FileHandler(const http::HttpRequest &request, http::HttpRespons
         return;
     }
     size_t file_size = st.st_size;
-    std::string mime = util::Util::ExtMime(request_path);
+    std::string mime(util::Util::ExtMime(request_path));
 
     //step3: 设置通用头部
     response->SetHeader("Content-Type", mime);
@@ -204,22 +152,15 @@ void HttpServer::FileHandler(const http::HttpRequest &request, http::HttpRespons
         size_t content_len = end - start + 1;
 
         response->_status = 206; // Partial Content
-        response->SetHeader("Content-Length", std::to_string(content_len));
         std::string content_range = "bytes " + std::to_string(start) + "-" + std::to_string(end) + "/" + std::to_string(file_size);
         response->SetHeader("Content-Range", content_range);
         SPDLOG_TRACE("构造Range响应: Content-Range: {}", content_range);
-        //通过自定义头部传给WriteResponse
-        response->_headers["X-SENDFILE-FD"] = std::to_string(fd);
-        response->_headers["X-SENDFILE-SIZE"] = std::to_string(content_len);
-        response->_headers["X-SENDFILE-OFFSET"] = std::to_string(start); // 传递偏移量
+        //通过正文描述传给WriteResponse，Content-Length 由正文长度得出
+        response->SetFileBody(fd, start, content_len);
     } else {
         SPDLOG_DEBUG("该请求是非Range请求");
         response->_status = 200;
-        response->SetHeader("Content-Length", std::to_string(file_size));
-
-        response->_headers["X-SENDFILE-FD"] = std::to_string(fd);
-        response->_headers["X-SENDFILE-SIZE"] = std::to_string(st.st_size);
-        response->_headers["X-SENDFILE-OFFSET"] = "0"; // 默认偏移量0
+        response->SetFileBody(fd, 0, file_size);
     }
     
     // 判断 MIME 是否以 image/ 开头，如果是，就开启缓存
@@ -227,90 +168,53 @@ void HttpServer::FileHandler(const http::HttpRequest &request, http::HttpRespons
     response->_body.clear();
     SPDLOG_DEBUG("退出FileHandler函数");
 }
-/* brief: 添加路由到 Trie */
+/* brief: 添加路由到路由表 */
 void HttpServer::AddRoute(const std::string &method, const std::string &pattern, const Handler &handler) {
-    if(_roots.find(method) == _roots.end()) {
-        _roots[method] = std::make_shared<TrieNode>();
-    }
-    auto node = _roots[method];
-
-    std::vector<std::string> parts = util::Util::SplitPath(pattern);
-    for(const auto &part : parts) {
-        if(!part.empty() && part[0] == ':') {
-            // 处理动态参数，例如 :id
-            if(!node->_param_child) {
-                node->_param_child = std::make_shared<TrieNode>();
-                node->_param_name = part.substr(1); // 存储"id";
-            }
-            // 简单实现: 如果有冲突的参数名，这里会覆盖，业务层应该避免
-            node->_param_name = part.substr(1);
-            node = node->_param_child;
-        } else {
-            // 处理静态路径
-            if(node->_children.find(part) == node->_children.end()) {
-                node->_children[part] = std::make_shared<TrieNode>();
-            }
-            node = node->_children[part];
-        }
+    int32_t id = _router.Insert(http::ParseMethod(method), pattern, static_cast<int32_t>(_handlers.size()));
+    if(id < 0) {
+        SPDLOG_ERROR("路由不合法: [{}] {}", method, pattern);
+        return;
     }
-    node->_is_end = true;
-    node->_handler = handler;
+    if(id == static_cast<int32_t>(_handlers.size())) _handlers.emplace_back();
+    _handlers[id] = handler;
     SPDLOG_DEBUG("注册路由: [{}] {}", method, pattern);
 }
-/* brief: 在 Trie 中匹配路由 */
+/* brief: 匹配路由 */
 bool HttpServer::MatchRoute(const std::string &method, const std::string &path, Handler &handler, std::unordered_map<std::string, std::string> &params) {
-    if(_roots.find(method) == _roots.end()) return false;
-    auto node = _roots[method];
-
-    std::vector<std::string> parts = util::Util::SplitPath(path);
-
-    for(const auto &part : parts) {
-        // 优先匹配静态路径
-        if(node->_children.count(part)) {
-            node = node->_children[part];
-        }
-        // 匹配动态参数
-        else if(node->_param_child) {
-            //捕获参数
-            params[node->_param_name] = part;
-            node = node->_param_child;
-        }
-        // 匹配失败
-        else {
-            return false;
-        }
-    }
-
-    if(node->_is_end && node->_handler) {
-        handler = node->_handler;
-        return true;
+    if(_router.Dirty()) _router.Compile();
+    int32_t id;
+    http::RouteParams captured;
+    if(_router.Match(http::ParseMethod(method), path, &id, &captured, nullptr) != http::ROUTE_FOUND) return false;
+    for(uint8_t i = 0; i < captured.size; ++i) {
+        params[std::string(captured.items[i].name)] = path.substr(captured.items[i].value_off, captured.items[i].value_len);
     }
-    return false;
+    handler = _handlers[id];
+    return true;
 }
 /* brief: 分发函数,动静分离 */
-void HttpServer::Dispatcher(const std::shared_ptr<src::Connection> &connection, http::HttpRequest &request, http::HttpResponse *response) {
+void HttpServer::Dispatcher(const std::shared_ptr<src::Connection> &connection, uint64_t seq, http::HttpRequest &request, http::HttpResponse *response) {
     //step1: 静态资源处理
     if(IsFileHandler(request)) {
         SPDLOG_DEBUG("检测到静态资源请求");
         FileHandler(request, response);
         //静态资源用 SendFile, 必须在当前IO线程直接发送
-        WriteResponse(connection, request, *response);
+        CompleteResponse(connection, seq, request, *response);
         return;
     }
 
     //step2: 动态业务处理
-    Handler handler;
-    std::unordered_map<std::string, std::string> params;
-    // 匹配路由
-    if(MatchRoute(request._method, request._path, handler, params)) {
+    // 匹配路由，路径参数直接写进 request._route_params
+    int32_t id;
+    uint32_t allow = 0;
+    http::RouteStatus status = _router.Match(request._method_id, request._path, &id, &request._route_params, &allow);
+    if(status == http::ROUTE_FOUND) {
         SPDLOG_DEBUG("路由匹配成功，投递到业务线程池");
-        //填充路径参数
-        for(auto &kv : params) request.SetParam(kv.first, kv.second);
+        const Handler &handler = _handlers[id];
         // [关键]深拷贝 Request 对象
         // 因为 OnMessage 结束后 context 会被重置
         http::HttpRequest req_copy = request;
         // [关键]投递任务
-        _worker_pool->Enqueue([connection, req_copy, handler, this](){
+        _worker_pool->Enqueue([connection, seq, req_copy, handler, this](){
             // 这里是 worker 线程执行的
             //1. 创建全新的 Response 对象(栈上)
             http::HttpResponse async_resp(200);
@@ -326,29 +230,68 @@ void HttpServer::Dispatcher(const std::shared_ptr<src::Connection> &connection,
                 async_resp.SetContent("Unknown Error");
             }
 
-            //3, 业务执行完，切换回 IO 线程发送
-            connection->GetLoop()->RunInLoop([connection, req_copy, async_resp, this]() mutable {
+            //3, 业务执行完，切换回 IO 线程，按请求顺序发送。同一个业务线程交回同一个 IO 线程的响应攒批投递
+            _worker_pool->PostBack(connection->GetLoop(), [connection, seq, req_copy, async_resp, this]() mutable {
                 // 这里回到了 IO 线程
-                this->WriteResponse(connection, req_copy, async_resp);
-                if(async_resp.IsClose()) {
-                    connection->Shutdown();
-                }
+                this->CompleteResponse(connection, seq, req_copy, async_resp);
             });
         });
     } else {
         SPDLOG_DEBUG("路由匹配失败");
-        response->_status = 404;
+        response->_status = (status == http::ROUTE_METHOD_NOT_ALLOWED) ? 405 : 404;
+        if(status == http::ROUTE_METHOD_NOT_ALLOWED) response->SetHeader("Allow", http::Router::AllowHeader(allow));
         ErrorHandler(request, response);
-        WriteResponse(connection, request, *response);
+        CompleteResponse(connection, seq, request, *response);
+    }
+}
+/* brief: 按编号顺序发送响应 */
+void HttpServer::CompleteResponse(const std::shared_ptr<src::Connection> &connection, uint64_t seq, http::HttpRequest &request, http::HttpResponse &response) {
+    PipelineContext *pipe = std::any_cast<PipelineContext>(connection->GetContext());
+    if(pipe == nullptr || seq > pipe->close_seq) return; // 连接已经升级了协议，或者排在关闭连接的响应之后
+    if(seq != pipe->send_seq) {
+        // 前面还有响应没完成，先存起来
+        pipe->ready.emplace(seq, std::make_pair(std::move(request), std::move(response)));
+        return;
+    }
+    WriteResponse(connection, request, response);
+    // 把已经完成的、紧接着的响应一起挂到输出队列，由一次 writev 发出
+    while(pipe->send_seq != pipe->close_seq) {
+        ++pipe->send_seq;
+        auto it = pipe->ready.find(pipe->send_seq);
+        if(it == pipe->ready.end()) {
+            // 在途请求降到上限以下，恢复读取，缓冲区里剩下的流水线请求会接着分发
+            if(pipe->read_paused && pipe->next_seq - pipe->send_seq < _max_inflight) {
+                pipe->read_paused = false;
+                connection->ResumeRead();
+            }
+            return;
+        }
+        WriteResponse(connection, it->second.first, it->second.second);
+        pipe->ready.erase(it);
     }
+    // 关闭连接的响应已经挂上，前面的响应都已经在它之前
+    pipe->ready.clear();
+    connection->Shutdown();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /* brief: 向服务器注册可读事件触发后的处理函数 */
 void HttpServer::OnMessage(const std::shared_ptr<src::Connection> &connection, src::Buffer *buffer) {
+    PipelineContext *pipe = std::any_cast<PipelineContext>(connection->GetContext());
+    //step 1. 获取上下文数据
+    http::HttpContext *context = &pipe->http;
     while(buffer->ReadableBytes() > 0) {
-        //step 1. 获取上下文数据
-        http::HttpContext *context = std::any_cast<http::HttpContext>(connection->GetContext());
+        if(pipe->close_seq != UINT64_MAX) {
+            // 已经决定关闭连接，后面的数据不再处理
+            buffer->MoveReadOffset(buffer->ReadableBytes());
+            return;
+        }
+        if(pipe->next_seq - pipe->send_seq >= _max_inflight) {
+            // 在途请求太多：不再分发，也不再从 socket 读，剩下的数据留在缓冲区，由 CompleteResponse 恢复读取
+            pipe->read_paused = true;
+            connection->PauseRead();
+            return;
+        }
         //step 2. 通过上下文数据对缓冲区数据进行解析，得到HttpRequest对象
         // 1. 解析出错，直接进行错误响应
         // 2. 解析正常，且请求获取完毕，才开始去处理请求
@@ -358,13 +301,14 @@ void HttpServer::OnMessage(const std::shared_ptr<src::Connection> &connection, s
         http::HttpResponse response(context->GetRespStatus());
         SPDLOG_DEBUG("创建 HttpResponse, 并写入解析过程中产生的状态码");
         if(context->GetRespStatus() >= 400) {
-            // 进行错误响应，关闭连接
+            // 进行错误响应，排在之前的流水线响应后面发送，然后关闭连接
             SPDLOG_DEBUG("状态码大于 400, 进行错误响应");
             ErrorHandler(request, &response); // 填充错误显示页面数据到response
-            WriteResponse(connection, request, response); // 组织响应发送给客户端
+            uint64_t seq = pipe->next_seq++;
+            pipe->close_seq = seq;
+            CompleteResponse(connection, seq, request, response); // 组织响应发送给客户端
             context->Reset();
             buffer->MoveReadOffset(buffer->ReadableBytes()); // 出错了就将缓冲区清空
-            connection->Shutdown();
             return;
         }
         if(context->GetRecvStatus() != http::RECV_HTTP_OVER) {
@@ -372,14 +316,16 @@ void HttpServer::OnMessage(const std::shared_ptr<src::Connection> &connection, s
             SPDLOG_DEBUG("当前请求还未接收完整，等待新数据到来");
             return;
         }
-        //step 3. 请求路由 + 业务处理
+        //step 3. 请求路由 + 业务处理。缓冲区里所有完整的请求都处理掉，不等前面的响应发完
         SPDLOG_DEBUG("开始请求路由 + 业务处理");
-        Dispatcher(connection, request, &response);
-        //缩容buffer
-        buffer->Shrink(src::Buffer::InitialSize);
+        uint64_t seq = pipe->next_seq++;
+        if(request.IsClose()) pipe->close_seq = seq; // 短连接：这个响应发完就关闭
+        Dispatcher(connection, seq, request, &response);
+        //归还已经消费完的块
+        buffer->ReleaseConsumed();
         //重置上下文
         context->Reset();
     }
 }
 
-}
\ No newline at end of file
+}
@@ -4,22 +4,23 @@
 #include "ThreadPool.h"
 #include "../util/Util.h"
 #include "HttpContext.h"
+#include "Router.h"
+#include <map>
 
 namespace webserver::server
 {
 
 #define DEFAULT_TIMEOUT 30
+static constexpr uint64_t kDefaultMaxInflight = 32;    // 每个连接最多同时在处理（已经分发、响应还没发送）的流水线请求数
 
-/* brief: 路由树节点 */
-struct TrieNode {
-    // 静态路径子节点
-    std::unordered_map<std::string, std::shared_ptr<TrieNode>> _children;
-    // 通配符/参数子结点(eg. /:id) - 每一层只允许一个动态参数
-    std::shared_ptr<TrieNode> _param_child = nullptr;
-    std::string _param_name; //参数名称 例如：id
-
-    bool _is_end; //是否是路由终点
-    std::function<void(const http::HttpRequest&, http::HttpResponse*)> _handler = nullptr; // 处理函数
+/* brief: 连接的协议上下文。流水线请求按到达顺序编号，业务线程池完成的先后不定，响应按编号顺序发送 */
+struct PipelineContext {
+    http::HttpContext http;     // 请求解析上下文
+    uint64_t next_seq = 0;      // 下一个请求的编号
+    uint64_t send_seq = 0;      // 下一个应该发送的响应编号
+    uint64_t close_seq = UINT64_MAX;    // 发送完这个编号的响应后关闭连接，之后到达的请求不再处理
+    bool read_paused = false;   // 在途请求达到上限，暂停了读取，等响应发出去再恢复
+    std::map<uint64_t, std::pair<http::HttpRequest, http::HttpResponse>> ready; // 已经完成、等待前面的响应发送的
 };
 
 class HttpServer
@@ -32,7 +33,7 @@ public:
     void SetBaseDir(const std::string &path);
     /* brief: 提供给使用者注册业务函数 */
     void AddRoute(const std::string &method, const std::string &pattern, const Handler &handler);
-    /* brief: 在 Trie 中匹配路由 */
+    /* brief: 匹配路由，捕获的路径参数写进 params。服务器启动之前也可以调用 */
     bool MatchRoute(const std::string &method, const std::string &path,
                     Handler &handler, std::unordered_map<std::string, std::string> &params);
     /* brief: 提供给使用者注册GET方法业务函数 */
@@ -51,11 +52,21 @@ public:
     void Delete(const std::string &pattern, const Handler &handler) {
         AddRoute("DELETE", pattern, handler);
     }
+    /* brief: 设置每个连接最多同时在处理的流水线请求数，达到上限时暂停读取该连接，前面的响应发送后恢复 */
+    void SetMaxInflight(uint64_t max_inflight) {
+        assert(max_inflight > 0);
+        _max_inflight = max_inflight;
+    }
     /* brief: 提供给使用者来设置从属线程数 */
     void SetThreadCount(int count) { _server.SetThreadCount(count); }
+    /* brief: 提供给使用者开启边缘触发模式，需要在 Listen 之前调用 */
+    void EnableEdgeTrigger() { _server.EnableEdgeTrigger(); }
+    /* brief: 提供给使用者开启 SO_REUSEPORT 多监听模式，需要在 Listen 之前调用 */
+    void EnableReusePort() { _server.EnableReusePort(); }
     /* brief: 提供给使用者来启动服务器监听新连接的函数 */
     void Listen() { 
         //printf("进入Listen函数 启动服务器\n");
+        if(_router.Dirty()) _router.Compile(); // 路由表在启动前压平，之后各个线程只读
         _server.Start(); 
     }
 private:
@@ -69,11 +80,13 @@ private:
     void FileHandler(const http::HttpRequest &request, http::HttpResponse *response);
     /* brief: 对功能性请求进行路由分配的函数(已经确认了请求方法) */
     //void Dispatcher(http::HttpRequest &request, http::HttpResponse *response, Handlers &handlers);
-    void Dispatcher(const std::shared_ptr<src::Connection> &connection, http::HttpRequest &request, http::HttpResponse *response);
+    void Dispatcher(const std::shared_ptr<src::Connection> &connection, uint64_t seq, http::HttpRequest &request, http::HttpResponse *response);
+    /* brief: 编号为 seq 的响应已经完成，按编号顺序发送。需要在连接所在的 IO 线程执行 */
+    void CompleteResponse(const std::shared_ptr<src::Connection> &connection, uint64_t seq, http::HttpRequest &request, http::HttpResponse &response);
     /* brief: 对功能性请求进行路由(还没有确认方法) */
     //void Route(http::HttpRequest &request, http::HttpResponse *response);
     /* brief: 向服务器注册连接成功后的处理函数 */
-    void OnConnected(const std::shared_ptr<src::Connection> &connection) { connection->SetContext(http::HttpContext()); } // 设置该连接的协议上下文信息
+    void OnConnected(const std::shared_ptr<src::Connection> &connection) { connection->SetContext(PipelineContext()); } // 设置该连接的协议上下文信息
     /* brief: 向服务器注册可读事件触发后的处理函数 */
     void OnMessage(const std::shared_ptr<src::Connection> &connection, src::Buffer *buffer);
 private:
@@ -81,11 +94,13 @@ private:
     //Handlers _post_route;   // 保存使用者注册的POST方法的业务函数
     //Handlers _put_route;    // 保存使用者注册的PUT方法的业务函数
     //Handlers _delete_route; // 保存使用者注册的DELETE方法的业务函数
-    std::unordered_map<std::string, std::shared_ptr<TrieNode>> _roots;
+    http::Router _router;   // 方法 + 路径 -> _handlers 下标
+    std::vector<Handler> _handlers; // 路由的处理函数，服务器启动后只读
     std::string _basedir;   // 保存使用者注册的基准路径
     src::TcpServer _server; // Tcp服务器
 
     std::unique_ptr<http::ThreadPool> _worker_pool;
+    uint64_t _max_inflight = kDefaultMaxInflight;   // 每个连接的在途请求上限
 };
 
 }
\ No newline at end of file
@@ -1,17 +1,198 @@
 #include "ThreadPool.h"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <spdlog/spdlog.h>
 
 namespace webserver::http
 {
 
+namespace {
+/* brief: 当前线程属于哪个线程池的哪个工作线程；不是工作线程时记录提交任务用的主工作线程 */
+struct LocalSlot {
+    const ThreadPool *pool = nullptr;
+    size_t index = 0;
+    bool worker = false;
+};
+thread_local LocalSlot t_slot;
+/* brief: 没找到任务时先让出几次 CPU 再休眠，短任务连续到达时不用每次都进出条件变量 */
+constexpr int kSpinRounds = 16;
+}
+
+ThreadPool::ThreadPool(size_t threads_num, bool pin_cpu) : _pin_cpu(pin_cpu), _pending(0), _idle(0), _next_home(0), _stop(false) {
+    if(threads_num == 0) threads_num = 1;
+    _workers.reserve(threads_num);
+    for(size_t i = 0; i < threads_num; ++i) _workers.push_back(std::make_unique<Worker>());
+    // 所有 Worker 建好之后再启动线程，窃取时会访问其他线程的 Worker
+    for(size_t i = 0; i < threads_num; ++i) {
+        _workers[i]->thread = std::thread([this, i]() { WorkerLoop(i); });
+    }
+}
+
 ThreadPool::~ThreadPool() {
     {
-        std::unique_lock<std::mutex> lock(_queue_mutex);
-        _stop = true;
+        std::unique_lock<std::mutex> lock(_park_mutex);
+        _stop.store(true);
+    }
+    _park_cond.notify_all();
+    for(auto &worker : _workers) {
+        if(worker->thread.joinable()) worker->thread.join();
+    }
+}
+/* brief: 交回 IO 线程 */
+void ThreadPool::PostBack(src::EventLoop *loop, src::Functor cb) {
+    if(t_slot.pool != this || !t_slot.worker) return loop->RunInLoop(cb);
+    Worker *self = _workers[t_slot.index].get();
+    if(self->back_count == 0) self->back_since = std::chrono::steady_clock::now();
+    ++self->back_count;
+    for(auto &batch : self->backs) {
+        if(batch.loop == loop) {
+            batch.callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    self->backs.push_back(BackBatch{loop, {}});
+    self->backs.back().callbacks.push_back(std::move(cb));
+}
+// ============= Private ============
+void ThreadPool::Submit(Task task) {
+    if(_stop.load(std::memory_order_relaxed)) throw std::runtime_error("向停止了的任务队列提交任务");
+    size_t target = (t_slot.pool == this && t_slot.worker) ? t_slot.index : HomeWorker();
+    Worker *worker = _workers[target].get();
+    {
+        std::unique_lock<std::mutex> lock(worker->mutex);
+        worker->tasks.push_back(std::move(task));
+        worker->size.store(worker->tasks.size(), std::memory_order_relaxed);
+    }
+    // 先计数再看有没有休眠的线程；休眠的一方先登记 _idle 再检查 _pending，两边至少有一方能看到对方
+    _pending.fetch_add(1, std::memory_order_seq_cst);
+    if(_idle.load(std::memory_order_seq_cst) > 0) {
+        // 拿一下锁，保证不会在休眠线程检查完条件、还没开始等待的间隙里通知
+        { std::unique_lock<std::mutex> lock(_park_mutex); }
+        _park_cond.notify_one();
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    t_slot = LocalSlot{this, index, true};
+    if(_pin_cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &set);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) SPDLOG_WARN("业务线程 {} 绑定 CPU 失败", index);
+    }
+    Worker *self = _workers[index].get();
+    Task task;
+    while(true) {
+        if(PopLocal(self, task) || Steal(index, task)) {
+            auto start = std::chrono::steady_clock::now();
+            // 攒着的回调等不到这个任务结束：按平均耗时估计会超过 kMaxBackDelayUs 就先交回去
+            if(self->back_count > 0 &&
+               start - self->back_since + std::chrono::nanoseconds(self->task_ns) >= std::chrono::microseconds(kMaxBackDelayUs)) {
+                FlushBack(self);
+            }
+            try {
+                task();
+            } catch(const std::exception &e) {
+                SPDLOG_ERROR("业务线程任务异常: {}", e.what());
+            } catch(...) {
+                SPDLOG_ERROR("业务线程任务异常");
+            }
+            task = nullptr;
+            auto end = std::chrono::steady_clock::now();
+            int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            self->task_ns += (elapsed - self->task_ns) / 8;
+            if(self->back_count > 0) {
+                bool idle = self->size.load(std::memory_order_relaxed) == 0;
+                bool full = self->back_count >= kMaxBackBatch;
+                bool late = end - self->back_since >= std::chrono::microseconds(kMaxBackDelayUs);
+                if(idle || full || late) FlushBack(self);
+            }
+            continue;
+        }
+        FlushBack(self);
+        for(int i = 0; i < kSpinRounds && _pending.load(std::memory_order_relaxed) == 0; ++i) std::this_thread::yield();
+        if(_pending.load(std::memory_order_relaxed) > 0) continue;
+
+        std::unique_lock<std::mutex> lock(_park_mutex);
+        _idle.fetch_add(1, std::memory_order_seq_cst);
+        _park_cond.wait(lock, [this]() { return _pending.load(std::memory_order_seq_cst) > 0 || _stop.load(); });
+        _idle.fetch_sub(1, std::memory_order_relaxed);
+        // 停止时先把已经提交的任务执行完
+        if(_stop.load() && _pending.load() == 0) return;
+    }
+}
+
+bool ThreadPool::PopLocal(Worker *self, Task &task) {
+    if(self->size.load(std::memory_order_relaxed) == 0) return false;
+    std::unique_lock<std::mutex> lock(self->mutex);
+    if(self->tasks.empty()) return false;
+    task = std::move(self->tasks.front());
+    self->tasks.pop_front();
+    self->size.store(self->tasks.size(), std::memory_order_relaxed);
+    lock.unlock();
+    _pending.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::Steal(size_t index, Task &task) {
+    const size_t count = _workers.size();
+    for(size_t i = 1; i < count; ++i) {
+        Worker *victim = _workers[(index + i) % count].get();
+        if(victim->size.load(std::memory_order_relaxed) == 0) continue;
+        // 一次偷走一半，减少之后再来偷的次数；同一时刻只持有一把锁
+        std::vector<Task> stolen;
+        {
+            std::unique_lock<std::mutex> lock(victim->mutex);
+            size_t n = (victim->tasks.size() + 1) / 2;
+            if(n == 0) continue;
+            stolen.reserve(n);
+            for(size_t j = 0; j < n; ++j) {
+                stolen.push_back(std::move(victim->tasks.back()));
+                victim->tasks.pop_back();
+            }
+            victim->size.store(victim->tasks.size(), std::memory_order_relaxed);
+        }
+        // stolen 里越靠后的越早提交，先执行最后一个，其余按提交顺序放进自己的队列
+        task = std::move(stolen.back());
+        stolen.pop_back();
+        if(!stolen.empty()) {
+            Worker *self = _workers[index].get();
+            std::unique_lock<std::mutex> lock(self->mutex);
+            for(auto it = stolen.rbegin(); it != stolen.rend(); ++it) self->tasks.push_back(std::move(*it));
+            self->size.store(self->tasks.size(), std::memory_order_relaxed);
+        }
+        _pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
     }
-    _cond.notify_all();
-    for(std::thread &worker : _workers) {
-        if(worker.joinable()) worker.join();
+    return false;
+}
+
+size_t ThreadPool::HomeWorker() {
+    if(t_slot.pool != this) {
+        size_t home;
+        int cpu = _pin_cpu ? sched_getcpu() : -1;
+        if(cpu >= 0) home = static_cast<size_t>(cpu);  // 工作线程 i 绑定在核 i 上，选同一个核上的
+        else home = _next_home.fetch_add(1, std::memory_order_relaxed);
+        t_slot = LocalSlot{this, home, false};
     }
+    return t_slot.index % _workers.size();
 }
 
-}
\ No newline at end of file
+void ThreadPool::FlushBack(Worker *self) {
+    if(self->back_count == 0) return;
+    for(auto &batch : self->backs) {
+        if(batch.callbacks.size() == 1) {
+            batch.loop->PushInLoop(std::move(batch.callbacks.front()));
+            continue;
+        }
+        // 一批回调只占一个任务节点，IO 线程一次执行完
+        batch.loop->PushInLoop([callbacks = std::move(batch.callbacks)]() {
+            for(auto &cb : callbacks) cb();
+        });
+    }
+    self->backs.clear();
+    self->back_count = 0;
+}
+
+}
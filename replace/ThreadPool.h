@@ -1,19 +1,34 @@
 /*  brief: 该线程池是业务线程池，如果要基于该组件搭建应用服务器，则需要用到业务线程池做到动静分离
  *         而如果只需要做网关服务器，则不用改业务线程池，因为如果业务处理很慢，则会阻塞其它就绪事
- *         件的处理 
+ *         件的处理
  */
 
 #pragma once
 
+#include "../src/EventLoop.h"
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <future>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <optional>
 #include <stdexcept>
+#include <type_traits>
+
+// author: Haoyang Yang
+// filename: ThreadPool.h
+// brief: 工作窃取（work-stealing）业务线程池。每个工作线程有自己的任务队列和锁，提交任务只锁目标队列，
+//        不再所有线程争同一把锁；自己的队列空了就从别的队列队尾一次偷走一半，都没有任务时在条件变量上休眠，
+//        只有存在休眠的线程时提交者才去唤醒。
+//        IO 线程第一次提交时绑定一个“主”工作线程，之后都投到它的队列；开启 CPU 亲和时工作线程 i 绑定到核 i，
+//        提交者的主工作线程选和它在同一个核上的那个。
+//        业务完成后的回调用 PostBack 交回 IO 线程：同一个工作线程发往同一个 EventLoop 的回调攒成一批，
+//        队列空了、攒够 kMaxBackBatch 个或者最早的一个等了 kMaxBackDelayUs 时一次投递；
+//        开始下一个任务前，如果按最近任务的平均耗时估计执行完会超过 kMaxBackDelayUs，就先投递，回调不会被长任务压住
 
 namespace webserver::http
 {
@@ -21,43 +36,103 @@ namespace webserver::http
 class ThreadPool
 {
 public:
-    /* brief: 构造函数，启动指定数量的工作线程 */
-    explicit ThreadPool(size_t threads_num) : _stop(false) {
-        for(size_t i = 0; i < threads_num; ++i) {
-            _workers.emplace_back([this] { while(true) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(this->_queue_mutex);
-                    this->_cond.wait(lock, [this]{ return this->_stop || !this->_tasks.empty(); });
-
-                    if(this->_stop && this->_tasks.empty()) return;
-
-                    task = std::move(this->_tasks.front());
-                    this->_tasks.pop();
-                }
-                task();
-            }});
-        }
-    }
-    /* brief: 析构函数 */
+    using Task = std::function<void()>;
+    static constexpr size_t kMaxBackBatch = 32;     // 一批交回 IO 线程的回调最多个数
+    static constexpr int64_t kMaxBackDelayUs = 100; // 回调最多攒多久（微秒）
+
+    /* brief: 构造函数，启动指定数量的工作线程。pin_cpu 为 true 时工作线程 i 绑定到 CPU i % 核数 */
+    explicit ThreadPool(size_t threads_num, bool pin_cpu = false);
+    /* brief: 析构函数，执行完已经提交的任务后退出 */
     ~ThreadPool();
-    /* brief: 提交任务 */
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    /* brief: 提交任务，任意线程可调用。工作线程里提交的放进自己的队列，其他线程放进它的主工作线程的队列 */
     template<class F, class... Args>
     void Enqueue(F&& f, Args&&... args) {
-        auto task = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-        {
-            std::unique_lock<std::mutex> lock(_queue_mutex);
-            if(_stop) throw std::runtime_error("向停止了的任务队列提交任务");
-            _tasks.emplace(task);
+        if constexpr (sizeof...(Args) == 0) {
+            Submit(Task(std::forward<F>(f)));
+        } else {
+            Submit([f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable { std::invoke(f, args...); });
         }
-        _cond.notify_one();
     }
+    /* brief: co_await pool.Offload(fn)：fn 在工作线程执行，协程随后回到发起等待的 EventLoop 线程，结果是 fn 的返回值，
+              fn 抛出的异常在 co_await 处重新抛出 */
+    template<class F>
+    auto Offload(F fn) { return OffloadAwaiter<std::invoke_result_t<F&>, F>(this, std::move(fn)); }
+    /* brief: 把 cb 交给 loop 执行。在工作线程里调用时攒批投递，其他线程直接 RunInLoop */
+    void PostBack(src::EventLoop *loop, src::Functor cb);
+    /* brief: 工作线程数 */
+    size_t Size() const { return _workers.size(); }
+private:
+    /* brief: Offload 的等待对象，存在协程帧里，工作线程直接写结果 */
+    template<class R, class F>
+    class OffloadAwaiter
+    {
+    public:
+        OffloadAwaiter(ThreadPool *pool, F fn) : _pool(pool), _fn(std::move(fn)) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            src::EventLoop *loop = src::EventLoop::Current();
+            _pool->Enqueue([this, h, loop]() {
+                try {
+                    if constexpr (std::is_void_v<R>) _fn();
+                    else _result.emplace(_fn());
+                } catch(...) {
+                    _error = std::current_exception();
+                }
+                if(loop) _pool->PostBack(loop, [h]() { h.resume(); });
+                else h.resume();
+            });
+        }
+        R await_resume() {
+            if(_error) std::rethrow_exception(_error);
+            if constexpr (!std::is_void_v<R>) return std::move(*_result);
+        }
+    private:
+        ThreadPool *_pool;
+        F _fn;
+        std::conditional_t<std::is_void_v<R>, bool, std::optional<R>> _result{};
+        std::exception_ptr _error;
+    };
+    /* brief: 交回同一个 EventLoop 的一批回调 */
+    struct BackBatch {
+        src::EventLoop *loop;
+        std::vector<src::Functor> callbacks;
+    };
+    /* brief: 工作线程，各自独占缓存行，避免相邻线程的队列互相干扰 */
+    struct alignas(64) Worker {
+        std::mutex mutex;                   // 只保护 tasks
+        std::deque<Task> tasks;             // 自己从队头取，窃取者从队尾拿
+        std::atomic<size_t> size{0};        // tasks 的长度，窃取者不加锁先看一眼
+        std::thread thread;
+        // 以下只有本线程访问
+        std::vector<BackBatch> backs;       // 还没交回的回调，按 EventLoop 分组
+        size_t back_count = 0;
+        std::chrono::steady_clock::time_point back_since;   // 最早一个没交回的回调的时间
+        int64_t task_ns = 0;                // 最近任务耗时的指数平均（权重 1/8），估计下一个任务要执行多久
+    };
+    /* brief: 把任务放进某个工作线程的队列，必要时唤醒休眠的线程 */
+    void Submit(Task task);
+    /* brief: 工作线程主循环 */
+    void WorkerLoop(size_t index);
+    /* brief: 从自己的队列取一个任务 */
+    bool PopLocal(Worker *self, Task &task);
+    /* brief: 从其他工作线程的队尾偷一半任务，留一个给 task，其余放进自己的队列 */
+    bool Steal(size_t index, Task &task);
+    /* brief: 当前线程提交任务的目标工作线程 */
+    size_t HomeWorker();
+    /* brief: 把攒着的回调交回各个 EventLoop */
+    void FlushBack(Worker *self);
 private:
-    std::vector<std::thread> _workers; //业务线程
-    std::queue<std::function<void()>> _tasks; //生产者消费者模型的任务队列
-    std::mutex _queue_mutex;
-    std::condition_variable _cond;
-    bool _stop;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    bool _pin_cpu;
+    std::atomic<size_t> _pending;       // 所有队列里的任务总数
+    std::atomic<size_t> _idle;          // 正在休眠或准备休眠的工作线程数
+    std::atomic<size_t> _next_home;     // 给新的提交线程分配主工作线程
+    std::mutex _park_mutex;             // 只在休眠和唤醒时使用
+    std::condition_variable _park_cond;
+    std::atomic<bool> _stop;
 };
 
-}
\ No newline at end of file
+}
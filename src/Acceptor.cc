@@ -1,33 +1,99 @@
 #include "Acceptor.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
 #include <spdlog/spdlog.h>
 
 namespace webserver::src
 {
 
-Acceptor::Acceptor(EventLoop *loop, uint16_t port) 
-    : _loop(loop), _socket(), _channel(loop, -1)
+Acceptor::Acceptor(EventLoop *loop, uint16_t port, bool reuse_port) 
+    : _loop(loop), _socket(reuse_port ? CreateReusePortServer(port) : -1), _channel(loop, -1)
     {
-        bool ret = _socket.CreateServer(port);
-        assert(ret == true);
+        if(!reuse_port) {
+            bool ret = _socket.CreateServer(port);
+            assert(ret == true);
+        }
         SPDLOG_TRACE("创建监听套接字");
         _channel.SetFd(_socket.Fd());
         _channel.SetReadCallback(std::bind(&Acceptor::HandleRead, this));
         SPDLOG_TRACE("channel 设置读事件回调成功");
     }
 
-void Acceptor::HandleRead() {
-    net::InetAddress peer;  // 创建一个网络地址对象，用于存储对端地址
-    std::shared_ptr<net::Socket> socket = _socket.Accept(peer); // 接收连接
-    if(!socket) {
-        // accept socket failed
-        SPDLOG_ERROR("Accept socket failed!");
-        return;
+int Acceptor::CreateReusePortServer(uint16_t port) {
+    // net 模块的 CreateServer 在 bind 之前没有机会设置 SO_REUSEPORT，这里自己创建
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        SPDLOG_ERROR("创建监听套接字失败, errno = {}", errno);
+        abort();
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        SPDLOG_ERROR("设置 SO_REUSEPORT 失败, errno = {}", errno);
+        abort();
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        SPDLOG_ERROR("监听端口 {} 失败, errno = {}", port, errno);
+        abort();
+    }
+    return fd;
+}
+
+void Acceptor::SetIncomingCpu(int cpu) {
+    if(setsockopt(_socket.Fd(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0) {
+        SPDLOG_WARN("设置 SO_INCOMING_CPU 失败, cpu = {}, errno = {}", cpu, errno);
     }
-    int newfd = socket->Fd();
-    if(newfd < 0) {
-        return;
+}
+
+bool Acceptor::AttachCpuSteering(const std::vector<int> &cpus) {
+    if(cpus.empty()) return false;
+    // A = 收到连接的 CPU；依次比较 cpus[i]，相等就返回 i；都不相等返回 A % 组大小
+    std::vector<struct sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)));
+    for(size_t i = 0; i < cpus.size(); ++i) {
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(cpus[i]), 0, 1));
+        code.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(i)));
+    }
+    code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(cpus.size())));
+    code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+    struct sock_fprog prog;
+    prog.len = static_cast<unsigned short>(code.size());
+    prog.filter = code.data();
+    if(setsockopt(_socket.Fd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        SPDLOG_WARN("挂载 SO_REUSEPORT 的 CBPF 程序失败, errno = {}", errno);
+        return false;
     }
-    if(_accept_callback) _accept_callback(newfd);
+    return true;
+}
+
+void Acceptor::HandleRead() {
+    // 边缘触发模式下必须一直 accept 到 EAGAIN，否则剩下的连接不会再通知
+    bool drain = _channel.IsEdgeTriggered();
+    do {
+        net::InetAddress peer;  // 创建一个网络地址对象，用于存储对端地址
+        errno = 0;
+        std::shared_ptr<net::Socket> socket = _socket.Accept(peer); // 接收连接
+        if(!socket) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return; // 已经取完
+            // accept socket failed
+            SPDLOG_ERROR("Accept socket failed!");
+            return;
+        }
+        int newfd = socket->Fd();
+        if(newfd < 0) {
+            return;
+        }
+        if(_accept_callback) _accept_callback(newfd);
+    } while(drain);
 }
 
 }
\ No newline at end of file
@@ -6,26 +6,39 @@
 namespace webserver::src
 {
 
-using AcceptCallback = std::function<void(int)>;
-
 /* brief: Acceptor 是一种特殊的Connection，它只负责分配文件描述符/套接字给子线程EventLoop，子线程用它们构造出Connection */
 class Acceptor
 {
 public:
     /* 注：不能将启动读事件监控放在构造里面，理由和 Connection 一样，必须在设置完回调后再启动
         否则有可能构造完后立刻有实际，而此时对应回调函数还没设置，导致得不到处理 */
-    /* brief: 构造一个Accptor，只需要告诉它主EventLoop监听的端口即可 */
-    Acceptor(EventLoop *loop, uint16_t port);
+    /* brief: 构造一个Accptor，只需要告诉它主EventLoop监听的端口即可。
+              reuse_port 为 true 时监听套接字带 SO_REUSEPORT，多个 Acceptor 可以监听同一端口，由内核分配连接 */
+    Acceptor(EventLoop *loop, uint16_t port, bool reuse_port = false);
     /* brief: 暴露给上层，用于设置监听事件回调的函数 */
     void SetAcceptCallback(const AcceptCallback &acptcb) { _accept_callback = acptcb; }
+    /* brief: 监听套接字使用边缘触发，一次就绪把已完成的连接全部 accept 出来 */
+    void EnableEdgeTrigger() { _channel.EnableEdgeTrigger(); }
+    /* brief: 设置 SO_INCOMING_CPU：内核在同一个 SO_REUSEPORT 组里优先把在 cpu 上收到的连接交给这个监听套接字 */
+    void SetIncomingCpu(int cpu);
+    /* brief: 给整个 SO_REUSEPORT 组挂上 CBPF 程序：在 cpus[i] 上收到的连接交给组里第 i 个监听套接字（按 listen 的先后顺序），
+              其余 CPU 按 cpu % 组大小 分配。组内任意一个监听套接字调用一次即可，失败返回 false */
+    bool AttachCpuSteering(const std::vector<int> &cpus);
     /* brief: 给上传使用，开始监听（开启对读事件的监控） */
     void Listen() { 
+        // io_uring 后端由内核持续 accept（multishot），新连接直接交给回调，不需要监控可读事件
+        if(_loop->StartAccept(&_channel, _accept_callback)) {
+            SPDLOG_TRACE("channel: {} ,由 io_uring 持续 accept", _channel.GetFd());
+            return;
+        }
         _channel.EnableRead(); 
         SPDLOG_TRACE("channel: {} ,开启对读事件监控", _channel.GetFd());
     }
 private:
     /* brief: 给Accptor管理的底层 channel 设置读事件回调函数。由于 Acceptor 只需要承担分配新连接的工作，所以只需要设置可读事件回调 */
     void HandleRead();
+    /* brief: 创建带 SO_REUSEPORT 的非阻塞监听套接字 */
+    static int CreateReusePortServer(uint16_t port);
 private:
     net::TcpSocket _socket;
     EventLoop *_loop;
@@ -1,5 +1,4 @@
 #include "Buffer.h"
-#include "../net/Socket.hpp"
 #include <cerrno>
 #include <sys/uio.h>
 #include <spdlog/spdlog.h>
@@ -7,42 +6,85 @@
 namespace webserver::src
 {
 
+char *Buffer::Pullup(size_t len) {
+    assert(len <= ReadableBytes());
+    assert(len <= kBlockSize);
+    if(len <= ContiguousReadableBytes()) return ReadPos();
+    // 数据跨块了：取一个新块，把前 len 个字节拼进去，再挂到链头
+    BufferBlock *block = BufferPool::Local()->Acquire();
+    Read(block->data, len);
+    block->write_idx = len;
+    MoveReadOffset(len);
+    block->next = _head;
+    _head = block;
+    if(_tail == nullptr) _tail = block;
+    _readable += len;
+    return block->ReadPos();
+}
+
 ssize_t Buffer::ReadFd(int fd, int *savedErrno) {
-    char extrabuf[65536];
-    struct iovec vec[2];
+    struct iovec vec[kMaxReadBlocks + 1];
+    BufferBlock *extra[kMaxReadBlocks];
+    BufferPool *pool = BufferPool::Local();
     const size_t writable = WritableBytes();
-    //当buffer有足够空间，就直接写入buffer，不会写入extrabuf
-    //当buffer没有足够空间，就先写入extrabuf，一是减少扩容的开销，二是防止一次传入大量数据的攻击
-    vec[0].iov_base = WritePos();
-    vec[0].iov_len = writable;
-    vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof(extrabuf);
+    //当链尾块有空闲空间，就先读进链尾块
+    //剩下的部分读进从池里取出的新块，新块不够 64K 就按块补齐，用不上的再还回去，既不用扩容，也不用二次拷贝
+    int iovcnt = 0;
+    if(writable > 0) {
+        vec[iovcnt].iov_base = WritePos();
+        vec[iovcnt].iov_len = writable;
+        ++iovcnt;
+    }
+    int extracnt = 0;
+    size_t capacity = writable;
+    while(extracnt < kMaxReadBlocks && capacity < kMaxReadBlocks * kBlockSize) {
+        extra[extracnt] = pool->Acquire();
+        vec[iovcnt].iov_base = extra[extracnt]->data;
+        vec[iovcnt].iov_len = kBlockSize;
+        capacity += kBlockSize;
+        ++extracnt;
+        ++iovcnt;
+    }
 
-    const int iovcnt = (writable < sizeof(extrabuf)) ? 2 : 1;
     const ssize_t n = readv(fd, vec, iovcnt);
+    const int err = (n < 0) ? errno : 0;
+    if(savedErrno) *savedErrno = err;
+    size_t remain = n > 0 ? static_cast<size_t>(n) : 0;
+    if(remain > 0 && writable > 0) {
+        // 先填满链尾块
+        size_t used = std::min(remain, writable);
+        _tail->write_idx += used;
+        _readable += used;
+        remain -= used;
+    }
+    for(int i = 0; i < extracnt; ++i) {
+        if(remain == 0) {
+            pool->Recycle(extra[i]);
+            continue;
+        }
+        // 有部分数据读进了新块，把新块挂到链尾
+        size_t used = std::min(remain, kBlockSize);
+        extra[i]->write_idx = used;
+        if(_tail) _tail->next = extra[i];
+        else _head = extra[i];
+        _tail = extra[i];
+        _readable += used;
+        remain -= used;
+    }
+
     if(n == 0) {
         SPDLOG_TRACE("对端关闭连接");
         return -1;
     }
     else if(n < 0) {
         // 读取socket缓冲区出错
-        if(errno == EAGAIN || errno == EINTR) {
+        if(err == EAGAIN || err == EINTR) {
             return 0;
         }
-        SPDLOG_ERROR("读取 socket 缓冲区出错, errno = {}", errno);
+        SPDLOG_ERROR("读取 socket 缓冲区出错, errno = {}", err);
         return -1;
     }
-    else if(n <= writable) {
-        // 读取的大小小于可写区域大小，直接移动写下标
-        _writer_idx += n;
-    }
-    else {
-        // 读取的大小大于可写区域大小，说明有部分写入了extra buffer，append就行
-        _writer_idx = _buffer.size();
-        Append(extrabuf, n - writable);
-    }
-
     return n;
 };
 
-}
\ No newline at end of file
+}
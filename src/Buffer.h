@@ -1,55 +1,70 @@
 #pragma once
 
+#include "BufferPool.h"
+#include "ByteScan.h"
 #include <vector>
+#include <algorithm>
 #include <string>
+#include <string_view>
 #include <cassert>
 #include <memory>
 #include <cstring>
+#include <sys/types.h>
 
 //author: Haoyang Yang(Icepop)
 //string_view: 是 C++ 17 新增的特性，它的本质是一个指针，它指向字符串的切片
-//             它能够减少传参的拷贝，提高网络IO的效率      
+//             它能够减少传参的拷贝，提高网络IO的效率
 //question: 那我用指针、引用不也能实现一样的效果？
 //answer: 并非如此，因为指针和引用只能指向整个对象内存，很笨重，依赖于 '\0' 来判断字符串结尾。
 //        而 string_view 顾名思义，它能够对原字符串进行“切片”，想看哪部分就看哪部分，轻量化。
+//chain: Buffer 不再是一整块 vector<char>，而是由 BufferPool 提供的固定大小块串成的链表。
+//       追加数据只会在链尾挂新块，已读完的块直接还给池，不需要扩容拷贝，也不需要把可读数据 memmove 到前面。
 
 namespace webserver::src
 {
 
 class Buffer
-{   
+{
     using StringPiece = std::string_view;
 public:
-    static constexpr size_t InitialSize = 1024;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr int kMaxReadBlocks = 4;    // ReadFd 一次最多额外挂上的新块数量（4 * 16K = 64K）
+
+    Buffer() : _head(nullptr), _tail(nullptr), _readable(0) {}
+    ~Buffer() { Clear(); }
+    Buffer(const Buffer&) = delete;
+    Buffer &operator=(const Buffer&) = delete;
 
-    Buffer(const size_t& initialSize = InitialSize) : 
-        _buffer(initialSize), _reader_idx(0), _writer_idx(0) 
-        {}
-    ~Buffer() = default;
-    
     void Swap(Buffer &rhs) {
-        _buffer.swap(rhs._buffer);
-        std::swap(_reader_idx, rhs._reader_idx);
-        std::swap(_writer_idx, rhs._writer_idx);
+        std::swap(_head, rhs._head);
+        std::swap(_tail, rhs._tail);
+        std::swap(_readable, rhs._readable);
     }
 
-    size_t ReadableBytes() const { return _writer_idx - _reader_idx; }
-
-    size_t WritableBytes() const { return _buffer.size() - _writer_idx; }
+    size_t ReadableBytes() const { return _readable; }
+    /* brief: 链尾块剩余的可写空间，追加数据时不够会自动挂新块 */
+    size_t WritableBytes() const { return _tail ? _tail->WritableBytes() : 0; }
+    /* brief: 第一个块里连续可读的字节数，ReadPos() 开始的这么多字节可以直接当作连续内存使用 */
+    size_t ContiguousReadableBytes() const { return _head ? _head->ReadableBytes() : 0; }
+    /* brief: 返回第一个块的读位置，和 ContiguousReadableBytes() 配合使用 */
+    char *ReadPos() { return _head ? _head->ReadPos() : nullptr; }
 
-    char *ReadPos() { return Begin() + _reader_idx; }
+    const char *ReadPos() const { return _head ? _head->ReadPos() : nullptr; }
 
-    const char *ReadPos() const { return &*(_buffer.begin()) + _reader_idx; }
-
-    char *WritePos() { return Begin() + _writer_idx; }
+    char *WritePos() { return _tail ? _tail->WritePos() : nullptr; }
 
     /* brief: Equal to Write() and WriteAndPush() */
     void Append(const void *data, size_t len) {
-        if(len == 0) return;
-        EnsureWritableBytes(len);
         const char *pos = (const char*)data;
-        std::copy(pos, pos + len, WritePos());
-        MoveWriteOffset(len);
+        while(len > 0) {
+            if(WritableBytes() == 0) AppendBlock();
+            size_t n = std::min(len, _tail->WritableBytes());
+            std::memcpy(_tail->WritePos(), pos, n);
+            _tail->write_idx += n;
+            _readable += n;
+            pos += n;
+            len -= n;
+        }
     }
     /* brief: Equal to WriteString() and  WriteStringAndPsuh() */
     void Append(const std::string_view &data) {
@@ -57,28 +72,41 @@ public:
     }
     /* brief: Equal to WriteBuffer() and WriteBufferAndPush() */
     void Append(Buffer &data) {
-        Append(data.ReadPos(), data.ReadableBytes());
-    }
-
-    void EnsureWritableBytes(size_t len) {
-        if(len > WritableBytes()) MakeSpace(len);
-        assert(len <= WritableBytes());
+        for(BufferBlock *block = data._head; block; block = block->next) {
+            Append(block->ReadPos(), block->ReadableBytes());
+        }
     }
 
-    /* brief: 返回一段数据的视图，但不移动 reader_idx */
-    std::string_view PeekAsStringView(size_t len) const {
+    /* brief: 返回一段数据的视图，但不移动 reader_idx。数据跨块时会先把它们拼到一个块里 */
+    std::string_view PeekAsStringView(size_t len) {
         assert(len <= ReadableBytes());
-        return std::string_view(ReadPos(), len);
+        return std::string_view(Pullup(len), len);
     }
-    /* brief: Equal to MoveReadOffset(uint64_t step) */
+    /* brief: Equal to MoveReadOffset(uint64_t step)，读完的块会立刻还给池（链尾块只回绕下标，留着继续写） */
     void MoveReadOffset(size_t len) {
         assert(len <= ReadableBytes());
-        _reader_idx += len;
+        _readable -= len;
+        while(len > 0) {
+            size_t n = std::min(len, _head->ReadableBytes());
+            _head->read_idx += n;
+            len -= n;
+            if(_head->ReadableBytes() == 0 && _head != _tail) PopBlock();
+        }
+        if(_head && _head == _tail && _readable == 0) {
+            _head->read_idx = 0;
+            _head->write_idx = 0;
+        }
     }
 
-    void Read(void *buf, size_t len) {
+    void Read(void *buf, size_t len) const {
         assert(len <= ReadableBytes());
-        std::memcpy(buf, ReadPos(), len);
+        char *dst = (char*)buf;
+        for(BufferBlock *block = _head; len > 0; block = block->next) {
+            size_t n = std::min(len, block->ReadableBytes());
+            std::memcpy(dst, block->ReadPos(), n);
+            dst += n;
+            len -= n;
+        }
     }
 
     void ReadAndPop(void *buf, size_t len) {
@@ -86,9 +114,10 @@ public:
         MoveReadOffset(len);
     }
 
-    std::string ReadAsString(size_t len) {
+    std::string ReadAsString(size_t len) const {
         assert(len <= ReadableBytes());
-        std::string str(ReadPos(), len);
+        std::string str(len, '\0');
+        Read(&str[0], len);
         return str;
     }
 
@@ -98,10 +127,10 @@ public:
         return str;
     }
 
-    std::string Getline() {
-        char* pos = FindCrlf();
-        if(pos == NULL) return "";
-        return ReadAsString(pos - ReadPos() + 1);
+    std::string Getline() const {
+        size_t pos = FindCrlf();
+        if(pos == npos) return "";
+        return ReadAsString(pos + 1);
     }
 
     std::string GetlineAndPop() {
@@ -109,49 +138,73 @@ public:
         MoveReadOffset(str.size());
         return str;
     }
-    /* brief: 缩容函数，在接收完一次数据后缩回默认大小 */
-    void Shrink(size_t reserve) {
-        Buffer other;
-        other.EnsureWritableBytes(ReadableBytes() + reserve);
-        other.Append(std::string_view(ReadPos(), static_cast<int>(ReadableBytes())));
-        Swap(other);
+    /* brief: 归还已经消费完的块。替代原来的 Shrink：缓冲区读空时连链尾块也还给池，空闲连接不占用任何块 */
+    void ReleaseConsumed() {
+        if(_readable > 0) return;
+        Clear();
     }
-    /* brief: 读取套接字的接口，内置一个缓存区 */
+    /* brief: 保证前 len 个可读字节在同一个块里连续存放，返回其起始地址。只有数据恰好跨块时才需要拷贝 */
+    char *Pullup(size_t len);
+    /* brief: 读取套接字的接口，直接读进链尾空闲空间和从池里取出的新块 */
     ssize_t ReadFd(int fd, int *savedErrno);
 
     void Clear() {
-        _reader_idx = 0;
-        _writer_idx = 0;
-    }
-
-    char *FindCrlf() {
-        char *res = (char*)memchr(ReadPos(), '\n', ReadableBytes());
-        return res;
-    }
-private:
-    char *Begin() { return &*(_buffer.begin()); }
-
-    size_t ReadedBytes() const { return _reader_idx; }
-    /* brief: Equal to MoveWriteOffset() */
-    void MoveWriteOffset(size_t len) { _writer_idx += len; }
-
-    void MakeSpace(size_t len) {
-        if(len <= ReadedBytes() + WritableBytes()) {
-            size_t readable = ReadableBytes();
-            std::copy(ReadPos(), ReadPos() + readable, Begin());
-            _reader_idx = 0;
-            _writer_idx = _reader_idx + readable;
-            assert(readable == ReadableBytes());
+        BufferPool *pool = BufferPool::Local();
+        while(_head) {
+            BufferBlock *block = _head;
+            _head = block->next;
+            pool->Recycle(block);
+        }
+        _tail = nullptr;
+        _readable = 0;
+    }
+    /* brief: 返回第一个 '\n' 相对读位置的偏移，没有则返回 npos */
+    size_t FindCrlf() const { return Find('\n'); }
+    /* brief: 从相对读位置 from 处开始查找字节 c，返回它相对读位置的偏移，没有则返回 npos。
+              调用者记住上次查到哪里，数据分多次到达时就不需要从头重新扫描 */
+    size_t Find(char c, size_t from = 0) const {
+        size_t offset = 0;
+        for(BufferBlock *block = _head; block; block = block->next) {
+            size_t len = block->ReadableBytes();
+            if(from < offset + len) {
+                const char *begin = block->ReadPos() + (from > offset ? from - offset : 0);
+                const char *end = block->ReadPos() + len;
+                const char *res = FindByte(begin, end, c);
+                if(res != end) return offset + (res - block->ReadPos());
+            }
+            offset += len;
         }
-        else {
-            // 读过的空间加上可读的空间不够，就扩容
-            _buffer.resize(_writer_idx + len);
+        return npos;
+    }
+    /* brief: 返回相对读位置 offset 处的字节 */
+    char PeekByte(size_t offset) const {
+        assert(offset < ReadableBytes());
+        BufferBlock *block = _head;
+        while(offset >= block->ReadableBytes()) {
+            offset -= block->ReadableBytes();
+            block = block->next;
         }
+        return block->ReadPos()[offset];
+    }
+private:
+    /* brief: 在链尾挂一个新块 */
+    void AppendBlock() {
+        BufferBlock *block = BufferPool::Local()->Acquire();
+        if(_tail) _tail->next = block;
+        else _head = block;
+        _tail = block;
+    }
+    /* brief: 摘掉并归还链头的块 */
+    void PopBlock() {
+        BufferBlock *block = _head;
+        _head = block->next;
+        if(_head == nullptr) _tail = nullptr;
+        BufferPool::Local()->Recycle(block);
     }
 private:
-    std::vector<char> _buffer;
-    size_t _reader_idx;
-    size_t _writer_idx;
+    BufferBlock *_head;     // 链头，读从这里开始
+    BufferBlock *_tail;     // 链尾，写从这里开始
+    size_t _readable;       // 整条链上的可读字节总数
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,57 @@
+#include "BufferPool.h"
+
+namespace webserver::src
+{
+
+namespace {
+// 每个块都是单独申请的，所以块可以归还给任意线程的池，不会出现某个池析构后块悬空的问题
+thread_local BufferPool *t_local_pool = nullptr;
+}
+
+BufferPool::~BufferPool() {
+    if(t_local_pool == this) t_local_pool = nullptr;
+    while(_free_list) {
+        BufferBlock *block = _free_list;
+        _free_list = block->next;
+        delete block;
+    }
+}
+/* brief: 取一个干净的块 */
+BufferBlock *BufferPool::Acquire() {
+    if(_free_list == nullptr) return new BufferBlock();
+    BufferBlock *block = _free_list;
+    _free_list = block->next;
+    --_cached;
+    block->Reset();
+    return block;
+}
+/* brief: 归还一个块 */
+void BufferPool::Recycle(BufferBlock *block) {
+    if(block == nullptr) return;
+    if(_cached >= _max_cached) {
+        delete block;
+        return;
+    }
+    block->next = _free_list;
+    _free_list = block;
+    ++_cached;
+}
+/* brief: 预热 */
+void BufferPool::Reserve(size_t n) {
+    while(_cached < n && _cached < _max_cached) {
+        BufferBlock *block = new BufferBlock();
+        block->next = _free_list;
+        _free_list = block;
+        ++_cached;
+    }
+}
+
+BufferPool *BufferPool::Local() {
+    if(t_local_pool) return t_local_pool;
+    static thread_local BufferPool fallback;
+    return &fallback;
+}
+
+void BufferPool::SetLocal(BufferPool *pool) { t_local_pool = pool; }
+
+}
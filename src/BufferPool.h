@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// author: Haoyang Yang
+// filename: BufferPool.h
+// brief: Buffer 的块内存池。Buffer 由固定大小的 BufferBlock 串成链，块从所在 EventLoop 的 BufferPool 里取，
+//        用完还回 free list，稳态下收发数据不再触发堆分配，也不需要 memmove 搬移已读数据
+
+namespace webserver::src
+{
+
+static constexpr size_t kBlockSize = 16 * 1024;         // 单个块的数据区大小，需要能装下一个完整的请求头
+static constexpr size_t kDefaultMaxCachedBlocks = 256;  // 每个池最多缓存的空闲块数量，超出的直接还给系统
+
+/* brief: Buffer 的基本存储单元，[read_idx, write_idx) 是可读数据，[write_idx, kBlockSize) 是可写空间 */
+struct BufferBlock {
+    BufferBlock *next = nullptr;
+    size_t read_idx = 0;
+    size_t write_idx = 0;
+    char data[kBlockSize];
+
+    size_t ReadableBytes() const { return write_idx - read_idx; }
+    size_t WritableBytes() const { return kBlockSize - write_idx; }
+    char *ReadPos() { return data + read_idx; }
+    const char *ReadPos() const { return data + read_idx; }
+    char *WritePos() { return data + write_idx; }
+    void Reset() { next = nullptr; read_idx = 0; write_idx = 0; }
+};
+
+class BufferPool
+{
+public:
+    explicit BufferPool(size_t max_cached = kDefaultMaxCachedBlocks) : _free_list(nullptr), _cached(0), _max_cached(max_cached) {}
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool &operator=(const BufferPool&) = delete;
+
+    /* brief: 取一个干净的块，free list 为空时才向系统申请 */
+    BufferBlock *Acquire();
+    /* brief: 归还一个块，池满了就直接释放 */
+    void Recycle(BufferBlock *block);
+    /* brief: 预热，提前申请 n 个块放进 free list */
+    void Reserve(size_t n);
+    /* brief: 当前缓存的空闲块数量 */
+    size_t CachedBlocks() const { return _cached; }
+
+    /* brief: 获取当前线程使用的池。EventLoop 线程返回该 EventLoop 的池，其它线程返回一个线程私有的兜底池 */
+    static BufferPool *Local();
+    /* brief: 将 pool 设置为当前线程使用的池，由 EventLoop 在所属线程内调用 */
+    static void SetLocal(BufferPool *pool);
+private:
+    BufferBlock *_free_list;    // 空闲块链表
+    size_t _cached;             // 空闲块数量
+    size_t _max_cached;         // 空闲块数量上限
+};
+
+}
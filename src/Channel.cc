@@ -5,7 +5,8 @@
 namespace webserver::src
 {
 
-Channel::Channel(EventLoop *loop, int fd) : _fd(fd), _loop(loop), _events(0), _revents(0) {}
+Channel::Channel(EventLoop *loop, int fd) 
+    : _fd(fd), _loop(loop), _events(0), _revents(0), _registered(0), _pending_revents(0), _edge_triggered(false), _lazy_write(false) {}
 
 void Channel::SetFd(int fd) { _fd = fd; }
 void Channel::SetRevents(uint32_t events) { _revents = events; }
@@ -15,40 +16,96 @@ void Channel::SetErrorCallback(const EventCallback &cb) { _error_callback = cb;
 void Channel::SetCloseCallback(const EventCallback &cb) { _close_callback = cb; }
 void Channel::SetEventCallback(const EventCallback &cb) { _event_callback = cb; }
 
+void Channel::EnableEdgeTrigger() {
+    if(_edge_triggered || !_loop->SupportsEdgeTrigger()) return;
+    _edge_triggered = true;
+    if(_registered != 0) Update();
+}
+
 int Channel::GetFd() { return _fd; }
-uint32_t Channel::GetEvents() { return _events; }
+uint32_t Channel::GetEvents() {
+    if(!_edge_triggered) return _events;
+    // 边缘触发：读事件按需注册，EPOLLOUT 常驻，由上层自己记录是否需要写
+    if(_events == 0) return 0;
+    return _events | EPOLLOUT | EPOLLET;
+}
 
 bool Channel::ReadAble() { return (_events & EPOLLIN); }
 bool Channel::WritAble() { return (_events & EPOLLOUT); }
 
 void Channel::EnableRead() { _events |= EPOLLIN; Update(); }
-void Channel::EnableWrite() { _events |= EPOLLOUT; Update(); }
+void Channel::EnableWrite() {
+    _events |= EPOLLOUT;
+    // 边缘触发模式下 EPOLLOUT 只会在 socket 从不可写变为可写时通知一次，这里直接在循环末尾尝试写，写不完再等通知
+    if(_edge_triggered) PendEvents(EPOLLOUT);
+    Update();
+}
+void Channel::EnableWriteLazily() {
+    _events |= EPOLLOUT;
+    _lazy_write = true;
+    PendEvents(EPOLLOUT);
+}
 void Channel::DisableRead() { _events &= ~EPOLLIN; Update(); }
 void Channel::DisableWrite() { _events &= ~EPOLLOUT; Update(); }
 void Channel::DisableAll() { _events = 0; Update(); }
 
-void Channel::Remove() { return _loop->RemoveEvent(this); }
-void Channel::Update() { return _loop->UpdateEvent(this); }
+void Channel::Remove() {
+    if(_pending_revents != 0) {
+        _pending_revents = 0;
+        _loop->CancelPending(this);
+    }
+    // 移除后不再关心任何事件，之后的 Update 不会把它重新加回 poller
+    _events = 0;
+    _lazy_write = false;
+    _registered = 0;
+    return _loop->RemoveEvent(this);
+}
+void Channel::Update() {
+    uint32_t events = GetEvents();
+    if(events == _registered) return; // 注册的事件没变，不需要 epoll_ctl
+    _registered = events;
+    return _loop->UpdateEvent(this);
+}
 
 void Channel::HandlerEvent() {
     SPDLOG_TRACE("Channel = {}, revents = {}", _fd, _revents);
-    if((_revents & EPOLLIN) || (_revents & EPOLLRDHUP) || (_revents & EPOLLPRI)) {
+    // 边缘触发模式下 EPOLLOUT 常驻，上层不关心写事件时过滤掉；暂停读取后补发的读事件同样过滤掉
+    uint32_t revents = _revents;
+    if(!(_events & EPOLLOUT)) revents &= ~EPOLLOUT;
+    if(!(_events & EPOLLIN)) revents &= ~EPOLLIN;
+    if((revents & EPOLLIN) || (revents & EPOLLRDHUP) || (revents & EPOLLPRI)) {
         if(_read_callback) _read_callback();
     }
 
-    if((_revents & EPOLLOUT)) {
+    if((revents & EPOLLOUT)) {
         /* epoll 监控到写事件就绪 */
         if(_write_callback) _write_callback();
     }
-    else if(_revents & EPOLLERR) {
+    else if(revents & EPOLLERR) {
         /* epoll 监控出错了 */
         if(_error_callback) _error_callback();
     }
-    else if(_revents & EPOLLHUP) {
+    else if(revents & EPOLLHUP) {
         /* epoll 监控到对端挂断了 */
         if(_close_callback) _close_callback();
     }
     
     if(_event_callback) _event_callback();
 }
+
+void Channel::PendEvents(uint32_t events) {
+    if(_pending_revents == 0) _loop->QueuePending(this);
+    _pending_revents |= events;
+}
+
+void Channel::HandlePendingEvents() {
+    if(_pending_revents == 0) return;
+    _revents = _pending_revents;
+    _pending_revents = 0;
+    bool lazy_write = _lazy_write;
+    _lazy_write = false;
+    HandlerEvent();
+    // 延迟开启的写监控：写完了回调里已经关掉，注册的事件不变；没写完才在这里注册 EPOLLOUT
+    if(lazy_write) Update();
+}
 }
\ No newline at end of file
@@ -30,8 +30,14 @@ public:
     void SetCloseCallback(const EventCallback &cb);
     void SetEventCallback(const EventCallback &cb);
     // ================================================== //
+    /* brief: 开启边缘触发（EPOLLET）模式，已经注册到 poller 的会按新事件重新注册，需要在所属 EventLoop 开始循环之前调用。
+              该模式下 EPOLLOUT 始终注册在内核里，EnableWrite/DisableWrite 只修改本地关心的事件，不再调用 epoll_ctl。
+              后端不支持边缘触发（内核不支持多次触发 poll 请求的 io_uring）时保持水平触发 */
+    void EnableEdgeTrigger();
+    bool IsEdgeTriggered() const { return _edge_triggered; }
     /* brief: 以下接口都是用于获取 Channel 有关信息的接口，用在 poller 里面，方便获取该连接想监听的事件 */
     int GetFd();
+    /* brief: 需要注册到 poller 里的事件 */
     uint32_t GetEvents();
 
     /* brief: 用于判断是否开启了读/写监控 */
@@ -41,6 +47,10 @@ public:
     /* brief: 用于对 epoll 关心的事件进行设置。底层动作就是对“关心”红黑树进行 CRUD （用 epoll_ctl） */
     void EnableRead();
     void EnableWrite();
+    /* brief: 延迟开启写监控：不调用 epoll_ctl，在本轮循环末尾直接调用一次写回调，回调里没写完（仍然关心写事件）时
+              才把 EPOLLOUT 注册进 poller。socket 发送缓冲区通常是空的，这样省掉两次 epoll_ctl 和一轮 epoll_wait，
+              同一轮里追加的数据也在末尾一起写出 */
+    void EnableWriteLazily();
     void DisableRead();
     void DisableWrite();
     void DisableAll();
@@ -51,11 +61,20 @@ public:
 
     /* brief: 在 poll 对应关心的事件就绪后，判断是哪个事件，并分配执行对应事件回调 */
     void HandlerEvent();
+    /* brief: 在本轮循环末尾补发一次 events 事件（不经过 poller）。用于边缘触发模式下：socket 已知可写时启动发送，
+              或者一次没读完时继续读 */
+    void PendEvents(uint32_t events);
+    /* brief: 由 EventLoop 在循环末尾调用，执行补发的事件 */
+    void HandlePendingEvents();
 private:
     int _fd;
     EventLoop *_loop;
-    uint32_t _events;
-    uint32_t _revents;
+    uint32_t _events;           // 本地关心的事件
+    uint32_t _revents;          // 就绪的事件
+    uint32_t _registered;       // 已经注册到 poller 里的事件，不变就不调用 epoll_ctl
+    uint32_t _pending_revents;  // 等待在循环末尾补发的事件
+    bool _edge_triggered;       // 是否为边缘触发模式
+    bool _lazy_write;           // 写监控是延迟开启的，补发的写事件处理完后再同步到 poller
 
     EventCallback _read_callback;
     EventCallback _write_callback;
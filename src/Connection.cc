@@ -1,36 +1,52 @@
 #include "Connection.h"
+#include <sys/epoll.h>
 
 namespace webserver::src
 {
 Connection::Connection(EventLoop *loop, uint64_t conn_id, int sockfd)
     : _conn_id(conn_id), _sockfd(sockfd), _loop(loop), _enable_inactive_release(true),
-    _status(CONNECTING), _socket(sockfd), _channel(_loop, _sockfd), _filectx()
+    _status(CONNECTING), _socket(sockfd), _channel(_loop, _sockfd)
     {
-        _channel.SetCloseCallback(std::bind(&Connection::HandleClose, this));
-        _channel.SetEventCallback(std::bind(&Connection::HandleEvent, this));
-        _channel.SetReadCallback(std::bind(&Connection::HandleRead, this));
-        _channel.SetWriteCallback(std::bind(&Connection::HandleWrite, this));
-        _channel.SetErrorCallback(std::bind(&Connection::HandleError, this));
+        // 回调只捕获 this，std::function 可以直接存下，构造连接时不需要额外申请内存
+        _channel.SetCloseCallback([this]() { HandleClose(); });
+        _channel.SetEventCallback([this]() { HandleEvent(); });
+        _channel.SetReadCallback([this]() { HandleRead(); });
+        _channel.SetWriteCallback([this]() { HandleWrite(); });
+        _channel.SetErrorCallback([this]() { HandleError(); });
     }
 
+/* brief: 对端地址 */
+const struct sockaddr_storage &Connection::PeerAddress() {
+    if(!_peer_known) {
+        _peer_known = true;
+        socklen_t len = sizeof(_peer);
+        if(getpeername(_sockfd, reinterpret_cast<struct sockaddr*>(&_peer), &len) < 0) _peer.ss_family = AF_UNSPEC;
+    }
+    return _peer;
+}
 /* brief: 建立函数，执行该函数即完成对一个连接的建立 */
 void Connection::Established() { _loop->RunInLoop(std::bind(&Connection::EstablishedInLoop, this)); }
 
 /* brief: 发送数据，需要在对应的 EventLoop线程 内执行 */
 void Connection::Send(const char *data, size_t len) {
-    /* Buffer buf;
-    buf.Append(data, len);
-    _loop->RunInLoop(std::bind(&Connection::SendInLoop, this, std::move(buf))); */
-    std::string str(data, len);
-    _loop->RunInLoop([this, str = std::move(str)]() {
-        if(_status == DISCONNECTED) return;
-        _out_buffer.Append(str);
-        if(!_channel.WritAble()) _channel.EnableWrite();
-    });
+    Send(std::string(data, len));
+}
+/* brief: 发送数据，字符串直接 move 进输出队列 */
+void Connection::Send(std::string &&data) {
+    if(_loop->IsInLoop()) return SendInLoop(data);
+    _loop->PushInLoop([this, str = std::move(data)]() mutable { SendInLoop(str); });
+}
+/* brief: 发送借用的数据 */
+void Connection::SendBorrowed(const char *data, size_t len, std::shared_ptr<const void> holder) {
+    _loop->RunInLoop(std::bind(&Connection::SendBorrowedInLoop, this, data, len, std::move(holder)));
 }
 /* brief: SendFile 发送 */
 void Connection::SendFile(int fd, off_t offset, size_t size) {
-    _loop->RunInLoop(std::bind(&Connection::SendFileInLoop, this, fd, offset, size));
+    _loop->RunInLoop(std::bind(&Connection::SendFileInLoop, this, fd, offset, size, nullptr));
+}
+/* brief: SendFile 发送借用的 fd */
+void Connection::SendFile(int fd, off_t offset, size_t size, std::shared_ptr<const void> holder) {
+    _loop->RunInLoop(std::bind(&Connection::SendFileInLoop, this, fd, offset, size, std::move(holder)));
 }
 /* brief: 进入关闭连接流程，需要在对应的 EventLoop线程 内执行 */
 void Connection::Shutdown() { _loop->RunInLoop(std::bind(&Connection::ShutdownInLoop, this)); }
@@ -38,6 +54,21 @@ void Connection::Shutdown() { _loop->RunInLoop(std::bind(&Connection::ShutdownIn
 void Connection::EnableInactiveRelease(int sec) { _loop->RunInLoop(std::bind(&Connection::EnableInactiveReleaseInLoop, this, sec)); }
 /* brief: 关闭非活跃连接销毁，需要在对应的 EventLoop线程 内执行 */
 void Connection::CancleInactiveRelease() { _loop->RunInLoop(std::bind(&Connection::CancleInactiveReleaseInLoop, this)); }
+/* brief: 暂停读取 */
+void Connection::PauseRead(ReadPauseReason reason) {
+    _loop->AssertInLoop();
+    if(_status != CONNECTED) return;
+    _read_pauses |= reason;
+    if(_channel.ReadAble()) _channel.DisableRead();
+}
+/* brief: 恢复读取。用 PushInLoop 而不是 RunInLoop：使用者可能在要求暂停的回调里就调用它，要保证在暂停之后执行 */
+void Connection::ResumeRead(ReadPauseReason reason) {
+    _loop->PushInLoop([self = shared_from_this(), reason]() { self->ResumeReadInLoop(reason); });
+}
+/* brief: 等待输出队列积压降下来 */
+void Connection::NotifyWhenDrained(size_t threshold, const Functor &cb) {
+    _loop->RunInLoop([self = shared_from_this(), threshold, cb]() { self->NotifyWhenDrainedInLoop(threshold, cb); });
+}
 /* brief: 协议上下文切换函数，用于更新/切换连接使用的协议。需要在对应的 EventLoop线程 内执行 */
 void Connection::Upgrade(const std::any &context,
                 const ConnectedCallback &conncb,
@@ -54,12 +85,23 @@ void Connection::Upgrade(const std::any &context,
 /* brief：读事件就绪回调函数，用于 epoll 读事件就绪后，读取 socket输入缓冲区 的数据，并递交给上层使用者设置的业务函数处理 */
 void Connection::HandleRead() {
     // epoll 监控的可读事件触发 EPOLLINT，channel 执行读事件回调
-    // step1：读取 内核sockfd缓冲区 里的数据
+    // step1：读取 内核sockfd缓冲区 里的数据。边缘触发模式下要一直读到 EAGAIN，否则剩下的数据不会再通知
     int savedError = 0;
-    ssize_t ret = _in_buffer.ReadFd(_sockfd, &savedError);
-    if(ret < 0) {
-        // 读取失败，进入正常关闭连接流程：检查缓冲区还有没有待发送的数据
-        return ShutdownInLoop();
+    size_t total_read_in_loop = 0;
+    while(true) {
+        ssize_t ret = _in_buffer.ReadFd(_sockfd, &savedError);
+        if(ret < 0) {
+            // 读取失败，进入正常关闭连接流程：检查缓冲区还有没有待发送的数据
+            return ShutdownInLoop();
+        }
+        _loop->GetMetrics()->bytes_read.Add(ret);
+        if(ret == 0 || !_channel.IsEdgeTriggered()) break;
+        total_read_in_loop += ret;
+        if(total_read_in_loop >= kMaxBytesPerLoop) {
+            // 单次 Loop 的配额用尽，剩下的数据留到下一轮循环再读，避免一个连接饿死其他连接
+            _channel.PendEvents(EPOLLIN);
+            break;
+        }
     }
     SPDLOG_TRACE("[EventLoop: {}, Connection: {}] socket 缓冲区数据读取到 in_buffer内", _loop->GetId(), _conn_id);
     //step2：将读取到的数据交给上层进行业务处理
@@ -69,69 +111,59 @@ void Connection::HandleRead() {
     }
 }
 
-/* brief：写事件回调函数，用于 epoll 写事件就绪后（即上层调用 Send 函数，把数据交给了连接的发送缓冲区），将连接发送缓冲区的内容传给 socket发送缓冲区 */
+/* brief：写事件回调函数，用于 epoll 写事件就绪后（即上层调用 Send 函数，把数据交给了连接的输出队列），将输出队列的内容传给 socket发送缓冲区 */
 void Connection::HandleWrite() {
     size_t total_sent_in_loop = 0; // 记录本次回调累计发送的数据量
-    // step1: 优先发送内存Buffer（通常Headers在这里）
-    if(_out_buffer.ReadableBytes() > 0) {
-        while(_out_buffer.ReadableBytes() > 0) {
-            // 内存输出缓冲区Buffer有数据，发送
-            SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 输出缓冲区有数据待发送: {}", _loop->GetId(), _conn_id, _out_buffer.ReadableBytes());
-            ssize_t ret = _socket.NonBlockSend(_out_buffer.ReadPos(), _out_buffer.ReadableBytes());
+    while(!_out_queue.Empty()) {
+        Segment &front = _out_queue.Front();
+        if(front.IsFile()) {
+            // step1: 队首是文件段（Body通常在这里），走 sendfile 零拷贝
+            size_t send_len = std::min(front.len, kMaxSendChunk);
+            SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 需要发送文件的大小为: {}bytes", _loop->GetId(), _conn_id, send_len);
+            ssize_t sent = sendfile(_sockfd, front.fd, &front.offset, send_len);
+            if(sent < 0 && (errno == EAGAIN || errno == EINTR)) break;
+            if(sent <= 0) {
+                // 出错，或文件被截断导致读不到数据
+                SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 文件发送失败, 关闭并释放连接", _loop->GetId(), _conn_id);
+                _out_queue.Clear();
+                return Release();
+            }
+            SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 发送了 {}bytes 的文件", _loop->GetId(), _conn_id, sent);
+            _out_queue.ConsumeFile(sent);
+            _loop->GetMetrics()->sendfile_bytes.Add(sent);
+            total_sent_in_loop += sent;
+            if(static_cast<size_t>(sent) < send_len) break; // socket 发送缓冲区满了
+        } else {
+            // step2: 队首连续的内存段（Headers、动态Body、尾部数据）合并成一次 writev
+            struct iovec iov[kMaxIovecs];
+            size_t expect = 0;
+            int cnt = _out_queue.PrepareIovec(iov, kMaxIovecs, &expect);
+            SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 输出队列有 {} 段数据待发送: {}", _loop->GetId(), _conn_id, cnt, expect);
+            ssize_t ret = writev(_sockfd, iov, cnt);
             if(ret < 0) {
+                if(errno == EAGAIN || errno == EINTR) break;
                 // Socket发送数据失败（一般是对端关闭连接)
                 return Release();
             }
-            SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 输出缓冲区发送了数据: {}", _loop->GetId(), _conn_id, ret);
-            _out_buffer.MoveReadOffset(ret);
+            SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 输出队列发送了数据: {}", _loop->GetId(), _conn_id, ret);
+            _out_queue.Consume(ret);
+            _loop->GetMetrics()->bytes_written.Add(ret);
             total_sent_in_loop += ret;
-
-            if(total_sent_in_loop >= kMaxBytesPerLoop) {
-                // 单次 Loop 的配额用尽，主动让出 Cpu
-                SPDLOG_TRACE("[Connnection: {}] 单次发送文件配额用尽, 此次发送了: {} bytes", _conn_id, total_sent_in_loop);
-                return;
-            }
+            if(static_cast<size_t>(ret) < expect) break; // socket 发送缓冲区满了
         }
-    }
 
-    // step2: 如果内存输出缓冲区Buffer发送完了，检查是否有文件要发送（Body通常在这里）
-    if(_out_buffer.ReadableBytes() == 0 && _filectx.active) {
-        // 原来SendFileInLoop 的逻辑移到这里
-        // 真正的 sendfile 系统调用逻辑
-        while(_filectx.remain > 0) {
-            size_t send_len = std::min(_filectx.remain, kMaxSendChunk);
-            SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 需要发送文件的大小为: {}bytes", _loop->GetId(), _conn_id, send_len);
-            ssize_t sent = sendfile(_sockfd, _filectx.fd, &_filectx.offset, send_len);
-            if(sent > 0) {
-                SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 发送了 {}bytes 的文件", _loop->GetId(), _conn_id, sent);
-                _filectx.remain -= sent;
-                total_sent_in_loop += sent;
-                if(_filectx.remain == 0) {
-                    SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 文件发送完毕", _loop->GetId(), _conn_id);
-                    close(_filectx.fd);
-                    _filectx.Reset();
-                    break;
-                }
-                // 配额检查
-                if(total_sent_in_loop >= kMaxBytesPerLoop) {
-                    SPDLOG_TRACE("[Connection: {}] 配额用尽, 此次写了 {} bytes", _conn_id, total_sent_in_loop);
-                    return;
-                }
-            } else {
-                if(errno != EAGAIN || errno != EINTR) {
-                    SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 文件发送失败, 关闭并释放连接");
-                    close(_filectx.fd);
-                    _filectx.Reset();
-                    return Release();
-                }
-                break;
-            }
+        if(total_sent_in_loop >= kMaxBytesPerLoop) {
+            // 单次 Loop 的配额用尽，主动让出 Cpu。边缘触发模式下 socket 仍然可写，不会再收到通知，只能自己补发
+            SPDLOG_TRACE("[Connection: {}] 配额用尽, 此次写了 {} bytes", _conn_id, total_sent_in_loop);
+            if(_channel.IsEdgeTriggered()) _channel.PendEvents(EPOLLOUT);
+            return UpdatePendingBytes();
         }
     }
+    UpdatePendingBytes();
 
-    // step3: 检查内存输出缓冲区Buffer和文件是否发送完毕
-    if(_out_buffer.ReadableBytes() == 0 && !_filectx.active) {
-        SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 输出缓冲区和文件没有待发送的数据", _loop->GetId(), _conn_id);
+    // step3: 检查输出队列是否发送完毕
+    if(_out_queue.Empty()) {
+        SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 输出队列没有待发送的数据", _loop->GetId(), _conn_id);
         _channel.DisableWrite();
 
         if(_status == DISCONNECTING) {
@@ -163,7 +195,8 @@ void Connection::HandleEvent() {
 
 /* brief: 关闭并释放连接的函数，不能暴露给外部，需要在对应的 EventLoop线程 内执行 */
 void Connection::Release() {
-    _loop->PushInLoop(std::bind(&Connection::ReleaseInLoop, this));
+    // 任务持有一份 shared_ptr：连接表可能在同一线程里被立即清理（多监听模式），重复投递的释放任务不能访问已析构的对象
+    _loop->PushInLoop(std::bind(&Connection::ReleaseInLoop, shared_from_this()));
 }
 
 /* brief：建立连接的函数，将连接状态置为已连接，然后开始对读事件的监控，并调用使用者设置的建立连接回调函数 */
@@ -183,48 +216,58 @@ void Connection::ReleaseInLoop() {
     if(_status == DISCONNECTED) return;
     //step1：修改连接状态，置为DISCONNECTED
     _status = DISCONNECTED;
+    _loop->GetMetrics()->closed.Add();
+    _loop->GetLoad()->connections.fetch_sub(1, std::memory_order_relaxed);
     //step2：移除连接的事件监控
     _channel.Remove();
     //step3：关闭描述符
     _socket.Close();
-    // === FIX START: 关闭残留的文件描述符 ===
-    if (_filectx.active && _filectx.fd >= 0) {
-        close(_filectx.fd);
-        _filectx.Reset();
-        SPDLOG_INFO("连接关闭，清理文件");
+    // 清空输出队列，关闭残留的文件描述符
+    if(!_out_queue.Empty()) {
+        _out_queue.Clear();
+        SPDLOG_DEBUG("连接关闭，清理输出队列");
     }
     //step4：如果有定时销毁任务，就取消任务
     if(_loop->HasTimer(_conn_id)) CancleInactiveReleaseInLoop();
-    //step5：调用关闭回调函数（避免先移除服务器的连接管理信息导致Connection释放后的处理（use-after-free）
+    //step5：在所属线程内把输入缓冲区的块还给本 EventLoop 的池（Connection 最终可能在主线程析构）
+    _in_buffer.Clear();
+    // 唤醒等待积压降下来的生产者，让它发现连接已经关闭
+    StorePendingBytes(0);
+    _closed.store(true, std::memory_order_release);
+    if(_drain_callback) {
+        Functor cb = std::move(_drain_callback);
+        _drain_callback = nullptr;
+        cb();
+    }
+    //step6：调用关闭回调函数（避免先移除服务器的连接管理信息导致Connection释放后的处理（use-after-free）
     if(_closed_callback) _closed_callback(shared_from_this());
     if(_server_closed_callback) _server_closed_callback(shared_from_this());
 }
 
-/* brief：连接的发送数据函数，将要发送的数据交给 Connection发送缓冲区，然后开启读事件监控 */
-void Connection::SendInLoop(Buffer &buf) {
+/* brief：连接的发送数据函数，将要发送的数据作为一个段挂到输出队列，然后开启写事件监控 */
+void Connection::SendInLoop(std::string &data) {
     if(_status == DISCONNECTED) return;
-    //将要发送的数据放入连接的发送缓冲区，并开启可写事件监控，表示可以写入内核缓冲区了
-    SPDLOG_TRACE("将要发送的数据放入连接的输出缓冲区");
-    _out_buffer.Append(buf);
-    SPDLOG_TRACE("输出缓冲区可读字节数: {}", _out_buffer.ReadableBytes());
-    if(_channel.WritAble() == false) _channel.EnableWrite();
+    _out_queue.PushString(std::move(data));
+    StorePendingBytes(_out_queue.QueuedBytes());
+    SPDLOG_TRACE("输出队列待发送字节数: {}", _out_queue.QueuedBytes());
+    if(_channel.WritAble() == false) _channel.EnableWriteLazily();
 }
-/* brief: 实际发送的函数 */
-void Connection::SendFileInLoop(int fd, off_t offset, size_t size) {
-    // 如果上一个文件还没发送完，这里需要处理策略（报错或排队）
-    if(_filectx.active) {
-        //上一个文件还没发完，应用层回等待上一条发完
-        close(fd);
-        SPDLOG_WARN("Connection繁忙, 不发送该文件");
-        return;       
+/* brief: 借用数据的发送函数 */
+void Connection::SendBorrowedInLoop(const char *data, size_t len, const std::shared_ptr<const void> &holder) {
+    if(_status == DISCONNECTED) return;
+    _out_queue.PushBorrowed(data, len, holder);
+    StorePendingBytes(_out_queue.QueuedBytes());
+    if(_channel.WritAble() == false) _channel.EnableWriteLazily();
+}
+/* brief: 实际发送的函数，文件区间排在之前的段后面，可以连续发送多个文件 */
+void Connection::SendFileInLoop(int fd, off_t offset, size_t size, const std::shared_ptr<const void> &holder) {
+    if(_status == DISCONNECTED) {
+        if(!holder) close(fd);
+        return;
     }
-    // 上一个文件发完了, Connection 空闲
-    _filectx.fd = fd;
-    _filectx.offset = offset;
-    _filectx.remain = size;
-    _filectx.active = true;
-
-    if(!_channel.WritAble()) _channel.EnableWrite();
+    _out_queue.PushFile(fd, offset, size, holder);
+    StorePendingBytes(_out_queue.QueuedBytes());
+    if(!_channel.WritAble()) _channel.EnableWriteLazily();
 }
 
 /* brief：关闭连接的函数，执行实际断开/销毁连接前的流程，再调用实际的断开/销毁函数 */
@@ -234,14 +277,14 @@ void Connection::ShutdownInLoop() {
     if(_in_buffer.ReadableBytes() > 0) {
         if(_message_callback) _message_callback(shared_from_this(), &_in_buffer);
     }
-    //只有当所有数据（Buffer 和 File）都发完了，才直接Release
-    if(_out_buffer.ReadableBytes() == 0 && !_filectx.active) {
+    //只有当输出队列里的数据（内存段和文件段）都发完了，才直接Release
+    if(_out_queue.Empty()) {
         SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 所以数据都发送完了，直接释放连接", _loop->GetId(), _conn_id);
         Release();
     } else {
         //还有数据没发完，确保 Write 事件开启，让 HandleWrite在发完后触发 Release
         SPDLOG_TRACE("[EventLoop: {}, Connection: {}] 还有数据没发完，开启可写事件监控", _loop->GetId(), _conn_id);
-        if(!_channel.WritAble()) _channel.EnableWrite();
+        if(!_channel.WritAble()) _channel.EnableWriteLazily();
     }
 }
 
@@ -251,7 +294,45 @@ void Connection::EnableInactiveReleaseInLoop(int sec) {
     _enable_inactive_release = true;
     //step2：添加/刷新定时销毁任务
     if(_loop->HasTimer(_conn_id)) return _loop->RefreshTimer(_conn_id);
-    _loop->AddTimer(_conn_id, sec, std::bind(&Connection::Release, this));
+    _loop->AddTimer(_conn_id, sec, [this]() { Release(); });
+}
+
+/* brief：恢复读取的实际执行 */
+void Connection::ResumeReadInLoop(ReadPauseReason reason) {
+    if(_status != CONNECTED || (_read_pauses & reason) == 0) return;
+    _read_pauses &= ~reason;
+    // 还有别的原因没有解除（例如协程还没结束时积压先降了下来），继续暂停
+    if(_read_pauses != 0 || _channel.ReadAble()) return;
+    _channel.EnableRead();
+    // 暂停期间已经读进来的数据不会再触发读事件，先交给上层
+    if(_in_buffer.ReadableBytes() > 0 && _message_callback) _message_callback(shared_from_this(), &_in_buffer);
+}
+
+/* brief：等待输出队列积压降下来的实际执行 */
+void Connection::NotifyWhenDrainedInLoop(size_t threshold, const Functor &cb) {
+    if(_status == DISCONNECTED || _out_queue.QueuedBytes() <= threshold) return cb();
+    _drain_threshold = threshold;
+    _drain_callback = cb;
+}
+/* brief：更新积压字节数，唤醒等待的回调 */
+void Connection::UpdatePendingBytes() {
+    StorePendingBytes(_out_queue.QueuedBytes());
+    if(_drain_callback && _out_queue.QueuedBytes() <= _drain_threshold) {
+        Functor cb = std::move(_drain_callback);
+        _drain_callback = nullptr;
+        cb();
+    }
+}
+
+/* brief：检查高低水位 */
+void Connection::CheckWaterMarks(size_t bytes) {
+    if(!_above_high_water && bytes >= _high_water_mark) {
+        _above_high_water = true;
+        if(_high_water_callback) _high_water_callback(shared_from_this());
+    } else if(_above_high_water && bytes <= _low_water_mark) {
+        _above_high_water = false;
+        if(_low_water_callback) _low_water_callback(shared_from_this());
+    }
 }
 
 /* brief：关闭超时连接销毁机制 */
@@ -274,11 +355,4 @@ void Connection::UpgradeInLoop(const std::any &context,
         _anyevent_callback = anyeventcb;
     }
 
-/* brief: 开始响应 */
-void Connection::StartResponseInLoop(bool expect_close) {
-    // 开始一次新的响应
-    // 清理 body/sendfile 状态（以防上次残留）
-    _filectx.Reset();
-}
-
 }
\ No newline at end of file
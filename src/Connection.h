@@ -3,10 +3,13 @@
 #include "EventLoop.h"
 #include "../net/Socket.hpp"
 #include "Buffer.h"
+#include "OutputQueue.h"
 #include "Channel.h"
 //#include "../util/Any.hpp" 这里可以用我自己写的 any，谁更好则需要后续来验证
 #include <any>
+#include <atomic>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <spdlog/spdlog.h>
 
 namespace webserver::src 
@@ -22,18 +25,10 @@ enum ConnectStatus {
     DISCONNECTING   //关闭连接，正在关闭连接的流程中
 };
 
-struct FileContext {
-    int fd = -1;
-    off_t offset = 0;
-    size_t remain = 0;
-    bool active = false;
-
-    void Reset() {
-        fd = -1;
-        offset = 0;
-        remain = 0;
-        active = false;
-    }
+/* brief: 暂停读取的原因，可以同时有多个，全部解除后才恢复读取 */
+enum ReadPauseReason {
+    PAUSE_BY_HANDLER = 1,   // 上层处理不过来（协程挂起、流式响应未结束、流式请求体处理不过来）
+    PAUSE_BY_OUTPUT = 2     // 输出队列积压超过高水位
 };
 
 class Connection : public std::enable_shared_from_this<Connection>
@@ -43,9 +38,10 @@ class Connection : public std::enable_shared_from_this<Connection>
     using MessageCallback = std::function<void(const std::shared_ptr<Connection>&, Buffer*)>;
     using ClosedCallback = std::function<void(const std::shared_ptr<Connection>&)>;
     using AnyEventCallback = std::function<void(const std::shared_ptr<Connection>&)>; 
+    using WaterMarkCallback = std::function<void(const std::shared_ptr<Connection>&)>;
 public:
     Connection(EventLoop *loop, uint64_t conn_id, int sockfd);
-    ~Connection() { SPDLOG_INFO("释放连接 fd = {}", _sockfd); }
+    ~Connection() { SPDLOG_DEBUG("释放连接 fd = {}", _sockfd); }
 
     int GetFd() const { return _sockfd; }
     int GetConnId() const { return _conn_id; }
@@ -64,12 +60,38 @@ public:
     void SetClosedCallback(const ClosedCallback &clscb) { _closed_callback = clscb; }
     void SetAnyEventCallback(const AnyEventCallback &anyeventcb) { _anyevent_callback = anyeventcb; }
     void SetSrvClosedCallback(const ClosedCallback &srvclscb) { _server_closed_callback = srvclscb; }
+    /* brief: 设置输出队列的高低水位（字节），high 为 0 表示不检查。积压涨到 high 及以上时调用一次高水位回调，
+              之后降到 low 及以下时调用一次低水位回调，如此交替；回调在连接所在线程内同步调用。需要在 Established 之前调用 */
+    void SetWaterMarks(size_t high, size_t low) {
+        assert(high == 0 || low < high);
+        _high_water_mark = high;
+        _low_water_mark = low;
+    }
+    void SetHighWaterMarkCallback(const WaterMarkCallback &highcb) { _high_water_callback = highcb; }
+    void SetLowWaterMarkCallback(const WaterMarkCallback &lowcb) { _low_water_callback = lowcb; }
     /* brief: 建立函数，执行该函数即完成对一个连接的建立 */
     void Established();
-    /* brief: 发送数据，需要在对应的 EventLoop线程 内执行 */
+    /* brief: 发送数据，需要在对应的 EventLoop线程 内执行。数据会被拷贝一次 */
     void Send(const char *data, size_t len);
-    /* brief: SendFile 发送 */
+    /* brief: 发送数据，字符串直接 move 进输出队列，不拷贝 */
+    void Send(std::string &&data);
+    /* brief: 发送借用的数据，不拷贝，holder 保证数据在发送完之前有效 */
+    void SendBorrowed(const char *data, size_t len, std::shared_ptr<const void> holder);
+    /* brief: SendFile 发送，fd 的所有权交给连接，发送完毕后关闭 */
     void SendFile(int fd, off_t offset, size_t size);
+    /* brief: SendFile 发送借用的 fd，发送完毕后不关闭，holder 保证 fd 在发送完之前有效（例如文件缓存里的条目） */
+    void SendFile(int fd, off_t offset, size_t size, std::shared_ptr<const void> holder);
+    /* brief: 把数据直接写进输出队列队尾的字符串，fill(std::string &) 负责追加，不产生临时字符串。
+              需要在对应的 EventLoop线程 内执行 */
+    template<typename Fill>
+    void AppendInLoop(Fill &&fill) {
+        _loop->AssertInLoop();
+        if(_status == DISCONNECTED) return;
+        fill(_out_queue.TailString());
+        _out_queue.CommitString();
+        StorePendingBytes(_out_queue.QueuedBytes());
+        if(_channel.WritAble() == false) _channel.EnableWriteLazily();
+    }
 
     /* brief: 进入关闭连接流程，需要在对应的 EventLoop线程 内执行 */
     void Shutdown();
@@ -84,8 +106,33 @@ public:
                 const ClosedCallback &clscb,
                 const AnyEventCallback &anyeventcb
             );
+    /* brief: 使用边缘触发模式：读事件一次读到 EAGAIN，写事件不再反复开关 EPOLLOUT。需要在 Established 之前调用 */
+    void EnableEdgeTrigger() { _channel.EnableEdgeTrigger(); }
+    /* brief: 因为 reason 暂停读取（背压），需要在对应的 EventLoop线程 内执行 */
+    void PauseRead(ReadPauseReason reason = PAUSE_BY_HANDLER);
+    /* brief: 解除 reason 引起的暂停，所有原因都解除后恢复读取，并把暂停期间留在输入缓冲区里的数据交给上层。
+              任意线程都可以调用，总是排到当前任务之后执行 */
+    void ResumeRead(ReadPauseReason reason = PAUSE_BY_HANDLER);
+    /* brief: 读取是否处于暂停状态，需要在对应的 EventLoop线程 内执行 */
+    bool IsReadPaused() const { return _read_pauses != 0; }
     /* brief: 判断连接是否繁忙（用于判断是否可以安全关闭或接收新请求） */
-    bool IsWriting() const { return _out_buffer.ReadableBytes() > 0 || _filectx.active; }
+    bool IsWriting() const { return !_out_queue.Empty(); }
+    /* brief: 输出队列里还没发出去的字节数，任意线程都可以调用（读到的是最近一次更新的值） */
+    size_t PendingBytes() const { return _pending_bytes.load(std::memory_order_relaxed); }
+    /* brief: 对端地址，第一次调用时 getpeername 并缓存，取不到时 ss_family 为 AF_UNSPEC。需要在对应的 EventLoop线程 内执行 */
+    const struct sockaddr_storage &PeerAddress();
+    /* brief: 连接是否已经关闭，任意线程都可以调用 */
+    bool IsClosed() const { return _closed.load(std::memory_order_acquire); }
+    /* brief: 输出队列积压降到 threshold 字节以下（或连接关闭）时，在连接所在线程调用一次 cb。
+              已经满足时立即调用；同一时间只保留最后一次设置的回调。任意线程都可以调用 */
+    void NotifyWhenDrained(size_t threshold, const Functor &cb);
+    /* brief: co_await conn->Drained(threshold)：在协程里等这个连接（可以是别的连接）的积压降下来，
+              协程回到发起等待的 EventLoop 线程，结果为 false 表示连接已经关闭 */
+    CallbackAwaiter<bool> Drained(size_t threshold) {
+        return Await<bool>([self = shared_from_this(), threshold](std::function<void(bool)> resume) {
+            self->NotifyWhenDrained(threshold, [self, resume]() { resume(!self->IsClosed()); });
+        });
+    }
 private:
     /* brief: 以下 5个 回调函数，都是设置给 Channel 的，用于对应事件就绪后执行 */
     void HandleRead();
@@ -98,18 +145,30 @@ private:
     /* brief: 以下函数都是具体执行函数，在对应线程内就执行它们 */
     void EstablishedInLoop();
     void ReleaseInLoop();
-    void SendInLoop(Buffer &buf);
-    void SendFileInLoop(int fd, off_t offset, size_t size);
+    void SendInLoop(std::string &data);
+    void SendBorrowedInLoop(const char *data, size_t len, const std::shared_ptr<const void> &holder);
+    void SendFileInLoop(int fd, off_t offset, size_t size, const std::shared_ptr<const void> &holder);
     void ShutdownInLoop();
     void EnableInactiveReleaseInLoop(int sec);
     void CancleInactiveReleaseInLoop();
+    void ResumeReadInLoop(ReadPauseReason reason);
+    void NotifyWhenDrainedInLoop(size_t threshold, const Functor &cb);
+    /* brief: 输出队列变化后更新 _pending_bytes，积压降到阈值以下时调用等待的回调 */
+    void UpdatePendingBytes();
+    /* brief: 更新 _pending_bytes，差值同时计入所在 loop 的待发送字节数，并检查是否越过高低水位 */
+    void StorePendingBytes(size_t bytes) {
+        size_t old = _pending_bytes.load(std::memory_order_relaxed);
+        _loop->GetLoad()->queued_bytes.Add(bytes - old);
+        _pending_bytes.store(bytes, std::memory_order_relaxed);
+        if(_high_water_mark > 0 && _status != DISCONNECTED) CheckWaterMarks(bytes);
+    }
+    /* brief: 积压越过高水位或回落到低水位时调用对应的回调 */
+    void CheckWaterMarks(size_t bytes);
     void UpgradeInLoop(const std::any &context,
                 const ConnectedCallback &conncb,
                 const MessageCallback &msgcb,
                 const ClosedCallback &clscb,
                 const AnyEventCallback &anyeventcb);
-    /* brief: 响应上下文 */
-    void StartResponseInLoop(bool clexpect_closeose);
 private:
     uint64_t _conn_id;                  // 连接的唯一id，计时器的唯一id也由它标识
     int _sockfd;                        // 该连接管理的套接字文件描述符
@@ -119,20 +178,30 @@ private:
     net::TcpSocket _socket;             // 该连接管理的套接字
     Channel _channel;                   // 该连接管理的 Channel
     Buffer _in_buffer;                  // 该连接的 输入缓冲区 ，用于存储读事件就绪后 内核socket的接收缓冲区 的数据
-    Buffer _out_buffer;                 // 该连接的 输出缓冲区 ，用于存储写事件就绪前，将要转移到 内核socket的发送缓冲区 的数据
+    OutputQueue _out_queue;             // 该连接的 输出队列 ，按顺序保存写事件就绪前，将要转移到 内核socket的发送缓冲区 的数据段
     //util::Any _context;
     std::any _context;                  // 存储 应用层协议上下文 的成员
+    std::atomic<size_t> _pending_bytes{0};  // 输出队列积压字节数的副本，给其他线程（例如业务线程里的生产者）读取
+    std::atomic<bool> _closed{false};   // 连接已经关闭
+    struct sockaddr_storage _peer;      // 缓存的对端地址，第一次调用 PeerAddress 时获取
+    bool _peer_known = false;
+    size_t _drain_threshold = 0;        // 等待的积压阈值
+    Functor _drain_callback;            // 积压降到阈值以下时调用的回调
+    size_t _high_water_mark = 0;        // 输出队列的高水位，0 表示不检查
+    size_t _low_water_mark = 0;         // 输出队列的低水位
+    bool _above_high_water = false;     // 积压越过了高水位，还没有回落到低水位
+    int _read_pauses = 0;               // 暂停读取的原因（ReadPauseReason 的位或）
 
     /* brief: 提供给组件使用者（应用层）的接口（hook），使用者可以设置回调 */
     ConnectedCallback _connected_callback;
     MessageCallback _message_callback;
     ClosedCallback _closed_callback;
     AnyEventCallback _anyevent_callback;
+    WaterMarkCallback _high_water_callback;
+    WaterMarkCallback _low_water_callback;
     /* brief: 组件内连接关闭回调——组件内设置，因为 webserver 组件内会把所有的连接分配到对应 EventLoop线程 管理起来，一旦某个连接要关闭，就要从管理自己对应
               的 EventLoop线程 内移除自己的信息 */
     ClosedCallback _server_closed_callback;
-
-    FileContext _filectx;            // 文件上下文
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "ConnectionPool.h"
+#include <new>
+
+namespace webserver::src
+{
+
+namespace {
+thread_local ConnectionPool *t_local_pool = nullptr;
+
+using Slot = ConnectionPool::Slot;
+
+Slot *NewSlot(size_t size) {
+    void *mem = ::operator new(sizeof(Slot) + size);
+    return new (mem) Slot();
+}
+
+void DeleteSlot(Slot *slot) {
+    slot->~Slot();
+    ::operator delete(slot);
+}
+}
+
+ConnectionPool::ConnectionPool(size_t max_cached)
+    : _free_list(nullptr), _cached(0), _max_cached(max_cached), _slot_size(0)
+    {}
+
+ConnectionPool::~ConnectionPool() {
+    if(t_local_pool == this) t_local_pool = nullptr;
+    DrainReturned();
+    while(_free_list) {
+        Slot *slot = _free_list;
+        _free_list = slot->next.load(std::memory_order_relaxed);
+        DeleteSlot(slot);
+    }
+}
+/* brief: 取一个槽位 */
+void *ConnectionPool::Allocate(size_t size) {
+    if(_slot_size == 0) _slot_size = size;
+    if(size != _slot_size) {
+        // 大小不符（理论上不会发生），不进池
+        Slot *slot = NewSlot(size);
+        return slot + 1;
+    }
+    if(_free_list == nullptr) DrainReturned();
+    Slot *slot = _free_list;
+    if(slot) {
+        _free_list = slot->next.load(std::memory_order_relaxed);
+        --_cached;
+    } else {
+        slot = NewSlot(_slot_size);
+        slot->owner = this;
+    }
+    return slot + 1;
+}
+/* brief: 归还槽位 */
+void ConnectionPool::Deallocate(void *ptr) {
+    if(ptr == nullptr) return;
+    Slot *slot = static_cast<Slot*>(ptr) - 1;
+    ConnectionPool *owner = slot->owner;
+    if(owner == nullptr) return DeleteSlot(slot);
+    if(owner == t_local_pool) return owner->Recycle(slot);
+    // 不在所属线程（例如最后一个引用在工作线程或其他 EventLoop 释放），投递回所属的池
+    owner->_returned.Push(slot);
+}
+
+ConnectionPool *ConnectionPool::Local() {
+    if(t_local_pool) return t_local_pool;
+    static thread_local ConnectionPool fallback;
+    return &fallback;
+}
+
+void ConnectionPool::SetLocal(ConnectionPool *pool) { t_local_pool = pool; }
+
+void ConnectionPool::DrainReturned() {
+    while(Slot *slot = _returned.Pop()) Recycle(slot);
+}
+
+void ConnectionPool::Recycle(Slot *slot) {
+    if(_cached >= _max_cached) return DeleteSlot(slot);
+    slot->next.store(_free_list, std::memory_order_relaxed);
+    _free_list = slot;
+    ++_cached;
+}
+
+}
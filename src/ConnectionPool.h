@@ -0,0 +1,80 @@
+#pragma once
+
+#include "MpscQueue.h"
+#include <cstddef>
+#include <atomic>
+
+// author: Haoyang Yang
+// filename: ConnectionPool.h
+// brief: Connection 的对象池。TcpServer 用 std::allocate_shared 配合 ConnectionAllocator 创建连接，
+//        Connection 对象和 shared_ptr 的控制块在同一个槽位里，槽位从连接所在的 EventLoop 的池里取（TcpServer 在该线程里构造连接），
+//        释放时回到原来的池：在原线程直接挂回 free list，在其他线程（工作线程、别的 EventLoop）则无锁投递回去，
+//        原线程下次取槽位时收回。稳态下接收/关闭连接不再调用 malloc/free
+
+namespace webserver::src
+{
+
+static constexpr size_t kDefaultMaxCachedConnections = 1024;   // 每个池最多缓存的空闲槽位数量
+
+class ConnectionPool
+{
+public:
+    explicit ConnectionPool(size_t max_cached = kDefaultMaxCachedConnections);
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool &operator=(const ConnectionPool&) = delete;
+
+    /* brief: 取一个至少 size 字节的槽位，只能在池所属线程调用。所有槽位大小相同，大小由第一次申请决定 */
+    void *Allocate(size_t size);
+    /* brief: 归还槽位，任意线程都可以调用 */
+    static void Deallocate(void *ptr);
+    /* brief: 当前缓存的空闲槽位数量 */
+    size_t CachedSlots() const { return _cached; }
+
+    /* brief: 获取当前线程使用的池。EventLoop 线程返回该 EventLoop 的池，其它线程返回一个线程私有的兜底池 */
+    static ConnectionPool *Local();
+    /* brief: 将 pool 设置为当前线程使用的池，由 EventLoop 在所属线程内调用 */
+    static void SetLocal(ConnectionPool *pool);
+
+    /* brief: 槽位头部，数据紧跟在后面 */
+    struct alignas(alignof(std::max_align_t)) Slot {
+        ConnectionPool *owner = nullptr;    // 槽位所属的池，为空表示大小不符、直接向系统申请的槽位
+        std::atomic<Slot*> next;            // free list / 归还队列的链接
+    };
+private:
+    /* brief: 收回其他线程归还的槽位 */
+    void DrainReturned();
+    /* brief: 挂回 free list，池满了就直接释放 */
+    void Recycle(Slot *slot);
+private:
+    Slot *_free_list;           // 空闲槽位链表，只有所属线程访问
+    size_t _cached;             // 空闲槽位数量
+    size_t _max_cached;         // 空闲槽位数量上限
+    size_t _slot_size;          // 槽位数据区大小，0 表示还没确定
+    MpscQueue<Slot> _returned;  // 其他线程归还的槽位
+};
+
+/* brief: 从当前线程的 ConnectionPool 申请内存的分配器，给 std::allocate_shared 使用 */
+template <typename T>
+class ConnectionAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ConnectionAllocator(ConnectionPool *pool) : _pool(pool) {}
+    template <typename U>
+    ConnectionAllocator(const ConnectionAllocator<U> &other) : _pool(other.Pool()) {}
+
+    T *allocate(size_t n) { return static_cast<T*>(_pool->Allocate(n * sizeof(T))); }
+    void deallocate(T *ptr, size_t) { ConnectionPool::Deallocate(ptr); }
+    ConnectionPool *Pool() const { return _pool; }
+
+    template <typename U>
+    bool operator==(const ConnectionAllocator<U> &other) const { return _pool == other.Pool(); }
+    template <typename U>
+    bool operator!=(const ConnectionAllocator<U> &other) const { return _pool != other.Pool(); }
+private:
+    ConnectionPool *_pool;
+};
+
+}
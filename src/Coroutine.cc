@@ -0,0 +1,39 @@
+#include "Coroutine.h"
+#include "EventLoop.h"
+
+namespace webserver::src
+{
+
+void ResumeInLoop(EventLoop *loop, std::coroutine_handle<> h) {
+    // 不在 loop 线程里发起的等待，在调用 resume 的线程直接恢复
+    if(loop == nullptr) return h.resume();
+    loop->PushInLoop([h]() { h.resume(); });
+}
+
+EventLoop *CurrentLoop() { return EventLoop::Current(); }
+
+void SleepAwaiter::await_suspend(std::coroutine_handle<> h) {
+    // 定时器回调在时间轮推进的中途执行，协程放到任务池里恢复，本轮循环稍后就会执行
+    EventLoop *loop = _loop;
+    loop->AddTimerMs(loop->NextCoroutineTimerId(), _ms, [loop, h]() { ResumeInLoop(loop, h); });
+}
+
+void FdAwaiter::await_suspend(std::coroutine_handle<> h) {
+    _loop->AssertInLoop();
+    _channel.emplace(_loop, _fd);
+    // Channel 属于协程帧，协程恢复后就会析构，所以先移除监控，再投递恢复，不在 Channel 的回调里恢复
+    auto ready = [this, h]() {
+        if(!_channel->ReadAble() && !_channel->WritAble()) return; // 同一轮里的其他事件，已经投递过
+        _channel->DisableAll();
+        _channel->Remove();
+        ResumeInLoop(_loop, h);
+    };
+    _channel->SetReadCallback(ready);
+    _channel->SetWriteCallback(ready);
+    _channel->SetErrorCallback(ready);
+    _channel->SetCloseCallback(ready);
+    if(_write) _channel->EnableWrite();
+    else _channel->EnableRead();
+}
+
+}
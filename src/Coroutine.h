@@ -0,0 +1,184 @@
+#pragma once
+
+#include "Channel.h"
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+// author: Haoyang Yang
+// filename: Coroutine.h
+// brief: 基于 EventLoop 的 C++20 协程。Task<T> 是惰性启动的协程返回类型，可以在另一个协程里 co_await，
+//        结束时通过对称转移直接回到等待它的协程；Spawn() 在当前线程启动一个顶层 Task，结束时调用回调。
+//        等待对象（EventLoop::Sleep / Readable / Writable、ThreadPool::Offload、Await）挂起期间不占用线程，
+//        在发起等待的 EventLoop 线程恢复，恢复动作都投递到任务池，不会在定时器或 Channel 回调的中途执行协程
+
+namespace webserver::src
+{
+
+class EventLoop;
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+/* brief: Task 的 promise 公共部分：惰性启动，结束时转移到等待者 */
+struct PromiseBase {
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;   // 等待这个协程的协程，顶层协程为空
+    std::exception_ptr error;               // 协程里没有捕获的异常，co_await 时重新抛出
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    Task<T> get_return_object() noexcept;
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T Result() {
+        if(error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+    std::optional<T> value;
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() const noexcept {}
+    void Result() {
+        if(error) std::rethrow_exception(error);
+    }
+};
+
+/* brief: Spawn 用的顶层协程，立即执行，结束后自己释放 */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+}
+
+/* brief: 协程返回类型。创建时不执行，被 co_await 或者交给 Spawn 时才开始 */
+template <typename T>
+class [[nodiscard]] Task
+{
+public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) noexcept : _handle(h) {}
+    Task(Task &&other) noexcept : _handle(std::exchange(other._handle, {})) {}
+    Task &operator=(Task &&other) noexcept {
+        if(this != &other) {
+            if(_handle) _handle.destroy();
+            _handle = std::exchange(other._handle, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task &operator=(const Task&) = delete;
+    ~Task() { if(_handle) _handle.destroy(); }
+
+    bool await_ready() const noexcept { return !_handle || _handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        _handle.promise().continuation = awaiting;
+        return _handle;
+    }
+    T await_resume() { return _handle.promise().Result(); }
+private:
+    std::coroutine_handle<promise_type> _handle;
+};
+
+namespace detail {
+template <typename T>
+inline Task<T> Promise<T>::get_return_object() noexcept { return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this)); }
+inline Task<void> Promise<void>::get_return_object() noexcept { return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this)); }
+}
+
+/* brief: 在当前线程启动 task，执行到第一次挂起为止。结束（包括抛出异常）时调用 done，error 为空表示正常结束 */
+inline detail::Detached Spawn(Task<void> task, std::function<void(std::exception_ptr error)> done) {
+    std::exception_ptr error;
+    try {
+        co_await task;
+    } catch(...) {
+        error = std::current_exception();
+    }
+    if(done) done(error);
+}
+
+/* brief: 把 h 投递到 loop 的任务池恢复执行 */
+void ResumeInLoop(EventLoop *loop, std::coroutine_handle<> h);
+/* brief: 当前线程的 EventLoop，不是 loop 线程时返回空 */
+EventLoop *CurrentLoop();
+
+/* brief: co_await loop->Sleep(ms)：在 loop 的时间轮上挂一个定时器，到期后恢复 */
+class SleepAwaiter
+{
+public:
+    SleepAwaiter(EventLoop *loop, uint64_t ms) : _loop(loop), _ms(ms) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+private:
+    EventLoop *_loop;
+    uint64_t _ms;
+};
+
+/* brief: co_await loop->Readable(fd) / Writable(fd)：等 fd 可读 / 可写（或出错、对端关闭）后恢复。
+          fd 不能同时被这个 loop 里的其他 Channel 监控，等待期间临时注册一个 Channel，就绪后移除 */
+class FdAwaiter
+{
+public:
+    FdAwaiter(EventLoop *loop, int fd, bool write) : _loop(loop), _fd(fd), _write(write) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+private:
+    EventLoop *_loop;
+    int _fd;
+    bool _write;
+    std::optional<Channel> _channel;    // 挂起期间存在于协程帧里
+};
+
+/* brief: co_await Await<T>(start)：把回调风格的接口变成等待对象，例如等待另一个连接的事件。
+          start 收到一个 resume(T) 回调，任意线程调用一次即可，协程回到发起等待的 EventLoop 线程，co_await 的结果就是 T */
+template <typename T>
+class CallbackAwaiter
+{
+public:
+    using Start = std::function<void(std::function<void(T)> resume)>;
+    explicit CallbackAwaiter(Start start) : _start(std::move(start)) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        EventLoop *loop = CurrentLoop();
+        _start([this, h, loop](T value) {
+            _value.emplace(std::move(value));
+            ResumeInLoop(loop, h);
+        });
+    }
+    T await_resume() { return std::move(*_value); }
+private:
+    Start _start;
+    std::optional<T> _value;
+};
+
+template <typename T>
+CallbackAwaiter<T> Await(typename CallbackAwaiter<T>::Start start) { return CallbackAwaiter<T>(std::move(start)); }
+
+}
@@ -4,16 +4,42 @@ namespace webserver::src
 
 {
 
-EventLoop::EventLoop(): _thread_id(std::this_thread::get_id()),
+namespace {
+thread_local EventLoop *t_current_loop = nullptr;  // 本线程的 EventLoop
+}
+
+EventLoop::EventLoop(PollerBackend backend): _thread_id(std::this_thread::get_id()),
                         _eventfd(CreateEventFd()),
                         _event_channel(std::make_unique<Channel>(this, _eventfd)),
-                        _time_wheel(this)
+                        _poller(Poller::Create(backend)),
+                        _time_wheel(this),
+                        _wakeup_pending(false)
 {
+    t_current_loop = this;
+    /* notes: 该线程内的 Buffer 都从本 EventLoop 的块池取块 */
+    BufferPool::SetLocal(&_buffer_pool);
+    /* notes: 该线程接收的连接从本 EventLoop 的对象池分配 */
+    ConnectionPool::SetLocal(&_connection_pool);
     /* notes: 给 _eventfd 添加可读事件回调函数，读取 _eventfd 事件通知次数 */
     _event_channel->SetReadCallback(std::bind(&EventLoop::ReadEventfd, this));
     /* notes: 启动 _eventfd 读事件监控 */
     _event_channel->EnableRead();
 }
+EventLoop::~EventLoop() {
+    // 丢弃还没来得及执行的任务
+    while(TaskNode *node = _tasks.Pop()) delete node;
+    if(t_current_loop == this) t_current_loop = nullptr;
+}
+EventLoop *EventLoop::Current() { return t_current_loop; }
+/* brief: 负载评分 */
+uint64_t EventLoop::LoadScore() const {
+    int64_t conns = _load.connections.load(std::memory_order_relaxed);
+    uint64_t score = conns > 0 ? static_cast<uint64_t>(conns) : 0;
+    // 待发送字节是各连接差值累加出来的，更新过程中可能短暂地读到回绕的值
+    uint64_t queued = _load.queued_bytes.Get();
+    if(queued < (1ull << 62)) score += queued / kLoadBytesPerConn;
+    return score + _load.task_depth.Get() + _load.busy_us.Get() / kLoadUsPerConn;
+}
 /* brief: 判断将要执行的任务是否属于该EventLoop对应的线程，如果是就直接执行，如果不是就压入该EventLoop队列 */
 void EventLoop::RunInLoop(const Functor &cb) {
     if(IsInLoop()) {
@@ -22,35 +48,65 @@ void EventLoop::RunInLoop(const Functor &cb) {
     return PushInLoop(cb);
 }
 /* brief: 将需要该EventLoop执行的任务压入任务池 */
-void EventLoop::PushInLoop(const Functor &cb) {
-    {
-        std::unique_lock<std::mutex> _lock(_mutex);
-        _tasks.push_back(cb);
-    }
+void EventLoop::PushInLoop(Functor cb) {
+    _tasks.Push(new TaskNode{{nullptr}, std::move(cb), Metrics::NowNs()});
     //唤醒可能因为没有事件就绪，而在epoll_wait阻塞的该eventloop对应的线程（给eventfd写一个数据，触发可读事件）
-    WakeUpEventFd();
+    //已经有人唤醒过、本线程还没开始处理任务时，它一定会看到这个任务，不需要再写
+    if(!_wakeup_pending.exchange(true, std::memory_order_acq_rel)) WakeUpEventFd();
+}
+/* brief: 获取缓存的 HTTP 日期 */
+std::string_view EventLoop::HttpDate() {
+    AssertInLoop();
+    time_t now = time(nullptr);
+    if(now != _date_sec) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        _date_len = strftime(_date_buf, sizeof(_date_buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        _date_sec = now;
+    }
+    return std::string_view(_date_buf, _date_len);
 }
 
 // ===================== EventLoop 的 Loop 循环 ======================
 
 /* brief: EventLoop 的 Loop 循环所在 */
 void EventLoop::Start() {
+    uint64_t now = Metrics::NowNs();
     while(true) {
         // step1: 事件监控
         SPDLOG_TRACE("开始事件监控");
         //printf("开始事件监控\n");
         std::vector<Channel*> actives;
-        _poller.Poll(actives); // 输出型参数，_poller返回活跃的Channel，channel保存了revents
+        // 还有补发事件没处理时不能阻塞，否则最多等到下一个定时器到期
+        int timeout_ms = _pending.empty() ? _time_wheel.NextTimeout() : 0;
+        _poller->Poll(actives, timeout_ms); // 输出型参数，_poller返回活跃的Channel，channel保存了revents
+        uint64_t woke = Metrics::NowNs();
+        _metrics.poll_wait_us.Record((woke - now) / 1000);
+        _metrics.poll_events.Record(actives.size());
         // step2: 就绪事件处理
         SPDLOG_TRACE("处理就绪事件");
         //printf("处理就绪事件\n");
         for(auto &channel : actives) {
             channel->HandlerEvent(); // channel根据revent里的就绪事件，执行相应的回调函数
         }
-        // step3: 执行任务
+        // step3: 推进时间轮，执行到期的定时任务
+        _time_wheel.RunExpired();
+        // step4: 执行任务
         SPDLOG_TRACE("执行任务池的任务");
         //printf("执行任务池的任务\n");
         RunAllTask();
+        // step5: 处理补发事件（边缘触发模式下没读完的数据、刚开启的写）
+        HandlePending();
+        // 本轮处理耗时按 1/8 的权重计入指数平均，作为负载信号；这个时刻也是下一轮等待的开始
+        now = Metrics::NowNs();
+        uint64_t busy = _load.busy_us.Get();
+        _load.busy_us.Set(busy - busy / 8 + (now - woke) / 1000 / 8);
+    }
+}
+
+void EventLoop::CancelPending(Channel *channel) {
+    for(auto &pending : _pending) {
+        if(pending == channel) pending = nullptr;
     }
 }
 
@@ -58,15 +114,40 @@ void EventLoop::Start() {
 
 /* brief: 执行该EventLoop任务池的所有任务 */
 void EventLoop::RunAllTask() {
-    std::vector<Functor> functor;
-    {
-        std::unique_lock<std::mutex> _lock(_mutex);
-        _tasks.swap(functor);
+    // 先清掉唤醒标记再取任务：之后入队的生产者会重新写 eventfd，任务不会被遗漏
+    _wakeup_pending.store(false, std::memory_order_seq_cst);
+    // 只执行开始时已经入队的任务，执行过程中新入队的留到下一轮，避免任务不断自我投递饿死 IO
+    uint64_t pending = _tasks.Size();
+    if(pending == 0) {
+        _load.task_depth.Set(0);
+        return;
     }
-    for(auto &f : functor) f();
-
+    // 等待时间都按开始处理这一批的时刻计算，每个任务不再单独读时钟
+    uint64_t now = Metrics::NowNs();
+    uint64_t count = 0;
+    // Pop 返回空说明有生产者入队到一半，它入队完成后会重新写 eventfd（上面已经清掉了唤醒标记）
+    while(count < pending) {
+        TaskNode *node = _tasks.Pop();
+        if(node == nullptr) break;
+        _metrics.task_wait_us.Record(now > node->enqueued_ns ? (now - node->enqueued_ns) / 1000 : 0);
+        ++count;
+        node->task();
+        delete node;
+    }
+    _metrics.task_batch.Record(count);
+    _load.task_depth.Set(count);
     return;
 }
+/* brief: 处理循环开始时已经登记的补发事件，处理过程中新登记的留到下一轮 */
+void EventLoop::HandlePending() {
+    size_t count = _pending.size();
+    for(size_t i = 0; i < count; ++i) {
+        Channel *channel = _pending[i];
+        _pending[i] = nullptr;  // 先清掉，回调里再次登记会追加到末尾
+        if(channel) channel->HandlePendingEvents();
+    }
+    _pending.erase(_pending.begin(), _pending.begin() + count);
+}
 /* brief: 创建eventfd */
 int EventLoop::CreateEventFd() {
     int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
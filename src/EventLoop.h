@@ -2,9 +2,16 @@
 
 #include "Poller.h"
 #include "TimeWheel.h"
+#include "BufferPool.h"
+#include "ConnectionPool.h"
+#include "MpscQueue.h"
+#include "Metrics.h"
+#include "Coroutine.h"
 #include <thread>
-#include <mutex>
+#include <atomic>
 #include <cassert>
+#include <ctime>
+#include <string_view>
 #include <sys/eventfd.h>
 #include <spdlog/spdlog.h>
 
@@ -19,14 +26,35 @@ namespace webserver::src
 
 using Functor = std::function<void()>;
 
+static constexpr uint64_t kCoroutineTimerBit = 1ull << 63;  // 协程定时器 id 的标记位
+
+static constexpr uint64_t kLoadBytesPerConn = 64 * 1024;   // 负载评分里多少待发送字节折算成一个连接
+static constexpr uint64_t kLoadUsPerConn = 100;             // 负载评分里每轮循环多少 us 的处理时间折算成一个连接
+
+/* brief: loop 的负载信号，由本 loop 线程（连接数还有分配连接的线程）写入，分配新连接时在其他线程读取 */
+struct LoopLoad {
+    std::atomic<int64_t> connections{0};    // 存活的连接数，连接分配到本 loop 时加一，关闭时减一
+    Counter queued_bytes;   // 本 loop 所有连接输出队列里还没发出去的字节数
+    Counter task_depth;     // 最近一轮从任务池取出的任务数
+    Counter busy_us;        // 每轮循环处理事件、定时器和任务的耗时（不含阻塞等待），指数平均，单位 us
+};
+
+/* brief: 跨线程任务队列的节点 */
+struct TaskNode {
+    std::atomic<TaskNode*> next;
+    Functor task;
+    uint64_t enqueued_ns = 0;   // 入队时刻，用于统计任务的等待时间
+};
+
 class EventLoop
 {
 public:
-    EventLoop();
+    EventLoop(PollerBackend backend = POLLER_EPOLL);
+    ~EventLoop();
     /* brief: 判断将要执行的任务是否属于该EventLoop对应的线程，如果是就直接执行，如果不是就压入该EventLoop队列 */
     void RunInLoop(const Functor &cb);
-    /* brief: 将需要该EventLoop执行的任务压入任务池 */
-    void PushInLoop(const Functor &cb);
+    /* brief: 将需要该EventLoop执行的任务压入任务池，无锁，并且每轮循环最多写一次 eventfd */
+    void PushInLoop(Functor cb);
     /* brief: 用来断言当前线程是否是属于该EventLoop对应的线程 */
     void AssertInLoop() { assert(_thread_id == std::this_thread::get_id()); }
     /* brief: 用来判断当前线程是否是该EventLoop对应的线程 */
@@ -35,17 +63,52 @@ public:
     // ================ 事件监控相关函数 ==================
 
     /* brief: 用来添加对传入的channel的事件监控 */ 
-    void UpdateEvent(Channel *channel) { return _poller.UpdateEvents(channel); }
+    void UpdateEvent(Channel *channel) { return _poller->UpdateEvents(channel); }
     /* brief: 用来移除对传入的channel的事件监控 */
-    void RemoveEvent(Channel *channel) { return _poller.RemoveEvents(channel); }
+    void RemoveEvent(Channel *channel) { return _poller->RemoveEvents(channel); }
+    /* brief: 事件监控后端是否支持边缘触发 */
+    bool SupportsEdgeTrigger() const { return _poller->SupportsEdgeTrigger(); }
+    /* brief: 让后端直接在监听套接字上 accept（见 Poller::StartAccept），不支持时返回 false */
+    bool StartAccept(Channel *channel, const AcceptCallback &cb) { return _poller->StartAccept(channel, cb); }
+    /* brief: 登记一个有补发事件的 channel，在本轮循环末尾处理（见 Channel::PendEvents） */
+    void QueuePending(Channel *channel) { _pending.push_back(channel); }
+    /* brief: channel 被移除监控时撤销它的补发事件 */
+    void CancelPending(Channel *channel);
 
     // ================ 计时器相关函数 ===================
 
+    /* brief: 添加定时任务，delay 单位为秒 */
     void AddTimer(uint64_t id, uint32_t delay, const TaskFunc &cb) { return _time_wheel.AddTimer(id, delay, cb); }
+    /* brief: 添加定时任务，delay 单位为毫秒 */
+    void AddTimerMs(uint64_t id, uint64_t delay_ms, const TaskFunc &cb) { return _time_wheel.AddTimerMs(id, delay_ms, cb); }
     void RefreshTimer(uint64_t id) { return _time_wheel.RefreshTimer(id); }
     void CancelTimer(uint64_t id) { return _time_wheel.CancelTimer(id); }
     bool HasTimer(uint64_t id) { return _time_wheel.HasTimer(id); }
 
+    // ================ 协程相关函数 ==================
+
+    /* brief: co_await loop->Sleep(ms)：挂起 ms 毫秒后在本 loop 线程恢复 */
+    SleepAwaiter Sleep(uint64_t ms) { return SleepAwaiter(this, ms); }
+    /* brief: co_await loop->Readable(fd) / Writable(fd)：等待 fd 就绪后在本 loop 线程恢复，需要在本 loop 线程 co_await */
+    FdAwaiter Readable(int fd) { return FdAwaiter(this, fd, false); }
+    FdAwaiter Writable(int fd) { return FdAwaiter(this, fd, true); }
+    /* brief: 协程定时器用的 id，最高位置 1，不会和连接 id 冲突 */
+    uint64_t NextCoroutineTimerId() { return kCoroutineTimerBit | _next_coroutine_timer.fetch_add(1, std::memory_order_relaxed); }
+    /* brief: 当前线程的 EventLoop，不是 loop 线程时返回空 */
+    static EventLoop *Current();
+
+    /* brief: 本 loop 的运行指标，只能在本 loop 线程内写入 */
+    Metrics *GetMetrics() { return &_metrics; }
+    /* brief: 本 loop 的负载信号 */
+    LoopLoad *GetLoad() { return &_load; }
+    /* brief: 负载评分：连接数 + 待发送字节 / kLoadBytesPerConn + 任务池深度 + 循环耗时 / kLoadUsPerConn，
+              越小越空闲。任意线程可调用，读到的是最近一次更新的值 */
+    uint64_t LoadScore() const;
+
+    /* brief: 当前时间的 HTTP 日期（IMF-fixdate，例如 "Sun, 06 Nov 1994 08:49:37 GMT"），
+              每秒最多格式化一次，其余调用直接返回缓存。需要在 loop 线程内调用 */
+    std::string_view HttpDate();
+
     // ================ EventLoop 循环 ==================
     /* brief: EventLoop 的 Loop 循环所在 */
     void Start();
@@ -60,6 +123,8 @@ public:
 private:
     /* brief: 执行该EventLoop任务池的所有任务 */
     void RunAllTask();
+    /* brief: 处理循环开始时已经登记的补发事件，处理过程中新登记的留到下一轮 */
+    void HandlePending();
     /* brief: 创建eventfd */
     static int CreateEventFd();
     /* brief: 读取EventFd */
@@ -68,13 +133,22 @@ private:
     void WakeUpEventFd();
 private:
     std::thread::id _thread_id; // 该EventLoop所绑定的线程id
+    Metrics _metrics;           // 本线程的运行指标，最先构造、最后析构
+    LoopLoad _load;             // 本 loop 的负载信号
     int _eventfd;               // _eventfd 用于唤醒IO事件监控可能导致的阻塞
     std::unique_ptr<Channel> _event_channel;    // 为eventfd封装的channel
-    Poller _poller;             // 执行所有channel的事件监控
+    std::unique_ptr<Poller> _poller;    // 执行所有channel的事件监控（epoll 或 io_uring）
     TimeWheel _time_wheel;      
+    BufferPool _buffer_pool;    // 该线程内所有 Buffer 共用的块内存池
+    ConnectionPool _connection_pool;    // 该线程接收的连接使用的对象池
 
-    std::vector<Functor> _tasks; // 任务池
-    std::mutex _mutex;
+    std::vector<Channel*> _pending;  // 有补发事件的 channel，非空时事件监控不阻塞
+    MpscQueue<TaskNode> _tasks;     // 任务池，任意线程无锁入队，只有本线程出队
+    std::atomic<bool> _wakeup_pending;  // 已经写过 eventfd 且本线程还没开始处理任务，其他生产者不用再写
+    std::atomic<uint64_t> _next_coroutine_timer{0};  // 协程定时器 id 的低位
+    time_t _date_sec = 0;       // _date_buf 对应的秒数
+    char _date_buf[32];         // 缓存的 HTTP 日期
+    size_t _date_len = 0;       // _date_buf 的有效长度
 };
 
 }
@@ -3,6 +3,11 @@
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include "EventLoop.h"
 
 namespace webserver::src
@@ -11,8 +16,10 @@ namespace webserver::src
 class LoopThread
 {
 public:
-    /* brief: 创建 EventLoop 线程，设置好线程执行的入口函数，但先不绑定对应的EventLoop */
-    LoopThread() :_loop(nullptr), _thread(std::thread(&LoopThread::ThreadEntry, this)) {}
+    /* brief: 创建 EventLoop 线程，设置好线程执行的入口函数，但先不绑定对应的EventLoop。
+              cpu >= 0 时线程绑定到这个 CPU，并且优先从它所在的 NUMA 节点分配内存 */
+    LoopThread(PollerBackend backend = POLLER_EPOLL, int cpu = -1)
+        :_loop(nullptr), _backend(backend), _cpu(cpu), _thread(std::thread(&LoopThread::ThreadEntry, this)) {}
     /* brief: 返回当前线程绑定的EventLoop */
     EventLoop *GetLoop() {
         EventLoop *loop = nullptr;
@@ -26,7 +33,9 @@ public:
 private:
     /* brief: 线程执行的入口 routine 函数*/
     void ThreadEntry() {
-        EventLoop loop; // 这里用到了RAII思想，该线程绑定的EventLoop的生命周期与线程绑定，线程销毁，它的EventLoop随之销毁
+        // 先绑定 CPU 和内存节点再构造 EventLoop，它的块池、连接对象池以后分配的内存都落在本节点
+        if(_cpu >= 0) BindCpu(_cpu);
+        EventLoop loop(_backend); // 这里用到了RAII思想，该线程绑定的EventLoop的生命周期与线程绑定，线程销毁，它的EventLoop随之销毁
         {
             std::unique_lock<std::mutex> lock(_mutex);
             _loop = &loop;
@@ -35,11 +44,28 @@ private:
         }
         _loop->Start();
     }
+    /* brief: 把当前线程绑定到 cpu，内存分配策略改为优先使用 cpu 所在的 NUMA 节点（只影响本线程）。失败时只打日志 */
+    static void BindCpu(int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            SPDLOG_WARN("EventLoop 线程绑定 CPU {} 失败", cpu);
+            return;
+        }
+        unsigned cur = 0, node = 0;
+        if(syscall(SYS_getcpu, &cur, &node, nullptr) != 0 || node >= 64) return;
+        unsigned long nodemask = 1ul << node;
+        // 单节点机器上也能成功，只是没有效果；内核不支持 NUMA 时返回 ENOSYS，忽略
+        if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, 64) != 0) SPDLOG_DEBUG("设置 NUMA 节点 {} 失败", node);
+    }
 private:
     /* 锁用于实现 _loop 获取的同步关系，避免线程创建了，但是 _loop 还没有实例化之前去获取 _loop */
     std::mutex _mutex;  // 互斥锁
     std::condition_variable _cond;  //条件变量
     EventLoop *_loop; // 该线程绑定的EventLoop
+    PollerBackend _backend; // 该线程的EventLoop使用的事件监控后端，必须在 _thread 之前初始化
+    int _cpu;   // 绑定的 CPU，-1 表示不绑定，必须在 _thread 之前初始化
     std::thread _thread; // 线程
 };
 
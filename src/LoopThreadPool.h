@@ -8,12 +8,30 @@ namespace webserver::src
 
 class EventLoop;
 
+/* brief: 新连接分配到从属线程的策略 */
+enum LoopPlacement {
+    PLACE_ROUND_ROBIN,  // 轮询
+    PLACE_LEAST_CONN,   // 存活连接最少的线程，连接数相同时比较负载评分
+    PLACE_TWO_CHOICES   // 随机挑两个线程，取负载评分（EventLoop::LoadScore）低的那个
+};
+
 class LoopThreadPool
 {
 public:
-    LoopThreadPool(EventLoop *baseloop) : _thread_count(0), _next_loop_idx(0), _baseloop(baseloop) {}
+    LoopThreadPool(EventLoop *baseloop) : _thread_count(0), _next_loop_idx(0), _backend(POLLER_EPOLL), _placement(PLACE_ROUND_ROBIN), _baseloop(baseloop) {}
     /* brief: 暴露给上层来设置线程数量 */
     void SetThreadCount(int count) { _thread_count = count; }
+    /* brief: 暴露给上层来设置从属线程的事件监控后端 */
+    void SetPollerBackend(PollerBackend backend) { _backend = backend; }
+    /* brief: 暴露给上层来设置从属线程绑定的 CPU：第 i 个线程绑定到 cpus[i % cpus.size()]，为空则不绑定。需要在 Create 之前调用 */
+    void SetCpuAffinity(const std::vector<int> &cpus) { _cpus = cpus; }
+    /* brief: 第 idx 个 loop（GetAllLoops 的顺序）绑定的 CPU，没有绑定返回 -1 */
+    int LoopCpu(size_t idx) const {
+        if(_thread_count == 0 || _cpus.empty()) return -1;
+        return _cpus[idx % _cpus.size()];
+    }
+    /* brief: 暴露给上层来设置新连接的分配策略 */
+    void SetPlacement(LoopPlacement placement) { _placement = placement; }
     /* brief: 创建线程池 */
     void Create() {
         SPDLOG_TRACE("进入线程池创建函数");
@@ -22,21 +40,71 @@ public:
             _threads.resize(_thread_count);
             _loops.resize(_thread_count);
             for(int i = 0; i < _thread_count; ++i) {
-                _threads[i] = new LoopThread(); // 此次可以用内存池优化
+                _threads[i] = new LoopThread(_backend, LoopCpu(i)); // 此次可以用内存池优化
                 _loops[i] = _threads[i]->GetLoop();
             }
         }
         SPDLOG_TRACE("退出线程池创建函数");
     }
-    /* brief: 获取下一个EventLoop */
+    /* brief: 获取所有处理连接的EventLoop，没有从属线程时只有 baseloop */
+    std::vector<EventLoop*> GetAllLoops() const {
+        if(_thread_count == 0) return { _baseloop };
+        return _loops;
+    }
+    /* brief: 按分配策略获取下一个EventLoop，只在分配连接的线程（baseloop）调用 */
     EventLoop *NextLoop() {
         if(_thread_count == 0) return _baseloop;
+        if(_thread_count == 1) return _loops[0];
+        switch(_placement) {
+            case PLACE_LEAST_CONN: return LeastConnLoop();
+            case PLACE_TWO_CHOICES: return TwoChoicesLoop();
+            default: break;
+        }
         _next_loop_idx = (_next_loop_idx + 1) % _thread_count;
         return _loops[_next_loop_idx];
     }
 private:
+    /* brief: 存活连接最少的 loop。从轮询位置开始找，负载相同时依次错开，不会总落在第一个线程 */
+    EventLoop *LeastConnLoop() {
+        _next_loop_idx = (_next_loop_idx + 1) % _thread_count;
+        EventLoop *best = nullptr;
+        int64_t best_conns = 0;
+        uint64_t best_score = 0;
+        for(int i = 0; i < _thread_count; ++i) {
+            EventLoop *loop = _loops[(_next_loop_idx + i) % _thread_count];
+            int64_t conns = loop->GetLoad()->connections.load(std::memory_order_relaxed);
+            if(best != nullptr && conns > best_conns) continue;
+            uint64_t score = loop->LoadScore();
+            if(best == nullptr || conns < best_conns || score < best_score) {
+                best = loop;
+                best_conns = conns;
+                best_score = score;
+            }
+        }
+        return best;
+    }
+    /* brief: 随机挑两个不同的 loop，取负载评分低的。只读两个 loop 的负载，线程多时也不用全部扫一遍 */
+    EventLoop *TwoChoicesLoop() {
+        uint32_t a = NextRandom() % _thread_count;
+        uint32_t b = NextRandom() % (_thread_count - 1);
+        if(b >= a) ++b;
+        EventLoop *first = _loops[a];
+        EventLoop *second = _loops[b];
+        return second->LoadScore() < first->LoadScore() ? second : first;
+    }
+    /* brief: xorshift 伪随机数 */
+    uint32_t NextRandom() {
+        _random ^= _random << 13;
+        _random ^= _random >> 17;
+        _random ^= _random << 5;
+        return _random;
+    }
     int _thread_count; // 从属线程数
     int _next_loop_idx;
+    PollerBackend _backend; // 从属线程的事件监控后端
+    LoopPlacement _placement; // 新连接的分配策略
+    uint32_t _random = 2463534242u; // 两选一策略的随机数状态
+    std::vector<int> _cpus; // 从属线程绑定的 CPU
     EventLoop *_baseloop; // 主reactor，运行在主线程，如果从属线程数为0，则所有操作都在baseloop进行
     std::vector<LoopThread*> _threads; // 保存所有的LoopThread对象
     std::vector<EventLoop*> _loops; // 从属线程大于0，则从_loops种进行线程EventLoop分配
@@ -0,0 +1,143 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <ctime>
+#include <iterator>
+#include <mutex>
+#include <fmt/format.h>
+
+namespace webserver::src
+{
+
+namespace {
+/* brief: 所有存活的 Metrics，只在创建 / 销毁 loop 和抓取时加锁 */
+struct Registry {
+    std::mutex mutex;
+    std::vector<Metrics*> items;
+};
+/* notes: 故意不析构，进程退出时静态对象里的 EventLoop 析构还会用到它 */
+Registry &GetRegistry() {
+    static Registry *registry = new Registry();
+    return *registry;
+}
+std::atomic<size_t> g_route_count{0};   // 路由数量，服务器启动前设置
+
+void AppendCounter(std::string *out, std::string_view name, std::string_view help, uint64_t value, bool gauge = false) {
+    Metrics::AppendHeader(out, name, gauge ? "gauge" : "counter", help);
+    fmt::format_to(std::back_inserter(*out), "{} {}\n", name, value);
+}
+}
+
+Metrics::Metrics() {
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.items.push_back(this);
+}
+
+Metrics::~Metrics() {
+    {
+        Registry &registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.items.erase(std::remove(registry.items.begin(), registry.items.end(), this), registry.items.end());
+    }
+    delete _routes.load(std::memory_order_acquire);
+}
+
+uint64_t Metrics::NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Metrics::RouteLatency(int32_t route, uint64_t us) {
+    RouteHistograms *routes = _routes.load(std::memory_order_relaxed);
+    if(routes == nullptr) {
+        // 只有本线程写 _routes，分配好再发布，抓取线程看到指针时内容已经初始化
+        size_t count = g_route_count.load(std::memory_order_relaxed);
+        if(count == 0) return;
+        routes = new RouteHistograms{count, std::make_unique<Histogram[]>(count)};
+        _routes.store(routes, std::memory_order_release);
+    }
+    if(route < 0 || static_cast<size_t>(route) >= routes->size) return;
+    routes->items[route].Record(us);
+}
+
+void Metrics::SetRouteCount(size_t count) { g_route_count.store(count, std::memory_order_relaxed); }
+
+MetricsSnapshot Metrics::Collect() {
+    MetricsSnapshot snapshot;
+    snapshot.route_latency_us.resize(g_route_count.load(std::memory_order_relaxed));
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for(const Metrics *m : registry.items) {
+        snapshot.accepted += m->accepted.Get();
+        snapshot.closed += m->closed.Get();
+        snapshot.bytes_read += m->bytes_read.Get();
+        snapshot.bytes_written += m->bytes_written.Get();
+        snapshot.sendfile_bytes += m->sendfile_bytes.Get();
+        snapshot.poll_wait_us.Merge(m->poll_wait_us);
+        snapshot.poll_events.Merge(m->poll_events);
+        snapshot.task_batch.Merge(m->task_batch);
+        snapshot.task_wait_us.Merge(m->task_wait_us);
+        snapshot.timers_added += m->timers_added.Get();
+        snapshot.timers_fired += m->timers_fired.Get();
+        snapshot.timers_cancelled += m->timers_cancelled.Get();
+        snapshot.timers_active += m->timers_active.Get();
+        for(int i = 0; i < kStatusSlots; ++i) snapshot.parse_errors[i] += m->_parse_errors[i].Get();
+        const RouteHistograms *routes = m->_routes.load(std::memory_order_acquire);
+        if(routes == nullptr) continue;
+        size_t count = std::min(routes->size, snapshot.route_latency_us.size());
+        for(size_t i = 0; i < count; ++i) snapshot.route_latency_us[i].Merge(routes->items[i]);
+    }
+    return snapshot;
+}
+
+void Metrics::AppendPrometheus(const MetricsSnapshot &s, std::string *out) {
+    AppendCounter(out, "webserver_connections_accepted_total", "Accepted connections.", s.accepted);
+    AppendCounter(out, "webserver_connections_closed_total", "Closed connections.", s.closed);
+    AppendCounter(out, "webserver_connections_active", "Open connections.", s.accepted - std::min(s.accepted, s.closed), true);
+    AppendCounter(out, "webserver_bytes_read_total", "Bytes read from sockets.", s.bytes_read);
+    AppendCounter(out, "webserver_bytes_written_total", "Bytes written to sockets with writev.", s.bytes_written);
+    AppendCounter(out, "webserver_sendfile_bytes_total", "Bytes sent with sendfile.", s.sendfile_bytes);
+    AppendHeader(out, "webserver_poll_wait_seconds", "histogram", "Time blocked in each event poll.");
+    AppendHistogram(out, "webserver_poll_wait_seconds", "", s.poll_wait_us, 1e-6);
+    AppendHeader(out, "webserver_poll_events", "histogram", "Ready events per poll wakeup.");
+    AppendHistogram(out, "webserver_poll_events", "", s.poll_events, 1);
+    AppendHeader(out, "webserver_task_batch", "histogram", "Tasks taken from the loop task queue per iteration.");
+    AppendHistogram(out, "webserver_task_batch", "", s.task_batch, 1);
+    AppendHeader(out, "webserver_task_wait_seconds", "histogram", "Time between queueing a loop task and running it.");
+    AppendHistogram(out, "webserver_task_wait_seconds", "", s.task_wait_us, 1e-6);
+    AppendCounter(out, "webserver_timers_added_total", "Timers added.", s.timers_added);
+    AppendCounter(out, "webserver_timers_fired_total", "Timers fired.", s.timers_fired);
+    AppendCounter(out, "webserver_timers_cancelled_total", "Timers cancelled.", s.timers_cancelled);
+    AppendCounter(out, "webserver_timers_active", "Timers armed.", s.timers_active, true);
+    AppendHeader(out, "webserver_parse_errors_total", "counter", "Requests rejected while parsing, by response status.");
+    for(int i = 0; i < kStatusSlots; ++i) {
+        if(s.parse_errors[i] == 0) continue;
+        fmt::format_to(std::back_inserter(*out), "webserver_parse_errors_total{{status=\"{}\"}} {}\n", kStatusMin + i, s.parse_errors[i]);
+    }
+}
+
+void Metrics::AppendHeader(std::string *out, std::string_view name, std::string_view type, std::string_view help) {
+    fmt::format_to(std::back_inserter(*out), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void Metrics::AppendHistogram(std::string *out, std::string_view name, std::string_view labels,
+                              const HistogramData &data, double scale) {
+    std::string_view sep = labels.empty() ? "" : ",";
+    uint64_t cumulative = 0;
+    for(int i = 0; i < kHistogramBuckets; ++i) {
+        cumulative += data.buckets[i];
+        fmt::format_to(std::back_inserter(*out), "{}_bucket{{{}{}le=\"{:g}\"}} {}\n",
+                       name, labels, sep, static_cast<double>(1ull << i) * scale, cumulative);
+    }
+    cumulative += data.buckets[kHistogramBuckets];
+    fmt::format_to(std::back_inserter(*out), "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, sep, cumulative);
+    if(labels.empty()) {
+        fmt::format_to(std::back_inserter(*out), "{}_sum {:g}\n{}_count {}\n", name, data.sum * scale, name, cumulative);
+    } else {
+        fmt::format_to(std::back_inserter(*out), "{}_sum{{{}}} {:g}\n{}_count{{{}}} {}\n",
+                       name, labels, data.sum * scale, name, labels, cumulative);
+    }
+}
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// author: Haoyang Yang
+// filename: Metrics.h
+// brief: 每个 EventLoop 一份的运行指标。计数器和直方图只由所属线程写入，写入是普通的 load + store（relaxed），
+//        没有锁也没有 lock 前缀，每次记录只要几纳秒，可以在生产环境一直开着；
+//        抓取（/metrics）时才在任意线程把所有 loop 的指标加起来，输出 Prometheus 文本格式
+
+namespace webserver::src
+{
+
+static constexpr int kHistogramBuckets = 24;       // 直方图第 i 个桶统计 <= 2^i 的值，再加一个 +Inf 桶
+static constexpr int kStatusMin = 400;             // 按状态码统计的解析错误从 400 开始
+static constexpr int kStatusSlots = 200;           // 400 ~ 599
+
+/* brief: 单写者计数器：只有所属线程写入，任意线程读取 */
+class Counter
+{
+public:
+    void Add(uint64_t v = 1) { _value.store(_value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed); }
+    /* brief: 当作瞬时值（gauge）使用时直接覆盖 */
+    void Set(uint64_t v) { _value.store(v, std::memory_order_relaxed); }
+    uint64_t Get() const { return _value.load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint64_t> _value{0};
+};
+
+/* brief: 单写者的对数直方图，桶的上界是 2 的幂，记录一次只是两次计数器累加 */
+class Histogram
+{
+public:
+    void Record(uint64_t v) {
+        size_t idx = v == 0 ? 0 : std::bit_width(v - 1);
+        if(idx > kHistogramBuckets) idx = kHistogramBuckets;
+        _buckets[idx].Add();
+        _sum.Add(v);
+    }
+    uint64_t Bucket(int idx) const { return _buckets[idx].Get(); }
+    uint64_t Sum() const { return _sum.Get(); }
+private:
+    Counter _buckets[kHistogramBuckets + 1];
+    Counter _sum;
+};
+
+/* brief: 抓取时合并出来的直方图 */
+struct HistogramData {
+    uint64_t buckets[kHistogramBuckets + 1] = {};
+    uint64_t sum = 0;
+
+    void Merge(const Histogram &h) {
+        for(int i = 0; i <= kHistogramBuckets; ++i) buckets[i] += h.Bucket(i);
+        sum += h.Sum();
+    }
+    uint64_t Count() const {
+        uint64_t count = 0;
+        for(uint64_t b : buckets) count += b;
+        return count;
+    }
+};
+
+/* brief: 所有 loop 的指标之和 */
+struct MetricsSnapshot {
+    uint64_t accepted = 0;
+    uint64_t closed = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t sendfile_bytes = 0;
+    HistogramData poll_wait_us;
+    HistogramData poll_events;
+    HistogramData task_batch;
+    HistogramData task_wait_us;
+    uint64_t timers_added = 0;
+    uint64_t timers_fired = 0;
+    uint64_t timers_cancelled = 0;
+    uint64_t timers_active = 0;
+    uint64_t parse_errors[kStatusSlots] = {};
+    std::vector<HistogramData> route_latency_us;    // 按路由下标
+};
+
+class Metrics
+{
+public:
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics &operator=(const Metrics&) = delete;
+
+    /* brief: 单调时钟的当前时刻（ns），用于计算耗时 */
+    static uint64_t NowNs();
+
+    /* brief: 记录一次解析错误，status 不在 400 ~ 599 时忽略 */
+    void ParseError(int status) {
+        if(status >= kStatusMin && status < kStatusMin + kStatusSlots) _parse_errors[status - kStatusMin].Add();
+    }
+    /* brief: 记录一次路由处理耗时。路由的直方图在本线程第一次记录时按 SetRouteCount 的数量分配 */
+    void RouteLatency(int32_t route, uint64_t us);
+
+    /* brief: 设置路由数量，需要在服务器启动前调用（路由表压平之后） */
+    static void SetRouteCount(size_t count);
+    /* brief: 把所有 loop 的指标加起来，任意线程可调用 */
+    static MetricsSnapshot Collect();
+    /* brief: 把路由之外的指标按 Prometheus 文本格式追加到 out */
+    static void AppendPrometheus(const MetricsSnapshot &snapshot, std::string *out);
+    /* brief: 追加指标的 HELP / TYPE 行，同名指标只需要输出一次 */
+    static void AppendHeader(std::string *out, std::string_view name, std::string_view type, std::string_view help);
+    /* brief: 追加一个直方图的样本行。labels 形如 method="GET"，可以为空；scale 把记录的单位换算成输出的单位（例如 us -> s） */
+    static void AppendHistogram(std::string *out, std::string_view name, std::string_view labels,
+                                const HistogramData &data, double scale);
+public:
+    // 以下指标只能在所属 EventLoop 线程内写入
+    Counter accepted;           // 接收的连接数
+    Counter closed;             // 关闭的连接数
+    Counter bytes_read;         // 从 socket 读取的字节数
+    Counter bytes_written;      // writev 发送的字节数
+    Counter sendfile_bytes;     // sendfile 发送的字节数
+    Histogram poll_wait_us;     // 每次事件监控阻塞的时间（us）
+    Histogram poll_events;      // 每次醒来的就绪事件数
+    Histogram task_batch;       // 每轮从任务池取出的任务数（醒来时的队列深度）
+    Histogram task_wait_us;     // 任务从入队到开始执行的等待时间（us）
+    Counter timers_added;       // 添加的定时器数
+    Counter timers_fired;       // 到期执行的定时器数
+    Counter timers_cancelled;   // 取消的定时器数
+    Counter timers_active;      // 时间轮上的定时器数（瞬时值）
+private:
+    /* brief: 路由耗时直方图，分配后大小不变 */
+    struct RouteHistograms {
+        size_t size;
+        std::unique_ptr<Histogram[]> items;
+    };
+    Counter _parse_errors[kStatusSlots];            // 下标是 状态码 - 400
+    std::atomic<RouteHistograms*> _routes{nullptr}; // 本线程第一次记录路由耗时时分配
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+
+// author: Haoyang Yang
+// filename: MpscQueue.h
+// brief: 侵入式无锁多生产者单消费者队列（Vyukov MPSC）。生产者入队只有一次原子 exchange、一次 store
+//        和一次计数，不加锁；只有所属 EventLoop 线程出队。节点类型 T 需要带一个 std::atomic<T*> next 成员
+
+namespace webserver::src
+{
+
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() : _head(&_stub), _tail(&_stub) { _stub.next.store(nullptr, std::memory_order_relaxed); }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue &operator=(const MpscQueue&) = delete;
+
+    /* brief: 入队，任意线程可调用 */
+    void Push(T *node) {
+        Link(node);
+        _pushed.fetch_add(1, std::memory_order_release);
+    }
+    /* brief: 出队，只能由消费者线程调用。队列为空，或者有生产者入队到一半时返回 nullptr */
+    T *Pop() {
+        T *tail = _tail;
+        T *next = tail->next.load(std::memory_order_acquire);
+        if(tail == &_stub) {
+            if(next == nullptr) return nullptr;
+            _tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if(next) {
+            _tail = next;
+            ++_popped;
+            return tail;
+        }
+        // tail 是最后一个节点：把 stub 挂到队尾，才能把 tail 取出来
+        if(tail != _head.load(std::memory_order_acquire)) return nullptr;
+        Link(&_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if(next) {
+            _tail = next;
+            ++_popped;
+            return tail;
+        }
+        return nullptr;
+    }
+    /* brief: 已经入队完成、还没出队的节点数，只能由消费者线程调用。用来给一轮出队划定边界。
+              不能用 _head 是否等于 stub 判断空：Pop 把 stub 挂到队尾时可能正好有生产者入队，stub 之前还有节点 */
+    uint64_t Size() const { return _pushed.load(std::memory_order_acquire) - _popped; }
+private:
+    /* brief: 把节点挂到队尾，不计数（Pop 挂 stub 也用它） */
+    void Link(T *node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        T *prev = _head.exchange(node, std::memory_order_acq_rel);
+        // 在 exchange 和这次 store 之间，消费者看到的链表是断开的，Pop 会暂时返回空
+        prev->next.store(node, std::memory_order_release);
+    }
+private:
+    alignas(64) std::atomic<T*> _head;  // 生产者竞争的入队端，单独占一个缓存行
+    std::atomic<uint64_t> _pushed{0};   // 入队完成的节点总数，和 _head 在同一个缓存行，生产者只需要拿一次
+    alignas(64) T *_tail;               // 消费者独占的出队端
+    uint64_t _popped = 0;               // 出队的节点总数，只有消费者访问
+    T _stub;                            // 哨兵节点，保证链表永远非空
+};
+
+}
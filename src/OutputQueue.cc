@@ -0,0 +1,139 @@
+#include "OutputQueue.h"
+#include <cassert>
+#include <algorithm>
+#include <unistd.h>
+
+namespace webserver::src
+{
+
+void OutputQueue::PushString(std::string &&str) {
+    if(str.empty()) return;
+    Segment &seg = _segments.emplace_back();
+    seg.type = SEGMENT_STRING;
+    seg.len = str.size();
+    seg.owned = std::move(str);
+    _bytes += seg.len;
+}
+
+void OutputQueue::PushBorrowed(const char *data, size_t len, std::shared_ptr<const void> holder) {
+    if(len == 0) return;
+    Segment &seg = _segments.emplace_back();
+    seg.type = SEGMENT_BORROWED;
+    seg.data = data;
+    seg.len = len;
+    seg.holder = std::move(holder);
+    _bytes += len;
+}
+
+void OutputQueue::PushFile(int fd, off_t offset, size_t size, std::shared_ptr<const void> holder) {
+    if(size == 0) {
+        // 空文件不入队，否则 sendfile 返回 0 会被当成文件截断而关闭连接；fd 归队列所有时直接关掉
+        if(fd >= 0 && !holder) close(fd);
+        return;
+    }
+    Segment &seg = _segments.emplace_back();
+    seg.type = SEGMENT_FILE;
+    seg.fd = fd;
+    seg.holder = std::move(holder);
+    seg.offset = offset;
+    seg.len = size;
+    _bytes += size;
+}
+
+std::string &OutputQueue::TailString() {
+    if(!Empty()) {
+        Segment &back = _segments.back();
+        if(back.type == SEGMENT_STRING && back.owned.size() < kCoalesceLimit) return back.owned;
+    }
+    Segment &seg = _segments.emplace_back();
+    seg.type = SEGMENT_STRING;
+    if(!_spare.empty()) {
+        seg.owned = std::move(_spare.back());
+        _spare.pop_back();
+        seg.owned.clear();
+    }
+    return seg.owned;
+}
+
+void OutputQueue::CommitString() {
+    Segment &back = _segments.back();
+    _bytes += back.owned.size() - back.len;
+    back.len = back.owned.size();
+    if(back.len == 0) {
+        // 什么也没写，新建的空段直接撤销
+        _spare.push_back(std::move(back.owned));
+        _segments.pop_back();
+        if(_head == _segments.size()) {
+            _segments.clear();
+            _head = 0;
+        }
+    }
+}
+
+int OutputQueue::PrepareIovec(struct iovec *iov, int max, size_t *bytes) const {
+    int cnt = 0;
+    size_t total = 0;
+    for(size_t i = _head; i < _segments.size() && cnt < max; ++i) {
+        const Segment &seg = _segments[i];
+        if(seg.IsFile()) break;
+        iov[cnt].iov_base = const_cast<char*>(seg.Data());
+        iov[cnt].iov_len = seg.Remain();
+        total += seg.Remain();
+        ++cnt;
+    }
+    if(bytes) *bytes = total;
+    return cnt;
+}
+
+void OutputQueue::Consume(size_t n) {
+    assert(n <= _bytes);
+    _bytes -= n;
+    while(n > 0) {
+        Segment &seg = Front();
+        assert(!seg.IsFile());
+        size_t step = std::min(n, seg.Remain());
+        seg.sent += step;
+        n -= step;
+        if(seg.Remain() == 0) PopFront();
+    }
+}
+
+void OutputQueue::ConsumeFile(size_t n) {
+    Segment &seg = Front();
+    assert(seg.IsFile() && n <= seg.len);
+    seg.len -= n;
+    _bytes -= n;
+    if(seg.len == 0) PopFront();
+}
+
+void OutputQueue::PopFront() {
+    Segment &seg = Front();
+    if(seg.IsFile()) {
+        if(seg.fd >= 0 && !seg.holder) close(seg.fd);
+        _bytes -= seg.len;
+    } else {
+        _bytes -= seg.Remain();
+        if(seg.type == SEGMENT_STRING && _spare.size() < kMaxSpareStrings &&
+           seg.owned.capacity() > 0 && seg.owned.capacity() <= kMaxSpareCapacity) {
+            if(_spare.capacity() == 0) _spare.reserve(kMaxSpareStrings);
+            _spare.push_back(std::move(seg.owned));
+        }
+    }
+    seg = Segment();
+    ++_head;
+    if(_head == _segments.size()) {
+        // 队列读空，回到起点复用已有容量
+        _segments.clear();
+        _head = 0;
+    } else if(_head >= 64 && _head * 2 >= _segments.size()) {
+        // 长时间没有读空（例如流水线持续写入），把已出队的段整体挪走，防止数组无限增长
+        _segments.erase(_segments.begin(), _segments.begin() + _head);
+        _head = 0;
+    }
+}
+
+void OutputQueue::Clear() {
+    while(!Empty()) PopFront();
+}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <climits>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// author: Haoyang Yang
+// filename: OutputQueue.h
+// brief: Connection 的输出队列。响应的各部分（头部字符串、正文、文件区间）按顺序作为段排队，
+//        HandleWrite 时把队首连续的内存段一次性交给 writev，文件段交给 sendfile，不再先拷贝进输出缓冲区
+
+namespace webserver::src
+{
+
+#ifdef IOV_MAX
+static constexpr int kMaxIovecs = IOV_MAX;
+#else
+static constexpr int kMaxIovecs = 1024;
+#endif
+
+static constexpr size_t kCoalesceLimit = 4096;      // 队尾字符串段小于它时，新写入的数据直接追加在它后面
+static constexpr size_t kMaxSpareStrings = 8;       // 回收的字符串最多保留几个
+static constexpr size_t kMaxSpareCapacity = 16384;  // 容量超过它的字符串不回收，避免大正文的内存一直被占着
+
+enum SegmentType {
+    SEGMENT_STRING,     // 自有字符串，数据被 move 进队列，由队列持有
+    SEGMENT_BORROWED,   // 借用的内存，由 holder 保证发送完之前不被释放
+    SEGMENT_FILE        // 文件区间，没有 holder 时由队列持有 fd，发送完或连接关闭时 close；有 holder 时 fd 是借用的
+};
+
+struct Segment {
+    SegmentType type = SEGMENT_STRING;
+    std::string owned;                      // SEGMENT_STRING 的数据
+    const char *data = nullptr;             // SEGMENT_BORROWED 的数据
+    std::shared_ptr<const void> holder;     // SEGMENT_BORROWED 的数据 / 借用的 SEGMENT_FILE 的 fd 的生命周期持有者
+    int fd = -1;                            // SEGMENT_FILE 的文件描述符
+    off_t offset = 0;                       // SEGMENT_FILE 下一次发送的文件偏移
+    size_t len = 0;                         // 段的总长度（文件段为剩余长度）
+    size_t sent = 0;                        // 内存段已经发送的字节数
+
+    bool IsFile() const { return type == SEGMENT_FILE; }
+    const char *Data() const { return (type == SEGMENT_STRING ? owned.data() : data) + sent; }
+    size_t Remain() const { return len - sent; }
+};
+
+class OutputQueue
+{
+public:
+    OutputQueue() : _head(0), _bytes(0) {}
+    ~OutputQueue() { Clear(); }
+    OutputQueue(const OutputQueue&) = delete;
+    OutputQueue &operator=(const OutputQueue&) = delete;
+
+    /* brief: 以下接口用于在队尾追加一个段 */
+    void PushString(std::string &&str);
+    void PushBorrowed(const char *data, size_t len, std::shared_ptr<const void> holder);
+    void PushFile(int fd, off_t offset, size_t size, std::shared_ptr<const void> holder = nullptr);
+    /* brief: 返回队尾可以直接追加数据的自有字符串：队尾是较短的字符串段时就是它，否则新建一个段，
+              优先复用已经发送完的字符串的容量。追加完后必须调用 CommitString */
+    std::string &TailString();
+    /* brief: 按队尾字符串的新长度更新段长度和待发送字节数 */
+    void CommitString();
+
+    bool Empty() const { return _head == _segments.size(); }
+    /* brief: 队列中还未发送的字节总数（包括文件段） */
+    size_t QueuedBytes() const { return _bytes; }
+    /* brief: 队首段 */
+    Segment &Front() { return _segments[_head]; }
+    /* brief: 把队首连续的内存段填进 iov，遇到文件段或填满 max 个就停止，返回填入的个数 */
+    int PrepareIovec(struct iovec *iov, int max, size_t *bytes) const;
+    /* brief: 内存段发送了 n 个字节，推进队首，发送完的段出队 */
+    void Consume(size_t n);
+    /* brief: 文件段发送了 n 个字节（offset 已由 sendfile 推进），发送完则关闭文件并出队 */
+    void ConsumeFile(size_t n);
+    /* brief: 队首段出队，自有 fd 的文件段会关闭 fd */
+    void PopFront();
+    /* brief: 清空队列，关闭所有还未发送的文件 */
+    void Clear();
+private:
+    std::vector<Segment> _segments;     // 段数组，[_head, size()) 是待发送的段，读空后复用容量
+    size_t _head;                       // 队首下标
+    size_t _bytes;                      // 待发送的字节总数
+    std::vector<std::string> _spare;    // 发送完回收的字符串，TailString 复用它们的容量，稳定后写响应头不再申请内存
+};
+
+}
@@ -1,35 +1,41 @@
 #pragma once
 
 #include "Channel.h"
-#include <sys/epoll.h>
-#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <functional>
 
 namespace webserver::src
 {
 
-#define INITIAL_EPOLLEVENTS 32
+/* brief: 新连接的回调，参数是新连接的文件描述符 */
+using AcceptCallback = std::function<void(int)>;
 
+/* brief: 事件监控的后端类型 */
+enum PollerBackend {
+    POLLER_EPOLL,   // epoll_ctl + epoll_wait
+    POLLER_URING    // io_uring 的 poll/accept 请求，注册变更和等待合并在一次 io_uring_enter 里提交
+};
+
+/* brief: 事件监控模块的接口，EventLoop 只依赖这个接口，不关心底层是 epoll 还是 io_uring */
 class Poller
 {
 public:
-    Poller();
-
-    /* brief: 更新事件监控，添加/更改关心的事件，在对红黑树节点的 events 作修改 */
-    void UpdateEvents(Channel *channel);
+    virtual ~Poller() = default;
+    /* brief: 更新事件监控，添加/更改关心的事件 */
+    virtual void UpdateEvents(Channel *channel) = 0;
     /* brief: 移除事件监控 */
-    void RemoveEvents(Channel *channel);
-
-    /* brief: 监控事件的执行函数，如果没有事件就绪就会阻塞 */
-    void Poll(std::vector<Channel*> &actives);
-private:
-    /* brief: 更新事件监控的具体实现 */
-    void Update(Channel *channel, int op);
-
-    //bool HasChannel(Channel *channel);
-private:
-    int _epollfd;
-    std::vector<struct epoll_event> _events;
-    std::unordered_map<int, Channel*> _channels; // 哈希表来存放监控的Channel，用文件描述符作键
+    virtual void RemoveEvents(Channel *channel) = 0;
+    /* brief: 监控事件的执行函数，如果没有事件就绪就会阻塞。timeout_ms 为 0 时不阻塞，-1 时一直等待 */
+    virtual void Poll(std::vector<Channel*> &actives, int timeout_ms) = 0;
+    /* brief: 后端是否支持边缘触发（EPOLLET） */
+    virtual bool SupportsEdgeTrigger() const = 0;
+    /* brief: 由后端直接在监听套接字 channel 上持续 accept，每个新连接的 fd 在本轮 Poll 返回前交给 cb，
+              不再经过可读事件 + accept4。后端不支持时返回 false，调用者照常开启读事件监控 */
+    virtual bool StartAccept(Channel *channel, const AcceptCallback &cb) { (void)channel; (void)cb; return false; }
+
+    /* brief: 按后端类型创建 Poller，io_uring 不可用（内核太旧或被禁用）时退回 epoll */
+    static std::unique_ptr<Poller> Create(PollerBackend backend);
 };
 
-}
\ No newline at end of file
+}
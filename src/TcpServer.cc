@@ -1,19 +1,30 @@
 #include "TcpServer.h"
+#include <algorithm>
 
 namespace webserver::src
 {
-TcpServer::TcpServer(uint16_t port)
-    : _port(port), _next_id(0), _enable_inactive_release(false),
-    _baseloop(), _acceptor(&_baseloop, _port), _threadpool(&_baseloop)
+TcpServer::TcpServer(uint16_t port, PollerBackend backend)
+    : _port(port), _next_id(0), _enable_inactive_release(false), _edge_triggered(false), _reuse_port(false), _cpu_steering(false),
+    _baseloop(backend), _threadpool(&_baseloop)
     {
-        _acceptor.SetAcceptCallback(std::bind(&TcpServer::NewConnection, this, std::placeholders::_1));
-        _acceptor.Listen();
+        _threadpool.SetPollerBackend(backend);
     }
 /* brief: 启动服务器 */
 void TcpServer::Start() {
     SPDLOG_TRACE("创建线程池");
     //printf("创建线程池\n");
     _threadpool.Create();
+    std::vector<EventLoop*> loops = _threadpool.GetAllLoops();
+    for(EventLoop *loop : loops) _connections[loop]; // 先把各线程的连接表建好，之后各线程只访问自己的那一张
+    if(_reuse_port) {
+        // 每个 EventLoop 各自监听、各自 accept，新连接留在接收它的线程，不经过 baseloop
+        _acceptors.resize(loops.size());
+        // 从第一个 loop 开始，每个 loop 监听完再交给下一个
+        loops[0]->RunInLoop(std::bind(&TcpServer::ListenInLoop, this, loops[0], 0));
+    } else {
+        _acceptors.resize(1);
+        ListenInLoop(&_baseloop, 0);
+    }
     SPDLOG_TRACE("启动 baseloop");
     //printf("启动 baseloop\n");
     _baseloop.Start();
@@ -23,33 +34,87 @@ void TcpServer::EnableInactiveRelease(int timeout) {
     _timeout = timeout;
     _enable_inactive_release = true;
 }
+/* brief: 开启边缘触发模式 */
+void TcpServer::EnableEdgeTrigger() { _edge_triggered = true; }
+/* brief: 开启 SO_REUSEPORT 多监听模式 */
+void TcpServer::EnableReusePort() { _reuse_port = true; }
+/* brief: 在 loop 所在线程创建第 idx 个监听套接字并开始监听 */
+void TcpServer::ListenInLoop(EventLoop *loop, size_t idx) {
+    auto acceptor = std::make_unique<Acceptor>(loop, _port, _reuse_port);
+    // 多监听模式下新连接交给接收它的 loop，否则由 NewConnection 轮询分配
+    EventLoop *owner = _reuse_port ? loop : nullptr;
+    acceptor->SetAcceptCallback(std::bind(&TcpServer::NewConnection, this, owner, std::placeholders::_1));
+    if(_edge_triggered) acceptor->EnableEdgeTrigger();
+    int cpu = _threadpool.LoopCpu(idx);
+    if(_reuse_port && _cpu_steering && cpu >= 0) acceptor->SetIncomingCpu(cpu);
+    acceptor->Listen();
+    _acceptors[idx] = std::move(acceptor);
+    if(!_reuse_port) return;
+    std::vector<EventLoop*> loops = _threadpool.GetAllLoops();
+    if(idx + 1 < loops.size()) {
+        loops[idx + 1]->RunInLoop(std::bind(&TcpServer::ListenInLoop, this, loops[idx + 1], idx + 1));
+        return;
+    }
+    // 整个组都建好了，按各 loop 绑定的 CPU 挂上分流程序
+    if(!_cpu_steering) return;
+    std::vector<int> cpus;
+    for(size_t i = 0; i < loops.size(); ++i) cpus.push_back(_threadpool.LoopCpu(i));
+    if(std::find(cpus.begin(), cpus.end(), -1) != cpus.end()) {
+        SPDLOG_WARN("从属线程没有绑定 CPU，不按 CPU 分配新连接");
+        return;
+    }
+    if(_acceptors[idx]->AttachCpuSteering(cpus)) SPDLOG_INFO("新连接按收到它的 CPU 分配到 {} 个监听套接字", cpus.size());
+}
 /* brief: 添加定时器实际操作 */
 void TcpServer::RunAfterInLoop(const Functor &task, int delay) {
-    _next_id++;
-    _baseloop.AddTimer(_next_id, delay, task);
+    _baseloop.AddTimer(++_next_id, delay, task);
 }
 /* brief: Acceptor的可读事件回调函数 */
-void TcpServer::NewConnection(int fd) {
-        SPDLOG_INFO("Accept 一个新连接, fd = {}", fd);
-        _next_id++;
-        // 构造出一个Connection对象（注：这里可以用内存池优化）
-        std::shared_ptr<Connection> connection(new Connection(_threadpool.NextLoop(), _next_id, fd));
+void TcpServer::NewConnection(EventLoop *owner, int fd) {
+    SPDLOG_DEBUG("Accept 一个新连接, fd = {}", fd);
+    // 多监听模式下连接就在接收它的线程里，不需要跨线程投递
+    if(owner) {
+        owner->GetLoad()->connections.fetch_add(1, std::memory_order_relaxed);
+        return NewConnectionInLoop(owner, fd);
+    }
+    // 否则 baseloop 只负责挑选从属线程，把 fd 交过去，在那个线程里构造连接
+    EventLoop *loop = _threadpool.NextLoop();
+    // 挑中就计入负载，不等连接在从属线程构造出来，同一批接着到来的新连接挑选时就能看到
+    loop->GetLoad()->connections.fetch_add(1, std::memory_order_relaxed);
+    loop->RunInLoop(std::bind(&TcpServer::NewConnectionInLoop, this, loop, fd));
+}
+/* brief: 在连接所属的 loop 线程里创建 Connection */
+void TcpServer::NewConnectionInLoop(EventLoop *loop, int fd) {
+        uint64_t id = ++_next_id;
+        loop->GetMetrics()->accepted.Add();
+        // 从连接所在线程的对象池构造出一个Connection对象，控制块和对象在同一个槽位里，
+        // 连接关闭后也在这个线程释放，槽位直接回到本线程的 free list
+        std::shared_ptr<Connection> connection = std::allocate_shared<Connection>(
+            ConnectionAllocator<Connection>(ConnectionPool::Local()), loop, id, fd);
         SPDLOG_TRACE("为新连接新建一个 Connection");
         connection->SetMessageCallback(_message_callback);
         connection->SetClosedCallback(_closed_callback);
         connection->SetConnectedCallback(_connected_callback);
         connection->SetAnyEventCallback(_anyevent_callback);
-        connection->SetSrvClosedCallback(std::bind(&TcpServer::RemoveConnection, this, std::placeholders::_1));
+        if(_high_water_mark > 0) {
+            connection->SetWaterMarks(_high_water_mark, _low_water_mark);
+            connection->SetHighWaterMarkCallback(_high_water_callback);
+            connection->SetLowWaterMarkCallback(_low_water_callback);
+        }
+        // 只捕获两个指针，std::function 可以直接存下，不需要额外申请内存
+        connection->SetSrvClosedCallback([this, loop](const std::shared_ptr<Connection> &conn) { RemoveConnection(loop, conn); });
         // 选择是否开启非活跃连接释放
         if(_enable_inactive_release) connection->EnableInactiveRelease(_timeout);
+        if(_edge_triggered) connection->EnableEdgeTrigger();
         connection->Established();
-        _connections[_next_id] = connection;
+        _connections[loop][id] = connection;
  }
 /* brief: 移除连接的实际执行操作 */
-void TcpServer::RemoveConnectionInLoop(const std::shared_ptr<Connection> &connection) {
-    int id = connection->GetConnId();
-    auto it = _connections.find(id);
-    if(it != _connections.end()) _connections.erase(it);
+void TcpServer::RemoveConnectionInLoop(EventLoop *table_loop, const std::shared_ptr<Connection> &connection) {
+    uint64_t id = connection->GetConnId();
+    auto &connections = _connections[table_loop];
+    auto it = connections.find(id);
+    if(it != connections.end()) connections.erase(it);
 }
 
 }
\ No newline at end of file
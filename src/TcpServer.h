@@ -2,6 +2,7 @@
 
 #include "LoopThreadPool.h"
 #include "Acceptor.h"
+#include <atomic>
 #include <signal.h>
 
 namespace webserver::src
@@ -11,14 +12,18 @@ using ConnectedCallback = std::function<void(const std::shared_ptr<Connection>&)
 using MessageCallback = std::function<void(const std::shared_ptr<Connection>&, Buffer*)>;
 using ClosedCallback = std::function<void(const std::shared_ptr<Connection>&)>;
 using AnyEventCallback = std::function<void(const std::shared_ptr<Connection>&)>;
+using WaterMarkCallback = std::function<void(const std::shared_ptr<Connection>&)>;
 
 
 class TcpServer
 {
 public:
-    TcpServer(uint16_t port);
+    /* brief: backend 选择所有 EventLoop 的事件监控后端，默认 epoll */
+    TcpServer(uint16_t port, PollerBackend backend = POLLER_EPOLL);
     /* brief: 设置从属线程数量 */
     void SetThreadCount(int count) { return _threadpool.SetThreadCount(count); }
+    /* brief: 设置新连接分配到从属线程的策略，默认轮询。多监听模式下由内核分配，不使用这个策略 */
+    void SetLoopPlacement(LoopPlacement placement) { return _threadpool.SetPlacement(placement); }
     /* brief: 启动服务器 */
     void Start();
     /* brief: 用户设置回调函数 */
@@ -26,34 +31,69 @@ public:
     void SetMessageCallback(const MessageCallback &msgcb) { _message_callback = msgcb; }
     void SetClosedCallback(const ClosedCallback &clscb) { _closed_callback = clscb; }
     void SetAnyEventCallback(const AnyEventCallback &anyeventcb) { _anyevent_callback = anyeventcb; }
+    void SetHighWaterMarkCallback(const WaterMarkCallback &highcb) { _high_water_callback = highcb; }
+    void SetLowWaterMarkCallback(const WaterMarkCallback &lowcb) { _low_water_callback = lowcb; }
+    /* brief: 设置所有新连接输出队列的高低水位（见 Connection::SetWaterMarks），high 为 0 表示不检查 */
+    void SetWaterMarks(size_t high, size_t low) {
+        assert(high == 0 || low < high);
+        _high_water_mark = high;
+        _low_water_mark = low;
+    }
     /* brief: 是否启动非活跃连接超时销毁功能 */
     void EnableInactiveRelease(int timeout);
+    /* brief: 监听套接字和所有新连接使用边缘触发模式，需要在 Start 之前调用。io_uring 后端用多次触发的 poll 请求实现，内核不支持时保持水平触发 */
+    void EnableEdgeTrigger();
+    /* brief: 每个从属线程（没有从属线程时是 baseloop）各自打开一个 SO_REUSEPORT 监听套接字并在本线程 accept，
+              由内核把新连接分散到各线程，新连接不再经过 baseloop 转交。需要在 Start 之前调用 */
+    void EnableReusePort();
+    /* brief: 从属线程绑定 CPU：第 i 个线程绑定到 cpus[i % cpus.size()]，并优先从该 CPU 所在的 NUMA 节点分配内存。需要在 Start 之前调用 */
+    void SetLoopCpus(const std::vector<int> &cpus) { return _threadpool.SetCpuAffinity(cpus); }
+    /* brief: 多监听模式下把新连接交给绑定在收到它的 CPU 上的线程（SO_INCOMING_CPU + SO_REUSEPORT 的 CBPF 程序），
+              软中断和处理连接的线程在同一个核上。需要同时开启 EnableReusePort 和 SetLoopCpus，在 Start 之前调用 */
+    void EnableCpuSteering() { _cpu_steering = true; }
+    /* brief: 获取主线程的 EventLoop，可以在上面挂其他事件（例如文件缓存的 inotify） */
+    EventLoop *GetBaseLoop() { return &_baseloop; }
     /* brief: 添加定时任务 */
     void RunAfter(const Functor &task, int delay) { _baseloop.RunInLoop(std::bind(&TcpServer::RunAfterInLoop, this, task, delay)); }
 private:
     void RunAfterInLoop(const Functor &task, int delay);
-    /* brief: 为新连接创建一个Connection进行管理 */
-    void NewConnection(int fd);
+    /* brief: 在 loop 所在线程创建监听套接字并开始监听。多监听模式下各线程按顺序依次创建，
+              监听套接字在 SO_REUSEPORT 组里的位置和 loop 的下标一致，最后一个创建完后挂上 CPU 分流程序 */
+    void ListenInLoop(EventLoop *loop, size_t idx);
+    /* brief: 为新连接创建一个Connection进行管理。owner 是接收连接的线程（多监听模式），为空则按分配策略选一个从属线程 */
+    void NewConnection(EventLoop *owner, int fd);
+    /* brief: 在 loop 线程里创建 Connection：对象从 loop 的对象池分配，登记在 loop 的连接表里 */
+    void NewConnectionInLoop(EventLoop *loop, int fd);
     /* brief: 移除连接的实际执行 */
-    void RemoveConnectionInLoop(const std::shared_ptr<Connection> &connection);
-    /* brief: 从 _connections 移除连接已经关闭的connection */
-    void RemoveConnection(const std::shared_ptr<Connection> &connection) { _baseloop.RunInLoop(std::bind(&TcpServer::RemoveConnectionInLoop, this, connection)); }
+    void RemoveConnectionInLoop(EventLoop *table_loop, const std::shared_ptr<Connection> &connection);
+    /* brief: 从 table_loop（连接所在的 loop）的连接表移除连接已经关闭的connection */
+    void RemoveConnection(EventLoop *table_loop, const std::shared_ptr<Connection> &connection) { 
+        table_loop->RunInLoop(std::bind(&TcpServer::RemoveConnectionInLoop, this, table_loop, connection)); 
+    }
     
 private:
     uint16_t _port;    //该server对应的端口号
-    uint64_t _next_id; //自动增长ID
+    std::atomic<uint64_t> _next_id; //自动增长ID，多监听模式下多个线程同时分配
     int _timeout;      //非活跃连接释放时间
     bool _enable_inactive_release; //是否开启非活跃连接释放
+    bool _edge_triggered; //新连接是否使用边缘触发
+    bool _reuse_port; //是否每个线程各自监听
+    bool _cpu_steering; //多监听模式下是否按收到连接的 CPU 分配监听套接字
+    size_t _high_water_mark = 0; //新连接输出队列的高水位，0 表示不检查
+    size_t _low_water_mark = 0;  //新连接输出队列的低水位
     EventLoop _baseloop; //主线程，负责监听事件的处理
-    Acceptor _acceptor;  //监听套接字的管理对象
     LoopThreadPool _threadpool; //从属线程池
-    std::unordered_map<uint64_t, std::shared_ptr<Connection>> _connections; //管理所有连接
+    std::vector<std::unique_ptr<Acceptor>> _acceptors;  //监听套接字的管理对象，多监听模式下每个线程一个
+    /* 管理所有连接：按连接所在的 loop 分开，每张表只在对应线程内访问 */
+    std::unordered_map<EventLoop*, std::unordered_map<uint64_t, std::shared_ptr<Connection>>> _connections;
 
     /* 以下的回调由服务器使用者设置 */
     ConnectedCallback _connected_callback;
     MessageCallback _message_callback;
     ClosedCallback _closed_callback;
     AnyEventCallback _anyevent_callback;
+    WaterMarkCallback _high_water_callback;
+    WaterMarkCallback _low_water_callback;
     /* 组件内的连接关闭回调，由组件内设置，因为webserver组件会把所有的连接管理起来，一旦某个连接要关闭
     就应该从管理的地方删除掉自己的信息 */
     ClosedCallback _server_closed_callback;
@@ -1,37 +1,43 @@
 #include "EventLoop.h"
+#include <ctime>
 
 namespace webserver::src
 {
-/* brief: 计时任务构造函数 */
-TimerTask::TimerTask(uint64_t id, uint32_t delay, const TaskFunc &cb)
-    : _id(id), _timeout(delay), _task_cb(cb)
+
+namespace {
+/* brief: 第 level 层（从 1 开始）一格的时间对应的位移 */
+constexpr int LevelShift(int level) { return kWheelRootBits + (level - 1) * kWheelLevelBits; }
+}
+
+TimeWheel::TimeWheel(EventLoop *loop)
+    : _loop(loop), _current(NowMs()), _count(0), _next_wake(0), _next_dirty(true)
     {}
-/* brief: 计时任务析构函数，析构时如果任务没取消，则执行定时任务。之后执行计时任务释放回调函数 */
-TimerTask::~TimerTask() {
-    if(!_is_cancel) {
-        _task_cb();
+
+TimeWheel::~TimeWheel() {
+    for(auto &it : _timers) {
+        it.second->Unlink();
+        delete it.second;
     }
-    _release_cb();
 }
-// ========== TimeWheel ==========
-TimeWheel::TimeWheel(EventLoop *loop, int capacity) 
-    : _capacity(60), _tick(0), _timewheel(_capacity), _loop(loop),
-    _timerfd(CreateTimerFd()), _timer_channel(std::make_unique<Channel>(loop, _timerfd))
-    {
-        _timer_channel->SetReadCallback(std::bind(&TimeWheel::OnTime, this));
-        _timer_channel->EnableRead();
-    }
 
 void TimeWheel::AddTimer(uint64_t id, uint32_t delay, const TaskFunc &cb) {
-    _loop->RunInLoop(std::bind(&TimeWheel::AddTimerInLoop, this, id, delay, cb));
+    AddTimerMs(id, static_cast<uint64_t>(delay) * 1000, cb);
 }
 
+void TimeWheel::AddTimerMs(uint64_t id, uint64_t delay_ms, const TaskFunc &cb) {
+    _loop->RunInLoop(std::bind(&TimeWheel::AddTimerInLoop, this, id, delay_ms, cb));
+}
+
+/* notes: 每个连接的每次事件都会刷新定时器，在所属线程内直接执行，不构造 std::function；
+          跨线程时 lambda 只捕获 this 和 id，能放进 std::function 的内部缓冲区，不需要额外申请内存 */
 void TimeWheel::RefreshTimer(uint64_t id) {
-    _loop->RunInLoop(std::bind(&TimeWheel::RefreshTimerInLoop, this, id));
+    if(_loop->IsInLoop()) return RefreshTimerInLoop(id);
+    _loop->RunInLoop([this, id]() { RefreshTimerInLoop(id); });
 }
 
 void TimeWheel::CancelTimer(uint64_t id) {
-    _loop->RunInLoop(std::bind(&TimeWheel::CancelTimerInLoop, this, id));
+    if(_loop->IsInLoop()) return CancelTimerInLoop(id);
+    _loop->RunInLoop([this, id]() { CancelTimerInLoop(id); });
 }
 
 bool TimeWheel::HasTimer(uint64_t id) {
@@ -42,86 +48,187 @@ bool TimeWheel::HasTimer(uint64_t id) {
     return true;
 }
 
-void TimeWheel::Remove(uint64_t id) {
-    auto it = _timers.find(id);
-    if(it != _timers.end()) {
-        _timers.erase(id);
-    }
+uint64_t TimeWheel::NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
 }
-
-int TimeWheel::CreateTimerFd() {
-    int timerfd = timerfd_create(CLOCK_MONOTONIC, 0); // 调用系统调用创建一个定时器描述符
-    if(timerfd < 0) {
-        // create timerfd failed
-        abort();
-    }
-    struct itimerspec itime;
-    // 第一次超时在1s后
-    itime.it_value.tv_sec = 1;
-    itime.it_value.tv_nsec = 0; 
-    // 第一次超时后，每次超时间隔时间
-    itime.it_interval.tv_sec = 1;
-    itime.it_interval.tv_nsec = 0;
-    // 设置计时时间
-    timerfd_settime(timerfd, 0, &itime, NULL);
-
-    return timerfd;
-}
-/*  brief: 读取计时器事件描述符 */
-int TimeWheel::ReadTimeFd() {
-    uint64_t times;
-    // 有可能因为其它描述符的事件处理较长，然后在处理定时器描述符事件的时候，有的任务超时了很多次
-    // read读取的times就是从上一次read之后超时的次数
-    int ret = read(_timerfd, &times, 8);
-    if(ret < 0) {
-        abort;
-    }
-    return times;
-}
-/* brief: 执行计时任务的函数 */
-void TimeWheel::RunTimerTask() {
-    _tick = (_tick + 1) % _capacity;
-    _timewheel[_tick].clear(); // 将这个时间格里的vector清空，对应的计时任务被析构，从而执行定时任务
-
+/* brief: 距离下一次需要推进时间轮的毫秒数 */
+int TimeWheel::NextTimeout() {
+    if(_count == 0) return -1;
+    if(_next_dirty) {
+        _next_wake = ComputeNextWake();
+        _next_dirty = false;
+    }
+    uint64_t now = NowMs();
+    if(_next_wake <= now) return 0;
+    uint64_t timeout = _next_wake - now;
+    return timeout > INT32_MAX ? INT32_MAX : static_cast<int>(timeout);
 }
-/* brief: 同步时间 */
-void TimeWheel::OnTime() {
-    int times = ReadTimeFd();
-    for(int i = 0; i < times; ++i) {
-        RunTimerTask(); //同步时间，然后将超时了的任务全部执行
+/* brief: 推进时间轮，执行到期任务 */
+void TimeWheel::RunExpired() {
+    uint64_t now = NowMs();
+    if(now <= _current) return;
+    while(_current < now) {
+        if(_count == 0) {
+            // 没有定时器，直接跳到当前时刻
+            _current = now;
+            break;
+        }
+        Tick();
     }
+    _next_dirty = true;
 }
 /* brief: 添加定时任务的实际执行 */
-void TimeWheel::AddTimerInLoop(uint64_t id, uint32_t delay, const TaskFunc &cb) {
-    SharedPtr ptr = std::make_shared<TimerTask>(id, delay, cb); // 创建一个定时任务的共享指针，这样只要计数不为0，就不会被析构 
-    ptr->SetRelease(std::bind(&TimeWheel::Remove, this, id));   // 设置定时任务释放函数，在定时任务析构时，把它从哈希表内移除
-    int pos = (_tick + delay) % _capacity;                      // 定时任务插入位置就是秒针当前指向的位置 + 要定的时间
-    _timewheel[pos].push_back(ptr);                             // 将定时任务插入对应时间的任务桶中
-    _timers[id] = WeakPtr(ptr);                                 // 在定时任务表中添加这一定时任务（注 weakptr 不会暂用引用计数
-}
-/* brief: 刷新定时任务的实际执行 */
+void TimeWheel::AddTimerInLoop(uint64_t id, uint64_t delay_ms, const TaskFunc &cb) {
+    auto it = _timers.find(id);
+    if(it != _timers.end()) {
+        // 同一个 id 重复添加，替换掉旧的任务
+        it->second->Unlink();
+        delete it->second;
+        --_count;
+        _timers.erase(it);
+    }
+    TimerNode *node = new TimerNode();
+    node->id = id;
+    node->delay = delay_ms;
+    node->expire = NowMs() + delay_ms;
+    node->task_cb = cb;
+    _timers[id] = node;
+    ++_count;
+    Insert(node);
+    Metrics *metrics = _loop->GetMetrics();
+    metrics->timers_added.Add();
+    metrics->timers_active.Set(_count);
+}
+/* brief: 刷新定时任务的实际执行：摘下节点，按新的到期时刻重新挂上 */
 void TimeWheel::RefreshTimerInLoop(uint64_t id) {
     auto it = _timers.find(id);
     if(it == _timers.end()) {
         // 不存在这个定时任务
         return;
     }
-    SharedPtr ptr = it->second.lock(); // 从 WeakPtr 中创建一个 SharedPtr
-    int delay = ptr->DelayTime();
-    int pos = (_tick + delay) % _capacity;
-    _timewheel[pos].push_back(ptr);
+    TimerNode *node = it->second;
+    node->Unlink();
+    node->expire = NowMs() + node->delay;
+    Insert(node);
 }
 /* brief: 关闭定时任务的实际执行 */
 void TimeWheel::CancelTimerInLoop(uint64_t id) {
-    auto pos = _timers.find(id);
-    if(pos == _timers.end()) {
+    auto it = _timers.find(id);
+    if(it == _timers.end()) {
         // 不存在这个定时任务
         return;
     }
-    SharedPtr ptr = pos->second.lock();
-    if(ptr) {
-        ptr->Cancel();
+    it->second->Unlink();
+    delete it->second;
+    --_count;
+    _timers.erase(it);
+    Metrics *metrics = _loop->GetMetrics();
+    metrics->timers_cancelled.Add();
+    metrics->timers_active.Set(_count);
+}
+
+void TimeWheel::Insert(TimerNode *node) {
+    // 已经过期的任务放到下一格，保证下一次 Tick 就能执行
+    uint64_t expire = node->expire > _current ? node->expire : _current + 1;
+    uint64_t delta = expire - _current;
+    if(delta >= kWheelMaxDelay) {
+        // 超出时间轮范围，先挂在最高层最远的位置，到时候重新分配
+        expire = _current + kWheelMaxDelay - 1;
+        delta = kWheelMaxDelay - 1;
+    }
+    uint64_t wake = expire;
+    if(delta < kWheelRootSize) {
+        _root[expire & (kWheelRootSize - 1)].PushBack(node);
+    } else {
+        int level = 1;
+        while(delta >= (1ull << LevelShift(level + 1))) ++level;
+        int shift = LevelShift(level);
+        _levels[level - 1][(expire >> shift) & (kWheelLevelSize - 1)].PushBack(node);
+        wake = (expire >> shift) << shift; // 高层的节点在所在格子被分配到低层时才需要醒来
+    }
+    if(!_next_dirty && wake < _next_wake) _next_wake = wake;
+}
+
+void TimeWheel::Cascade(int level, uint64_t idx) {
+    TimerLink list;
+    TimerLink &slot = _levels[level - 1][idx];
+    while(!slot.Empty()) {
+        TimerLink *link = slot.next;
+        link->Unlink();
+        list.PushBack(link);
+    }
+    while(!list.Empty()) {
+        TimerLink *link = list.next;
+        link->Unlink();
+        Insert(static_cast<TimerNode*>(link));
+    }
+}
+
+void TimeWheel::Tick() {
+    ++_current;
+    // step1: 第 0 层转完一圈，从上一层取下一格分配下来；上一层也转完一圈就继续往上
+    if((_current & (kWheelRootSize - 1)) == 0) {
+        for(int level = 1; level <= kWheelLevels; ++level) {
+            uint64_t idx = (_current >> LevelShift(level)) & (kWheelLevelSize - 1);
+            Cascade(level, idx);
+            if(idx != 0) break;
+        }
+    }
+    // step2: 执行当前格子的任务。先整体摘到本地链表，任务里可以安全地添加/取消其他定时器
+    TimerLink &slot = _root[_current & (kWheelRootSize - 1)];
+    if(slot.Empty()) return;
+    TimerLink expired;
+    while(!slot.Empty()) {
+        TimerLink *link = slot.next;
+        link->Unlink();
+        expired.PushBack(link);
+    }
+    while(!expired.Empty()) {
+        TimerNode *node = static_cast<TimerNode*>(expired.next);
+        node->Unlink();
+        if(node->expire > _current) {
+            // 因为超出范围被截断过的任务，还没到期
+            Insert(node);
+            continue;
+        }
+        // 先从表里移除再执行，任务里可以用同一个 id 重新添加定时器
+        _timers.erase(node->id);
+        --_count;
+        TaskFunc task = std::move(node->task_cb);
+        delete node;
+        Metrics *metrics = _loop->GetMetrics();
+        metrics->timers_fired.Add();
+        metrics->timers_active.Set(_count);
+        task();
     }
 }
 
-}
\ No newline at end of file
+uint64_t TimeWheel::ComputeNextWake() const {
+    // 第 0 层：第一个非空格子就是最早的到期时刻
+    uint64_t wake = UINT64_MAX;
+    for(uint64_t i = 1; i <= kWheelRootSize; ++i) {
+        uint64_t t = _current + i;
+        if(!_root[t & (kWheelRootSize - 1)].Empty()) {
+            wake = t;
+            break;
+        }
+    }
+    // 高层：第一个非空格子被分配下来的时刻，各层取最早的
+    for(int level = 1; level <= kWheelLevels; ++level) {
+        int shift = LevelShift(level);
+        uint64_t block = _current >> shift;
+        for(uint64_t i = 1; i <= kWheelLevelSize; ++i) {
+            uint64_t t = (block + i) << shift;
+            if(t >= wake) break;
+            if(!_levels[level - 1][(block + i) & (kWheelLevelSize - 1)].Empty()) {
+                wake = t;
+                break;
+            }
+        }
+    }
+    return wake;
+}
+
+}
@@ -1,8 +1,15 @@
 #pragma once
 
-#include <memory>
-#include <sys/timerfd.h>
-#include <unistd.h>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+// author: Haoyang Yang
+// filename: TimeWheel.h
+// brief: 分层时间轮，精度 1ms。第 0 层 256 格，每格 1ms；往上每层 64 格，每格是下一层一整圈的时间，
+//        共 5 层覆盖约 49 天，更远的定时器先挂在最高层，到期时重新计算位置，所以延时没有上限。
+//        定时器节点是侵入式双向链表，刷新/取消只是把节点摘下来再挂上，O(1) 且不分配内存。
+//        不再使用 timerfd，EventLoop 用 NextTimeout() 作为 epoll_wait 的超时时间，醒来后调用 RunExpired()
 
 namespace webserver::src
 {
@@ -10,66 +17,89 @@ namespace webserver::src
 class EventLoop;
 
 using TaskFunc = std::function<void()>;
-using ReleaseFunc = std::function<void()>;
 
-class TimerTask 
-{
-public:
-    TimerTask(uint64_t id, uint32_t delay, const TaskFunc &cb);
-    /* brief: 设置释放定时器回调 */
-    void SetRelease(const ReleaseFunc &cb) { _release_cb = cb; }
-    /* brief: 取消 */
-    void Cancel() { _is_cancel = true; }
-    /* brief: 超时时间 */
-    uint32_t DelayTime() { return _timeout; }
+static constexpr int kWheelRootBits = 8;                        // 第 0 层的位数
+static constexpr int kWheelLevelBits = 6;                       // 其余每层的位数
+static constexpr int kWheelLevels = 4;                          // 第 0 层之外的层数
+static constexpr uint64_t kWheelRootSize = 1ull << kWheelRootBits;
+static constexpr uint64_t kWheelLevelSize = 1ull << kWheelLevelBits;
+static constexpr uint64_t kWheelMaxDelay = 1ull << (kWheelRootBits + kWheelLevels * kWheelLevelBits); // 一次能挂上的最远距离（ms）
 
-    /* brief: 时间到了析构定时器任务，在析构函数种执行定时任务 */
-    ~TimerTask();
-private:
-    bool _is_cancel;
-    uint64_t _id;      //定时器任务id
-    uint32_t _timeout; //定时器超时时间
-    TaskFunc _task_cb; //定时器对象要执行的定时任务
-    ReleaseFunc _release_cb;
+/* brief: 时间轮格子里的链表指针，格子本身用它作哨兵 */
+struct TimerLink {
+    TimerLink *prev = this;
+    TimerLink *next = this;
+
+    bool Empty() const { return next == this; }
+    /* brief: 把自己从所在链表里摘下来 */
+    void Unlink() {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+    /* brief: 把 node 挂到以自己为哨兵的链表尾部 */
+    void PushBack(TimerLink *node) {
+        node->prev = prev;
+        node->next = this;
+        prev->next = node;
+        prev = node;
+    }
 };
 
-using WeakPtr = std::weak_ptr<TimerTask>;
-using SharedPtr = std::shared_ptr<TimerTask>;
+/* brief: 定时器节点 */
+struct TimerNode : public TimerLink {
+    uint64_t id = 0;        // 定时器任务id
+    uint64_t expire = 0;    // 到期时刻（ms，单调时钟）
+    uint64_t delay = 0;     // 超时时间（ms），刷新时按它重新计算到期时刻
+    TaskFunc task_cb;       // 定时器到期要执行的任务
+};
 
 class TimeWheel
 {
 public:
-    TimeWheel(EventLoop *loop, int capacity = 60);
-    /* brief: 添加定时任务 */
+    explicit TimeWheel(EventLoop *loop);
+    ~TimeWheel();
+    TimeWheel(const TimeWheel&) = delete;
+    TimeWheel &operator=(const TimeWheel&) = delete;
+    /* brief: 添加定时任务，delay 单位为秒 */
     void AddTimer(uint64_t id, uint32_t delay, const TaskFunc &cb);
-    /* brief: 刷新定时器，体现为在时间轮新增一个定时任务 */
+    /* brief: 添加定时任务，delay 单位为毫秒 */
+    void AddTimerMs(uint64_t id, uint64_t delay_ms, const TaskFunc &cb);
+    /* brief: 刷新定时器，把节点移到 现在 + 超时时间 的位置 */
     void RefreshTimer(uint64_t id);
     /* brief: 取消定时器 */
     void CancelTimer(uint64_t id);
     /* waring: 这个接口不能被外界使用者调用，只能在模块内，对应EventLoop线程内执行 */
     /* brief: 检测有无定时任务 */
     bool HasTimer(uint64_t id);
+    /* brief: 距离下一次需要推进时间轮还有多少毫秒，没有定时器返回 -1。只能在对应EventLoop线程内执行 */
+    int NextTimeout();
+    /* brief: 把时间轮推进到当前时刻，执行所有到期的任务。只能在对应EventLoop线程内执行 */
+    void RunExpired();
+
+    /* brief: 单调时钟的当前时刻（ms） */
+    static uint64_t NowMs();
 private:
-    /* brief: 移除定时任务 */
-    void Remove(uint64_t id);
-    /* brief: 创建TimerFd，操作系统底层会帮我们计时，时间到了会通过这个fd通知我们，和eventfd有异曲同工 */
-    static int CreateTimerFd();
-    int ReadTimeFd();
-    /* brief: timerfd 被触发，进程就执行一次RunTimerTask，即让指针移动一次，执行一下所有过期定时任务 */
-    void RunTimerTask();
-    void OnTime();
-    void AddTimerInLoop(uint64_t id, uint32_t delay, const TaskFunc &cb);
+    void AddTimerInLoop(uint64_t id, uint64_t delay_ms, const TaskFunc &cb);
     void RefreshTimerInLoop(uint64_t id);
     void CancelTimerInLoop(uint64_t id);
+    /* brief: 按到期时刻把节点挂到对应层的格子里 */
+    void Insert(TimerNode *node);
+    /* brief: 把第 level 层第 idx 格的节点重新分配到更低的层 */
+    void Cascade(int level, uint64_t idx);
+    /* brief: 前进 1ms：必要时从高层往下分配，然后执行第 0 层当前格子里到期的任务 */
+    void Tick();
+    /* brief: 重新计算最早需要醒来的时刻 */
+    uint64_t ComputeNextWake() const;
 private:
-    int _capacity;
-    int _tick;
-    std::vector<std::vector<SharedPtr>> _timewheel;
-    std::unordered_map<uint64_t, WeakPtr> _timers;
-
     EventLoop *_loop;
-    int _timerfd; //定时器描述符号，实现内核每隔一段时间，给进程一次超时事件
-    std::unique_ptr<Channel> _timer_channel;
+    uint64_t _current;      // 时间轮已经推进到的时刻（ms），不晚于它到期的任务都已执行
+    size_t _count;          // 时间轮上的定时器数量
+    uint64_t _next_wake;    // 缓存的最早醒来时刻
+    bool _next_dirty;       // _next_wake 需要重新计算
+    TimerLink _root[kWheelRootSize];                    // 第 0 层
+    TimerLink _levels[kWheelLevels][kWheelLevelSize];   // 第 1~4 层
+    std::unordered_map<uint64_t, TimerNode*> _timers;   // 定时器id -> 节点
 };
 
-}
\ No newline at end of file
+}
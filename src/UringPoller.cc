@@ -0,0 +1,351 @@
+#include "UringPoller.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <spdlog/spdlog.h>
+
+namespace webserver::src
+{
+
+namespace {
+constexpr uint64_t kIgnoreUserData = 0;                       // POLL_REMOVE 请求自己的完成事件不需要处理
+constexpr uint64_t kTimeoutUserData = UINT64_MAX;             // 超时请求的完成事件，fd 部分是 -1，不会和真实请求冲突
+constexpr uint64_t kProbeUserData = UINT64_MAX - 1;           // 探测内核功能用的请求，完成事件不需要处理
+constexpr uint32_t kPollMask = ~(EPOLLET | EPOLLONESHOT);     // poll 请求不认识 epoll 专有的标志位
+
+int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg = nullptr, size_t argsz = 0) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz));
+}
+}
+
+UringPoller::UringPoller(unsigned entries)
+    : _ringfd(-1), _sq_head(nullptr), _sq_tail(nullptr), _sq_mask(nullptr), _sq_array(nullptr),
+    _sq_entries(0), _sqes(nullptr), _sq_local_tail(0), _to_submit(0),
+    _cq_head(nullptr), _cq_tail(nullptr), _cq_mask(nullptr), _cqes(nullptr),
+    _sq_ring_ptr(MAP_FAILED), _sq_ring_size(0), _cq_ring_ptr(MAP_FAILED), _cq_ring_size(0), _sqes_size(0),
+    _ext_arg(false), _timeout_armed(false), _poll_multishot(false), _accept_multishot(true), _next_gen(0), _round(0)
+    {
+        if(!Setup(entries)) {
+            SPDLOG_ERROR("io_uring 初始化失败, errno = {}", errno);
+            if(_ringfd >= 0) close(_ringfd);
+            _ringfd = -1;
+            return;
+        }
+        _poll_multishot = ProbeMultishotPoll();
+        if(!_poll_multishot) SPDLOG_WARN("内核不支持 IORING_POLL_ADD_MULTI, io_uring 后端只支持水平触发");
+    }
+
+UringPoller::~UringPoller() {
+    if(_sqes) munmap(_sqes, _sqes_size);
+    if(_cq_ring_ptr != MAP_FAILED && _cq_ring_ptr != _sq_ring_ptr) munmap(_cq_ring_ptr, _cq_ring_size);
+    if(_sq_ring_ptr != MAP_FAILED) munmap(_sq_ring_ptr, _sq_ring_size);
+    if(_ringfd >= 0) close(_ringfd);
+}
+
+bool UringPoller::Setup(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // CQ 开到 SQ 的 4 倍，所有 fd 同时就绪也不容易溢出
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    _ringfd = io_uring_setup(entries, &params);
+    if(_ringfd < 0) return false;
+    _ext_arg = (params.features & IORING_FEAT_EXT_ARG) != 0;
+
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+    }
+    _sq_ring_ptr = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQ_RING);
+    if(_sq_ring_ptr == MAP_FAILED) return false;
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ring_ptr = _sq_ring_ptr;
+    } else {
+        _cq_ring_ptr = mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_CQ_RING);
+        if(_cq_ring_ptr == MAP_FAILED) return false;
+    }
+    _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) return false;
+    _sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    char *sq = static_cast<char*>(_sq_ring_ptr);
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    _sq_entries = params.sq_entries;
+    _sq_local_tail = *_sq_tail;
+
+    char *cq = static_cast<char*>(_cq_ring_ptr);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool UringPoller::ProbeMultishotPoll() {
+    // 对一个已经可读的 eventfd 挂多次触发的 poll 请求：5.13 之前的内核不认识这个标志，完成事件是 -EINVAL
+    int efd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(efd < 0) return false;
+    struct io_uring_sqe *sqe = GetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = efd;
+    sqe->poll32_events = EPOLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = kProbeUserData;
+    Enter(1, 0);
+    bool supported = false;
+    unsigned head = *_cq_head;
+    if(head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+        supported = _cqes[head & *_cq_mask].res >= 0;
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+    if(supported) {
+        // 撤销探测请求，之后的完成事件在 Reap 里忽略
+        sqe = GetSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = kProbeUserData;
+        sqe->user_data = kIgnoreUserData;
+        Enter(0, 0);
+    }
+    close(efd);
+    return supported;
+}
+
+struct io_uring_sqe *UringPoller::GetSqe() {
+    while(_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+        // SQ 满了，先把攒下的请求交给内核
+        Enter(0, 0);
+    }
+    unsigned idx = _sq_local_tail & *_sq_mask;
+    struct io_uring_sqe *sqe = &_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    _sq_array[idx] = idx;
+    ++_sq_local_tail;
+    ++_to_submit;
+    __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+int UringPoller::Enter(unsigned wait_nr, int timeout_ms) {
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    if(wait_nr > 0 && timeout_ms > 0 && _ext_arg) {
+        // 等待带超时（5.11+）：超时时间作为扩展参数和这次 enter 一起传进去
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        ret = io_uring_enter(_ringfd, _to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        if(wait_nr > 0 && timeout_ms > 0 && !_timeout_armed) {
+            // 老内核：挂一个超时请求，它完成时会把等待唤醒
+            _timeout.tv_sec = timeout_ms / 1000;
+            _timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+            struct io_uring_sqe *sqe = GetSqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<uint64_t>(&_timeout);
+            sqe->len = 1;
+            sqe->user_data = kTimeoutUserData;
+            _timeout_armed = true;
+        }
+        ret = io_uring_enter(_ringfd, _to_submit, wait_nr, flags);
+    }
+    if(ret < 0) {
+        if(errno == EINTR || errno == EAGAIN || errno == EBUSY || errno == ETIME) return 0;
+        // io_uring_enter fail!
+        SPDLOG_ERROR("io_uring_enter 失败, errno = {}", errno);
+        abort();
+    }
+    _to_submit -= std::min(_to_submit, static_cast<unsigned>(ret));
+    return ret;
+}
+
+void UringPoller::Arm(int fd, Registration &reg) {
+    if(++_next_gen == 0) ++_next_gen; // 代号 0 留给不需要处理的完成事件
+    reg.gen = _next_gen;
+    reg.armed = true;
+    struct io_uring_sqe *sqe = GetSqe();
+    sqe->fd = fd;
+    sqe->user_data = MakeUserData(fd, reg.gen);
+    if(reg.accept) {
+        // 不需要对端地址，Connection 需要时自己 getpeername
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        return;
+    }
+    reg.armed_events = reg.channel->GetEvents();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = reg.armed_events & kPollMask;
+    // 边缘触发：多次触发的请求一直挂着，每次被唤醒产生一个完成事件
+    if(_poll_multishot && (reg.armed_events & EPOLLET)) sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+void UringPoller::Disarm(Registration &reg) {
+    if(!reg.armed) return;
+    struct io_uring_sqe *sqe = GetSqe();
+    sqe->opcode = reg.accept ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = MakeUserData(reg.channel->GetFd(), reg.gen);
+    sqe->user_data = kIgnoreUserData;
+    reg.armed = false;
+}
+
+void UringPoller::UpdateEvents(Channel *channel) {
+    assert(channel != nullptr);
+    int fd = channel->GetFd();
+    Registration &reg = _channels[fd];
+    reg.channel = channel;
+    if(reg.accept) return; // 已经挂着 accept 请求，不需要可读事件
+    uint32_t events = channel->GetEvents();
+    if(reg.armed && reg.armed_events == events) return;
+    // 关心的事件变了：撤销旧请求（它的完成事件会因为代号不匹配被丢弃），再按新事件挂一个
+    Disarm(reg);
+    if(events & kPollMask) Arm(fd, reg);
+}
+
+void UringPoller::RemoveEvents(Channel *channel) {
+    assert(channel != nullptr);
+    auto it = _channels.find(channel->GetFd());
+    if(it == _channels.end()) return;
+    Disarm(it->second);
+    _channels.erase(it);
+    _accept_callbacks.erase(channel->GetFd());
+}
+
+bool UringPoller::StartAccept(Channel *channel, const AcceptCallback &cb) {
+    assert(channel != nullptr);
+    if(!_accept_multishot) return false;
+    int fd = channel->GetFd();
+    Registration &reg = _channels[fd];
+    Disarm(reg);
+    reg.channel = channel;
+    reg.accept = true;
+    _accept_callbacks[fd] = cb;
+    Arm(fd, reg);
+    return true;
+}
+
+void UringPoller::Poll(std::vector<Channel*> &actives, int timeout_ms) {
+    // step1: 上一轮触发过的一次性 poll 请求，在这里重新挂上（挂上时内核会立刻检查一次就绪状态，因此是水平触发语义）
+    for(int fd : _rearm) {
+        auto it = _channels.find(fd);
+        if(it == _channels.end()) continue;
+        Registration &reg = it->second;
+        if(!reg.armed && (reg.accept || (reg.channel->GetEvents() & kPollMask))) Arm(fd, reg);
+    }
+    _rearm.clear();
+    // step2: 一次 io_uring_enter 完成 提交注册变更 + 等待事件
+    if(timeout_ms != 0 && __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) == *_cq_head) {
+        Enter(1, timeout_ms);
+    } else if(_to_submit > 0) {
+        Enter(0, 0);
+    }
+    // step3: 收割完成事件
+    Reap(actives);
+    // step4: 新连接交给回调，回调里会注册新的 Channel
+    DispatchAccepted();
+}
+
+void UringPoller::Reap(std::vector<Channel*> &actives) {
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    ++_round;
+    for(; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &_cqes[head & *_cq_mask];
+        uint64_t user_data = cqe->user_data;
+        if(user_data == kIgnoreUserData || user_data == kProbeUserData) continue;
+        if(user_data == kTimeoutUserData) {
+            _timeout_armed = false;
+            continue;
+        }
+        int fd = static_cast<int>(user_data >> 32);
+        uint32_t gen = static_cast<uint32_t>(user_data);
+        auto it = _channels.find(fd);
+        if(it == _channels.end() || it->second.gen != gen || !it->second.armed) continue; // 已经作废的请求
+        Registration &reg = it->second;
+        if(reg.accept) {
+            ReapAccept(fd, reg, cqe);
+            continue;
+        }
+        // 多次触发的请求带 IORING_CQE_F_MORE 时还挂着；没有时已经结束（出错、被取消），下一轮重新挂上
+        if(!(cqe->flags & IORING_CQE_F_MORE)) {
+            reg.armed = false;
+            _rearm.push_back(fd);
+        }
+        if(cqe->res < 0) continue;
+        uint32_t revents = static_cast<uint32_t>(cqe->res);
+        if(reg.round == _round) {
+            // 同一轮里多次被唤醒，合并成一次事件
+            reg.revents |= revents;
+            reg.channel->SetRevents(reg.revents);
+            continue;
+        }
+        reg.round = _round;
+        reg.revents = revents;
+        reg.channel->SetRevents(revents);
+        actives.push_back(reg.channel);
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+}
+
+void UringPoller::ReapAccept(int fd, Registration &reg, struct io_uring_cqe *cqe) {
+    if(!(cqe->flags & IORING_CQE_F_MORE)) {
+        reg.armed = false;
+        _rearm.push_back(fd);
+    }
+    if(cqe->res >= 0) {
+        _accepted.push_back(Accepted{fd, cqe->res});
+        return;
+    }
+    if(cqe->res == -EINVAL && _accept_multishot) {
+        // 5.19 之前的内核不认识 IORING_ACCEPT_MULTISHOT，改回监控可读事件 + accept4
+        SPDLOG_WARN("内核不支持 IORING_ACCEPT_MULTISHOT, 改回监控监听套接字的可读事件");
+        _accept_multishot = false;
+    }
+    if(!_accept_multishot) {
+        reg.accept = false;
+        _accept_fallback.push_back(reg.channel);
+        return;
+    }
+    if(cqe->res != -EAGAIN && cqe->res != -EINTR && cqe->res != -ECANCELED) SPDLOG_ERROR("Accept socket failed, errno = {}", -cqe->res);
+}
+
+void UringPoller::DispatchAccepted() {
+    for(Channel *channel : _accept_fallback) {
+        _accept_callbacks.erase(channel->GetFd());
+        channel->EnableRead();
+    }
+    _accept_fallback.clear();
+    if(_accepted.empty()) return;
+    std::vector<Accepted> accepted;
+    accepted.swap(_accepted);
+    for(const Accepted &acc : accepted) {
+        auto it = _accept_callbacks.find(acc.listen_fd);
+        if(it == _accept_callbacks.end() || !it->second) {
+            close(acc.fd); // 监听套接字已经移除
+            continue;
+        }
+        it->second(acc.fd);
+    }
+}
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Poller.h"
+#include <linux/io_uring.h>
+#include <unordered_map>
+
+// author: Haoyang Yang
+// filename: UringPoller.h
+// brief: 基于 io_uring 的 Poller。每个 Channel 对应一个 IORING_OP_POLL_ADD 请求：
+//        水平触发的 Channel 用一次性的 poll 请求，触发后在下一轮 Poll 重新挂上，语义和 epoll 的水平触发一致；
+//        边缘触发的 Channel 用多次触发的 poll 请求（IORING_POLL_ADD_MULTI，5.13+），挂一次一直有效，
+//        每次 socket 被唤醒产生一个完成事件，语义和 EPOLLET 一致，不再每次触发后重新挂。
+//        监听套接字不监控可读事件，而是挂一个多次触发的 accept 请求（IORING_ACCEPT_MULTISHOT，5.19+），
+//        内核每接收一个连接产生一个带新 fd 的完成事件，省掉每个连接一次 accept4（边缘触发时还有最后一次 EAGAIN）。
+//        和 epoll 相比，EnableWrite/DisableWrite 等注册变更不再各自调用一次 epoll_ctl，
+//        而是作为 SQE 攒起来，和等待一起通过一次 io_uring_enter 提交。
+
+namespace webserver::src
+{
+
+static constexpr unsigned kUringEntries = 1024;
+
+class UringPoller : public Poller
+{
+public:
+    explicit UringPoller(unsigned entries = kUringEntries);
+    ~UringPoller() override;
+    /* brief: io_uring 是否初始化成功 */
+    bool Valid() const { return _ringfd >= 0; }
+
+    void UpdateEvents(Channel *channel) override;
+    void RemoveEvents(Channel *channel) override;
+    void Poll(std::vector<Channel*> &actives, int timeout_ms) override;
+    /* brief: 内核支持多次触发的 poll 请求时支持边缘触发 */
+    bool SupportsEdgeTrigger() const override { return _poll_multishot; }
+    /* brief: 挂一个多次触发的 accept 请求。内核不认识时（完成事件是 -EINVAL）自动改回监控可读事件 */
+    bool StartAccept(Channel *channel, const AcceptCallback &cb) override;
+private:
+    /* brief: 一个被监控的文件描述符的登记信息 */
+    struct Registration {
+        Channel *channel = nullptr;
+        uint32_t gen = 0;           // 当前挂着的 poll 请求的代号，用来丢弃已经作废的完成事件
+        uint32_t armed_events = 0;  // 当前挂着的 poll 请求关心的事件
+        bool armed = false;         // 是否有 poll 请求挂在内核里
+        bool accept = false;        // 监听套接字，挂的是多次触发的 accept 请求
+        uint32_t round = 0;         // 最近一次在哪一轮 Reap 里触发，同一轮多个完成事件合并成一次
+        uint32_t revents = 0;       // 这一轮合并后的就绪事件
+    };
+    /* brief: 多次触发的 accept 请求接收到的新连接，在 Reap 之后交给回调 */
+    struct Accepted {
+        int listen_fd;
+        int fd;
+    };
+    /* brief: 初始化 io_uring，映射 SQ/CQ 环 */
+    bool Setup(unsigned entries);
+    /* brief: 探测内核是否支持多次触发的 poll 请求 */
+    bool ProbeMultishotPoll();
+    /* brief: 取一个空闲的 SQE，SQ 满了就先提交 */
+    struct io_uring_sqe *GetSqe();
+    /* brief: 提交攒下的 SQE，wait_nr > 0 时阻塞等待完成事件，timeout_ms > 0 时最多等待这么久 */
+    int Enter(unsigned wait_nr, int timeout_ms);
+    /* brief: 为 fd 挂上 poll（监听套接字是 accept）请求 / 撤销已挂的请求 */
+    void Arm(int fd, Registration &reg);
+    void Disarm(Registration &reg);
+    /* brief: 收割 CQ 里的完成事件 */
+    void Reap(std::vector<Channel*> &actives);
+    /* brief: 处理 accept 请求的完成事件 */
+    void ReapAccept(int fd, Registration &reg, struct io_uring_cqe *cqe);
+    /* brief: 把接收到的新连接交给回调；内核不支持 accept 请求的监听套接字改回监控可读事件 */
+    void DispatchAccepted();
+
+    static uint64_t MakeUserData(int fd, uint32_t gen) { return (static_cast<uint64_t>(fd) << 32) | gen; }
+private:
+    int _ringfd;
+    // SQ 环
+    unsigned *_sq_head;
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_array;
+    unsigned _sq_entries;
+    struct io_uring_sqe *_sqes;
+    unsigned _sq_local_tail;
+    unsigned _to_submit;        // 已经写入但还没有提交给内核的 SQE 数量
+    // CQ 环
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    struct io_uring_cqe *_cqes;
+    // mmap 区域
+    void *_sq_ring_ptr;
+    size_t _sq_ring_size;
+    void *_cq_ring_ptr;
+    size_t _cq_ring_size;
+    size_t _sqes_size;
+
+    bool _ext_arg;                          // 内核支持 IORING_ENTER_EXT_ARG，等待超时直接传给 io_uring_enter
+    bool _timeout_armed;                    // 不支持时用 IORING_OP_TIMEOUT 请求实现超时，是否有一个还没完成
+    struct __kernel_timespec _timeout;      // 超时请求引用的时间，请求完成前必须有效
+
+    bool _poll_multishot;                   // 内核支持 IORING_POLL_ADD_MULTI，边缘触发的 Channel 使用多次触发的 poll 请求
+    bool _accept_multishot;                 // 还没发现内核不支持 IORING_ACCEPT_MULTISHOT
+
+    uint32_t _next_gen;
+    uint32_t _round;                                   // Reap 的轮次
+    std::unordered_map<int, Registration> _channels;  // fd -> 登记信息
+    std::vector<int> _rearm;                           // 上一轮触发过、需要重新挂请求的 fd
+    std::unordered_map<int, AcceptCallback> _accept_callbacks;  // 监听套接字 fd -> 新连接的回调
+    std::vector<Accepted> _accepted;                   // 本轮接收到、还没交给回调的新连接
+    std::vector<Channel*> _accept_fallback;            // accept 请求被内核拒绝、需要改回监控可读事件的监听套接字
+};
+
+}
@@ -1,8 +1,16 @@
 #include "Util.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <array>
+#include <algorithm>
 
 namespace webserver::util
 {
-std::unordered_map<int, std::string> status_message = {
+namespace {
+/* brief: 状态码和描述，编译期展开成按状态码下标访问的表 */
+struct StatusEntry { int code; std::string_view desc; };
+constexpr StatusEntry kStatusEntries[] = {
     {100, "Continue"},
     {101, "Switching Protocol"},
     {102, "Processing"},
@@ -55,19 +63,30 @@ std::unordered_map<int, std::string> status_message = {
     {429, "Too Many Requests"},
     {431, "Request Header Fields Too Large"},
     {451, "Unavailable For Legal Reasons"},
+    {500, "Internal Server Error"},
     {501, "Not Implemented"},
     {502, "Bad Gateway"},
     {503, "Service Unavailable"},
     {504, "Gateway Timeout"},
     {505, "HTTP Version Not Supported"},
-    {506, "Variant Also Negotiates"},          
+    {506, "Variant Also Negotiates"},
     {507, "Insufficient Storage"},
     {508, "Loop Detected"},
     {510, "Not Extended"},
     {511, "Network Authentication Required"}
 };
+constexpr auto kStatusTable = []() {
+    std::array<std::string_view, 600> table{};
+    for(auto &entry : kStatusEntries) table[entry.code] = entry.desc;
+    return table;
+}();
 
-std::unordered_map<std::string, std::string> mime_message = {
+/* brief: 文件后缀和 MIME，按后缀排好序，二分查找 */
+struct MimeEntry { std::string_view ext; std::string_view mime; };
+constexpr MimeEntry kMimeEntries[] = {
+    {".3g2", "video/3gpp2"},
+    {".3gp", "video/3gpp"},
+    {".7z", "application/x-7z-compressed"},
     {".aac", "audio/aac"},
     {".abw", "application/x-abiword"},
     {".arc", "application/x-freearc"},
@@ -95,6 +114,7 @@ std::unordered_map<std::string, std::string> mime_message = {
     {".js", "text/javascript"},
     {".json", "application/json"},
     {".jsonld", "application/ld+json"},
+    {".m3u8", "application/vnd.apple.mpegurl"},
     {".mid", "audio/midi"},
     {".midi", "audio/x-midi"},
     {".mjs", "text/javascript"},
@@ -108,8 +128,8 @@ std::unordered_map<std::string, std::string> mime_message = {
     {".ogv", "video/ogg"},
     {".ogx", "application/ogg"},
     {".otf", "font/otf"},
-    {".png", "image/png"},
     {".pdf", "application/pdf"},
+    {".png", "image/png"},
     {".ppt", "application/vnd.ms-powerpoint"},
     {".pptx", "application/vnd.openxmlformatsofficedocument.presentationml.presentation"},
     {".rar", "application/x-rar-compressed"},
@@ -120,6 +140,7 @@ std::unordered_map<std::string, std::string> mime_message = {
     {".tar", "application/x-tar"},
     {".tif", "image/tiff"},
     {".tiff", "image/tiff"},
+    {".ts", "video/mp2t"},
     {".ttf", "font/ttf"},
     {".txt", "text/plain"},
     {".vsd", "application/vnd.visio"},
@@ -134,11 +155,17 @@ std::unordered_map<std::string, std::string> mime_message = {
     {".xlsx", "application/vnd.openxmlformatsofficedocument.spreadsheetml.sheet"},
     {".xml", "application/xml"},
     {".xul", "application/vnd.mozilla.xul+xml"},
-    {".zip", "application/zip"},
-    {".3gp", "video/3gpp"},
-    {".3g2", "video/3gpp2"},
-    {".7z", "application/x-7z-compressed"}
-};   
+    {".zip", "application/zip"}
+};
+constexpr bool MimeSorted() {
+    for(size_t i = 1; i < std::size(kMimeEntries); ++i) {
+        if(!(kMimeEntries[i - 1].ext < kMimeEntries[i].ext)) return false;
+    }
+    return true;
+}
+static_assert(MimeSorted(), "kMimeEntries 必须按后缀排序");
+}
+
 
 
 /* brief: 分割字符串 */
@@ -240,8 +267,14 @@ std::vector<std::string_view> Util::SplitLine(const std::string &line) {
 }
 /* brief: 对Url进行解码 */
 std::string Util::UrlDecode(const std::string_view &url, bool is_convert_space_to_plus) {
-    //遇到了 % 就将后面两个字符转化为数字，第一位数字左移4位，然后加上第二位数字 eg: + -> 2b %2b -> 2 << 4 + 11
     std::string res;
+    UrlDecode(url, is_convert_space_to_plus, &res);
+    return res;
+}
+/* brief: 对uri进行解码，结果追加到 out */
+void Util::UrlDecode(const std::string_view &url, bool is_convert_space_to_plus, std::string *out) {
+    //遇到了 % 就将后面两个字符转化为数字，第一位数字左移4位，然后加上第二位数字 eg: + -> 2b %2b -> 2 << 4 + 11
+    std::string &res = *out;
     for(int i = 0; i < url.size(); ++i) {
         if(url[i] == '+' && is_convert_space_to_plus == true) {
             res += ' ';
@@ -257,7 +290,6 @@ std::string Util::UrlDecode(const std::string_view &url, bool is_convert_space_t
         }
         res += url[i];
     }
-    return res;
 }
 /* brief: 判断路径是否是一个目录 */
 bool Util::IsDirectory(const std::string &filename) {
@@ -303,11 +335,38 @@ bool Util::WriteFile(const std::string &filename, const std::string &buf) {
     ofs.close();
     return true;
 }
+/* brief: 创建已经 unlink 的临时文件 */
+int Util::CreateTempFile(const std::string &dir) {
+    // 优先用 O_TMPFILE，文件从来不会出现在目录里；文件系统不支持时退回 mkstemp + unlink
+    int fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(fd >= 0) return fd;
+    std::string path = dir + "/webserver-body-XXXXXX";
+    fd = mkostemp(&path[0], O_CLOEXEC);
+    if(fd < 0) {
+        SPDLOG_ERROR("创建临时文件失败: {}", strerror(errno));
+        return -1;
+    }
+    unlink(path.c_str());
+    return fd;
+}
+/* brief: 把数据完整写进 fd */
+bool Util::WriteAll(int fd, const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t ret = write(fd, data, len);
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            SPDLOG_ERROR("写入文件失败: {}", strerror(errno));
+            return false;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
 /* brief: 响应状态码的描述信息获取 */
-std::string Util::StatusDesc(int status) {
-    auto it = status_message.find(status);
-    if(it != status_message.end()) {
-        return it->second;
+std::string_view Util::StatusDesc(int status) {
+    if(status >= 0 && status < static_cast<int>(kStatusTable.size()) && !kStatusTable[status].empty()) {
+        return kStatusTable[status];
     }
     return "Unknow";
 }
@@ -329,17 +388,18 @@ bool Util::ValidPath(const std::string &path) {
     return true;
 }
 /* brief: 根据文件后缀名获取文件mime */
-std::string Util::ExtMime(const std::string &filename) {
+std::string_view Util::ExtMime(std::string_view filename) {
     size_t pos = filename.find_last_of('.');
-    if(pos == std::string::npos) {
+    if(pos == std::string_view::npos) {
         return "application/octet-stream";
     }
-    std::string ext = filename.substr(pos);
-    auto it = mime_message.find(ext);
-    if(it == mime_message.end()) {
+    std::string_view ext = filename.substr(pos);
+    auto it = std::lower_bound(std::begin(kMimeEntries), std::end(kMimeEntries), ext,
+                               [](const MimeEntry &entry, std::string_view key) { return entry.ext < key; });
+    if(it == std::end(kMimeEntries) || it->ext != ext) {
         return "application/octet-stream";
     }
-    return it->second;
+    return it->mime;
 }
 /* brief: 分割请求路径 */
 std::vector<std::string> Util::SplitPath(const std::string &path) {
@@ -424,4 +484,47 @@ bool Util::ParseRange(std::string_view range, size_t file_size, off_t &start, of
     return true;
 }
 
-}
\ No newline at end of file
+/* brief: 解析 Accept-Encoding 中某个编码的 q 值 */
+int Util::CodingQuality(std::string_view accept, std::string_view coding) {
+    // Accept-Encoding 格式: "gzip, deflate;q=0.5, br;q=1.0, *;q=0"
+    auto trim = [](std::string_view v) {
+        while(!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+        while(!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+        return v;
+    };
+    auto iequal = [](std::string_view a, std::string_view b) {
+        if(a.size() != b.size()) return false;
+        for(size_t i = 0; i < a.size(); ++i) {
+            if(tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) return false;
+        }
+        return true;
+    };
+    int wildcard = 0;
+    while(!accept.empty()) {
+        size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        accept.remove_prefix(comma == std::string_view::npos ? accept.size() : comma + 1);
+
+        size_t semi = item.find(';');
+        std::string_view name = trim(item.substr(0, semi));
+        int q = 1000;
+        if(semi != std::string_view::npos) {
+            std::string_view param = trim(item.substr(semi + 1));
+            if(param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                // qvalue 最多三位小数: "0", "0.8", "1.000"
+                param.remove_prefix(2);
+                q = (param[0] == '1') ? 1000 : 0;
+                int scale = 100;
+                for(size_t i = 2; i < param.size() && i < 5 && q < 1000; ++i, scale /= 10) {
+                    if(param[i] < '0' || param[i] > '9') break;
+                    q += (param[i] - '0') * scale;
+                }
+            }
+        }
+        if(iequal(name, coding)) return q;
+        if(name == "*") wildcard = q;
+    }
+    return wildcard;
+}
+
+}
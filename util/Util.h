@@ -24,6 +24,8 @@ public:
     static std::vector<std::string_view> SplitLine(const std::string &line);
     /* brief: 对uri进行解码 */
     static std::string UrlDecode(const std::string_view &url, bool is_convert_space_to_plus);
+    /* brief: 对uri进行解码，结果追加到 out，out 已有容量时不需要申请内存 */
+    static void UrlDecode(const std::string_view &url, bool is_convert_space_to_plus, std::string *out);
     /* brief: 判断路径是否是一个目录 */
     static bool IsDirectory(const std::string &filename);
     /* brief: 判断路径是否是一个普通文件 */
@@ -32,16 +34,22 @@ public:
     static bool ReadFile(const std::string &filename, std::string *buf);
     /* brief: 写入文件 */
     static bool WriteFile(const std::string &filename, const std::string &buf);
+    /* brief: 在 dir 下创建一个已经 unlink 的临时文件，返回可读写的 fd，失败返回 -1 */
+    static int CreateTempFile(const std::string &dir);
+    /* brief: 把数据完整写进 fd，被信号打断会重试 */
+    static bool WriteAll(int fd, const char *data, size_t len);
     /* brief: 响应状态码的描述信息获取 */
-    static std::string StatusDesc(int status);
+    static std::string_view StatusDesc(int status);
     /* brief: 判断请求路径是否有效 */
     static bool ValidPath(const std::string &path);
     /* brief: 根据文件后缀名获取文件mime */
-    static std::string ExtMime(const std::string &filename);
+    static std::string_view ExtMime(std::string_view filename);
     /* brief: 分割请求路径 */
     static std::vector<std::string> SplitPath(const std::string &path);
     /* brief: 解析Range请求 */
     static bool ParseRange(std::string_view range, size_t file_size, off_t &start, off_t &end);
+    /* brief: 从 Accept-Encoding 中取出 coding 的 q 值（千分制，0~1000），没有列出时取 * 的 q 值，都没有返回 0 表示不接受 */
+    static int CodingQuality(std::string_view accept, std::string_view coding);
 };
 
 